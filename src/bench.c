@@ -0,0 +1,595 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file bench.c
+ *  This file contains micro-benchmarks of the PDU codec and the contactlist.
+ *  They are run by "make bench" (see: meshbench.c for the benchmark of a
+ *  local mesh of clients).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "dchat_h/bench.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/framing.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/contactscan.h"
+#include "dchat_h/consoleui.h"
+#include "dchat_h/util.h"
+
+
+dchat_conf_t config;
+dchat_conf_t* _cnf = &config;
+
+//! header lines of a typical text message (decoded in place)
+static char _lines[][64] =
+{
+    "DCHAT: 1.0\n",
+    "Content-Type: text/plain\n",
+    "Content-Length: 42\n",
+    "Host: aaaaaaaaaaaaaaaa.onion\n",
+    "Listen-Port: 7001\n",
+    "Nickname: alice\n",
+    "Date: Wed, 14 Oct 2026 08:00:00 GMT\n",
+    "Server: dchat/0.2\n"
+};
+
+
+/**
+ *  Connection requests of contacts are never sent by the benchmarks,
+ *  since they do not run the main loop of dchat.
+ *  @return -1
+ */
+int
+handle_local_conn_request(char* onion_id, uint16_t port)
+{
+    (void) onion_id;
+    (void) port;
+    return -1;
+}
+
+
+/**
+ *  PDUs are never received from reactors by the benchmarks, since they
+ *  do not run the main loop of dchat.
+ *  @return -1
+ */
+int
+handle_remote_pdu(int n, dchat_pdu_t* pdu)
+{
+    (void) n;
+    (void) pdu;
+    return -1;
+}
+
+
+/**
+ *  Initializes a text message PDU like the ones sent by the main loop.
+ *  @param pdu     PDU to initialize
+ *  @param content Text message
+ */
+void
+init_bench_pdu(dchat_pdu_t* pdu, char* content)
+{
+    if (init_dchat_pdu(pdu, DCHAT_V1, CTT_ID_TXT, "aaaaaaaaaaaaaaaa.onion", 7001, "alice") == -1)
+    {
+        ui_fatal("Initialization of benchmark PDU failed!");
+    }
+
+    init_dchat_pdu_content(pdu, content, strlen(content));
+}
+
+
+/**
+ *  Fills the contactlist with connected contacts, whose onion addresses
+ *  differ in their last characters. The contacts use fake file descriptors,
+ *  which are never read or written.
+ *  @param amount Amount of contacts
+ *  @return 0 on success, -1 on error
+ */
+int
+init_bench_contacts(int amount)
+{
+    char onion_id[ONION_ADDRLEN + 1];
+    int i, n;
+
+    for (i = 0; i < amount; i++)
+    {
+        if ((n = add_contact(0, 0)) == -1)
+        {
+            return -1;
+        }
+
+        snprintf(onion_id, sizeof(onion_id), "aaaaaaaaaaaa%c%c%c%c.onion",
+                 'a' + (i >> 12) % 26, 'a' + (i >> 8) % 16,
+                 'a' + (i >> 4) % 16, 'a' + i % 16);
+        CONTACT(n)->fd = 1024 + n;
+        set_contact_address(n, onion_id, 7000 + i % 100);
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Decodes the header lines of a text message.
+ *  @param iterations Amount of decoded header blocks
+ *  @return amount of decoded header lines
+ */
+long
+bench_decode_header(long iterations)
+{
+    int amount = sizeof(_lines) / sizeof(_lines[0]);
+    int len[amount];
+    dchat_pdu_t pdu;
+    long i;
+    int j;
+
+    for (j = 0; j < amount; j++)
+    {
+        len[j] = strlen(_lines[j]);
+    }
+
+    for (i = 0; i < iterations; i++)
+    {
+        memset(&pdu, 0, sizeof(pdu));
+
+        for (j = 0; j < amount; j++)
+        {
+            if (decode_header(&pdu, _lines[j], len[j]) == -1)
+            {
+                ui_fatal("Decoding of header '%s' failed!", _lines[j]);
+            }
+        }
+    }
+
+    return iterations * amount;
+}
+
+
+/**
+ *  Encodes all headers of a text message.
+ *  @param iterations Amount of encoded header blocks
+ *  @return amount of encoded header lines
+ */
+long
+bench_encode_header(long iterations)
+{
+    char buf[MAX_HEADERS_LEN];
+    dchat_pdu_t pdu;
+    long i;
+    int id;
+
+    init_bench_pdu(&pdu, "The quick brown fox jumps over the lazy dog");
+
+    for (i = 0; i < iterations; i++)
+    {
+        for (id = HDR_ID_VER; id <= HDR_AMOUNT; id++)
+        {
+            if (encode_header(&pdu, id, buf, sizeof(buf)) == -1)
+            {
+                ui_fatal("Encoding of header '%d' failed!", id);
+            }
+        }
+    }
+
+    free_pdu(&pdu);
+    return iterations * HDR_AMOUNT;
+}
+
+
+/**
+ *  Writes text messages to a socketpair, which is drained after every
+ *  batch of BENCH_BATCH PDUs.
+ *  @param iterations Amount of written PDUs
+ *  @return amount of written PDUs
+ */
+long
+bench_write_pdu(long iterations)
+{
+    char buf[RECV_BUF_LEN];
+    dchat_pdu_t pdu;
+    int fd[2];
+    long i;
+    long pending = 0;
+    int ret;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == -1)
+    {
+        ui_fatal("Creation of socketpair failed!");
+    }
+
+    init_bench_pdu(&pdu, "The quick brown fox jumps over the lazy dog");
+
+    for (i = 0; i < iterations; i++)
+    {
+        if ((ret = write_pdu(fd[0], &pdu)) == -1)
+        {
+            ui_fatal("Writing of PDU failed!");
+        }
+
+        pending += ret;
+
+        // drain socketpair, so that the writer never blocks
+        while ((i % BENCH_BATCH == BENCH_BATCH - 1 || i == iterations - 1) && pending > 0)
+        {
+            if ((ret = read(fd[1], buf, sizeof(buf))) <= 0)
+            {
+                ui_fatal("Reading from socketpair failed!");
+            }
+
+            pending -= ret;
+        }
+    }
+
+    free_pdu(&pdu);
+    close(fd[0]);
+    close(fd[1]);
+    return iterations;
+}
+
+
+/**
+ *  Decodes prepared PDUs received from a socketpair. Batches of
+ *  BENCH_BATCH PDUs are written at once and then decoded.
+ *  @param session    PDU written once before the batches, may be NULL
+ *  @param wp         Prepared PDU
+ *  @param iterations Amount of decoded PDUs
+ *  @return amount of decoded PDUs
+ */
+long
+read_batches(wire_pdu_t* session, wire_pdu_t* wp, long iterations)
+{
+    pdu_reader_t* rd;
+    dchat_pdu_t pdu;
+    int fd[2];
+    long i = 0;
+    int j;
+    int ret;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == -1)
+    {
+        ui_fatal("Creation of socketpair failed!");
+    }
+
+    if ((rd = malloc(sizeof(*rd))) == NULL)
+    {
+        ui_fatal("Memory allocation for PDU reader failed!");
+    }
+
+    init_pdu_reader(rd);
+
+    if (session != NULL && write_wire_pdu(fd[0], session) == -1)
+    {
+        ui_fatal("Writing of session failed!");
+    }
+
+    while (i < iterations)
+    {
+        for (j = 0; j < BENCH_BATCH; j++)
+        {
+            if (write_wire_pdu(fd[0], wp) == -1)
+            {
+                ui_fatal("Writing of PDU failed!");
+            }
+        }
+
+        // decode the whole batch
+        for (j = 0; j < BENCH_BATCH; )
+        {
+            if ((ret = read_pdu(rd, &pdu)) == -1)
+            {
+                ui_fatal("Decoding of PDU failed!");
+            }
+            else if (!ret)
+            {
+                if (fill_pdu_reader(NULL, fd[1], rd) <= 0)
+                {
+                    ui_fatal("Reading from socketpair failed!");
+                }
+
+                continue;
+            }
+
+            free_pdu(&pdu);
+            j++;
+        }
+
+        i += BENCH_BATCH;
+    }
+
+    free_pdu_reader(rd);
+    free(rd);
+    close(fd[0]);
+    close(fd[1]);
+    return i;
+}
+
+
+/**
+ *  Decodes text messages received from a socketpair (see: read_batches()).
+ *  @param iterations Amount of decoded PDUs
+ *  @return amount of decoded PDUs
+ */
+long
+bench_read_pdu(long iterations)
+{
+    dchat_pdu_t pdu;
+    wire_pdu_t* wp;
+
+    init_bench_pdu(&pdu, "The quick brown fox jumps over the lazy dog");
+
+    if ((wp = prepare_pdu(&pdu)) == NULL)
+    {
+        ui_fatal("Preparation of PDU failed!");
+    }
+
+    free_pdu(&pdu);
+    iterations = read_batches(NULL, wp, iterations);
+    unref_wire_pdu(wp);
+    return iterations;
+}
+
+
+/**
+ *  Prepares text messages as DChat V2 frames.
+ *  @param iterations Amount of prepared frames
+ *  @return amount of prepared frames
+ */
+long
+bench_prepare_frame(long iterations)
+{
+    dchat_pdu_t pdu;
+    long i;
+
+    init_bench_pdu(&pdu, "The quick brown fox jumps over the lazy dog");
+
+    for (i = 0; i < iterations; i++)
+    {
+        unref_wire_pdu(prepare_frame(&pdu));
+    }
+
+    free_pdu(&pdu);
+    return iterations;
+}
+
+
+/**
+ *  Decodes text messages received as DChat V2 frames from a socketpair
+ *  (see: read_batches()).
+ *  @param iterations Amount of decoded frames
+ *  @return amount of decoded frames
+ */
+long
+bench_read_frame(long iterations)
+{
+    dchat_session_t tx;
+    dchat_pdu_t pdu;
+    wire_pdu_t* session;
+    wire_pdu_t* wp;
+
+    memset(&tx, 0, sizeof(tx));
+    init_bench_pdu(&pdu, "The quick brown fox jumps over the lazy dog");
+
+    if ((wp = prepare_frame(&pdu)) == NULL || (session = update_session(&tx)) == NULL)
+    {
+        ui_fatal("Preparation of frame failed!");
+    }
+
+    free_pdu(&pdu);
+    iterations = read_batches(session, wp, iterations);
+    unref_wire_pdu(session);
+    unref_wire_pdu(wp);
+    return iterations;
+}
+
+
+/**
+ *  Converts contacts to strings (see: send_contacts()).
+ *  @param iterations Amount of conversions
+ *  @return amount of conversions
+ */
+long
+bench_contact_to_string(long iterations)
+{
+    contact_t contact;
+    char* str;
+    long i;
+
+    memset(&contact, 0, sizeof(contact));
+    strcpy(contact.onion_id, "aaaaaaaaaaaaaaaa.onion");
+    contact.lport = 7001;
+
+    for (i = 0; i < iterations; i++)
+    {
+        if ((str = contact_to_string(&contact)) == NULL)
+        {
+            ui_fatal("Conversion of contact failed!");
+        }
+
+        free(str);
+    }
+
+    return iterations;
+}
+
+
+
+/**
+ *  Converts strings to contacts (see: receive_contacts()).
+ *  @param iterations Amount of conversions
+ *  @return amount of conversions
+ */
+long
+bench_string_to_contact(long iterations)
+{
+    char* line = "aaaaaaaaaaaaaaaa.onion 7001\n";
+    char buf[64];
+    contact_t contact;
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        // the string is split in place
+        strcpy(buf, line);
+
+        if (string_to_contact(&contact, buf) == -1)
+        {
+            ui_fatal("Conversion of contact string failed!");
+        }
+    }
+
+    return iterations;
+}
+
+
+/**
+ *  Parses contact lists filling a whole discover PDU (see: receive_contacts()).
+ *  @param iterations Minimum amount of contacts to parse
+ *  @return amount of parsed contacts
+ */
+long
+bench_scan_contacts(long iterations)
+{
+    char buf[MAX_CONTENT_LEN];
+    cs_record_t rec[CS_BATCH];
+    cs_scan_t sc;
+    long ops = 0;
+    int len = 0;
+    int cnt;
+    int i;
+
+    for (i = 0; len + CS_MIN_LINE + CS_MAX_PORT <= (int) sizeof(buf); i++)
+    {
+        len += sprintf(buf + len, "%016d.onion %d\n", i, 1024 + i);
+    }
+
+    while (ops < iterations)
+    {
+        init_contact_scan(&sc, buf, len);
+
+        while ((cnt = scan_contacts(&sc, rec, CS_BATCH)) > 0)
+        {
+            ops += cnt;
+        }
+
+        if (sc.invalid || sc.truncated)
+        {
+            ui_fatal("Scanning of contact list failed!");
+        }
+    }
+
+    return ops;
+}
+
+
+/**
+ *  Looks up contacts of a contactlist holding BENCH_CONTACTS contacts.
+ *  @param iterations Amount of lookups
+ *  @return amount of lookups
+ */
+long
+bench_find_contact(long iterations)
+{
+    contact_t contact;
+    long i;
+    int n;
+
+    for (i = 0; i < iterations; i++)
+    {
+        n = i % _cnf->cl.cl_size;
+        memcpy(&contact, CONTACT(n), sizeof(contact));
+
+        if (find_contact(&contact, 0) < 0)
+        {
+            ui_fatal("Contact '%d' could not be found!", n);
+        }
+    }
+
+    return iterations;
+}
+
+
+int
+main(int argc, char** argv)
+{
+    bench_t bench[BENCH_AMOUNT] =
+    {
+        BENCH("decode_header", bench_decode_header, 200000),
+        BENCH("encode_header", bench_encode_header, 200000),
+        BENCH("write_pdu", bench_write_pdu, 200000),
+        BENCH("read_pdu", bench_read_pdu, 200000),
+        BENCH("prepare_frame", bench_prepare_frame, 1000000),
+        BENCH("read_frame", bench_read_frame, 200000),
+        BENCH("contact_to_string", bench_contact_to_string, 1000000),
+        BENCH("string_to_contact", bench_string_to_contact, 1000000),
+        BENCH("scan_contacts", bench_scan_contacts, 10000000),
+        BENCH("find_contact", bench_find_contact, 1000000)
+    };
+    double scale = 1.0;        // scale of the default iterations
+    long long start;
+    long long elapsed;
+    long ops;
+    int i;
+
+    if (argc > 2 || (argc == 2 && (scale = strtod(argv[1], NULL)) <= 0))
+    {
+        fprintf(stderr, "usage: %s [SCALE]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // discard log messages of the benchmarked functions
+    memset(_cnf, 0, sizeof(*_cnf));
+    _cnf->out_fd = _cnf->log_fd = open("/dev/null", O_WRONLY);
+    _cnf->cl.free_head = -1;
+    init_contact_index(&_cnf->cl.index);
+    strcpy(_cnf->me.onion_id, "bbbbbbbbbbbbbbbb.onion");
+    _cnf->me.lport = 7002;
+    strcpy(_cnf->me.name, "bob");
+
+    if (init_bench_contacts(BENCH_CONTACTS) == -1)
+    {
+        ui_fatal("Initialization of contactlist failed!");
+    }
+
+    printf("%-20s %12s %12s %14s\n", "benchmark", "operations", "ns/op", "ops/s");
+
+    for (i = 0; i < BENCH_AMOUNT; i++)
+    {
+        start = get_time_ns();
+        ops = bench[i].run((long)(bench[i].iterations * scale) + 1);
+        elapsed = get_time_ns() - start;
+        printf("%-20s %12ld %12.1f %14.0f\n", bench[i].name, ops,
+               (double) elapsed / ops, ops * 1e9 / (elapsed ? elapsed : 1));
+    }
+
+    return EXIT_SUCCESS;
+}
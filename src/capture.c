@@ -0,0 +1,218 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+
+/** @file capture.c
+ *  This file contains the capture of the PDUs sent and received by this
+ *  client (see: capt_parse()). Every PDU is appended to a trace file
+ *  together with the time it has been handled and the connection it
+ *  belongs to (see: capture.h for the format). Received PDUs are recorded
+ *  after they have been decoded, sent PDUs when they are queued, thus both
+ *  are encoded as DChat V1 independent of the frames and encodings
+ *  negotiated with the contact. The trace can be replayed against other
+ *  clients by dchat-replay (see: replay.c). PDUs are captured by the main
+ *  loop only, therefore the trace file is not locked.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "dchat_h/capture.h"
+#include "dchat_h/types.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/util.h"
+#include "dchat_h/consoleui.h"
+
+
+static FILE* _trace;        //!< trace file, NULL if nothing is captured
+static long long _last;     //!< time of the latest record in us
+static char _buf[CP_BUF_LEN]; //!< buffer of the trace file
+
+
+/**
+ *  Stores an integer in little endian byte order.
+ *  @param p   Destination
+ *  @param v   Value to store
+ *  @param len Amount of bytes to store
+ */
+static void
+put_le(unsigned char* p, uint64_t v, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        p[i] = (unsigned char) (v >> (8 * i));
+    }
+}
+
+
+/**
+ *  Opens the trace file and writes its header. An existing file will
+ *  be truncated.
+ *  @param path Path of the trace file
+ *  @return 0 on success, -1 in case of error
+ */
+int
+init_capture(char* path)
+{
+    unsigned char hdr[CP_HEADER_LEN];
+    struct timespec ts;
+
+    if ((_trace = fopen(path, "w")) == NULL)
+    {
+        ui_log_errno(LOG_ERR, "Could not open trace file '%s'!", path);
+        return -1;
+    }
+
+    setvbuf(_trace, _buf, _IOFBF, sizeof(_buf));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memcpy(hdr, CP_MAGIC, 4);
+    put_le(hdr + 4, CP_VERSION, 2);
+    put_le(hdr + 6, CP_RECORD_LEN, 2);
+    put_le(hdr + 8, (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000, 8);
+    _last = get_time_ns() / 1000;
+
+    if (fwrite(hdr, sizeof(hdr), 1, _trace) != 1)
+    {
+        ui_log_errno(LOG_ERR, "Writing to trace file '%s' failed!", path);
+        fclose(_trace);
+        _trace = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Flushes and closes the trace file.
+ */
+void
+destroy_capture()
+{
+    if (_trace != NULL && fclose(_trace) == EOF)
+    {
+        ui_log_errno(LOG_WARN, "Closing trace file failed!");
+    }
+
+    _trace = NULL;
+}
+
+
+/**
+ *  Appends a record to the trace file. The capture is stopped, if the
+ *  trace file can not be written anymore. Pauses longer than the
+ *  counter of a record (about 71 minutes) are shortened.
+ *  @param n       Index of the contact
+ *  @param dir     Direction of the PDU (CP_DIR_IN or CP_DIR_OUT)
+ *  @param ctt     Content-type of the PDU
+ *  @param hdr     Encoded headers
+ *  @param hdr_len Length of the encoded headers
+ *  @param ctt_buf Content, may be NULL if empty
+ *  @param ctt_len Length of the content
+ */
+static void
+write_record(int n, int dir, int ctt, const char* hdr, int hdr_len,
+             const char* ctt_buf, int ctt_len)
+{
+    unsigned char rec[CP_RECORD_LEN];
+    long long now = get_time_ns() / 1000;
+    long long delta = now - _last;
+
+    delta = delta < 0 ? 0 : delta > UINT32_MAX ? UINT32_MAX : delta;
+    _last = now;
+    put_le(rec, delta, 4);
+    put_le(rec + 4, n, 4);
+    put_le(rec + 8, CONTACT(n)->gen, 4);
+    rec[12] = dir;
+    rec[13] = ctt;
+    put_le(rec + 14, hdr_len + ctt_len, 4);
+
+    if (fwrite(rec, sizeof(rec), 1, _trace) != 1 ||
+        (hdr_len && fwrite(hdr, hdr_len, 1, _trace) != 1) ||
+        (ctt_len && fwrite(ctt_buf, ctt_len, 1, _trace) != 1))
+    {
+        ui_log_errno(LOG_ERR, "Writing to trace file failed! Capture stopped!");
+        fclose(_trace);
+        _trace = NULL;
+    }
+}
+
+
+/**
+ *  Records a PDU received from a contact. The PDU is encoded as DChat V1
+ *  without the headers negotiating frames and encodings, since the
+ *  content of a decoded PDU has already been decompressed.
+ *  @param n   Index of the contact in the contactlist
+ *  @param pdu PDU decoded from the contact
+ */
+void
+capture_pdu(int n, dchat_pdu_t* pdu)
+{
+    char headers[MAX_HEADERS_LEN];
+    dchat_pdu_t v1;
+    int len;
+
+    if (_trace == NULL)
+    {
+        return;
+    }
+
+    memcpy(&v1, pdu, sizeof(v1));
+    v1.version = DCHAT_V1;
+    v1.accept_version = 0;
+    v1.accept_encoding = 0;
+    v1.encoding = 0;
+
+    if ((len = encode_headers(&v1, headers, sizeof(headers))) == -1)
+    {
+        ui_log(LOG_WARN, "Encoding of captured PDU failed!");
+        return;
+    }
+
+    write_record(n, CP_DIR_IN, pdu->content_type, headers, len, pdu->content,
+                 pdu->content_length);
+}
+
+
+/**
+ *  Records a PDU sent to a contact. The V1 encoding of the prepared
+ *  PDU is recorded, file chunks (see: prepare_file_pdu()) are skipped,
+ *  since their contents are not kept in memory.
+ *  @param n  Index of the contact in the contactlist
+ *  @param wp Prepared PDU sent to the contact
+ */
+void
+capture_wire_pdu(int n, wire_pdu_t* wp)
+{
+    if (_trace == NULL || wp->file_len)
+    {
+        return;
+    }
+
+    write_record(n, CP_DIR_OUT, wp->content_type, wp->data, wp->len, NULL, 0);
+}
@@ -32,6 +32,10 @@
 #include "dchat_h/types.h"
 #include "dchat_h/util.h"
 #include "dchat_h/consoleui.h"
+#include "dchat_h/transfer.h"
+#include "dchat_h/snapshot.h"
+#include "dchat_h/connector.h"
+#include "dchat_h/metrics.h"
 
 
 /**
@@ -89,6 +93,30 @@ parse_cmd(char* line)
 }
 
 
+/**
+ * Executes a command, which only reads the contactlist, in the calling
+ * thread. Such commands read a snapshot of the contactlist (see:
+ * snapshot.c), thus they neither have to be passed to nor wait for the
+ * main loop.
+ * @param line Line entered by the user
+ * @return 0 if the command has been executed, -1 if the line is no such
+ * command
+ */
+int
+parse_snapshot_cmd(char* line)
+{
+    int len = strlen(CMD_NAME_LST);
+
+    if (strncmp(line, CMD_NAME_LST, len) || (line[len] != '\0' && line[len] != ' '))
+    {
+        return -1;
+    }
+
+    parse_cmd(line);
+    return 0;
+}
+
+
 /**
  * Initializes a commands structure with all available in-chat commands and its
  * executable functions.
@@ -105,7 +133,9 @@ init_cmds(cmds_t* cmds)
     {
         COMMAND(CMD_ID_HLP, CMD_NAME_HLP, CMD_ARG_HLP, hlp_exec),
         COMMAND(CMD_ID_CON, CMD_NAME_CON, CMD_ARG_CON, con_exec),
-        COMMAND(CMD_ID_LST, CMD_NAME_LST, CMD_ARG_LST, lst_exec)
+        COMMAND(CMD_ID_LST, CMD_NAME_LST, CMD_ARG_LST, lst_exec),
+        COMMAND(CMD_ID_SND, CMD_NAME_SND, CMD_ARG_SND, snd_exec),
+        COMMAND(CMD_ID_STS, CMD_NAME_STS, CMD_ARG_STS, sts_exec)
     };
     temp_size = sizeof(temp) / sizeof(temp[0]);
 
@@ -185,50 +215,91 @@ con_exec(char* arg)
         return 1;
     }
 
-    // write onion address to connector pipe
-    if (write(_cnf->connect_fd[1], address, ONION_ADDRLEN) == -1)
+    // pass the request to the connector
+    request_connect(address, port);
+    return 0;
+}
+
+
+/**
+ * Lists alls contacts within the local contactlist. The contacts are read
+ * from a snapshot of the contactlist, thus this command may be executed
+ * by any thread (see: parse_snapshot_cmd()).
+ * @return 0 on success, 1 on syntax error, -1 otherwise
+ */
+int
+lst_exec(char* arg)
+{
+    cl_snapshot_t* snap = enter_cl_snapshot();
+    cl_entry_t* e;
+
+    // are there no contacts in the list a message will be printed
+    if (!snap->count)
     {
-        return -1;
+        ui_log(LOG_NOTICE, "No contacts found in the contactlist");
     }
 
-    if (write(_cnf->connect_fd[1], &port, sizeof(uint16_t)) == -1)
+    for (int i = 0; i < snap->count; i++)
     {
-        return -1;
+        e = &snap->entry[i];
+        ui_log(LOG_NOTICE, "");
+        // print all available information about the connection
+        ui_log(LOG_NOTICE, "Contact................%s", e->name);
+        ui_log(LOG_NOTICE, "Onion-ID...............%s", e->onion_id);
+        ui_log(LOG_NOTICE, "Hidden-Port............%hu", e->lport);
     }
 
+    leave_cl_snapshot();
     return 0;
 }
 
 
 /**
- * Lists alls contacts within the local contactlist.
+ * Offers a file to a contact (see: offer_file()).
  * @return 0 on success, 1 on syntax error, -1 otherwise
  */
 int
-lst_exec(char* arg)
+snd_exec(char* arg)
 {
+    char* nickname;
+    char* path;
     int i;
 
-    // are there no contacts in the list a message will be printed
-    if (!_cnf->cl.used_contacts)
+    if ((arg = remove_leading_spaces(arg)) == NULL)
     {
-        ui_log(LOG_NOTICE, "No contacts found in the contactlist");
+        return 1;
+    }
+
+    nickname = strtok_r(arg, " ", &path);
+
+    // the rest of the line is the path, which may contain spaces
+    if (nickname == NULL || (path = remove_leading_spaces(path)) == NULL || !strlen(path))
+    {
+        return 1;
     }
-    else
+
+    for (i = 0; i < _cnf->cl.cl_size; i++)
     {
-        for (i = 0; i < _cnf->cl.cl_size; i++)
+        if (CONTACT(i)->fd > 0 && !strcmp(CONTACT(i)->name, nickname))
         {
-            // check if entry is a valid connection
-            if (_cnf->cl.contact[i].fd)
-            {
-                ui_log(LOG_NOTICE, "");
-                // print all available information about the connection
-                ui_log(LOG_NOTICE, "Contact................%s", _cnf->cl.contact[i].name);
-                ui_log(LOG_NOTICE, "Onion-ID...............%s", _cnf->cl.contact[i].onion_id);
-                ui_log(LOG_NOTICE, "Hidden-Port............%hu", _cnf->cl.contact[i].lport);
-            }
+            // errors have already been reported
+            offer_file(i, path);
+            return 0;
         }
     }
 
+    ui_log(LOG_WARN, "Unknown contact '%s'!", nickname);
+    return 0;
+}
+
+
+/**
+ * Prints the metrics of the client and of its contacts (see: metrics.c).
+ * @return 0 on success, 1 on syntax error, -1 otherwise
+ */
+int
+sts_exec(char* arg)
+{
+    log_metrics();
     return 0;
 }
@@ -0,0 +1,234 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file compress.c
+ *  This file contains the compression of PDU contents, which is negotiated
+ *  per connection by the "Accept-Encoding" header (see: zlib_parse()).
+ *  Contents are compressed as raw deflate streams, each PDU on its own,
+ *  since a prepared PDU is shared by all contacts it is sent to. Instead
+ *  of a compression context per connection, contents of the same
+ *  content-type share a preset dictionary, which helps with the short
+ *  onion address lists of "control/discover".
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#include "dchat_h/compress.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/pool.h"
+#include "dchat_h/consoleui.h"
+
+
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H)
+
+//! preset dictionary of "control/discover" contents
+static const char _dsc_dict[] =
+    "abcdefghijklmnopqrstuvwxyz234567 7000\n 7001\n 7002\n 8000\n 8080\n 9000\n"
+    ".onion 7000\n.onion 7001\n.onion 8000\n.onion 9000\n.onion ";
+
+static z_stream _deflate; //!< deflate stream, which is reset for every content
+static int _deflate_init; //!< deflate stream has been initialized
+//! inflate stream per thread, since reactors decode concurrently (see: reactor.c)
+static __thread z_stream _inflate;
+static __thread int _inflate_init; //!< inflate stream has been initialized
+
+
+/**
+ *  Looks up the preset dictionary of a content-type.
+ *  @param content_type Content-type of the content
+ *  @param len          Pointer where the length of the dictionary is stored
+ *  @return dictionary or NULL if the content-type has none
+ */
+static const char*
+get_dictionary(int content_type, int* len)
+{
+    if (content_type == CTT_ID_DSC)
+    {
+        *len = sizeof(_dsc_dict) - 1;
+        return _dsc_dict;
+    }
+
+    return NULL;
+}
+
+
+/**
+ *  @return 1 if contents can be compressed, 0 otherwise
+ */
+int
+compression_available()
+{
+    return 1;
+}
+
+
+/**
+ *  Compresses the content of a PDU.
+ *  @param pdu  PDU whose content will be compressed
+ *  @param buf  Buffer where the compressed content will be written to
+ *  @param size Size of the buffer
+ *  @return length of the compressed content or -1 if the content could not
+ *  be compressed or the compressed content would not be smaller
+ */
+int
+deflate_content(dchat_pdu_t* pdu, char* buf, int size)
+{
+    const char* dict;
+    int dict_len;
+    int ret;
+
+    if (!_deflate_init)
+    {
+        if (deflateInit2(&_deflate, ZL_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return -1;
+        }
+
+        _deflate_init = 1;
+    }
+    else if (deflateReset(&_deflate) != Z_OK)
+    {
+        return -1;
+    }
+
+    if ((dict = get_dictionary(pdu->content_type, &dict_len)) != NULL &&
+        deflateSetDictionary(&_deflate, (const Bytef*) dict, dict_len) != Z_OK)
+    {
+        return -1;
+    }
+
+    // the compressed content must be smaller than the content
+    if (size > pdu->content_length - 1)
+    {
+        size = pdu->content_length - 1;
+    }
+
+    _deflate.next_in = (Bytef*) pdu->content;
+    _deflate.avail_in = pdu->content_length;
+    _deflate.next_out = (Bytef*) buf;
+    _deflate.avail_out = size > 0 ? size : 0;
+
+    if ((ret = deflate(&_deflate, Z_FINISH)) != Z_STREAM_END)
+    {
+        return -1;
+    }
+
+    return size - _deflate.avail_out;
+}
+
+
+/**
+ *  Decompresses the content of a received PDU and replaces it. The
+ *  decompressed content must not exceed MAX_CONTENT_LEN.
+ *  @param pdu PDU whose content will be decompressed
+ *  @return length of the decompressed content or -1 on error
+ */
+int
+inflate_content(dchat_pdu_t* pdu)
+{
+    char buf[MAX_CONTENT_LEN + 1];
+    const char* dict;
+    int dict_len;
+    int len;
+
+    if (pdu->encoding != ENC_ID_DEFLATE)
+    {
+        return -1;
+    }
+
+    if (!_inflate_init)
+    {
+        if (inflateInit2(&_inflate, -15) != Z_OK)
+        {
+            return -1;
+        }
+
+        _inflate_init = 1;
+    }
+    else if (inflateReset(&_inflate) != Z_OK)
+    {
+        return -1;
+    }
+
+    if ((dict = get_dictionary(pdu->content_type, &dict_len)) != NULL &&
+        inflateSetDictionary(&_inflate, (const Bytef*) dict, dict_len) != Z_OK)
+    {
+        return -1;
+    }
+
+    _inflate.next_in = (Bytef*) pdu->content;
+    _inflate.avail_in = pdu->content_length;
+    _inflate.next_out = (Bytef*) buf;
+    _inflate.avail_out = MAX_CONTENT_LEN;
+
+    // contents exceeding MAX_CONTENT_LEN do not end within the buffer
+    if (inflate(&_inflate, Z_FINISH) != Z_STREAM_END || _inflate.avail_in)
+    {
+        return -1;
+    }
+
+    len = MAX_CONTENT_LEN - _inflate.avail_out;
+    pool_free(pdu->content);
+
+    if ((pdu->content = pool_alloc(len + 1)) == NULL)
+    {
+        ui_fatal("Memory allocation for PDU content failed!");
+    }
+
+    memcpy(pdu->content, buf, len);
+    pdu->content[len] = '\0'; // NULL terminate potential string
+    pdu->content_length = len;
+    pdu->encoding = 0;
+    return len;
+}
+
+#else
+
+int
+compression_available()
+{
+    return 0;
+}
+
+
+int
+deflate_content(dchat_pdu_t* pdu, char* buf, int size)
+{
+    return -1;
+}
+
+
+int
+inflate_content(dchat_pdu_t* pdu)
+{
+    return -1;
+}
+
+#endif
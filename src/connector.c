@@ -0,0 +1,687 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file connector.c
+ *  This file contains the connector, which establishes connections to
+ *  remote hosts via TOR without blocking the main loop. Any amount of
+ *  connection attempts may be in progress in parallel. Peers whose
+ *  connection has been lost are reconnected with exponential backoff.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "dchat_h/connector.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/event.h"
+#include "dchat_h/util.h"
+#include "dchat_h/dchat.h"
+#include "dchat_h/peercache.h"
+#include "dchat_h/relay.h"
+#include "dchat_h/metrics.h"
+#include "dchat_h/consoleui.h"
+
+
+static connector_t _cn; //!< pending connection attempts
+
+
+static void expire_connect(void* arg);
+static void retry_reconnect(char* onion_id, uint16_t port);
+
+
+/**
+ *  Requests the main loop to connect to a remote host (see:
+ *  handle_connect_requests()). May be called by any thread.
+ *  @param onion_id Destination onion address to connect to
+ *  @param port     Destination port to connect to
+ */
+void
+request_connect(char* onion_id, uint16_t port)
+{
+    conn_request_t* req;
+
+    if ((req = malloc(sizeof(*req))) == NULL)
+    {
+        ui_fatal("Memory allocation for connection request failed!");
+    }
+
+    req->onion_id[0] = '\0';
+    strncat(req->onion_id, onion_id, ONION_ADDRLEN);
+    req->lport = port;
+    push_lf_queue(&_cnf->connect_q, &req->node);
+}
+
+
+/**
+ *  Starts connection attempts for all requests passed to the main loop
+ *  (see: request_connect()).
+ */
+void
+handle_connect_requests()
+{
+    conn_request_t* req;
+
+    ack_lf_queue(&_cnf->connect_q);
+
+    while ((req = (conn_request_t*) pop_lf_queue(&_cnf->connect_q)) != NULL)
+    {
+        if (handle_local_conn_request(req->onion_id, req->lport) == -1)
+        {
+            ui_log(LOG_WARN, "Connection to remote host failed!");
+        }
+
+        free(req);
+    }
+}
+
+
+/**
+ *  Releases the requests, which have not been handled by the main loop,
+ *  and closes their queue.
+ */
+void
+destroy_connect_requests()
+{
+    conn_request_t* req;
+
+    while ((req = (conn_request_t*) pop_lf_queue(&_cnf->connect_q)) != NULL)
+    {
+        free(req);
+    }
+
+    destroy_lf_queue(&_cnf->connect_q);
+}
+
+
+/**
+ *  Starts a connection attempt to a remote host via TOR (or directly,
+ *  see: drct_parse()).
+ *  The attempt continues in the main loop whenever its socket becomes ready
+ *  (see: handle_connect_event()). Once the remote host has been
+ *  connected, it will be added as contact.
+ *  @param onion_id Destination onion address to connect to
+ *  @param port     Destination port to connect to
+ *  @return 0 if the attempt has been started or there is already an attempt
+ *  to this host, -1 on error
+ */
+int
+start_connect(char* onion_id, uint16_t port)
+{
+    conn_attempt_t* ca;
+    int i, n = -1;
+
+    // search for an attempt to the same host and for a free slot
+    for (i = 0; i < _cn.size; i++)
+    {
+        ca = CN_ATTEMPT(&_cn, i);
+
+        if (ca->state == CN_STATE_FREE)
+        {
+            n = n == -1 ? i : n;
+        }
+        else if (ca->lport == port && !strcmp(ca->onion_id, onion_id))
+        {
+            return 0;
+        }
+    }
+
+    if (n == -1)
+    {
+        if (_cn.size >= CN_MAX_ATTEMPTS)
+        {
+            ui_log(LOG_ERR, "Too many pending connection attempts!");
+            return -1;
+        }
+
+        // existing attempts keep their index, which is used as event id,
+        // and their address, since their timers are armed
+        if ((_cn.block[_cn.size / CN_INIT_ATTEMPTS] =
+                 calloc(CN_INIT_ATTEMPTS, sizeof(conn_attempt_t))) == NULL)
+        {
+            ui_fatal("Allocation of connection attempts failed!");
+        }
+
+        n = _cn.size;
+        _cn.size += CN_INIT_ATTEMPTS;
+    }
+
+    ca = CN_ATTEMPT(&_cn, n);
+    memset(ca, 0, sizeof(*ca));
+
+    if ((ca->fd = _cnf->direct ? create_direct_socket(port) : create_tor_socket(&_cnf->tor)) == -1)
+    {
+        return -1;
+    }
+
+    // wait until the connection to the TOR client has been established
+    if (ev_add(&_cnf->ev, ca->fd, EV_WRITE, EV_ID(EV_SRC_SOCKS, n)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Registration of connection attempt in event loop failed!");
+        close(ca->fd);
+        return -1;
+    }
+
+    strncat(ca->onion_id, onion_id, ONION_ADDRLEN);
+    ca->lport = port;
+    ca->state = CN_STATE_CONNECT;
+    ca->started = get_time_ms();
+    init_timer(&ca->timeout, expire_connect, (void*) (intptr_t) n);
+    arm_timer(&ca->timeout, CN_TIMEOUT);
+    _cn.used++;
+    note_peer_attempt(ca->onion_id, ca->lport);
+    return 0;
+}
+
+
+/**
+ *  Aborts a connection attempt and closes its socket.
+ *  @param n Index of the connection attempt
+ */
+void
+abort_connect(int n)
+{
+    conn_attempt_t* ca = CN_ATTEMPT(&_cn, n);
+
+    if (ca->state == CN_STATE_FREE)
+    {
+        return;
+    }
+
+    cancel_timer(&ca->timeout);
+    ev_del(&_cnf->ev, ca->fd);
+    close(ca->fd);
+    memset(ca, 0, sizeof(*ca));
+    _cn.used--;
+}
+
+
+/**
+ *  Aborts a failed connection attempt. If the remote host is a peer
+ *  being reconnected, the next reconnection attempt is scheduled.
+ *  @param n Index of the connection attempt
+ */
+static void
+fail_connect(int n)
+{
+    conn_attempt_t* ca = CN_ATTEMPT(&_cn, n);
+    char onion_id[ONION_ADDRLEN + 1];
+    uint16_t lport = ca->lport;
+
+    memcpy(onion_id, ca->onion_id, sizeof(onion_id));
+    count_connect(0, 0);
+    abort_connect(n);
+    retry_reconnect(onion_id, lport);
+}
+
+
+/**
+ *  Adds the remote host of a successful connection attempt as contact
+ *  and sends our contactlist to it.
+ *  @param n Index of the connection attempt
+ *  @return index of the new contact or -1 on error
+ */
+int
+finish_connect(int n)
+{
+    conn_attempt_t ca;
+    int c;
+
+    // hand over the socket from the connector to the contactlist
+    cancel_timer(&CN_ATTEMPT(&_cn, n)->timeout);
+    memcpy(&ca, CN_ATTEMPT(&_cn, n), sizeof(ca));
+    ev_del(&_cnf->ev, ca.fd);
+    memset(CN_ATTEMPT(&_cn, n), 0, sizeof(ca));
+    _cn.used--;
+    cancel_reconnect(ca.onion_id, ca.lport);
+
+    // contacts use blocking sockets, the reply to a SOCKS5 request
+    // that has just been sent is read by the contact
+    if (set_nonblocking(ca.fd, 0) == -1 ||
+        (c = add_contact(ca.fd, ca.state == CN_STATE_REQUEST ? _cnf->socks5 : 0)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Could not add new contact!");
+        close(ca.fd);
+        return -1;
+    }
+
+    // set onion id and listening port of new contact
+    set_contact_address(c, ca.onion_id, ca.lport);
+    note_peer_connected(ca.onion_id, ca.lport, get_time_ms() - ca.started);
+    count_connect(1, get_time_ms() - ca.started);
+    // send all our known contacts to the newly connected client
+    send_contacts(c);
+    return c;
+}
+
+
+/**
+ *  Returns the username of a SOCKS5 request, which lets TOR isolate the
+ *  stream of the connection attempt from streams using other usernames
+ *  (see: sck5_parse()).
+ *  @param ca   Pointer to the connection attempt
+ *  @param user Buffer the username will be written to
+ *  @param size Size of the buffer
+ *  @return Pointer to the username or NULL if no authentication is used
+ */
+static char*
+socks5_user(conn_attempt_t* ca, char* user, int size)
+{
+    switch (_cnf->socks5)
+    {
+        // one circuit for all streams of this client
+        case SOCKS_ISO_SESSION:
+            snprintf(user, size, "dchat:%s:%u", _cnf->me.onion_id, _cnf->me.lport);
+            return user;
+
+        // one circuit per peer
+        case SOCKS_ISO_PEER:
+            snprintf(user, size, "dchat:%s:%u", ca->onion_id, ca->lport);
+            return user;
+
+        default:
+            return NULL;
+    }
+}
+
+
+/**
+ *  Advances a connection attempt, whose socket has become ready.
+ *  The remote host will be added as contact, if the connection has been
+ *  established, thus this function must be called by the main loop.
+ *  @param n  Index of the connection attempt (see: EV_SRC_SOCKS)
+ *  @param fd File descriptor that became ready
+ *  @return index of the new contact, -2 if the attempt is still in
+ *  progress or -1 if the attempt failed
+ */
+int
+handle_connect_event(int n, int fd)
+{
+    conn_attempt_t* ca;
+    socks4a_pdu_t pdu; // SOCKS request/response
+    char user[SOCKS5_MAX_USER + 1]; // SOCKS5 username
+    socklen_t len;
+    int err;
+    int ret;
+
+    // the attempt may have been aborted while handling previous events
+    if (n >= _cn.size || CN_ATTEMPT(&_cn, n)->state == CN_STATE_FREE ||
+        CN_ATTEMPT(&_cn, n)->fd != fd)
+    {
+        return -2;
+    }
+
+    ca = CN_ATTEMPT(&_cn, n);
+
+    switch (ca->state)
+    {
+        // connection to TOR client has been established or failed
+        case CN_STATE_CONNECT:
+            len = sizeof(err);
+
+            if (getsockopt(ca->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err)
+            {
+                errno = err;
+                ui_log_errno(LOG_ERR, "Could not connect to TOR client!");
+                break;
+            }
+
+            // remote host has been connected without TOR
+            if (_cnf->direct)
+            {
+                return finish_connect(n);
+            }
+
+            // craft SOCKS request, SOCKS5 requests are sent with a single
+            // write including the greeting and the authentication
+            if (_cnf->socks5)
+            {
+                ca->len = encode_socks5(ca->onion_id, ca->lport,
+                                        socks5_user(ca, user, sizeof(user)),
+                                        ca->buf, sizeof(ca->buf));
+            }
+            else
+            {
+                memset(&pdu, 0, sizeof(pdu));
+                pdu.version  = SOCKS_VERSION;
+                pdu.command  = SOCKS_CONNECT;
+                pdu.port     = ca->lport;
+                pdu.fakeip   = SOCKS_FAKEIP;
+                pdu.delim    = SOCKS_DELIM;
+                pdu.hostname = ca->onion_id;
+                ca->len = encode_socks4a(&pdu, ca->buf, sizeof(ca->buf));
+            }
+
+            if (ca->len == -1)
+            {
+                ui_log(LOG_ERR, "Could not encode SOCKS connection request!");
+                break;
+            }
+
+            ca->off = 0;
+            ca->state = CN_STATE_REQUEST;
+
+        // fall through - the socket is writable
+        case CN_STATE_REQUEST:
+
+            // send connection request to TOR
+            if ((ret = send(ca->fd, ca->buf + ca->off, ca->len - ca->off,
+                            MSG_DONTWAIT | MSG_NOSIGNAL)) == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                {
+                    return -2;
+                }
+
+                ui_log_errno(LOG_ERR, "Could not write SOCKS connection request!");
+                break;
+            }
+
+            if ((ca->off += ret) < ca->len)
+            {
+                return -2;
+            }
+
+            // TOR buffers data following a SOCKS5 request until the stream
+            // has been established (optimistic data), thus the contact is
+            // added at once and its first PDUs are sent right behind the
+            // request, the reply is read by the contact (see: read_pdu())
+            if (_cnf->socks5)
+            {
+                return finish_connect(n);
+            }
+
+            // wait for the response of the TOR client
+            ca->len = SOCKS4A_RESPONSE_LEN;
+            ca->off = 0;
+            ca->state = CN_STATE_RESPONSE;
+
+            if (ev_mod(&_cnf->ev, ca->fd, EV_READ, EV_ID(EV_SRC_SOCKS, n)) == -1)
+            {
+                ui_log_errno(LOG_ERR, "Updating event of connection attempt failed!");
+                break;
+            }
+
+            return -2;
+
+        // response of the TOR client has been received
+        case CN_STATE_RESPONSE:
+
+            // read response code from TOR
+            if ((ret = recv(ca->fd, ca->buf + ca->off, ca->len - ca->off,
+                            MSG_DONTWAIT)) == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                {
+                    return -2;
+                }
+
+                ui_log_errno(LOG_ERR, "Could not read SOCKS connection response!");
+                break;
+            }
+
+            if (!ret)
+            {
+                ui_log(LOG_ERR, "Connection to TOR client has been closed!");
+                break;
+            }
+
+            if ((ca->off += ret) < ca->len)
+            {
+                return -2;
+            }
+
+            decode_socks4a(ca->buf, &pdu);
+
+            if (pdu.command != SOCKS_GRANTED)
+            {
+                ui_log(LOG_WARN,
+                       "TOR Connection to remote host failed. Status code: %d - '%s'", pdu.command,
+                       parse_socks_status(pdu.command));
+                break;
+            }
+
+            return finish_connect(n);
+    }
+
+    fail_connect(n);
+    return -1;
+}
+
+
+/**
+ *  Aborts a connection attempt, whose deadline has expired (see:
+ *  CN_TIMEOUT). Called by the timer of the attempt.
+ *  @param arg Index of the connection attempt
+ */
+static void
+expire_connect(void* arg)
+{
+    int n = (int) (intptr_t) arg;
+
+    ui_log(LOG_WARN, "Connection to '%s' timed out!", CN_ATTEMPT(&_cn, n)->onion_id);
+    fail_connect(n);
+}
+
+
+/**
+ *  @return amount of pending connection attempts
+ */
+int
+pending_connects()
+{
+    return _cn.used;
+}
+
+
+/**
+ *  Searches a peer being reconnected.
+ *  @param onion_id Onion address of the peer, empty for an unused entry
+ *  @param port     Listening port of the peer, 0 for an unused entry
+ *  @return Pointer to the entry of the peer or NULL if not found
+ */
+static reconnect_t*
+find_reconnect(char* onion_id, uint16_t port)
+{
+    for (int i = 0; i < CN_RECONNECTS; i++)
+    {
+        if (_cn.rc[i].lport == port && !strcmp(_cn.rc[i].onion_id, onion_id))
+        {
+            return &_cn.rc[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ *  Arms the timer of the next reconnection attempt to a peer. The delay
+ *  starts at CN_BACKOFF_MIN and doubles with every attempt up to
+ *  CN_BACKOFF_MAX. After CN_BACKOFF_TRIES attempts the peer is given up.
+ *  @param rc Entry of the peer
+ */
+static void
+backoff_reconnect(reconnect_t* rc)
+{
+    long long delay;
+
+    if (rc->tries >= CN_BACKOFF_TRIES)
+    {
+        ui_log(LOG_INFO, "Giving up to reconnect to '%s'!", rc->onion_id);
+        memset(rc, 0, sizeof(*rc));
+        return;
+    }
+
+    delay = (long long) CN_BACKOFF_MIN << rc->tries;
+    delay = delay > CN_BACKOFF_MAX ? CN_BACKOFF_MAX : delay;
+    // add up to 25% jitter, so that peers, which lost each other, do
+    // not reconnect in lockstep
+    delay += new_msg_id() % (delay / 4 + 1);
+    rc->tries++;
+    arm_timer(&rc->timer, delay);
+}
+
+
+/**
+ *  Starts a reconnection attempt to a peer, unless it has been connected
+ *  meanwhile or the partial mesh does not accept another neighbour.
+ *  If the peer has been connected for CN_STABLE_TIME, its backoff is
+ *  forgotten. Called by the timer of the peer.
+ *  @param arg Entry of the peer
+ */
+static void
+fire_reconnect(void* arg)
+{
+    reconnect_t* rc = arg;
+
+    if (rc->connected ||
+        lookup_contact_index(&_cnf->cl.index, rc->onion_id, rc->lport, 0) >= 0 ||
+        !accepts_neighbour())
+    {
+        memset(rc, 0, sizeof(*rc));
+        return;
+    }
+
+    if (start_connect(rc->onion_id, rc->lport) == -1)
+    {
+        backoff_reconnect(rc);
+    }
+}
+
+
+/**
+ *  Schedules the next reconnection attempt to a peer, if it is being
+ *  reconnected (see: schedule_reconnect()).
+ *  @param onion_id Onion address of the peer
+ *  @param port     Listening port of the peer
+ */
+static void
+retry_reconnect(char* onion_id, uint16_t port)
+{
+    reconnect_t* rc;
+
+    if ((rc = find_reconnect(onion_id, port)) != NULL && !timer_armed(&rc->timer))
+    {
+        backoff_reconnect(rc);
+    }
+}
+
+
+/**
+ *  Reconnects to a peer, whose connection has been lost. The peer is
+ *  reconnected with exponential backoff until it has been connected or
+ *  CN_BACKOFF_TRIES attempts failed. If the peer has been reconnected
+ *  recently (see: cancel_reconnect()), the backoff continues to grow.
+ *  @param onion_id Onion address of the peer
+ *  @param port     Listening port of the peer
+ */
+void
+schedule_reconnect(char* onion_id, uint16_t port)
+{
+    reconnect_t* rc;
+
+    // never connect to ourselves
+    if (port == _cnf->me.lport && !strcmp(onion_id, _cnf->me.onion_id))
+    {
+        return;
+    }
+
+    if ((rc = find_reconnect(onion_id, port)) == NULL)
+    {
+        if ((rc = find_reconnect("", 0)) == NULL)
+        {
+            ui_log(LOG_WARN, "Too many peers to reconnect - '%s' is not reconnected!", onion_id);
+            return;
+        }
+
+        strncat(rc->onion_id, onion_id, ONION_ADDRLEN);
+        rc->lport = port;
+        init_timer(&rc->timer, fire_reconnect, rc);
+    }
+
+    // the connection did not last for CN_STABLE_TIME
+    if (rc->connected)
+    {
+        cancel_timer(&rc->timer);
+        rc->connected = 0;
+    }
+
+    if (!timer_armed(&rc->timer))
+    {
+        backoff_reconnect(rc);
+    }
+}
+
+
+/**
+ *  Stops reconnecting to a peer, since it has been connected. The
+ *  attempts so far are kept for CN_STABLE_TIME, so that peers, which
+ *  drop the connection at once, are reconnected less and less often.
+ *  @param onion_id Onion address of the peer
+ *  @param port     Listening port of the peer
+ */
+void
+cancel_reconnect(char* onion_id, uint16_t port)
+{
+    reconnect_t* rc;
+
+    if ((rc = find_reconnect(onion_id, port)) != NULL)
+    {
+        cancel_timer(&rc->timer);
+        rc->connected = 1;
+        arm_timer(&rc->timer, CN_STABLE_TIME);
+    }
+}
+
+
+/**
+ *  Aborts all pending connection attempts and frees the connector.
+ */
+void
+destroy_connector()
+{
+    int i;
+
+    for (i = 0; i < _cn.size; i++)
+    {
+        abort_connect(i);
+    }
+
+    for (i = 0; i < _cn.size / CN_INIT_ATTEMPTS; i++)
+    {
+        free(_cn.block[i]);
+    }
+
+    for (i = 0; i < CN_RECONNECTS; i++)
+    {
+        cancel_timer(&_cn.rc[i].timer);
+    }
+
+    memset(&_cn, 0, sizeof(_cn));
+}
@@ -5,6 +5,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -20,6 +21,10 @@
 
 #include "dchat_h/consoleui.h"
 #include "dchat_h/decoder.h"
+#include "dchat_h/log.h"
+#include "dchat_h/metrics.h"
+#include "dchat_h/pool.h"
+#include "dchat_h/util.h"
 
 // log level
 static int level_ = LOG_DEBUG;
@@ -40,6 +45,14 @@ static pthread_t _th_acpt_inp;
 static pthread_t _th_acpt_out;
 static pthread_t _th_acpt_log;
 static pthread_t _th_rec;
+static pthread_t _th_wrt;
+
+// messages queued for the user interface (see: th_ui_writer())
+static ui_ring_t _ring;
+
+static char _path_inp[UI_PATH_LEN];
+static char _path_out[UI_PATH_LEN];
+static char _path_log[UI_PATH_LEN];
 
 /**
  * Initializes input, output and log filedescriptor.
@@ -52,6 +65,17 @@ init_ui()
     _ipc_out.path = OUT_SOCK_PATH;
     _ipc_log.path = LOG_SOCK_PATH;
 
+    // sockets have been moved to another directory (see: udir_parse())
+    if (_cnf->ui_dir != NULL)
+    {
+        snprintf(_path_inp, sizeof(_path_inp), "%s/%s", _cnf->ui_dir, UI_SOCK_INP);
+        snprintf(_path_out, sizeof(_path_out), "%s/%s", _cnf->ui_dir, UI_SOCK_OUT);
+        snprintf(_path_log, sizeof(_path_log), "%s/%s", _cnf->ui_dir, UI_SOCK_LOG);
+        _ipc_inp.path = _path_inp;
+        _ipc_out.path = _path_out;
+        _ipc_log.path = _path_log;
+    }
+
     // mutex for reconnect
     if (pthread_mutex_init(&_lock, NULL) != 0)
     {
@@ -76,9 +100,21 @@ init_ui()
         return -1;
     }
 
+    // output ring
+    if (pthread_mutex_init(&_ring.mx, NULL) != 0)
+    {
+        return -1;
+    }
+
+    if (pthread_cond_init(&_ring.cond, NULL) != 0)
+    {
+        return -1;
+    }
+
     signal(SIGPIPE, SIG_IGN);
     pthread_create(&_th_rec, NULL, (void*) th_ipc_reconnector, NULL);
-    return 0;
+    pthread_create(&_th_wrt, NULL, (void*) th_ui_writer, NULL);
+    return init_log();
 }
 
 /**
@@ -87,6 +123,12 @@ init_ui()
 void
 free_unix_socks()
 {
+    int fds[3] = {_cnf->in_fd, _cnf->out_fd, _cnf->log_fd};
+
+    // the event loop keeps registered files open, the user interface would
+    // not notice the close
+    ev_unregister_fds(&_cnf->ev, fds, 3);
+
     if (_cnf->in_fd > 2)
     {
         close(_cnf->in_fd);
@@ -176,6 +218,8 @@ th_ipc_accept(void* ptr)
 void
 ipc_connect()
 {
+    int fds[3];
+
     while (1)
     {
         free_unix_socks();
@@ -193,6 +237,17 @@ ipc_connect()
         if (_cnf->in_fd != -1 && _cnf->out_fd != -1 && _cnf->log_fd != -1)
         {
             local_log(LOG_NOTICE, "CONNECTIONS ESTABLISHED");
+            // the sockets stay open until the user interface reconnects
+            // (see: free_unix_socks())
+            fds[0] = _cnf->in_fd;
+            fds[1] = _cnf->out_fd;
+            fds[2] = _cnf->log_fd;
+
+            if (ev_register_fds(&_cnf->ev, fds, 3) == -1)
+            {
+                local_log(LOG_WARN, "REGISTRATION OF SOCKETS FAILED");
+            }
+
             break;
         }
 
@@ -212,6 +267,27 @@ signal_reconnect()
 }
 
 
+/**
+ * Waits until the user interface has been (re)connected by
+ * th_ipc_reconnector(). Must be called with _lock held, which is
+ * released by this function.
+ */
+static void
+wait_reconnect()
+{
+    pthread_mutex_lock(&_lock_wake);
+
+    if (!_reconnect)
+    {
+        signal_reconnect();
+    }
+
+    pthread_mutex_unlock(&_lock);
+    pthread_cond_wait(&_cond_wake, &_lock_wake);
+    pthread_mutex_unlock(&_lock_wake);
+}
+
+
 void*
 th_ipc_reconnector(void* ptr)
 {
@@ -227,10 +303,24 @@ th_ipc_reconnector(void* ptr)
         pthread_mutex_lock(&_lock_wake);
         ipc_connect();
         _reconnect = 0;
+        // greet the new user interface and replay the last messages
+        pthread_mutex_lock(&_ring.mx);
+        _ring.conn++;
+
+        if (_ring.sent - _ring.tail > UI_REPLAY)
+        {
+            _ring.sent -= UI_REPLAY;
+        }
+        else
+        {
+            _ring.sent = _ring.tail;
+        }
+
+        pthread_cond_signal(&_ring.cond);
+        pthread_mutex_unlock(&_ring.mx);
         pthread_cond_broadcast(&_cond_wake);
         pthread_mutex_unlock(&_lock_wake);
         pthread_mutex_unlock(&_lock);
-        ui_write(_cnf->me.name, "");
     }
 
     free_unix_socks();
@@ -241,35 +331,201 @@ th_ipc_reconnector(void* ptr)
 
 
 /**
- * Write recived message to out file descriptor.
+ * Queues a received message for the user interface.
+ * The message is written to the output file descriptor by
+ * th_ui_writer(), therefore this function never blocks. If the ring
+ * is full of messages that have not been written yet, the message
+ * is dropped.
  * @nickname Nickname of the client from whom we received the message
  * @msg Text message to print
- * @return 0 on success, -1 in case of error
+ * @return 0 on success, -1 if the message has been dropped
 */
 int
 ui_write(char* nickname, char* msg)
 {
-    int ret;
-    pthread_mutex_lock(&_lock);
+    int nlen = strlen(nickname);
+    int mlen = strlen(msg);
+    int len = nlen + mlen + 2;
+    long long start = get_time_ns();
+    unsigned int i;
+    char* buf;
+
+    if ((buf = pool_alloc(len + 1)) == NULL)
+    {
+        return -1;
+    }
 
-    if (dprintf(_cnf->out_fd, "%s;%s\n", nickname, msg) < 0)
+    memcpy(buf, nickname, nlen);
+    buf[nlen] = ';';
+    memcpy(buf + nlen + 1, msg, mlen);
+    buf[len - 1] = '\n';
+    buf[len] = '\0';
+    pthread_mutex_lock(&_ring.mx);
+
+    if (_ring.head - _ring.tail == UI_RING_SIZE)
     {
-        pthread_mutex_lock(&_lock_wake);
-        signal_reconnect();
+        // drop the newest message, the older ones are pending too
+        if (_ring.tail == _ring.sent)
+        {
+            _ring.dropped++;
+            pthread_mutex_unlock(&_ring.mx);
+            pool_free(buf);
+            return -1;
+        }
+
+        // forget the oldest message that has already been written
+        pool_free(_ring.msg[_ring.tail % UI_RING_SIZE]);
+        _ring.tail++;
+    }
+
+    i = _ring.head++ % UI_RING_SIZE;
+    _ring.msg[i] = buf;
+    _ring.len[i] = len;
+    pthread_cond_signal(&_ring.cond);
+    pthread_mutex_unlock(&_ring.mx);
+    record_latency(MT_HIST_UI_WRITE, get_time_ns() - start);
+    return 0;
+}
+
+
+/**
+ * Thread that writes the messages queued by ui_write() to the output
+ * file descriptor. Up to UI_BATCH messages are written by one writev(2).
+ * If the user interface has (re)connected, it is greeted with the own
+ * nickname first (see: th_ipc_reconnector()).
+ */
+void*
+th_ui_writer(void* ptr)
+{
+    struct iovec iov[UI_BATCH + 1]; // greeting followed by the messages
+    char hello[MAX_NICKNAME + 3];   // "nickname;\n"
+    unsigned int first;             // first message of the batch
+    unsigned int dropped;           // messages dropped since last time
+    int greeted = 0;                // connection that has been greeted
+    int conn;                       // connection of the batch
+    int cnt;                        // amount of buffers
+    int amount;                     // amount of messages
+
+    while (1)
+    {
+        pthread_mutex_lock(&_ring.mx);
+
+        while (_ring.sent == _ring.head && _ring.conn == greeted)
+        {
+            pthread_cond_wait(&_ring.cond, &_ring.mx);
+        }
+
+        conn = _ring.conn;
+        cnt = 0;
+
+        if (conn != greeted)
+        {
+            iov[cnt].iov_base = hello;
+            iov[cnt].iov_len = snprintf(hello, sizeof(hello), "%s;\n", _cnf->me.name);
+            cnt++;
+        }
+
+        first = _ring.sent;
+
+        for (amount = 0; first + amount != _ring.head && amount < UI_BATCH; amount++)
+        {
+            iov[cnt].iov_base = _ring.msg[(first + amount) % UI_RING_SIZE];
+            iov[cnt].iov_len = _ring.len[(first + amount) % UI_RING_SIZE];
+            cnt++;
+        }
+
+        dropped = _ring.dropped;
+        _ring.dropped = 0;
+        pthread_mutex_unlock(&_ring.mx);
+
+        if (dropped)
+        {
+            ui_log(LOG_WARN, "%u messages for the user interface have been dropped!",
+                   dropped);
+        }
+
+        pthread_mutex_lock(&_lock);
+
+        // user interface has reconnected meanwhile, batch is outdated
+        if (conn != _ring.conn)
+        {
+            pthread_mutex_unlock(&_lock);
+            continue;
+        }
+
+        // not connected yet or write failed, wait for the reconnector
+        if (_reconnect || write_iov(_cnf->out_fd, iov, cnt) == -1)
+        {
+            wait_reconnect();
+            continue;
+        }
+
+        pthread_mutex_lock(&_ring.mx);
+        _ring.sent = first + amount;
+        greeted = conn;
+        pthread_mutex_unlock(&_ring.mx);
         pthread_mutex_unlock(&_lock);
-        pthread_cond_wait(&_cond_wake, &_lock_wake);
-        pthread_mutex_unlock(&_lock_wake);
-        ret = -1;
+    }
+
+    return NULL;
+}
+
+/**
+ * Writes a batch of formatted log lines to the log file descriptor
+ * (see: th_log_flusher()). If the user interface is not connected, this
+ * function waits for it and writes the whole batch again.
+ * @param buf Formatted log lines
+ * @param len Length of the log lines
+ */
+void
+ui_write_log(char* buf, int len)
+{
+    struct iovec iov;
+
+    while (1)
+    {
+        iov.iov_base = buf;
+        iov.iov_len = len;
+        pthread_mutex_lock(&_lock);
+
+        if (!_reconnect && write_iov(_cnf->log_fd, &iov, 1) != -1)
+        {
+            pthread_mutex_unlock(&_lock);
+            return;
+        }
+
+        wait_reconnect();
+    }
+}
+
+
+/**
+ * Formats a log line the same way as vlog_msgf() does.
+ * @param buf Buffer the line will be written to
+ * @param size Size of the buffer
+ * @param level Log priority
+ * @param msg Formatted message
+ * @param err errno to append, -1 if none
+ * @return Length of the line, truncated to the size of the buffer
+ */
+int
+format_log_line(char* buf, int size, int level, const char* msg, int err)
+{
+    int len;
+
+    if (err != -1)
+    {
+        len = snprintf(buf, size, "%s;%s (%s)\n", flty_[level], msg, strerror(err));
     }
     else
     {
-        pthread_mutex_unlock(&_lock);
-        ret = 0;
+        len = snprintf(buf, size, "%s;%s\n", flty_[level], msg);
     }
 
-    return ret;
+    return len < size ? len : size - 1;
 }
 
+
 /**
 *  Log a message to a filedescriptor.
 *  @param fd File descritpor where the log will be written to
@@ -341,7 +597,21 @@ ui_log(int lf,const char* fmt, ...)
 {
     int ret;
     va_list ap;
+
+    if (level_ < LOG_PRI(lf))
+    {
+        return 0;
+    }
+
     va_start(ap, fmt);
+
+    // queued for the log flusher (see: queue_log())
+    if (queue_log(LOG_PRI(lf), fmt, ap, 0) != -2)
+    {
+        va_end(ap);
+        return 0;
+    }
+
     pthread_mutex_lock(&_lock);
 
     if ((vlog_msgf(_cnf->log_fd, lf, fmt, ap, 0)) < 0)
@@ -389,8 +659,21 @@ int
 ui_log_errno(int lf, const char* fmt, ...)
 {
     va_list ap;
+
+    if (level_ < LOG_PRI(lf))
+    {
+        return 0;
+    }
+
     va_start(ap, fmt);
 
+    // queued for the log flusher (see: queue_log())
+    if (queue_log(LOG_PRI(lf), fmt, ap, 1) != -2)
+    {
+        va_end(ap);
+        return 0;
+    }
+
     if ((vlog_msgf(_cnf->log_fd, lf, fmt, ap, 1)) < 0)
     {
         return -1;
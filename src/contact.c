@@ -31,91 +31,161 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
 
 #include "dchat_h/contact.h"
 #include "dchat_h/types.h"
 #include "dchat_h/decoder.h"
+#include "dchat_h/sendqueue.h"
+#include "dchat_h/contactindex.h"
 #include "dchat_h/dchat.h"
 #include "dchat_h/util.h"
+#include "dchat_h/event.h"
 #include "dchat_h/consoleui.h"
+#include "dchat_h/gossip.h"
+#include "dchat_h/network.h"
+#include "dchat_h/reactor.h"
+#include "dchat_h/snapshot.h"
+#include "dchat_h/relay.h"
+#include "dchat_h/framing.h"
+#include "dchat_h/connector.h"
+#include "dchat_h/keepalive.h"
+#include "dchat_h/compress.h"
+#include "dchat_h/transfer.h"
+#include "dchat_h/peercache.h"
+#include "dchat_h/contactscan.h"
+#include "dchat_h/ratelimit.h"
+#include "dchat_h/metrics.h"
+#include "dchat_h/capture.h"
 
 
 /**
  *  Sends local contactlist to a contact.
- *  Sends all known contacts stored in the contactlist within the global config
- *  in form of a "control/discover" PDU to the given contact.
+ *  Queues all known contacts stored in the contactlist within the global config
+ *  in form of "control/discover" PDUs for the given contact. If gossip is enabled
+ *  (see: gossip.c), only a digest of the contactlist will be sent.
  *  @param n   Index of contact to whom we send our contactlist (excluding him)
  *  @return amount of bytes that have been written as content, -1 on error
  */
 int
 send_contacts(int n)
+{
+    if (_cnf->gossip)
+    {
+        return send_digest(n);
+    }
+
+    return send_contact_list(n, GOSSIP_ALL);
+}
+
+
+/**
+ *  Queues a "control/discover" PDU with the given content for a contact.
+ *  @param n       Index of the contact
+ *  @param content Contact lines
+ *  @param len     Length of the content
+ *  @return 0 on success, -1 on error
+ */
+int
+send_contact_page(int n, char* content, int len)
 {
     dchat_pdu_t pdu;    // pdu with contact information
+    wire_pdu_t* wp;     // prepared pdu
+    int ret = 0;
+
+    if (init_dchat_pdu(&pdu, DCHAT_V1, CTT_ID_DSC, _cnf->me.onion_id, _cnf->me.lport,
+                       _cnf->me.name) == -1)
+    {
+        return -1;
+    }
+
+    // the content is copied while the pdu is prepared
+    pdu.content = content;
+    pdu.content_length = len;
+
+    if ((wp = prepare_wire_pdu(&pdu)) == NULL || send_wire_pdu(n, wp) == -1)
+    {
+        ret = -1;
+    }
+
+    unref_wire_pdu(wp);
+    return ret;
+}
+
+
+/**
+ *  Sends the contacts of the local contactlist, whose gossip bucket is set in the
+ *  given mask (see: gossip.h), to a contact. The contacts are sent in as many
+ *  "control/discover" PDUs as needed, since the content of a PDU
+ *  must not exceed MAX_CONTENT_LEN. At least one PDU will be sent.
+ *  @param n       Index of contact to whom we send our contactlist (excluding him)
+ *  @param buckets Mask of gossip buckets to send (GOSSIP_ALL for all contacts)
+ *  @return amount of bytes that have been written as content, -1 on error
+ */
+int
+send_contact_list(int n, uint32_t buckets)
+{
+    char content[MAX_CONTENT_LEN]; // content of the current page
     char* contact_str;  // pointer to a string representation of a contact
-    int i;
-    int ret;            // return value
-    int pdu_len = 0;    // total content length of pdu-packet that will be sent
+    int len = 0;        // length of the current page
+    int total = 0;      // total length of all pages
+    int pages = 0;      // amount of pages sent
+    int str_len;        // length of a contact string
     contact_t* contact; // contact that will be converted to a string
-    // initialize PDU
-    init_dchat_pdu(&pdu, 1.0, CTT_ID_DSC, _cnf->me.onion_id, _cnf->me.lport,
-                   _cnf->me.name);
+    int i;
 
     // iterate through our contactlist
     for (i = 0; i < _cnf->cl.cl_size; i++)
     {
-        // except client n to whom we sent our contactlist
-        if (n == i)
+        // temporarily point to a contact
+        contact = CONTACT(i);
+
+        // except client n to whom we sent our contactlist, empty contact slots
+        // and temporary contacts (which have not sent "control/discover" yet)
+        if (n == i || contact->lport == 0 || (buckets != GOSSIP_ALL &&
+            !(buckets & (1u << GOSSIP_BUCKET(gossip_hash(contact->onion_id, contact->lport))))))
         {
             continue;
         }
 
-        // temporarily point to a contact
-        contact = &(_cnf->cl.contact[i]);
-
-        // if its not an empty contact slot and contact is not temporary (has not sent "control/discover" yet)
-        if (contact->lport != 0)
+        // convert contact to a string
+        if ((contact_str = contact_to_string(contact)) == NULL)
         {
-            // convert contact to a string
-            if ((contact_str = contact_to_string(contact)) == NULL)
-            {
-                ui_log(LOG_WARN, "Conversion of contact '%s' to string failed! - Skipped",
-                       contact->name);
-                continue;
-            }
+            ui_log(LOG_WARN, "Conversion of contact '%s' to string failed! - Skipped",
+                   contact->name);
+            continue;
+        }
 
-            // (re)allocate memory for pdu for contact string
-            pdu.content = realloc(pdu.content, pdu_len + strlen(contact_str) + 1);
-            pdu.content[pdu_len] = '\0'; // set the first byte to \0.. used for strcat
+        str_len = strlen(contact_str);
 
-            // could not allocate memory for content
-            if (pdu.content == NULL)
+        // page is full
+        if (len + str_len > MAX_CONTENT_LEN)
+        {
+            if (send_contact_page(n, content, len) == -1)
             {
-                ui_fatal("Memory reallocation for contactlist failed!");
+                free(contact_str);
+                ui_log(LOG_ERR, "Sending of contactlist failed!");
+                return -1;
             }
 
-            // add contact information to content
-            strncat(pdu.content, contact_str, strlen(contact_str));
-            // increase size of pdu content-length
-            pdu_len += strlen(contact_str);
-            free(contact_str);
+            pages++;
+            len = 0;
         }
-    }
-
-    // set content-length of this pdu
-    pdu.content_length = pdu_len;
 
-    // write pdu inkluding all addresses of our contacts
-    if ((ret = write_pdu(_cnf->cl.contact[n].fd, &pdu)) == -1)
-    {
-        ui_log(LOG_ERR, "Sending of contactlist failed!");
+        // add contact information to content
+        memcpy(content + len, contact_str, str_len);
+        len += str_len;
+        total += str_len;
+        free(contact_str);
     }
 
-    if (pdu.content_length != 0)
+    if ((len > 0 || !pages) && send_contact_page(n, content, len) == -1)
     {
-        free(pdu.content);
+        ui_log(LOG_ERR, "Sending of contactlist failed!");
+        return -1;
     }
 
-    return ret;
+    return total;
 }
 
 
@@ -124,63 +194,90 @@ send_contacts(int n)
  *  Parses the contact information stored in the given PDU, connects to this remote client
  *  , if this client is unknown, the local contactlist within the global config will be sent
  *  to him. Finally the remote client is added as contact to the local contactlist.
- *  For every parsed contact information, this procedure is repeated.
+ *  For every parsed contact information, this procedure is repeated. The
+ *  connection attempts are limited by the connect budget of the sending
+ *  contact (see: admit_connect()), contacts exceeding it are skipped.
+ *  @param n   Index of the contact that sent the PDU
  *  @param pdu PDU with the contact information in its content
  *  @return amount of new contacts added to the contactlist, -1 on error
  */
 int
-receive_contacts(dchat_pdu_t* pdu)
+receive_contacts(int n, dchat_pdu_t* pdu)
 {
     contact_t contact;
-    int ret = 0;            // return value
-    int new_contacts = 0;   // stores how many new contacts have been received
-    int known_contacts = 0; // stores how many known contacts have been received
-    int line_begin = 0;     // offset of content of given pdu
-    int line_end = 0;       // offset (end) of content of given pdu
-    char* line;             // contact string
-
-    // as long as the line_end index is lower than content-length
-    while (line_end < pdu->content_length)
-    {
-        line_begin = line_end;
-
-        // extract a line from the content of the pdu
-        if ((line_end = get_content_part(pdu, line_begin, '\n', &line)) == -1)
-        {
-            ui_log(LOG_ERR, "Extraction of contact line from received PDU failed!");
-            ret = -1;
-            break;
-        }
+    cs_record_t rec[CS_BATCH]; // contacts parsed from the content
+    cs_scan_t sc;              // state of the parser
+    int ret = 0;               // return value
+    int new_contacts = 0;      // stores how many new contacts have been received
+    int known_contacts = 0;    // stores how many known contacts have been received
+    int refused = 0;           // connects refused due to the connect budget
+    int cnt;                   // amount of contacts parsed by the last scan
+    int i;
 
-        // parse line ane make string to contact
-        if (string_to_contact(&contact, line) == -1)
-        {
-            ui_log(LOG_WARN, "Conversion of string to contact failed! - Skipped");
-            ret = -1;
-            continue;
-        }
+    // the content is parsed in place, batch by batch
+    init_contact_scan(&sc, pdu->content, pdu->content_length);
 
-        // if parsed contact is unknown
-        if (find_contact(&contact, 0) == -2)
+    while ((cnt = scan_contacts(&sc, rec, CS_BATCH)) > 0)
+    {
+        for (i = 0; i < cnt; i++)
         {
-            // increment new contacts counter
-            new_contacts++;
+            memcpy(contact.onion_id, rec[i].onion_id, ONION_ADDRLEN);
+            contact.onion_id[ONION_ADDRLEN] = '\0';
+            contact.lport = rec[i].lport;
 
-            // connect to new contact, add him as contact, and send contactlist to him
-            if (handle_local_conn_request(contact.onion_id, contact.lport) == -1)
+            // if parsed contact is unknown
+            if (find_contact(&contact, 0) == -2)
             {
-                ui_log(LOG_WARN, "Connection to new contact failed!");
-                ret = -1;
+                // increment new contacts counter
+                new_contacts++;
+
+                // if gossip is enabled, contacts announced by others will not be
+                // announced again and only one of both peers connects to the other
+                if (_cnf->gossip)
+                {
+                    mark_heard(&contact);
+                }
+
+                // connect to new contact, add him as contact, and send contactlist to him
+                // (in the partial mesh mode only as long as neighbours are missing)
+                if ((!_cnf->gossip || gossip_initiates(&contact)) && accepts_neighbour())
+                {
+                    if (!admit_connect(&CONTACT(n)->rl, get_time_ms()))
+                    {
+                        refused++;
+                    }
+                    else if (handle_local_conn_request(contact.onion_id, contact.lport) == -1)
+                    {
+                        ui_log(LOG_WARN, "Connection to new contact failed!");
+                        ret = -1;
+                    }
+                }
+            }
+            else
+            {
+                // we found parsed contact in contactlist -> increment known contacts counter
+                known_contacts++;
             }
         }
-        else
-        {
-            // we found parsed contact in contactlist -> increment known contacts counter
-            known_contacts++;
-        }
+    }
+
+    if (refused)
+    {
+        count_refused_connects(&CONTACT(n)->mt, refused);
+        ui_log(LOG_WARN, "Connect budget of '%s' exceeded! - Skipped %d contact(s)",
+               CONTACT(n)->name, refused);
+    }
 
-        // increment end of line index, to point to the beginning of the next line
-        line_end++;
+    if (sc.invalid)
+    {
+        ui_log(LOG_WARN, "Conversion of %d contact line(s) failed! - Skipped", sc.invalid);
+        ret = -1;
+    }
+
+    if (sc.truncated)
+    {
+        ui_log(LOG_ERR, "Extraction of contact line from received PDU failed!");
+        ret = -1;
     }
 
     return ret != -1 ? new_contacts : -1;
@@ -210,7 +307,7 @@ check_duplicates(int n)
     int accept_contact = 0;  // index of contact from whom we accepted a connection
     int ret;
     // check if given contact is in the contactlist
-    fst_oc = find_contact(&_cnf->cl.contact[n], 0);
+    fst_oc = find_contact(CONTACT(n), 0);
 
     // contact is this client
     if (fst_oc == -1)
@@ -224,7 +321,7 @@ check_duplicates(int n)
     }
 
     // check if given contact is in the contactlist a second time
-    sec_oc = find_contact(&_cnf->cl.contact[n], fst_oc + 1);
+    sec_oc = find_contact(CONTACT(n), fst_oc + 1);
 
     if (sec_oc == -2)
     {
@@ -232,7 +329,7 @@ check_duplicates(int n)
     }
 
     // extract port of sockaddr_storage structure
-    temp = &_cnf->cl.contact[fst_oc];
+    temp = CONTACT(fst_oc);
 
     // which kind of contact has to be deleted?
     if (temp->accepted)
@@ -249,7 +346,7 @@ check_duplicates(int n)
     // if local onion address is greater than the remote one
     // than the index of the  contact, who got added because of a "connect",
     // will be returned
-    ret = strcmp(_cnf->me.onion_id, _cnf->cl.contact[n].onion_id);
+    ret = strcmp(_cnf->me.onion_id, CONTACT(n)->onion_id);
 
     if (ret > 0)
     {
@@ -261,11 +358,11 @@ check_duplicates(int n)
         return accept_contact;
     }
     // if ip addresses are equal, do the same for the listening port
-    else if (_cnf->me.lport > _cnf->cl.contact[n].lport)
+    else if (_cnf->me.lport > CONTACT(n)->lport)
     {
         return connect_contact;
     }
-    else if (_cnf->me.lport < _cnf->cl.contact[n].lport)
+    else if (_cnf->me.lport < CONTACT(n)->lport)
     {
         return accept_contact;
     }
@@ -381,54 +478,47 @@ string_to_contact(contact_t* contact, char* string)
 
 
 /**
- *  Resizes the contactlist.
- *  Function to resize the contactlist to a given size. Old contacts are copied to the new
- *  resized contact list if they fit in it
- *  @param newsize New size of the contactlist
+ *  Grows the contactlist by one slab of CL_SLAB_SIZE contacts.
+ *  Contacts are stored in slabs that are never moved, thus the index of a
+ *  contact stays valid as long as the contact exists. Only the array of
+ *  slab pointers is reallocated. The slots of the new slab are added to the
+ *  free list, lowest index first.
  *  @return 0 on success, -1 on error
  */
 int
-realloc_contactlist(int newsize)
+grow_contactlist()
 {
-    int i, j = 0;
-    contact_t* new_contact_list;
-    contact_t* old_contact_list;
+    contact_t** slab;
+    int i;
 
-    // size may not be lower than 1 and not be lower than the amount of contacts actually used
-    if (newsize < 1 || newsize < _cnf->cl.used_contacts)
+    if (_cnf->cl.cl_size + CL_SLAB_SIZE > CL_MAX_CONTACTS)
     {
-        ui_log(LOG_ERR,
-               "New size of contactlist must not be lower than 1 or the amount of contacts actually stored in the contactlist!");
+        ui_log(LOG_ERR, "Contactlist must not store more than %d contacts!", CL_MAX_CONTACTS);
         return -1;
     }
 
-    // pointer to beginning of old contactlist
-    old_contact_list = &(_cnf->cl.contact[0]);
-
-    // reserve memory for new contactlist
-    if ((new_contact_list = malloc(newsize * sizeof(contact_t))) == NULL)
+    if ((slab = realloc(_cnf->cl.slab, (_cnf->cl.slabs + 1) * sizeof(contact_t*))) == NULL)
     {
         ui_fatal("Reallocation of contactlist failed!");
     }
 
-    // zero out new contactlist
-    memset(new_contact_list, 0, newsize * sizeof(contact_t));
+    _cnf->cl.slab = slab;
 
-    // copy contacts to new contactlist
-    for (i = 0; i < _cnf->cl.cl_size; i++)
+    if ((slab[_cnf->cl.slabs] = calloc(CL_SLAB_SIZE, sizeof(contact_t))) == NULL)
     {
-        if (old_contact_list[i].fd)
-        {
-            memcpy(new_contact_list + j, old_contact_list + i, sizeof(contact_t));
-            j++;
-        }
+        ui_fatal("Allocation of contact slab failed!");
+    }
+
+    _cnf->cl.slabs++;
+    _cnf->cl.cl_size += CL_SLAB_SIZE;
+
+    // push new slots to the free list
+    for (i = _cnf->cl.cl_size - 1; i >= _cnf->cl.cl_size - CL_SLAB_SIZE; i--)
+    {
+        CONTACT(i)->next_free = _cnf->cl.free_head;
+        _cnf->cl.free_head = i;
     }
 
-    // set new size and point to new contactlist in the global config
-    _cnf->cl.cl_size = newsize;
-    _cnf->cl.contact = new_contact_list;
-    // free old contactlist
-    free(old_contact_list);
     return 0;
 }
 
@@ -436,35 +526,83 @@ realloc_contactlist(int newsize)
 /**
  *  Adds a new contact to the local contactlist.
  *  The given socket descriptor of the remote client will be used to add a new contact
- *  to the contactlist holded by the global config.
- *  @param fd  Socket file descriptor of the new contact
+ *  to the contactlist holded by the global config. The slot of the contact is
+ *  taken from the free list of the contactlist.
+ *  @param fd    Socket file descriptor of the new contact
+ *  @param socks Stream isolation of the SOCKS5 request, whose reply precedes
+ *               the first PDU (see: expect_socks5_reply()), 0 for none
  *  @return index of contact list, where new contact has been added or -1 in case
  *          of error
  */
 int
-add_contact(int fd)
+add_contact(int fd, int socks)
 {
+    contact_t* contact;
+    uint32_t gen;
     int i;
 
-    // if contactlist is full - resize it so that we can store more contacts in it
-    if (_cnf->cl.used_contacts == _cnf->cl.cl_size)
+    // if contactlist is full - add a slab so that we can store more contacts in it
+    if (_cnf->cl.free_head == -1 && grow_contactlist() == -1)
     {
-        if ((realloc_contactlist(_cnf->cl.cl_size + INIT_CONTACTS)) < 0)
-        {
-            return -1;
-        }
+        return -1;
     }
 
-    // search for an empty place to store the new contact
-    for (i = 0; i < _cnf->cl.cl_size; i++)
+    i = _cnf->cl.free_head;
+    contact = CONTACT(i);
+
+    // register socket of contact in the event loop (fd 0 is used
+    // for fake contacts, see: roni_parse()), reactors must never
+    // block on the socket (see: add_reactor_contact())
+    if (fd > 0 && (_cnf->reactors ? set_nonblocking(fd, 1) :
+                   ev_add(&_cnf->ev, fd, EV_READ | EV_RECV, CONTACT_EV_ID(i))) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Registration of contact in event loop failed!");
+        return -1;
+    }
+
+    // pop slot from free list, the generation identifies this
+    // use of the slot (see: get_contact_handle())
+    _cnf->cl.free_head = contact->next_free;
+    gen = contact->gen;
+    memset(contact, 0, sizeof(*contact));
+    contact->gen = gen;
+    contact->used = 1;
+
+    // every connected contact buffers its received PDUs
+    if (fd > 0)
     {
-        // if fd is 0 -> this place can be used to store a new contact
-        if (!_cnf->cl.contact[i].fd)
+        if ((contact->reader = malloc(sizeof(pdu_reader_t))) == NULL)
         {
-            _cnf->cl.contact[i].fd = fd;
-            _cnf->cl.used_contacts++; // increase contact counter
-            break;
+            ui_fatal("Memory allocation for PDU reader failed!");
+        }
+
+        init_pdu_reader(contact->reader);
+
+        // the reply has to be skipped, before a reactor reads the socket
+        if (socks)
+        {
+            expect_socks5_reply(contact->reader, socks);
+        }
+
+        if ((contact->sq = malloc(sizeof(send_queue_t))) == NULL)
+        {
+            ui_fatal("Memory allocation for outbound queue failed!");
         }
+
+        init_send_queue(contact->sq);
+        contact->sq->mt = &contact->mt;
+        // detect dead contacts (see: kpal_parse())
+        start_keepalive(i);
+    }
+
+    contact->fd = fd;
+    _cnf->cl.used_contacts++; // increase contact counter
+    touch_cl_snapshot();
+
+    // hand over the socket to a reactor
+    if (fd > 0 && _cnf->reactors)
+    {
+        add_reactor_contact(i);
     }
 
     // return index where contact has been stored
@@ -475,12 +613,21 @@ add_contact(int fd)
 /**
  *  Deletes a contact from the local contactlist.
  *  Deletes a contact from the contact list holded by the global config.
- *  @param n   Index of customer in the customer list
+ *  Its slot is returned to the free list and its generation is incremented,
+ *  so that handles of this contact become invalid. Only peers whose
+ *  connection has been lost (DEL_CLOSED, DEL_EVICTED) are reconnected,
+ *  peers that have been dropped would be dropped again after every
+ *  reconnection.
+ *  @param n      Index of customer in the customer list
+ *  @param reason Reason of the removal (see: DEL_*)
  *  @return 0 on success, -1 if index is out of bounds
  */
 int
-del_contact(int n)
+del_contact(int n, int reason)
 {
+    contact_t* contact;
+    uint32_t gen;
+
     // is index 'n' a valid index?
     if ((n < 0) || (n >= _cnf->cl.cl_size))
     {
@@ -488,31 +635,131 @@ del_contact(int n)
         return -1;
     }
 
-    if (_cnf->cl.contact[n].fd == 0)
+    contact = CONTACT(n);
+
+    if (!contact->used)
     {
         return 0;
     }
 
-    close(_cnf->cl.contact[n].fd);
-    // zero out the contact on index 'n'
-    memset(&_cnf->cl.contact[n], 0, sizeof(contact_t));
-    // decrease contacts counter variable
-    _cnf->cl.used_contacts--;
-
-    // if contacts counter has been decreased INIT_CONTACTS time, resize the contactlist to free
-    // unused memory
-    if ((_cnf->cl.used_contacts == (_cnf->cl.cl_size - INIT_CONTACTS)) &&
-        _cnf->cl.used_contacts != 0)
+    // fake contacts are used to store command line arguments
+    // (see: roni_parse()) and have neither socket nor buffers
+    if (contact->fd > 0)
     {
-        if ((realloc_contactlist(_cnf->cl.cl_size - INIT_CONTACTS)) < 0)
+        cancel_timer(&contact->keepalive);
+        remove_contact_index(&_cnf->cl.index, n);
+
+        // the reactor closes the socket and releases its buffers
+        if (contact->rt != NULL)
         {
-            return -1;
+            del_reactor_contact(n);
+        }
+        else
+        {
+            // unregister socket before it is closed
+            ev_del(&_cnf->ev, contact->fd);
+            close(contact->fd);
+            // free partially received PDUs
+            free_pdu_reader(contact->reader);
+            free(contact->reader);
+            // release queued PDUs
+            free_send_queue(contact->sq);
+            free(contact->sq);
+        }
+
+        // close files sent to or received from the contact
+        free_transfers(contact);
+
+        // a congested contact, whose socket has been shut down, is
+        // dropped even though the socket is closed then
+        reason = contact->dropped ? DEL_DROPPED : reason;
+
+        // remember when the peer has been connected last and reconnect
+        // to it, if the connection has been lost
+        if (contact->lport)
+        {
+            note_peer_seen(contact->onion_id, contact->lport);
+
+            if (reason == DEL_CLOSED || reason == DEL_EVICTED)
+            {
+                schedule_reconnect(contact->onion_id, contact->lport);
+            }
+        }
+
+        // a contact that reconnects has to be announced again
+        if (_cnf->gossip && contact->lport != 0)
+        {
+            forget_heard(contact);
         }
     }
 
+    // zero out the contact on index 'n' and return it to the free list
+    gen = contact->gen + 1;
+    memset(contact, 0, sizeof(*contact));
+    contact->gen = gen;
+    contact->next_free = _cnf->cl.free_head;
+    _cnf->cl.free_head = n;
+    // decrease contacts counter variable
+    _cnf->cl.used_contacts--;
+    touch_cl_snapshot();
     return 0;
 }
 
+
+/**
+ *  Returns a handle of a contact, which identifies the contact
+ *  even if its slot has been reused in the meantime.
+ *  @param n Index of the contact in the contactlist
+ *  @return handle of the contact
+ */
+contact_handle_t
+get_contact_handle(int n)
+{
+    return CONTACT_HANDLE(n, CONTACT(n)->gen);
+}
+
+
+/**
+ *  Resolves a handle of a contact (see: get_contact_handle()).
+ *  @param h Handle of the contact
+ *  @return index of the contact or -1 if the contact has been deleted
+ */
+int
+resolve_contact_handle(contact_handle_t h)
+{
+    int n = CONTACT_HANDLE_INDEX(h);
+
+    if (n < 0 || n >= _cnf->cl.cl_size || !CONTACT(n)->used ||
+        CONTACT(n)->gen != CONTACT_HANDLE_GEN(h))
+    {
+        return -1;
+    }
+
+    return n;
+}
+
+
+/**
+ *  Sets the onion address and listening port of a contact and updates
+ *  the index of the contactlist accordingly.
+ *  @param n        Index of the contact in the contactlist
+ *  @param onion_id Onion address of the contact
+ *  @param lport    Listening port of the contact
+ */
+void
+set_contact_address(int n, char* onion_id, uint16_t lport)
+{
+    contact_t* contact = CONTACT(n);
+
+    remove_contact_index(&_cnf->cl.index, n);
+    contact->onion_id[0] = '\0';
+    strncat(contact->onion_id, onion_id, ONION_ADDRLEN);
+    contact->lport = lport;
+    insert_contact_index(&_cnf->cl.index, n);
+    touch_cl_snapshot();
+}
+
+
 /**
  *  Searches a contact in the local contactlist.
  *  Searches for a contact in the contactlist holded within the global config
@@ -525,39 +772,240 @@ del_contact(int n)
 int
 find_contact(contact_t* contact, int begin)
 {
-    int i;
-    contact_t* c;
-
     // is begin a valid index?
     if (begin < 0 || begin >= _cnf->cl.cl_size)
     {
         return -2;
     }
 
-    // iterate through contactlist, but first check
-    // if the contact represents ourself
-    for (i = -1; i < _cnf->cl.cl_size; i++)
+    // first check if the given contact matches ourself
+    if (contact->lport == _cnf->me.lport &&
+        !strcmp(contact->onion_id, _cnf->me.onion_id))
+    {
+        return -1;
+    }
+
+    return lookup_contact_index(&_cnf->cl.index, contact->onion_id,
+                                contact->lport, begin);
+}
+
+
+/**
+ *  Prepares a PDU for all contacts it will be sent to (see: prepare_pdu()).
+ *  If DChat V2 frames are negotiated (see: bnry_parse()), the PDU is also
+ *  prepared as frame. If compression is negotiated (see: zlib_parse()) and
+ *  the content exceeds ZL_THRESHOLD bytes, the PDU (and its frame) is also
+ *  prepared with compressed content. PDUs identifying the local client
+ *  advertise both by their "Accept-Version" and "Accept-Encoding" headers.
+ *  @param pdu PDU to prepare
+ *  @return Pointer to the prepared PDU or NULL in case of error
+ */
+wire_pdu_t*
+prepare_wire_pdu(dchat_pdu_t* pdu)
+{
+    char content[MAX_CONTENT_LEN];
+    dchat_pdu_t deflated;
+    wire_pdu_t* wp;
+    int len;
+
+    if (pdu->content_type == CTT_ID_DSC || pdu->content_type == CTT_ID_DGT)
+    {
+        pdu->accept_version = _cnf->binary ? DCHAT_V2 : 0;
+        pdu->accept_encoding = _cnf->compress ? ENC_ID_DEFLATE : 0;
+    }
+
+    if ((wp = prepare_pdu(pdu)) == NULL)
     {
-        // first check if the given contact matches ourself
-        if (i == -1)
+        return NULL;
+    }
+
+    if (_cnf->binary && (wp->v2 = prepare_frame(pdu)) == NULL)
+    {
+        unref_wire_pdu(wp);
+        return NULL;
+    }
+
+    if (_cnf->compress && pdu->content_length >= ZL_THRESHOLD &&
+        (len = deflate_content(pdu, content, sizeof(content))) != -1)
+    {
+        memcpy(&deflated, pdu, sizeof(deflated));
+        deflated.content = content;
+        deflated.content_length = len;
+        deflated.encoding = ENC_ID_DEFLATE;
+
+        if ((wp->deflated = prepare_pdu(&deflated)) == NULL ||
+            (wp->v2 != NULL && (wp->v2->deflated = prepare_frame(&deflated)) == NULL))
         {
-            c = &_cnf->me;
-            i = begin - 1;
+            unref_wire_pdu(wp);
+            return NULL;
         }
-        else
+    }
+
+    return wp;
+}
+
+
+/**
+ *  Queues a prepared PDU for a contact.
+ *  The PDU will be written as soon as the socket of the contact becomes
+ *  writable. If the outbound queue of the contact is congested, the policy
+ *  configured in the global config is applied. If the policy demands to
+ *  disconnect the contact, its socket will be shut down, so that it will be
+ *  removed by the main loop.
+ *  @param n  Index of the contact in the contactlist
+ *  @param wp Prepared PDU, a reference will be acquired
+ *  @return 0 on success, -1 if the PDU could not be queued
+ */
+int
+send_wire_pdu(int n, wire_pdu_t* wp)
+{
+    contact_t* contact = CONTACT(n);
+    wire_pdu_t* session;
+    int empty;
+    int ret = 0;
+
+    // fake contacts can not be written to
+    if (contact->fd <= 0)
+    {
+        return -1;
+    }
+
+    capture_wire_pdu(n, wp);
+
+    // contacts accepting DChat V2 are sent frames, which are preceded by
+    // the identity of the local client whenever it has not been sent yet
+    if (contact->v2 && wp->v2 != NULL)
+    {
+        session = update_session(&contact->tx);
+        wp = wp->v2;
+    }
+    else
+    {
+        session = NULL;
+    }
+
+    if (contact->deflate && wp->deflated != NULL)
+    {
+        wp = wp->deflated;
+    }
+
+    // the reactor owning the socket queues the PDUs
+    if (contact->rt != NULL)
+    {
+        if (session != NULL)
         {
-            c = &_cnf->cl.contact[i];
+            send_reactor_pdu(n, session);
+            unref_wire_pdu(session);
         }
 
-        // dont check empty contacts or temporary contacts
-        if (c->lport)
+        send_reactor_pdu(n, wp);
+        return 0;
+    }
+
+    empty = contact->sq->head == NULL;
+
+    if (session != NULL)
+    {
+        ret = push_send_queue(contact->sq, session, _cnf->sq_policy);
+        unref_wire_pdu(session);
+    }
+
+    if (ret == -1 || push_send_queue(contact->sq, wp, _cnf->sq_policy) == -1)
+    {
+        ui_log(LOG_WARN, "Disconnecting congested contact '%s'!", contact->name);
+        contact->dropped = 1;
+        shutdown(contact->fd, SHUT_RDWR);
+        return -1;
+    }
+
+    // wait until the socket becomes writable
+    if (empty && ev_mod(&_cnf->ev, contact->fd, contact_events(contact),
+                        CONTACT_EV_ID(n)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Updating event of contact '%d' failed!", n);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Writes queued PDUs of a contact to its socket without blocking.
+ *  Once the outbound queue has been drained, up to FT_CHUNKS_PER_FLUSH
+ *  chunks of files requested by the contact are written. If nothing is
+ *  left to be written, the contact will no longer be watched for
+ *  writability.
+ *  @param n  Index of the contact in the contactlist
+ *  @return amount of bytes written or -1 in case of error
+ */
+int
+flush_contact(int n)
+{
+    contact_t* contact = CONTACT(n);
+    int chunks = 0;
+    int len = 0;
+    int ret = 0;
+
+    for (;;)
+    {
+        // chunks of files are queued one at a time, once all other pdus
+        // have been written (see: queue_file_chunk())
+        if (contact->sq->head == NULL &&
+            (chunks++ == FT_CHUNKS_PER_FLUSH || (ret = queue_file_chunk(n)) != 1))
         {
-            if (strcmp(contact_to_string(contact), contact_to_string(c)) == 0)
-            {
-                return i;
-            }
+            break;
+        }
+
+        if ((ret = flush_send_queue(contact->fd, contact->sq)) == -1)
+        {
+            ui_log_errno(LOG_ERR, "Writing to '%s' failed!", contact->name);
+            return -1;
         }
+
+        len += ret;
+
+        // the socket is not writable anymore
+        if (!ret || contact->ft == NULL)
+        {
+            break;
+        }
+    }
+
+    if (ret == -1)
+    {
+        return -1;
+    }
+
+    if (contact->sq->head == NULL &&
+        ev_mod(&_cnf->ev, contact->fd, contact_events(contact),
+               CONTACT_EV_ID(n)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Updating event of contact '%d' failed!", n);
+        return -1;
+    }
+
+    return len;
+}
+
+
+/**
+ *  Returns the events a contact is waiting for in the event loop.
+ *  @param contact Pointer to the contact
+ *  @return EV_READ unless the contact is throttled, combined with EV_WRITE
+ *  if PDUs or chunks of files are waiting to be written, always combined
+ *  with EV_RECV (see: fill_pdu_reader())
+ */
+int
+contact_events(contact_t* contact)
+{
+    // throttled contacts are not read (see: throttle_contact())
+    int events = (contact->rl.throttled ? 0 : EV_READ) | EV_RECV;
+
+    if (contact->sq != NULL && (contact->sq->head != NULL || has_file_chunks(contact)))
+    {
+        return events | EV_WRITE;
     }
 
-    return -2; // not found
+    return events;
 }
@@ -0,0 +1,268 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file contactindex.c
+ *  This file contains the hash index of the contactlist, which is used to
+ *  find contacts by their onion address and listening port.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dchat_h/contactindex.h"
+#include "dchat_h/types.h"
+#include "dchat_h/consoleui.h"
+
+
+/**
+ *  Initializes an empty contact index.
+ *  @param ci Pointer to the contact index
+ */
+void
+init_contact_index(contact_index_t* ci)
+{
+    memset(ci, 0, sizeof(*ci));
+}
+
+
+/**
+ *  Computes the hash of an onion address and a listening port (FNV-1a).
+ *  @param onion_id Onion address
+ *  @param lport    Listening port
+ *  @return hash value
+ */
+unsigned int
+hash_contact(char* onion_id, uint16_t lport)
+{
+    unsigned int h = 2166136261u;
+
+    for (; *onion_id != '\0'; onion_id++)
+    {
+        h = (h ^ (unsigned char) *onion_id) * 16777619u;
+    }
+
+    h = (h ^ (lport & 0xFF)) * 16777619u;
+    h = (h ^ (lport >> 8)) * 16777619u;
+    return h;
+}
+
+
+/**
+ *  Checks if a contact of the contactlist should be stored in the index.
+ *  Empty contacts, fake contacts and contacts whose listening port is
+ *  not known yet are not indexed.
+ *  @param n Index of the contact in the contactlist
+ *  @return 1 if the contact is indexable, 0 otherwise
+ */
+int
+is_indexable(int n)
+{
+    contact_t* c = CONTACT(n);
+
+    return c->fd > 0 && c->lport != 0;
+}
+
+
+/**
+ *  Stores an index of the contactlist in the buckets without checking
+ *  the load of the index.
+ *  @param ci Pointer to the contact index
+ *  @param n  Index of the contact in the contactlist
+ */
+void
+place_contact_index(contact_index_t* ci, int n)
+{
+    contact_t* c = CONTACT(n);
+    unsigned int mask = ci->size - 1;
+    unsigned int i = hash_contact(c->onion_id, c->lport) & mask;
+
+    while (ci->bucket[i] >= 0)
+    {
+        i = (i + 1) & mask;
+    }
+
+    if (ci->bucket[i] == CI_DELETED)
+    {
+        ci->deleted--;
+    }
+
+    ci->bucket[i] = n;
+    ci->used++;
+}
+
+
+/**
+ *  Rebuilds a contact index from the contactlist of the global config.
+ *  The amount of buckets is chosen so that at most half of them are used.
+ *  This function is called whenever the index has too few empty buckets.
+ *  @param ci Pointer to the contact index
+ */
+void
+rebuild_contact_index(contact_index_t* ci)
+{
+    int size = CI_INIT_SIZE;
+    int i;
+
+    while (size < 2 * (_cnf->cl.used_contacts + 1))
+    {
+        size <<= 1;
+    }
+
+    if (size != ci->size)
+    {
+        free(ci->bucket);
+
+        if ((ci->bucket = malloc(size * sizeof(int))) == NULL)
+        {
+            ui_fatal("Memory allocation for contact index failed!");
+        }
+
+        ci->size = size;
+    }
+
+    for (i = 0; i < ci->size; i++)
+    {
+        ci->bucket[i] = CI_EMPTY;
+    }
+
+    ci->used = 0;
+    ci->deleted = 0;
+
+    for (i = 0; i < _cnf->cl.cl_size; i++)
+    {
+        if (is_indexable(i))
+        {
+            place_contact_index(ci, i);
+        }
+    }
+}
+
+
+/**
+ *  Adds a contact of the contactlist to the index. Its onion address
+ *  and listening port are used as key. Nothing will be done, if the
+ *  contact is not indexable (see: is_indexable()).
+ *  @param ci Pointer to the contact index
+ *  @param n  Index of the contact in the contactlist
+ */
+void
+insert_contact_index(contact_index_t* ci, int n)
+{
+    if (!is_indexable(n))
+    {
+        return;
+    }
+
+    // keep the load (including deleted buckets) below 1/2
+    if (2 * (ci->used + ci->deleted + 1) > ci->size)
+    {
+        rebuild_contact_index(ci);
+
+        // the contact may already have been indexed by the rebuild
+        if (lookup_contact_index(ci, CONTACT(n)->onion_id,
+                                 CONTACT(n)->lport, n) == n)
+        {
+            return;
+        }
+    }
+
+    place_contact_index(ci, n);
+}
+
+
+/**
+ *  Removes a contact of the contactlist from the index. It has to be
+ *  called before the onion address or the listening port of the contact
+ *  are changed.
+ *  @param ci Pointer to the contact index
+ *  @param n  Index of the contact in the contactlist
+ */
+void
+remove_contact_index(contact_index_t* ci, int n)
+{
+    contact_t* c = CONTACT(n);
+    unsigned int mask = ci->size - 1;
+    unsigned int i;
+
+    if (!ci->size || !is_indexable(n))
+    {
+        return;
+    }
+
+    for (i = hash_contact(c->onion_id, c->lport) & mask;
+         ci->bucket[i] != CI_EMPTY; i = (i + 1) & mask)
+    {
+        if (ci->bucket[i] == n)
+        {
+            ci->bucket[i] = CI_DELETED;
+            ci->used--;
+            ci->deleted++;
+            return;
+        }
+    }
+}
+
+
+/**
+ *  Searches the index for a contact with the given onion address and
+ *  listening port.
+ *  @param ci       Pointer to the contact index
+ *  @param onion_id Onion address of the contact
+ *  @param lport    Listening port of the contact
+ *  @param begin    Lowest index of the contactlist that may be returned
+ *  @return lowest index of a matching contact, which is not lower than
+ *  begin, or -2 if there is no such contact
+ */
+int
+lookup_contact_index(contact_index_t* ci, char* onion_id, uint16_t lport, int begin)
+{
+    unsigned int mask = ci->size - 1;
+    unsigned int i;
+    int found = -2;
+    int n;
+    contact_t* c;
+
+    if (!ci->size)
+    {
+        return -2;
+    }
+
+    for (i = hash_contact(onion_id, lport) & mask;
+         ci->bucket[i] != CI_EMPTY; i = (i + 1) & mask)
+    {
+        if ((n = ci->bucket[i]) < begin || (found >= 0 && n > found))
+        {
+            continue;
+        }
+
+        c = CONTACT(n);
+
+        if (c->lport == lport && !strcmp(c->onion_id, onion_id))
+        {
+            found = n;
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,253 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file contactscan.c
+ *  This file contains the parser of contact lists (see: receive_contacts()).
+ *  A contact list consists of lines in the form of "<onion-id> <port>\n",
+ *  which are split and validated in place without copying or allocating
+ *  memory. Newlines are searched and onion-ids are checked 16 or 32 bytes
+ *  at once with SSE2, AVX2 or NEON, depending on the instruction sets the
+ *  compiler targets. Other targets use the scalar fallback.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "dchat_h/contactscan.h"
+#include "dchat_h/network.h"
+
+
+/**
+ *  Searches the next newline within a buffer.
+ *  @param p   Pointer to the first byte to search
+ *  @param end End of the buffer
+ *  @return pointer to the newline, NULL if there is none
+ */
+const char*
+find_newline(const char* p, const char* end)
+{
+#if defined(__AVX2__)
+    const __m256i nl = _mm256_set1_epi8('\n');
+    unsigned int m;
+
+    for (; end - p >= 32; p += 32)
+    {
+        m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) p), nl));
+
+        if (m)
+        {
+            return p + __builtin_ctz(m);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    unsigned int m;
+
+    for (; end - p >= 16; p += 16)
+    {
+        m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p), nl));
+
+        if (m)
+        {
+            return p + __builtin_ctz(m);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t nl = vdupq_n_u8('\n');
+    uint8x16_t eq;
+    uint64_t m;
+
+    for (; end - p >= 16; p += 16)
+    {
+        eq = vceqq_u8(vld1q_u8((const uint8_t*) p), nl);
+        // narrow the mask to 4 bits per byte, since NEON has no movemask
+        m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+
+        if (m)
+        {
+            return p + (__builtin_ctzll(m) >> 2);
+        }
+    }
+#endif
+
+    for (; p < end; p++)
+    {
+        if (*p == '\n')
+        {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ *  Checks the onion-id at the beginning of a line, with the same rules
+ *  as is_valid_onion(): CS_ONION_LEN characters not containing a dot,
+ *  followed by the ".onion" suffix. The line must hold at least
+ *  ONION_ADDRLEN bytes.
+ *  @param p Pointer to the onion-id
+ *  @return 1 if the onion-id is valid, 0 otherwise
+ */
+static int
+check_onion(const char* p)
+{
+#if defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i*) p);
+    __m128i bad = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')),
+                                            _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))),
+                               _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+
+    if (_mm_movemask_epi8(bad))
+    {
+        return 0;
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t v = vld1q_u8((const uint8_t*) p);
+    uint8x16_t bad = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('.')), vceqq_u8(v, vdupq_n_u8(' '))),
+                              vceqq_u8(v, vdupq_n_u8(0)));
+
+    if (vget_lane_u64(vreinterpret_u64_u8(vorr_u8(vget_low_u8(bad), vget_high_u8(bad))), 0))
+    {
+        return 0;
+    }
+#else
+    int i;
+
+    for (i = 0; i < CS_ONION_LEN; i++)
+    {
+        if (p[i] == '.' || p[i] == ' ' || p[i] == '\0')
+        {
+            return 0;
+        }
+    }
+#endif
+
+    return !memcmp(p + CS_ONION_LEN, CS_SUFFIX, ONION_ADDRLEN - CS_ONION_LEN);
+}
+
+
+/**
+ *  Parses a single line of a contact list.
+ *  @param p   Pointer to the beginning of the line
+ *  @param len Length of the line without the newline
+ *  @param rec Record where the contact will be stored
+ *  @return 0 on success, -1 if the line is malformed
+ */
+static int
+parse_line(const char* p, int len, cs_record_t* rec)
+{
+    int port = 0;
+    int i;
+
+    if (len < CS_MIN_LINE - 1 || len > ONION_ADDRLEN + 1 + CS_MAX_PORT ||
+        p[ONION_ADDRLEN] != ' ' || !check_onion(p))
+    {
+        return -1;
+    }
+
+    for (i = ONION_ADDRLEN + 1; i < len; i++)
+    {
+        if (p[i] < '0' || p[i] > '9')
+        {
+            return -1;
+        }
+
+        port = port * 10 + (p[i] - '0');
+    }
+
+    if (!is_valid_port(port))
+    {
+        return -1;
+    }
+
+    rec->onion_id = p;
+    rec->lport = port;
+    return 0;
+}
+
+
+/**
+ *  Starts scanning a contact list.
+ *  @param sc  State of the scan
+ *  @param buf Contact list
+ *  @param len Length of the contact list
+ */
+void
+init_contact_scan(cs_scan_t* sc, const char* buf, int len)
+{
+    sc->pos = buf;
+    sc->end = buf + len;
+    sc->invalid = 0;
+    sc->truncated = 0;
+}
+
+
+/**
+ *  Parses the next contacts of a contact list. Malformed lines are
+ *  skipped and counted. A last line, which is not terminated by a
+ *  newline, ends the scan.
+ *  @param sc  State of the scan
+ *  @param rec Array where the parsed contacts will be stored
+ *  @param max Size of the array
+ *  @return amount of parsed contacts, 0 if the whole list has been scanned
+ */
+int
+scan_contacts(cs_scan_t* sc, cs_record_t* rec, int max)
+{
+    const char* nl;
+    int cnt = 0;
+
+    while (cnt < max && sc->pos < sc->end)
+    {
+        if ((nl = find_newline(sc->pos, sc->end)) == NULL)
+        {
+            sc->truncated = 1;
+            sc->pos = sc->end;
+            break;
+        }
+
+        if (parse_line(sc->pos, nl - sc->pos, &rec[cnt]) == 0)
+        {
+            cnt++;
+        }
+        else
+        {
+            sc->invalid++;
+        }
+
+        sc->pos = nl + 1;
+    }
+
+    return cnt;
+}
@@ -46,7 +46,6 @@
 #include <errno.h>
 #include <netinet/in.h>
 #include <pthread.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <signal.h>
 #include <unistd.h>
@@ -60,6 +59,20 @@
 #include "dchat_h/network.h"
 #include "dchat_h/util.h"
 #include "dchat_h/option.h"
+#include "dchat_h/event.h"
+#include "dchat_h/sendqueue.h"
+#include "dchat_h/connector.h"
+#include "dchat_h/gossip.h"
+#include "dchat_h/relay.h"
+#include "dchat_h/transfer.h"
+#include "dchat_h/reactor.h"
+#include "dchat_h/snapshot.h"
+#include "dchat_h/history.h"
+#include "dchat_h/peercache.h"
+#include "dchat_h/timer.h"
+#include "dchat_h/keepalive.h"
+#include "dchat_h/metrics.h"
+#include "dchat_h/capture.h"
 
 
 #include "dchat_h/consoleui.h"
@@ -196,8 +209,20 @@ main(int argc, char** argv)
 
     if (_cnf->cl.used_contacts == 1)
     {
-        remote_onion = _cnf->cl.contact[0].onion_id;
-        rport = _cnf->cl.contact[0].lport;
+        remote_onion = CONTACT(0)->onion_id;
+        rport = CONTACT(0)->lport;
+    }
+
+    // trace of the pdus sent and received (see: capt_parse())
+    if (_cnf->capture_file != NULL && init_capture(_cnf->capture_file) == -1)
+    {
+        ui_fatal("Initialization of capture failed!");
+    }
+
+    // peers of the last session (see: peer_parse())
+    if (_cnf->peer_file != NULL && load_peer_cache(_cnf->peer_file) == -1)
+    {
+        ui_fatal("Initialization of peer cache failed!");
     }
 
     // init threads (connection thread, userinput thread, ...)
@@ -212,9 +237,9 @@ main(int argc, char** argv)
     if (_cnf->cl.used_contacts == 1)
     {
         // use default if onion-id has not been specified
-        if (is_valid_onion(_cnf->cl.contact[0].onion_id))
+        if (is_valid_onion(CONTACT(0)->onion_id))
         {
-            remote_onion = _cnf->cl.contact[0].onion_id;
+            remote_onion = CONTACT(0)->onion_id;
         }
         else
         {
@@ -222,25 +247,28 @@ main(int argc, char** argv)
         }
 
         // use default if remote port has not been specified
-        if (is_valid_port(_cnf->cl.contact[0].lport))
+        if (is_valid_port(CONTACT(0)->lport))
         {
-            rport = _cnf->cl.contact[0].lport;
+            rport = CONTACT(0)->lport;
         }
         else
         {
             rport = DEFAULT_PORT;
         }
 
-        // delete fake contact
-        del_contact(0);
         // inform connection handler to connect to the specified
         // remote host
-        if(write(_cnf->connect_fd[1], remote_onion, ONION_ADDRLEN) == -1){
-             ui_log_errno(LOG_WARN, "Remote onion id could not be written");
-	}
-        if(write(_cnf->connect_fd[1], &rport,       sizeof(uint16_t)) == -1){
-             ui_log_errno(LOG_WARN, "Remote port could not be written");
-	}
+        request_connect(remote_onion, rport);
+        // delete fake contact, after its onion id has been copied
+        del_contact(0, DEL_LOCAL);
+    }
+
+    // connect to the best ranked peers of the last session in parallel
+    // (in the partial mesh mode only to as many as neighbours are allowed)
+    if (_cnf->peer_file != NULL)
+    {
+        prime_peer_cache(_cnf->neighbours && _cnf->neighbours < PC_PRIME ?
+                         _cnf->neighbours : PC_PRIME);
     }
 
     if (init_ui() == -1)
@@ -267,6 +295,18 @@ init_global_config()
     memset(_cnf, 0, sizeof(*_cnf));
     _cnf->cl.cl_size       = 0;    // set initial size of contactlist
     _cnf->cl.used_contacts = 0;    // no known contacts, at start
+    _cnf->cl.free_head     = -1;   // no free slots, at start
+    init_contact_index(&_cnf->cl.index); // empty index of contacts
+    _cnf->sq_policy = SQ_POLICY_DROP; // drop oldest pdus of slow contacts
+    // connect to remote hosts via the default SOCKS port of TOR
+    _cnf->tor.sin_family = AF_INET;
+    _cnf->tor.sin_port = htons(TOR_PORT);
+
+    if (inet_pton(AF_INET, TOR_ADDR, &_cnf->tor.sin_addr) != 1)
+    {
+        return -1;
+    }
+
     return 0;
 }
 
@@ -356,6 +396,7 @@ init_threads()
 {
     struct sigaction sa_terminate; // signal action for program termination
     sigset_t sigmask;
+    int fds[3];                    // long-lived files of the main loop
     sigemptyset(&sigmask);
     sigaddset(&sigmask, SIGHUP);
     sigaddset(&sigmask, SIGQUIT);
@@ -372,39 +413,65 @@ init_threads()
     sigaction(SIGINT,  &sa_terminate, NULL); // interrupt programm
     sigaction(SIGTERM, &sa_terminate, NULL); // software termination
 
-    // pipe to the th_new_conn
-    if (pipe(_cnf->connect_fd) == -1)
+    // queue to request new connections from the main loop
+    if (init_lf_queue(&_cnf->connect_q) == -1)
     {
-        ui_log_errno(LOG_ERR, "Creation of connection pipe failed!");
+        ui_log_errno(LOG_ERR, "Creation of connection queue failed!");
         return -1;
     }
 
-    // pipe to send signal to wait loop from connect
-    if (pipe(_cnf->cl_change) == -1)
+    // ring buffer to pass new user input from stdin
+    if (init_lf_ring(&_cnf->user_input) == -1)
     {
-        ui_log_errno(LOG_ERR, "Creation of change pipe failed!");
+        ui_log_errno(LOG_ERR, "Creation of userinput queue failed!");
         return -1;
     }
 
-    // pipe to signal new user input from stdin
-    if (pipe(_cnf->user_input) == -1)
+    // init event loop of the main thread
+    if (ev_init(&_cnf->ev, _cnf->ev_backend) == -1)
     {
-        ui_log_errno(LOG_ERR, "Creation of userinput pipe faild!");
+        ui_log_errno(LOG_ERR, "Initialization of event loop failed!");
         return -1;
     }
 
-    // init the mutex function used for locking the contactlist
-    if (pthread_mutex_init(&_cnf->cl.cl_mx, NULL))
+    // timers of the main loop (see: run_timers())
+    init_timers();
+    // errors have been reported, the client runs without metrics socket
+    init_metrics();
+
+    // register pipes and listening socket, contacts will be registered
+    // whenever they are added to the contactlist (see: add_contact())
+    if (ev_add(&_cnf->ev, _cnf->user_input.wake.fd[0], EV_READ,
+               EV_ID(EV_SRC_INPUT, 0)) == -1 ||
+        ev_add(&_cnf->ev, _cnf->acpt_fd, EV_READ | EV_ACCEPT,
+               EV_ID(EV_SRC_ACCEPT, 0)) == -1 ||
+        ev_add(&_cnf->ev, _cnf->connect_q.wake.fd[0], EV_READ,
+               EV_ID(EV_SRC_CONNECT, 0)) == -1)
     {
-        ui_log_errno(LOG_ERR, "Initialization of mutex failed!");
+        ui_log_errno(LOG_ERR, "Registration of file descriptors in event loop failed!");
         return -1;
     }
 
-    // create new th_new_conn-thread
-    if (pthread_create
-        (&_cnf->conn_th, NULL, (void* (*)(void*)) th_new_conn, _cnf) == -1)
+    // they stay open until the client exits, the sockets of the user
+    // interface are registered once it connects (see: ipc_connect())
+    fds[0] = _cnf->user_input.wake.fd[0];
+    fds[1] = _cnf->acpt_fd;
+    fds[2] = _cnf->connect_q.wake.fd[0];
+
+    if (ev_register_fds(&_cnf->ev, fds, 3) == -1)
+    {
+        ui_log_errno(LOG_WARN, "Registration of files in event loop failed!");
+    }
+
+    // reactors own the sockets of the contacts (see: thrd_parse())
+    if (_cnf->reactors && init_reactors(_cnf->reactors) == -1)
+    {
+        return -1;
+    }
+
+    // messages are kept for the replay to contacts (see: hist_parse())
+    if (_cnf->hist_file != NULL && init_history(_cnf->hist_file) == -1)
     {
-        ui_log_errno(LOG_ERR, "Creation of connection thread failed!");
         return -1;
     }
 
@@ -430,22 +497,31 @@ init_threads()
 void
 destroy()
 {
+    char* line; // line entered by the user, not handled yet
+
     // cancel select thread
     pthread_cancel(_cnf->select_th);
     // wait for termination of select thread
     pthread_join(_cnf->select_th, NULL);
-    // cancel connection thread
-    pthread_cancel(_cnf->conn_th);
-    // cancel connection thread
-    // wait for termination of connection thread
-    pthread_join(_cnf->conn_th, NULL);
-    // wait for termination of select thread
-    // destroy contact mutex
-    pthread_mutex_destroy(&_cnf->cl.cl_mx);
-    // close write pipe for thread function th_new_conn
-    close(_cnf->connect_fd[1]);
-    // close write pipe for thread function th_new_input
-    close(_cnf->user_input[1]);
+    // terminate reactor threads
+    destroy_reactors();
+    // unmap history file
+    destroy_history();
+    // remember the peers of this session
+    save_peer_cache();
+    // flush the captured trace
+    destroy_capture();
+    // free snapshots of the contactlist
+    destroy_cl_snapshots();
+    // close queue of connection requests
+    destroy_connect_requests();
+    // close ring buffer of user input
+    while ((line = pop_lf_ring(&_cnf->user_input)) != NULL)
+    {
+        free(line);
+    }
+
+    destroy_lf_ring(&_cnf->user_input);
     // delete readline prompt and return to beginning of current line
     local_log(LOG_INFO, "Good Bye!");
 }
@@ -476,13 +552,15 @@ terminate(int sig)
  * line is a command it will be executed, otherwise it will be treated as
  * text message and send to all known contacts stored in the contactlist
  * in the global configuration.
- * @see write_pdu()
+ * @see prepare_wire_pdu()
  * @return 0 on success, -1 on error
  */
 int
 handle_local_input(char* line)
 {
     dchat_pdu_t msg; // pdu containing the chat text message
+    wire_pdu_t* wp;  // prepared pdu shared by all contacts
+    cl_snapshot_t* snap; // connected contacts
     int i, ret = 0, len;
 
     // check if user entered command
@@ -499,57 +577,93 @@ handle_local_input(char* line)
         if (len != 0)
         {
             // inititialize pdu
-            if (init_dchat_pdu(&msg, CTT_ID_TXT, 1.0, _cnf->me.onion_id, _cnf->me.lport,
-                               _cnf->me.name) == -1)
+            if (init_dchat_pdu(&msg, DCHAT_V1, CTT_ID_TXT, _cnf->me.onion_id,
+                               _cnf->me.lport, _cnf->me.name) == -1)
             {
                 ui_log(LOG_ERR, "Initialization of PDU failed!");
                 return -1;
             }
 
             // set content of pdu
-            init_dchat_pdu_content(&msg, line, strlen(line));
+            init_dchat_pdu_content(&msg, line, len);
 
-            // write pdu to known contacts
-            for (i = 0; i < _cnf->cl.cl_size; i++)
+            // in the partial mesh mode messages are relayed by the neighbours
+            if (_cnf->neighbours)
             {
-                if (_cnf->cl.contact[i].fd)
+                msg.msg_id = new_msg_id();
+                msg.ttl = RELAY_TTL;
+                seen_msg_id(msg.msg_id);
+            }
+
+            // replayed messages are recognized by their id
+            if (_cnf->hist_file != NULL)
+            {
+                if (!msg.msg_id)
                 {
-                    ret = write_pdu(_cnf->cl.contact[i].fd, &msg);
+                    msg.msg_id = new_msg_id();
+                    seen_msg_id(msg.msg_id);
                 }
+
+                store_history(msg.msg_id, _cnf->me.name, line, len);
+            }
+
+            // encode pdu only once for all contacts
+            if ((wp = prepare_wire_pdu(&msg)) == NULL)
+            {
+                ui_log(LOG_ERR, "Encoding of PDU failed!");
+                free_pdu(&msg);
+                return -1;
             }
 
             free_pdu(&msg);
+
+            // queue pdu for connected contacts, it will be written
+            // as soon as their sockets become writable
+            snap = publish_cl_snapshot();
+
+            for (i = 0; i < snap->count; i++)
+            {
+                ret = send_wire_pdu(snap->entry[i].n, wp);
+            }
+
+            unref_wire_pdu(wp);
         }
     }
 
-    // return value of write_pdu
+    // return value of send_wire_pdu
     return ret != -1 ? 0 : -1;
 }
 
 
 /**
- * Handles PDUs received from a remote client.
- * Reads in a PDU from a certain contact file descriptor and interpretes its
- * headers and handles its content.
+ * Handles input received from a remote client.
+ * Reads all available bytes from a certain contact file descriptor into
+ * the PDU reader of the contact and handles the PDUs that have been
+ * received completely (see: handle_remote_pdus()). Partially received
+ * PDUs remain buffered until the next call of this function.
  * @param n Index of contact in the respective contactlist
- * @return length of bytes read, 0 on EOF or -1 in case of error
+ * @return length of bytes read, 0 on EOF, -1 if reading failed or -2 if
+ *         the contact has to be dropped (see: handle_remote_pdus())
  */
 int
 handle_remote_input(int n)
 {
-    dchat_pdu_t pdu;    // pdu read from contact file descriptor
-    char* txt_msg;      // message used to store remote input
-    int ret;            // return value
+    contact_t* contact; // contact that sent the input
+    int fd;             // file descriptor of the contact
     int len;            // amount of bytes read
-    contact_t* contact; // contact to send a message to
-    contact = &_cnf->cl.contact[n];
+    contact = CONTACT(n);
+    fd = contact->fd;
 
-    // read pdu from file descriptor (-1 indicates error)
-    if ((len = read_pdu(contact->fd, &pdu)) == -1)
+    // read available bytes (-2 indicates that no data is available)
+    if ((len = fill_pdu_reader(&_cnf->ev, fd, contact->reader)) == -1)
     {
-        ui_log(LOG_ERR, "Illegal PDU from '%s'!", contact->name);
+        ui_log_errno(LOG_ERR, "Reading from '%s' failed!", contact->name);
         return -1;
     }
+    else if (len == -2)
+    {
+        return 1;
+    }
     // EOF
     else if (!len)
     {
@@ -557,96 +671,375 @@ handle_remote_input(int n)
         return 0;
     }
 
+    count_bytes_in(&contact->mt, len);
+    spend_tokens(&contact->rl.bytes, _cnf->rl_bytes, len, get_time_ms());
+    return handle_remote_pdus(n) == -1 ? -2 : len;
+}
+
+
+/**
+ * Decodes and handles up to RL_BATCH PDUs buffered by the PDU reader of
+ * a contact, as long as the rate limits of the contact admit them (see:
+ * admit_input()). A contact exceeding its limits is not read until its
+ * buckets have been refilled, a contact with PDUs left after the batch is
+ * serviced again in the next loop iteration (see: service_contacts()).
+ * @param n Index of contact in the respective contactlist
+ * @return 0 on success or -1 if the contact has to be removed
+ */
+int
+handle_remote_pdus(int n)
+{
+    dchat_pdu_t pdu;    // pdu decoded from the buffer of the contact
+    contact_t* contact; // contact that sent the input
+    contact_handle_t h; // handle of the contact
+    int ret;            // return value
+    long long start;    // time when decoding or handling a pdu started
+    long long delay;    // time until the contact is admitted again
+    h = get_contact_handle(n);
+    CONTACT(n)->rl.round = _cnf->rq.round;
+
+    // handle complete pdus, as long as the contact
+    // has not been removed by a previous pdu
+    for (int i = 0; resolve_contact_handle(h) == n; i++)
+    {
+        contact = CONTACT(n);
+
+        // remaining pdus are decoded in the next loop iteration
+        if (i == RL_BATCH)
+        {
+            push_rl_queue(&_cnf->rq, &contact->rl, n, get_time_ms());
+            break;
+        }
+
+        // the limits are checked before the pdu is decoded
+        if ((delay = admit_input(&contact->rl, get_time_ms())) > 0)
+        {
+            return throttle_contact(n, delay);
+        }
+
+        start = get_time_ns();
+
+        if ((ret = read_pdu(contact->reader, &pdu)) == -1)
+        {
+            count_decode_error(&contact->mt);
+            ui_log(LOG_ERR, "Illegal PDU from '%s'!", contact->name);
+            return -1;
+        }
+        // pdu has not been received completely yet
+        else if (!ret)
+        {
+            break;
+        }
+
+        count_pdu_in(&contact->mt, get_time_ns() - start);
+        spend_tokens(&contact->rl.pdus, _cnf->rl_pdus, 1, get_time_ms());
+        start = get_time_ns();
+        ret = handle_remote_pdu(n, &pdu);
+        record_latency(MT_HIST_DISPATCH, get_time_ns() - start);
+        free_pdu(&pdu);
+
+        if (ret == -1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Pauses reading from a contact, which has exceeded its rate limits.
+ * The contact is serviced again after the given delay.
+ * @param n     Index of contact in the respective contactlist
+ * @param delay Time in ms until the contact is read again
+ * @return 0 on success or -1 if the event of the contact could not be updated
+ */
+int
+throttle_contact(int n, long long delay)
+{
+    contact_t* contact = CONTACT(n);
+
+    if (!contact->rl.throttled)
+    {
+        contact->rl.throttled = 1;
+        count_throttled(&contact->mt);
+
+        if (ev_mod(&_cnf->ev, contact->fd, contact_events(contact),
+                   CONTACT_EV_ID(n)) == -1)
+        {
+            ui_log_errno(LOG_ERR, "Updating event of contact '%d' failed!", n);
+            return -1;
+        }
+    }
+
+    push_rl_queue(&_cnf->rq, &contact->rl, n, get_time_ms() + delay);
+    return 0;
+}
+
+
+/**
+ * Services the contacts in the service queue of the main loop, which are
+ * due. Every contact decodes at most one batch of PDUs per loop iteration,
+ * so that no contact can monopolise the main loop, and throttled contacts
+ * are read again.
+ */
+void
+service_contacts()
+{
+    rl_queue_t* q = &_cnf->rq;
+    contact_t* contact;
+    long long now = get_time_ms();
+    int cnt = q->len;
+    int n;
+
+    while (cnt-- > 0 && (n = pop_rl_queue(q)) != -1)
+    {
+        // the contact may have been removed while it was queued
+        if (n >= _cnf->cl.cl_size || CONTACT(n)->fd <= 0 || !CONTACT(n)->rl.queued ||
+            CONTACT(n)->rt != NULL)
+        {
+            continue;
+        }
+
+        contact = CONTACT(n);
+        contact->rl.queued = 0;
+
+        // contacts that are throttled or have already decoded a batch
+        // in this loop iteration have to wait
+        if (contact->rl.due > now || contact->rl.round == q->round)
+        {
+            push_rl_queue(q, &contact->rl, n, contact->rl.due);
+            continue;
+        }
+
+        if (contact->rl.throttled)
+        {
+            contact->rl.throttled = 0;
+
+            if (ev_mod(&_cnf->ev, contact->fd, contact_events(contact),
+                       CONTACT_EV_ID(n)) == -1)
+            {
+                ui_log_errno(LOG_ERR, "Updating event of contact '%d' failed!", n);
+                del_contact(n, DEL_LOCAL);
+                continue;
+            }
+        }
+
+        if (handle_remote_pdus(n) == -1)
+        {
+            del_contact(n, DEL_DROPPED);
+        }
+    }
+
+    q->round++;
+}
+
+
+/**
+ * Handles a PDU received from a remote client.
+ * Interpretes the headers of the given PDU and handles its content.
+ * @param n   Index of contact in the respective contactlist
+ * @param pdu PDU received from the contact
+ * @return 0 on success, -1 if the contact has to be removed
+ */
+int
+handle_remote_pdu(int n, dchat_pdu_t* pdu)
+{
+    char* txt_msg;      // message used to store remote input
+    int ret;            // return value
+    int identify;       // pdu identifies the contact
+    int first;          // first pdu received from the contact
+    contact_t* contact; // contact that sent the pdu
+    contact = CONTACT(n);
+    // the contact is alive (see: keepalive.c)
+    contact->last_rx = get_time_ms();
+    // record the pdu, if a trace is captured (see: capt_parse())
+    capture_pdu(n, pdu);
+
     // the first pdus of a newly connected client have to be a
-    // "control/discover" containing the onion-id and listening
-    // port, otherwise raise an error and delete
-    // this contact
+    // "control/discover" (or "control/digest" when gossiping)
+    // containing the onion-id and listening port, otherwise
+    // raise an error and delete this contact
     if ((contact->onion_id[0] == '\0' || !contact->lport)  &&
-        pdu.content_type != CTT_ID_DSC)
+        pdu->content_type != CTT_ID_DSC &&
+        !(_cnf->gossip && pdu->content_type == CTT_ID_DGT))
     {
         ui_log(LOG_ERR, "Client '%d' omitted identification!", n);
         return -1;
     }
 
     // check mandatory headers received
-    if (contact->name[0] != '\0' && strcmp(contact->name, pdu.nickname) != 0)
+    if (contact->name[0] != '\0' && strcmp(contact->name, pdu->nickname) != 0)
     {
         ui_log(LOG_INFO, "'%s' changed nickname to '%s'!", contact->name,
-               pdu.nickname);
+               pdu->nickname);
     }
 
     if (contact->onion_id[0] != '\0' &&
-        strcmp(contact->onion_id, pdu.onion_id) != 0)
+        strcmp(contact->onion_id, pdu->onion_id) != 0)
     {
         ui_log(LOG_ERR, "'%s' changed Onion-ID! Contact will be removed!",
                contact->name);
         return -1;
     }
 
-    if (contact->lport != 0 && contact->lport != pdu.lport)
+    if (contact->lport != 0 && contact->lport != pdu->lport)
     {
         ui_log(LOG_ERR, "'%s' changed Listening Port! Contact will be removed!",
                contact->name);
         return -1;
     }
 
-    // set nickname of contact
-    contact->name[0] = '\0';
+    // set nickname of contact, which is unknown until its first pdu
+    first = contact->name[0] == '\0';
+    snprintf(contact->name, sizeof(contact->name), "%s", pdu->nickname);
+
+    // set onion id and listening port of contact
+    identify = contact->lport == 0;
+    set_contact_address(n, pdu->onion_id, pdu->lport);
 
-    if (pdu.nickname[0] != '\0')
+    // ask a newly connected contact for the messages we missed
+    if (first && request_replay(n) == -1)
     {
-        strncat(contact->name, pdu.nickname, MAX_NICKNAME);
+        ui_log(LOG_WARN, "Could not request the replay of missed messages!");
     }
 
-    // set onion id of contact
-    contact->onion_id[0] = '\0';
+    // a peer we are reconnecting to has connected us
+    if (first)
+    {
+        note_peer_seen(contact->onion_id, contact->lport);
+        cancel_reconnect(contact->onion_id, contact->lport);
+    }
 
-    if (pdu.onion_id[0] != '\0')
+    // send DChat V2 frames, if the contact accepts them
+    if (_cnf->binary && !contact->v2 && pdu->accept_version == DCHAT_V2)
     {
-        strncat(contact->onion_id, pdu.onion_id, ONION_ADDRLEN);
+        contact->v2 = 1;
+        ui_log(LOG_INFO, "'%s' accepts DChat V2 frames!", contact->name);
     }
 
-    // set listening port of contact
-    contact->lport = pdu.lport;
+    // send compressed contents, if the contact accepts them
+    if (_cnf->compress && !contact->deflate && pdu->accept_encoding == ENC_ID_DEFLATE)
+    {
+        contact->deflate = 1;
+        ui_log(LOG_INFO, "'%s' accepts compressed contents!", contact->name);
+    }
 
     /*
      * == TEXT/PLAIN ==
      */
-    if (pdu.content_type == CTT_ID_TXT)
+    if (pdu->content_type == CTT_ID_TXT)
     {
-        // allocate memory for text message
-        if ((txt_msg = malloc(pdu.content_length + 1)) == NULL)
+        // relayed messages are only handled once
+        if (pdu->msg_id && seen_msg_id(pdu->msg_id))
         {
-            ui_fatal("Memory allocation for text message failed!");
+            return 0;
         }
 
-        // store bytes from pdu in txt_msg and terminate it
-        memcpy(txt_msg, pdu.content, pdu.content_length);
-        txt_msg[pdu.content_length] = '\0';
-        // print text message
-        ui_write(pdu.nickname, txt_msg);
-        free(txt_msg);
+        // the content of a received pdu is terminated by the decoder
+        txt_msg = pdu->content;
+        // print text message (on behalf of its author, if relayed)
+        ui_write(pdu->origin[0] != '\0' ? pdu->origin : pdu->nickname, txt_msg);
+
+        // messages of clients without history are given an id of our own
+        if (_cnf->hist_file != NULL)
+        {
+            store_history(pdu->msg_id ? pdu->msg_id : new_msg_id(),
+                          pdu->origin[0] != '\0' ? pdu->origin : pdu->nickname, txt_msg,
+                          pdu->content_length);
+        }
+
+        if (_cnf->neighbours && pdu->ttl > 1 && relay_pdu(n, pdu) == -1)
+        {
+            ui_log(LOG_WARN, "Relaying of message from '%s' failed!", contact->name);
+        }
     }
     /*
-     * == CONTROL/DISCOVER ==
+     * == CONTROL/DISCOVER, CONTROL/DIGEST ==
      */
-    else if (pdu.content_type == CTT_ID_DSC)
+    else if (pdu->content_type == CTT_ID_DSC ||
+             (_cnf->gossip && pdu->content_type == CTT_ID_DGT))
     {
         // since dchat brings with the problem of duplicate contacts
         // check if there are duplicate contacts in the contactlist
         if ((ret = check_duplicates(n)) != -1) //error
         {
             ui_log(LOG_INFO, "Detected duplicate contact - removing it!");
-            del_contact(ret);  // delete duplicate
+            del_contact(ret, DEL_DUPLICATE);  // delete duplicate
+
+            if (ret == n)
+            {
+                return 0;
+            }
         }
 
+        // contacts we did not learn from others are announced
+        // to all other contacts
+        if (_cnf->gossip && identify)
+        {
+            announce_contact(n);
+        }
+
+        if (pdu->content_type == CTT_ID_DGT)
+        {
+            // answer with the contacts the contact is missing
+            if (receive_digest(n, pdu) == -1)
+            {
+                ui_log(LOG_WARN, "Could not answer the received contact digest!");
+            }
+        }
         // iterate through the content of the pdu containing
         // the new contacts
-        if ((ret = receive_contacts(&pdu)) == -1)
+        else if ((ret = receive_contacts(n, pdu)) == -1)
         {
             ui_log(LOG_WARN, "Could not add all contacts from the received contactlist!");
         }
     }
+    /*
+     * == APPLICATION/OCTET ==
+     */
+    else if (pdu->content_type == CTT_ID_BIN)
+    {
+        // offer or chunk of a file
+        if (receive_file_pdu(n, pdu) == -1)
+        {
+            ui_log(LOG_WARN, "Could not receive the file from '%s'!", contact->name);
+        }
+    }
+    /*
+     * == CONTROL/RESUME ==
+     */
+    else if (pdu->content_type == CTT_ID_RSM)
+    {
+        // request of an offered file
+        if (receive_resume(n, pdu) == -1)
+        {
+            ui_log(LOG_WARN, "Could not send the file to '%s'!", contact->name);
+        }
+    }
+    /*
+     * == CONTROL/REPLAY ==
+     */
+    else if (pdu->content_type == CTT_ID_RPY)
+    {
+        // request of missed messages or messages replayed
+        if (receive_replay(n, pdu) == -1)
+        {
+            ui_log(LOG_WARN, "Illegal replay received from '%s'!", contact->name);
+        }
+    }
+    /*
+     * == CONTROL/KEEPALIVE ==
+     */
+    else if (pdu->content_type == CTT_ID_KAL)
+    {
+        // ping to answer or pong measuring the round trip time
+        if (receive_keepalive(n, pdu) == -1)
+        {
+            ui_log(LOG_WARN, "Illegal keepalive received from '%s'!", contact->name);
+        }
+    }
     /*
      * == UNKNOWN CONTENT-TYPE ==
      */
@@ -655,53 +1048,24 @@ handle_remote_input(int n)
         ui_log(LOG_WARN, "Unknown Content-Type!");
     }
 
-    free_pdu(&pdu);
-    return len;
+    return 0;
 }
 
 
 /**
  * Handles local connection requests from the user.
- * Connects to the remote client with the given onion address, who will
- * be added as contact. This new contact will be sent that all of our known
- * contacts as specified in the DChat protocol.
+ * Starts to connect to the remote client with the given onion address.
+ * Once the connection has been established, the remote client will be
+ * added as contact and will be sent all of our known contacts as
+ * specified in the DChat protocol (see: connector.c).
  * @param onion_id Destination onion address to connect to
  * @param port     Destination port to connect to
- * @return The index where the contact has been added in the contactlist,
- * -1 on error
+ * @return 0 if the connection attempt has been started, -1 on error
  */
 int
 handle_local_conn_request(char* onion_id, uint16_t port)
 {
-    int s; // socket of the contact we have connected to
-    int n; // index of the contact in our contactlist
-
-    // connect to given address
-    if ((s = create_tor_socket(onion_id, port)) == -1)
-    {
-        return -1;
-    }
-    else
-    {
-        // add contact
-        if ((n = add_contact(s)) == -1)
-        {
-            ui_log_errno(LOG_ERR, "Could not add new contact!");
-            return -1;
-        }
-        else
-        {
-            // set onion id of new contact
-            _cnf->cl.contact[n].onion_id[0] = '\0';
-            strncat(_cnf->cl.contact[n].onion_id, onion_id, ONION_ADDRLEN);
-            // set listening port of new contact
-            _cnf->cl.contact[n].lport = port;
-            // send all our known contacts to the newly connected client
-            send_contacts(n);
-        }
-    }
-
-    return n;
+    return start_connect(onion_id, port);
 }
 
 
@@ -720,123 +1084,37 @@ handle_remote_conn_request()
     int s;                      // socket file descriptor
     int n;                      // index of new contact
 
-    // accept connection request
-    if ((s = accept(_cnf->acpt_fd, NULL, NULL)) == -1)
+    // accept connection request, the event loop may have accepted it already
+    if ((s = ev_accept(&_cnf->ev, _cnf->acpt_fd)) == -1)
     {
         ui_log_errno(LOG_ERR, "Could not accept connection from remote host!");
         return -1;
     }
 
     // add new contact to contactlist
-    if ((n = add_contact(s)) != -1)
+    if ((n = add_contact(s, 0)) != -1)
     {
         ui_log(LOG_INFO, "Remote host (%d) connected!", n);
     }
     else
     {
         ui_log_errno(LOG_ERR, "Could not add new contact!");
+        close(s);
         return -1;
     }
 
-    _cnf->cl.contact[n].accepted = 1;
+    CONTACT(n)->accepted = 1;
     send_contacts(n);
     return n;
 }
 
 
-/**
- * Cleanup ressources used by the thread `conn_th` holded by the
- * global config.
- * Closes the reading pipe `connect_fd` and the writing pipe end
- * of `cl_change` stored in the global config.
- */
-void
-cleanup_th_new_conn(void* arg)
-{
-    /// close pipes used for in `th_new_conn`
-    close(_cnf->connect_fd[0]);
-    close(_cnf->cl_change[1]);
-}
-
-
-/**
- * Thread function that reads an onion address from a pipe and connects to this
- * address.
- * Establishes new connections to the given addresses read from the global config
- * pipe `connect_fd`. It reads an onion address and then connects to
- * this address via TOR. If a connection has been established successfully, a new
- * contact will be added and the contactlist will be sent to him. Furthermore
- * the character '1' will be written to the global config pipe `cl_change`.
- * @see handle_local_conn_request()
- */
-void*
-th_new_conn()
-{
-    char onion_id[ONION_ADDRLEN + 1]; // onion address of remote host
-    uint16_t port;                    // port of remote host
-    char c = '1';                     // signal that a new connection has been established
-    int ret;
-    // setup cleanup handler and cancelation attributes
-    pthread_cleanup_push(cleanup_th_new_conn, NULL);
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
-    for (;;)
-    {
-        // read from pipe to get new address
-        if ((ret = read(_cnf->connect_fd[0], onion_id, ONION_ADDRLEN)) == -1)
-        {
-            ui_log(LOG_WARN, "Could not read Onion-ID from connection pipe!");
-        }
-
-        // EOF
-        if (!ret)
-        {
-            break;
-        }
-
-        // read from pipe to get new port
-        if ((ret = read(_cnf->connect_fd[0], &port, sizeof(uint16_t))) == -1)
-        {
-            ui_log(LOG_WARN, "Could not read Listening-Port from connection pipe!");
-        }
-
-        // EOF
-        if (!ret)
-        {
-            break;
-        }
-
-        // terminate address
-        onion_id[ONION_ADDRLEN] = '\0';
-        // lock contactlist
-        pthread_mutex_lock(&_cnf->cl.cl_mx);
-
-        if (handle_local_conn_request(onion_id, port) == -1)
-        {
-            ui_log(LOG_WARN, "Connection to remote host failed!");
-        }
-        else if ((write(_cnf->cl_change[1], &c, sizeof(c))) == -1)
-        {
-            ui_log(LOG_WARN, "Could not write to change pipe!");
-        }
-
-        // unlock contactlist
-        pthread_mutex_unlock(&_cnf->cl.cl_mx);
-    }
-
-    // execute cleanup handler
-    pthread_cleanup_pop(1);
-    pthread_exit(NULL);
-}
-
-
 /**
  * Thread function that reads from stdin until the user hits enter.
  * Waits for new user input. If the user has entered something,
- * it will be written to the global config pipe `user_input`.
- * First the length (int) of the string will be written to the pipe and then each
- * byte of the string. On EOF of stdin 0 will be written
+ * the line will be passed to the main loop by the ring buffer
+ * `user_input` of the global config, a batch of lines costs a single
+ * wakeup of the main loop.
  * @return 0 on success, -1 in case of error
  */
 int
@@ -867,39 +1145,26 @@ th_new_input()
         {
             break;
         }
+        // commands reading the contactlist do not wait for the main loop
+        else if (!parse_snapshot_cmd(line))
+        {
+            free(line);
+        }
         else
         {
             // user did not write anything -> just hit enter
             if (len == 0)
             {
-                len = 1;
-
-                if (write(_cnf->user_input[1], &len, sizeof(int)) == -1)
-                {
-                    return -1;
-                }
-
-                if (write(_cnf->user_input[1], "\n", len) == -1)
-                {
-                    return -1;
-                }
+                line[0] = '\n';
+                line[1] = '\0';
             }
-            else
-            {
-                // first write length of string
-                if (write(_cnf->user_input[1], &len, sizeof(int)) == -1)
-                {
-                    return -1;
-                }
 
-                // then write the bytes of the string
-                if (write(_cnf->user_input[1], line, len) == -1)
-                {
-                    return -1;
-                }
+            // the main loop takes ownership of the line, if it lags
+            // behind the user, the ring buffer may be full
+            while (push_lf_ring(&_cnf->user_input, line) == -1)
+            {
+                usleep(INPUT_RETRY);
             }
-
-            free(line);
         }
     }
 
@@ -910,197 +1175,186 @@ th_new_input()
 /**
  * Cleanup ressources used by the thread `select_th` holded by the
  * global config.
- * Closes the listening port, every contact file descriptor and
- * the reading pipe end of `user_input` and `cl_change`.
+ * Closes the listening port and every contact file descriptor.
  */
 void
 cleanup_th_main_loop(void* arg)
 {
     int i;
-    // close local listening socket
+    // close local listening socket, which the event loop keeps open as long
+    // as it is registered (see: init_threads())
+    ev_unregister_fds(&_cnf->ev, &_cnf->acpt_fd, 1);
     close(_cnf->acpt_fd);
 
     // close file descriptors of contacts
     for (i = 0; i < _cnf->cl.cl_size; i++)
     {
-        if (_cnf->cl.contact[i].fd)
+        if (CONTACT(i)->fd)
         {
-            close(_cnf->cl.contact[i].fd);
+            close(CONTACT(i)->fd);
         }
     }
 
-    //close pipe stdin
-    close(_cnf->user_input[0]);
-    // close write pipe for main thread function th_main_loop
-    close(_cnf->cl_change[0]);
+    // abort pending connection attempts
+    destroy_connector();
+    destroy_metrics();
+    // close event loop
+    ev_destroy(&_cnf->ev);
 }
 
 
 /**
  * Main chat loop of this client.
- * This function is the main loop of DChat that selects(2) certain file
- * descriptors stored in the global configuration to read from.
+ * This function is the main loop of DChat that waits for events on certain
+ * file descriptors registered in the event loop of the global configuration.
  * It waits for local userinput, PDUs from remote clients, local connection
- * requests and remote connection requests. If select returns and a  file
- * descriptor can be read, this function will take action depending on which file
- * descriptor is able to read from.
+ * requests and remote connection requests. If a file descriptor can be read,
+ * this function will take action depending on the source of the event.
+ * Contacts are registered, whenever they are added to the contactlist, thus
+ * every wakeup only costs as much as file descriptors are ready.
+ * @see ev_wait()
  */
 void*
 th_main_loop()
 {
-    fd_set rset;    // list of readable file descriptors
-    int nfds;       // number of fd in rset
+    ev_event_t events[EV_MAX_EVENTS]; // ready file descriptors
+    int nev;        // number of ready file descriptors
     int ret;        // return value
-    char c;         // for pipe: th_new_conn
     char* line;     // line returned from user input
     int cancel = 0; // cancel main loop
-    int i;
+    int i, n;
+    int stale;      // event of a removed contact
+    contact_t* contact;
     // setup cleanup handler and cancelation attributes
     pthread_cleanup_push(cleanup_th_main_loop, NULL);
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
-    for (;;)
-    {
-        // INIT fd_set
-        FD_ZERO(&rset);
-        // ADD STDIN: pipe file descriptor that connects the thread
-        // function 'th_new_input'
-        FD_SET(_cnf->user_input[0], &rset);
-        // ADD LISTENING PORT: acpt_fd of global config
-        FD_SET(_cnf->acpt_fd, &rset);
-        nfds = max(_cnf->user_input[0], _cnf->acpt_fd);
-        // ADD NEW CONN: pipe file descriptor that connects the thead
-        // function 'th_new_conn'
-        FD_SET(_cnf->cl_change[0], &rset);
-        nfds = max(nfds, _cnf->cl_change[0]);
-        // ADD CONTACTS: add all contact socket file descriptors from
-        // the contactlist
-        pthread_mutex_lock(&_cnf->cl.cl_mx);
-
-        for (i = 0; i < _cnf->cl.cl_size; i++)
-        {
-            if (_cnf->cl.contact[i].fd)
-            {
-                FD_SET(_cnf->cl.contact[i].fd, &rset);
-                // determine fd with highest value
-                nfds = max(_cnf->cl.contact[i].fd, nfds);
-            }
-        }
-
-        pthread_mutex_unlock(&_cnf->cl.cl_mx);
-        // used as backup since nfds will be overwritten if an
-        // interrupt
-        // occurs
-        int old_nfds = nfds;
+    while (!cancel)
+    {
         pthread_testcancel();
 
-        while ((nfds = select(old_nfds + 1, &rset, NULL, NULL, NULL))  <= 0)
+        // run expired timers and wake up when the next timer may expire
+        // contacts in the service queue may wake it up earlier
+        if ((nev = ev_wait(&_cnf->ev, events, EV_MAX_EVENTS,
+                           rl_timeout(&_cnf->rq, run_timers(), get_time_ms()))) == -1)
         {
-            pthread_testcancel();
-
-            if (nfds == -1)
+            // something interrupted the event loop - try again
+            if (errno == EINTR)
             {
-                // something interrupted select(2) - try select again
-                if (errno == EINTR)
-                {
-                    continue;
-                }
-
-                ui_log_errno(LOG_ERR, "select() failed!");
-                cancel = 1;
-                break;
+                continue;
             }
-        }
 
-        if (cancel)
-        {
+            ui_log_errno(LOG_ERR, "ev_wait() failed!");
             break;
         }
 
-        // CHECK STDIN: check if thread has written to the user_input
-        // pipe
-        if (FD_ISSET(_cnf->user_input[0], &rset))
-        {
-            nfds--;
-
-            // read length of string from pipe
-            if (read(_cnf->user_input[0], &ret, sizeof(int)) < 0)
-            {
-                break;
-            }
-
-            // allocate memory for the string entered from user
-            line = malloc(ret + 1);
-
-            // read string
-            if (read(_cnf->user_input[0], line, ret) < 0 || ret <= 0)
-            {
-                free(line);
-                break;
-            }
-
-            line[ret] = '\0';
-            pthread_mutex_lock(&_cnf->cl.cl_mx);
-
-            // handle user input
-            if ((ret = handle_local_input(line)) == -1)
-            {
-                break;
-            }
-
-            pthread_mutex_unlock(&_cnf->cl.cl_mx);
-            free(line);
-        }
-
-        // CHECK LISTENING PORT: check if new connection can be
-        // accepted
-        if (FD_ISSET(_cnf->acpt_fd, &rset))
-        {
-            nfds--;
-            pthread_mutex_lock(&_cnf->cl.cl_mx);
-
-            // handle new connection request
-            if ((ret = handle_remote_conn_request()) == -1)
-            {
-                break;
-            }
-
-            pthread_mutex_unlock(&_cnf->cl.cl_mx);
-        }
-
-        // CHECK NEW CONN: check if user new connection has been added
-        if (FD_ISSET(_cnf->cl_change[0], &rset))
-        {
-            nfds--;
-
-            // !< EOF
-            if (read(_cnf->cl_change[0], &c, sizeof(c)) < 0)
-            {
-                break;
-            }
-        }
-
-        // CHECK CONTACTS: check file descriptors of contacts
-        // check if nfds is 0 => no contacts have written something
-        pthread_mutex_lock(&_cnf->cl.cl_mx);
+        pthread_testcancel();
 
-        for (i = 0; nfds && i < _cnf->cl.cl_size; i++)
+        for (i = 0; !cancel && i < nev; i++)
         {
-            if (FD_ISSET(_cnf->cl.contact[i].fd, &rset))
+            switch (EV_ID_SRC(events[i].id))
             {
-                nfds--;
-
-                // handle input from remote user
-                // -1 = error, 0 = EOF
-                if ((ret = handle_remote_input(i)) == -1 || ret == 0)
-                {
-                    del_contact(i);
-                }
+                // CHECK STDIN: check if thread has passed lines to the
+                // user_input ring buffer
+                case EV_SRC_INPUT:
+                    ack_lf_ring(&_cnf->user_input);
+
+                    for (n = 0; !cancel && n < INPUT_BATCH &&
+                         (line = pop_lf_ring(&_cnf->user_input)) != NULL; n++)
+                    {
+                        // handle user input
+                        if (handle_local_input(line) == -1)
+                        {
+                            cancel = 1;
+                        }
+
+                        free(line);
+                    }
+
+                    // flush the contacts before handling the remaining
+                    // lines, so that their outbound queues do not overflow
+                    if (n == INPUT_BATCH)
+                    {
+                        signal_lf_wake(&_cnf->user_input.wake);
+                    }
+
+                    break;
+
+                // CHECK LISTENING PORT: check if new connection can be
+                // accepted
+                case EV_SRC_ACCEPT:
+                    // handle new connection request
+                    handle_remote_conn_request();
+                    break;
+
+                // CHECK NEW CONN: check if the user requested new
+                // connections
+                case EV_SRC_CONNECT:
+                    handle_connect_requests();
+                    break;
+
+                // CHECK CONNECTION ATTEMPTS: advance pending connections
+                // to remote hosts
+                case EV_SRC_SOCKS:
+                    if (handle_connect_event(EV_ID_INDEX(events[i].id), events[i].fd) == -1)
+                    {
+                        ui_log(LOG_WARN, "Connection to remote host failed!");
+                    }
+
+                    break;
+
+                // CHECK REACTORS: handle pdus received and sockets
+                // closed or drained by the reactors
+                case EV_SRC_REACTOR:
+                    handle_reactor_msgs();
+                    break;
+
+                // CHECK METRICS SOCKET: accept new clients of the metrics
+                // socket and write the metrics to them
+                case EV_SRC_METRICS:
+                    handle_metrics_request(EV_ID_INDEX(events[i].id));
+                    break;
+
+                // CHECK CONTACTS: check file descriptors of contacts
+                case EV_SRC_CONTACT:
+                    n = EV_ID_INDEX(events[i].id);
+
+                    // the contact may have been removed while handling
+                    // previous events, and its slot and file descriptor
+                    // may even have been reused by a new contact, which
+                    // has another generation
+                    if (n < _cnf->cl.cl_size)
+                    {
+                        contact = CONTACT(n);
+                        stale = !contact->used || contact->fd != events[i].fd ||
+                                EV_GENERATION(contact->gen) != EV_ID_GENERATION(events[i].id);
+
+                        // write queued pdus, if the socket is writable
+                        if (!stale && (events[i].events & EV_WRITE) && flush_contact(n) == -1)
+                        {
+                            del_contact(n, DEL_CLOSED);
+                        }
+                        // handle input from remote user
+                        // -1 = error, 0 = EOF, -2 = illegal pdus
+                        else if (!stale && (events[i].events & EV_READ) &&
+                                 (ret = handle_remote_input(n)) <= 0)
+                        {
+                            del_contact(n, ret == -2 ? DEL_DROPPED : DEL_CLOSED);
+                        }
+                    }
+
+                    break;
             }
         }
 
-        pthread_mutex_unlock(&_cnf->cl.cl_mx);
+        // contacts with pdus left to decode or whose throttle has
+        // expired get their next turn
+        service_contacts();
+        // let other threads read the changes of the contactlist
+        publish_cl_snapshot();
+        // save the peer cache from time to time
+        checkpoint_peer_cache();
     }
 
     //execute cleanup handler
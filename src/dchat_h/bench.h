@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h"
+#include "decoder.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define BENCH_CONTACTS   1024
+#define BENCH_BATCH      32
+#define BENCH_AMOUNT     10
+
+
+//*********************************
+//             MACRO
+//*********************************
+#define BENCH(NAME, RUN, ITER) { NAME, RUN, ITER }
+
+
+/*!
+ * Structure of a micro-benchmark.
+ * The run function is called with the amount of iterations and returns
+ * the amount of operations that have been executed.
+ */
+typedef struct bench
+{
+    char* name;              //!< name of the benchmark
+    long (*run)(long);       //!< runs the benchmark
+    long iterations;         //!< default amount of iterations
+} bench_t;
+
+
+//*********************************
+//        BENCH FUNCTIONS
+//*********************************
+long bench_decode_header(long iterations);
+long bench_encode_header(long iterations);
+long bench_write_pdu(long iterations);
+long bench_read_pdu(long iterations);
+long bench_prepare_frame(long iterations);
+long bench_read_frame(long iterations);
+long bench_contact_to_string(long iterations);
+long bench_string_to_contact(long iterations);
+long bench_scan_contacts(long iterations);
+long bench_find_contact(long iterations);
+
+
+//*********************************
+//         MISC FUNCTIONS
+//*********************************
+int init_bench_contacts(int amount);
+void init_bench_pdu(dchat_pdu_t* pdu, char* content);
+long read_batches(wire_pdu_t* session, wire_pdu_t* wp, long iterations);
+
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "types.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define CP_BUF_LEN    65536  // buffer of the trace file
+#define CP_HEADER_LEN 16     // length of the file header
+#define CP_RECORD_LEN 18     // length of the header of a record
+
+
+//*********************************
+//         TRACE FORMAT
+//*********************************
+#define CP_MAGIC   "DCTR"    // first bytes of a trace file
+#define CP_VERSION 1         // version of the trace format
+
+
+//*********************************
+//      DIRECTION OF A RECORD
+//*********************************
+#define CP_DIR_IN  0x01      // PDU received from the contact
+#define CP_DIR_OUT 0x02      // PDU sent to the contact
+
+
+/*
+ * A trace file starts with a header of CP_HEADER_LEN bytes, followed by one
+ * record per PDU. All integers are stored in little endian byte order.
+ *
+ * File header:
+ *   0  4  magic (CP_MAGIC)
+ *   4  2  version (CP_VERSION)
+ *   6  2  length of a record header (CP_RECORD_LEN)
+ *   8  8  start of the capture in microseconds since the epoch
+ *
+ * Record:
+ *   0  4  microseconds since the previous record (or the start)
+ *   4  4  index of the contact
+ *   8  4  generation of the contact slot, index and generation identify
+ *         the connection
+ *  12  1  direction (CP_DIR_IN or CP_DIR_OUT)
+ *  13  1  content-type of the PDU (see: CTT_ID_*)
+ *  14  4  length of the PDU
+ *  18     PDU encoded as DChat V1 (headers and content)
+ */
+
+
+struct wire_pdu;
+
+//*********************************
+//       CAPTURE FUNCTIONS
+//*********************************
+int init_capture(char* path);
+void destroy_capture();
+void capture_pdu(int n, dchat_pdu_t* pdu);
+void capture_wire_pdu(int n, struct wire_pdu* wp);
+
+
+#endif
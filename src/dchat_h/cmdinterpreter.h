@@ -28,7 +28,7 @@
 //*********************************
 //          MISC
 //*********************************
-#define CMD_AMOUNT 3
+#define CMD_AMOUNT 5
 #define CMD_PREFIX "/"
 
 
@@ -38,6 +38,8 @@
 #define CMD_ID_HLP 0x01
 #define CMD_ID_CON 0x02
 #define CMD_ID_LST 0x03
+#define CMD_ID_SND 0x04
+#define CMD_ID_STS 0x05
 
 
 //*********************************
@@ -46,6 +48,8 @@
 #define CMD_NAME_HLP CMD_PREFIX "help"
 #define CMD_NAME_CON CMD_PREFIX "connect"
 #define CMD_NAME_LST CMD_PREFIX "list"
+#define CMD_NAME_SND CMD_PREFIX "send"
+#define CMD_NAME_STS CMD_PREFIX "stats"
 
 
 //*********************************
@@ -54,6 +58,8 @@
 #define CMD_ARG_HLP ""
 #define CMD_ARG_CON CLI_OPT_ARG_RONI " " CLI_OPT_ARG_RPRT
 #define CMD_ARG_LST ""
+#define CMD_ARG_SND CLI_OPT_ARG_NICK " FILE"
+#define CMD_ARG_STS ""
 
 
 //*********************************
@@ -86,6 +92,7 @@ typedef struct cmds
 //     MAIN PARSING FUNCTION
 //*********************************
 int parse_cmd(char* buf);
+int parse_snapshot_cmd(char* line);
 
 
 //*********************************
@@ -94,6 +101,8 @@ int parse_cmd(char* buf);
 int hlp_exec(char* arg);
 int con_exec(char* arg);
 int lst_exec(char* arg);
+int snd_exec(char* arg);
+int sts_exec(char* arg);
 
 
 //*********************************
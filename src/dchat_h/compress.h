@@ -0,0 +1,43 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "types.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define ZL_THRESHOLD 128 // contents shorter than this are sent uncompressed
+#define ZL_LEVEL     6
+
+
+//*********************************
+//      COMPRESSION FUNCTIONS
+//*********************************
+int compression_available();
+int deflate_content(dchat_pdu_t* pdu, char* buf, int size);
+int inflate_content(dchat_pdu_t* pdu);
+
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CONNECTOR_H
+#define CONNECTOR_H
+
+#include <stdint.h>
+
+#include "network.h"
+#include "lfqueue.h"
+#include "timer.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define CN_TIMEOUT       60000 // ms until a connection attempt is aborted
+#define CN_INIT_ATTEMPTS 16
+#define CN_MAX_ATTEMPTS  256
+#define CN_RECONNECTS    32      // peers being reconnected at the same time
+#define CN_BACKOFF_MIN   1000    // ms until the first reconnection attempt
+#define CN_BACKOFF_MAX   60000   // max. ms between two reconnection attempts
+#define CN_BACKOFF_TRIES 8       // reconnection attempts until we give up
+#define CN_STABLE_TIME   60000   // ms a reconnected peer has to stay connected until its backoff is reset
+
+
+//*********************************
+//   STATE OF CONNECTION ATTEMPT
+//*********************************
+#define CN_STATE_FREE     0x00
+#define CN_STATE_CONNECT  0x01
+#define CN_STATE_REQUEST  0x02
+#define CN_STATE_RESPONSE 0x03
+
+
+/*!
+ * Structure of a connection attempt to a remote host via TOR.
+ * A connection attempt advances from connecting to the TOR client, over
+ * writing the SOCKS request, to reading the SOCKS response, whenever its
+ * socket becomes ready.
+ */
+typedef struct conn_attempt
+{
+    int fd;                           //!< socket connected to the TOR client
+    int state;                        //!< state of the attempt
+    char onion_id[ONION_ADDRLEN + 1]; //!< onion address of remote host
+    uint16_t lport;                   //!< listening port of remote host
+    char buf[SOCKS_REQUEST_LEN];      //!< SOCKS request or response
+    int len;                          //!< length of request or response
+    int off;                          //!< bytes written or read so far
+    long long started;                //!< time when the attempt has been started
+    tm_timer_t timeout;               //!< aborts the attempt after CN_TIMEOUT ms
+} conn_attempt_t;
+
+
+/*!
+ * Structure of a peer, whose connection has been lost and which is
+ * reconnected with exponential backoff (see: schedule_reconnect()).
+ */
+typedef struct reconnect
+{
+    char onion_id[ONION_ADDRLEN + 1]; //!< onion address of the peer, empty if unused
+    uint16_t lport;                   //!< listening port of the peer
+    int tries;                        //!< reconnection attempts so far
+    int connected;                    //!< peer has been connected again (see: cancel_reconnect())
+    tm_timer_t timer;                 //!< starts the next reconnection attempt or resets the backoff
+} reconnect_t;
+
+
+/*!
+ * Structure of a request to connect to a remote host, which is passed
+ * to the main loop (see: request_connect()).
+ */
+typedef struct conn_request
+{
+    lf_node_t node;                   //!< node of the queue (must be the first member)
+    char onion_id[ONION_ADDRLEN + 1]; //!< onion address of remote host
+    uint16_t lport;                   //!< listening port of remote host
+} conn_request_t;
+
+
+/*!
+ * Structure storing all pending connection attempts. The attempts are
+ * allocated in blocks of CN_INIT_ATTEMPTS, which are never moved, since
+ * their timers are linked into the timer wheel.
+ */
+typedef struct connector
+{
+    conn_attempt_t* block[CN_MAX_ATTEMPTS / CN_INIT_ATTEMPTS]; //!< blocks of attempts
+    int size;                          //!< amount of attempts in all blocks
+    int used;                          //!< pending connection attempts
+    reconnect_t rc[CN_RECONNECTS];     //!< peers being reconnected
+} connector_t;
+
+
+//*********************************
+//             MACRO
+//*********************************
+#define CN_ATTEMPT(CN, N) (&(CN)->block[(N) / CN_INIT_ATTEMPTS][(N) % CN_INIT_ATTEMPTS])
+
+
+//*********************************
+//      CONNECTOR FUNCTIONS
+//*********************************
+int start_connect(char* onion_id, uint16_t port);
+void request_connect(char* onion_id, uint16_t port);
+void handle_connect_requests();
+void destroy_connect_requests();
+int handle_connect_event(int n, int fd);
+void abort_connect(int n);
+int finish_connect(int n);
+int pending_connects();
+void schedule_reconnect(char* onion_id, uint16_t port);
+void cancel_reconnect(char* onion_id, uint16_t port);
+void destroy_connector();
+
+
+#endif
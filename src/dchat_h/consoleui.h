@@ -3,14 +3,50 @@
 
 #include <syslog.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include "types.h"
 #include "option.h"
 
 #define LOG_WARN LOG_WARNING
 
+#define UI_PATH_LEN  108
+#define UI_SOCK_INP  "dinp.sock"
+#define UI_SOCK_OUT  "dout.sock"
+#define UI_SOCK_LOG  "dlog.sock"
+#define UI_SOCK_MET  "dmet.sock"
+
+#define UI_RING_SIZE 8192 // messages buffered for the user interface
+#define UI_REPLAY    64   // messages replayed after a reconnect
+#define UI_BATCH     64   // messages written by one writev(2)
+
+/*!
+ * Structure of the output ring of the user interface.
+ * Messages are queued by ui_write() and written to the output socket by
+ * th_ui_writer(). Messages already written are kept until the ring is
+ * full, so that the last UI_REPLAY of them can be replayed to a user
+ * interface that has reconnected. If the ring is full of messages
+ * that have not been written yet, new messages are dropped.
+ */
+typedef struct ui_ring
+{
+    char* msg[UI_RING_SIZE]; //!< formatted messages ("nickname;text\n")
+    int len[UI_RING_SIZE];   //!< length of the formatted messages
+    unsigned int tail;       //!< oldest message still retained
+    unsigned int sent;       //!< first message not written yet
+    unsigned int head;       //!< slot used by the next message
+    unsigned int dropped;    //!< messages dropped since the last report
+    int conn;                //!< connection the writer has greeted
+    pthread_mutex_t mx;      //!< lock of the ring
+    pthread_cond_t cond;     //!< signaled if a message has been queued
+} ui_ring_t;
+
+
 int init_ui();
 int ui_write(char* nickname, char* msg);
+void* th_ui_writer(void* ptr);
+void ui_write_log(char* buf, int len);
+int format_log_line(char* buf, int size, int level, const char* msg, int err);
 int ui_log(int lf,const char* fmt, ...);
 void local_log(int lf, const char* fmt, ...);
 int ui_log_errno(int lf, const char* fmt, ...);
@@ -22,12 +22,25 @@
 #define CONTACT_H
 
 #include "types.h"
+#include "decoder.h"
+
+
+//*********************************
+//  REASON OF REMOVING A CONTACT
+//*********************************
+#define DEL_CLOSED    0x01 // connection has been closed or failed, the peer is reconnected
+#define DEL_EVICTED   0x02 // contact has been idle for too long, the peer is reconnected
+#define DEL_DROPPED   0x03 // contact sent illegal PDUs or is congested
+#define DEL_DUPLICATE 0x04 // peer is still connected by another contact
+#define DEL_LOCAL     0x05 // removed by this client (fake contacts, local errors)
 
 //*********************************
 //       DCHAT PROTO FUNCTIONS
 //*********************************
 int send_contacts(int n);
-int receive_contacts(dchat_pdu_t* pdu);
+int send_contact_page(int n, char* content, int len);
+int send_contact_list(int n, uint32_t buckets);
+int receive_contacts(int n, dchat_pdu_t* pdu);
 int check_duplicates(int n);
 
 
@@ -41,10 +54,22 @@ int string_to_contact(contact_t* contact, char* string);
 //*********************************
 //         MISC FUNCTIONS
 //*********************************
-int realloc_contactlist(int newsize);
-int add_contact(int fd);
-int del_contact(int n);
+int grow_contactlist();
+int add_contact(int fd, int socks);
+int del_contact(int n, int reason);
+contact_handle_t get_contact_handle(int n);
+int resolve_contact_handle(contact_handle_t h);
 int find_contact(contact_t* contact, int begin);
+void set_contact_address(int n, char* onion_id, uint16_t lport);
+
+
+//*********************************
+//       OUTBOUND FUNCTIONS
+//*********************************
+wire_pdu_t* prepare_wire_pdu(dchat_pdu_t* pdu);
+int send_wire_pdu(int n, wire_pdu_t* wp);
+int flush_contact(int n);
+int contact_events(contact_t* contact);
 
 
 #endif
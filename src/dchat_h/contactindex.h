@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CONTACTINDEX_H
+#define CONTACTINDEX_H
+
+#include <stdint.h>
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define CI_INIT_SIZE 64   // initial amount of buckets (power of 2)
+
+
+//*********************************
+//        BUCKET VALUES
+//*********************************
+#define CI_EMPTY   -1
+#define CI_DELETED -2
+
+
+/*!
+ * Structure of a hash index of contacts.
+ * Maps the onion address and listening port of a contact to its index
+ * in the contactlist using open addressing with linear probing. Since
+ * duplicate contacts may exist temporarily, a key may be stored more
+ * than once.
+ */
+typedef struct contact_index
+{
+    int* bucket;  //!< index of contact, CI_EMPTY or CI_DELETED
+    int size;     //!< amount of buckets (power of 2)
+    int used;     //!< amount of stored contacts
+    int deleted;  //!< amount of deleted buckets
+} contact_index_t;
+
+
+//*********************************
+//        INDEX FUNCTIONS
+//*********************************
+void init_contact_index(contact_index_t* ci);
+void rebuild_contact_index(contact_index_t* ci);
+int is_indexable(int n);
+void place_contact_index(contact_index_t* ci, int n);
+void insert_contact_index(contact_index_t* ci, int n);
+void remove_contact_index(contact_index_t* ci, int n);
+int lookup_contact_index(contact_index_t* ci, char* onion_id, uint16_t lport, int begin);
+unsigned int hash_contact(char* onion_id, uint16_t lport);
+
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef CONTACTSCAN_H
+#define CONTACTSCAN_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "network.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define CS_ONION_LEN  16                        // length of the onion-id without suffix
+#define CS_SUFFIX     ".onion"
+#define CS_MIN_LINE   (ONION_ADDRLEN + 3)       // "<onion-id> <port>\n" with a 1 digit port
+#define CS_MAX_PORT   5                         // digits of a port
+#define CS_BATCH      64                        // records returned per scan_contacts() call
+
+
+/*!
+ * Structure of a contact parsed from a contact list. The onion-id
+ * points into the scanned buffer and is not terminated, it is valid
+ * as long as the buffer is.
+ */
+typedef struct cs_record
+{
+    const char* onion_id; //!< onion-id of ONION_ADDRLEN bytes within the buffer
+    uint16_t lport;       //!< listening port
+} cs_record_t;
+
+
+/*!
+ * State of a contact list that is scanned in batches of records.
+ */
+typedef struct cs_scan
+{
+    const char* pos; //!< first byte not scanned yet
+    const char* end; //!< end of the buffer
+    int invalid;     //!< amount of malformed lines that have been skipped
+    int truncated;   //!< the last line is not terminated by a newline
+} cs_scan_t;
+
+
+//*********************************
+//        SCAN FUNCTIONS
+//*********************************
+void init_contact_scan(cs_scan_t* sc, const char* buf, int len);
+int scan_contacts(cs_scan_t* sc, cs_record_t* rec, int max);
+const char* find_newline(const char* p, const char* end);
+
+
+#endif
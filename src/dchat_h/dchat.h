@@ -33,6 +33,8 @@
 #define DEFAULT_PORT   7777
 #define LISTEN_ADDR    "127.0.0.1"
 #define LISTEN_BACKLOG 20
+#define INPUT_RETRY    1000 // us until a line is passed again, if the main loop lags behind
+#define INPUT_BATCH    32   // lines handled per wakeup of the main loop
 
 
 //*********************************
@@ -42,7 +44,6 @@ int init_global_config();
 int init_listening(char* address);
 int init_threads();
 void destroy();
-void cleanup_th_new_conn(void* arg);
 void cleanup_th_main_loop(void* arg);
 
 
@@ -52,6 +53,10 @@ void cleanup_th_main_loop(void* arg);
 void terminate(int sig);
 int handle_local_input(char* line);
 int handle_remote_input(int n);
+int handle_remote_pdus(int n);
+int throttle_contact(int n, long long delay);
+void service_contacts();
+int handle_remote_pdu(int n, dchat_pdu_t* pdu);
 int handle_local_conn_request(char* onion_id, uint16_t port);
 int handle_remote_conn_request();
 
@@ -59,7 +64,6 @@ int handle_remote_conn_request();
 //*********************************
 //      THREAD FUNCTIONS
 //*********************************
-void* th_new_conn();
 int th_new_input();
 void*  th_main_loop();
 
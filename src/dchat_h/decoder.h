@@ -21,6 +21,9 @@
 #ifndef DECODER_H
 #define DECODER_H
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include "types.h"
 
 
@@ -28,14 +31,18 @@
 //          LIMITS
 //*********************************
 #define MAX_CONTENT_LEN 4096
-#define HDR_AMOUNT      8
-#define CTT_AMOUNT      4
+#define MAX_HEADERS_LEN 1024
+#define MAX_TTL         255
+#define RECV_BUF_LEN    (MAX_HEADERS_LEN + MAX_CONTENT_LEN)
+#define HDR_AMOUNT      17
+#define CTT_AMOUNT      7
 
 
 //*********************************
 //          VERSION
 //*********************************
 #define DCHAT_V1 1.0
+#define DCHAT_V2 2.0
 
 
 //*********************************
@@ -49,6 +56,15 @@
 #define HDR_ID_NIC 0x06
 #define HDR_ID_DAT 0x07
 #define HDR_ID_SRV 0x08
+#define HDR_ID_MID 0x09
+#define HDR_ID_TTL 0x0A
+#define HDR_ID_ORG 0x0B
+#define HDR_ID_ACV 0x0C
+#define HDR_ID_ACE 0x0D
+#define HDR_ID_CEN 0x0E
+#define HDR_ID_FNM 0x0F
+#define HDR_ID_FSZ 0x10
+#define HDR_ID_FOF 0x11
 
 
 //*********************************
@@ -62,6 +78,15 @@
 #define HDR_NAME_NIC "Nickname"
 #define HDR_NAME_DAT "Date"
 #define HDR_NAME_SRV "Server"
+#define HDR_NAME_MID "Message-ID"
+#define HDR_NAME_TTL "TTL"
+#define HDR_NAME_ORG "Origin"
+#define HDR_NAME_ACV "Accept-Version"
+#define HDR_NAME_ACE "Accept-Encoding"
+#define HDR_NAME_CEN "Content-Encoding"
+#define HDR_NAME_FNM "Filename"
+#define HDR_NAME_FSZ "File-Size"
+#define HDR_NAME_FOF "File-Offset"
 
 
 //*********************************
@@ -71,8 +96,11 @@
 #define CTT_ID_BIN 0x02
 #define CTT_ID_DSC 0x03
 #define CTT_ID_RPY 0x04
+#define CTT_ID_DGT 0x05
+#define CTT_ID_RSM 0x06
+#define CTT_ID_KAL 0x07
 
-#define CTT_MASK_ALL 0x05
+#define CTT_MASK_ALL 0x07
 
 
 //*********************************
@@ -82,6 +110,29 @@
 #define CTT_NAME_BIN "application/octet"
 #define CTT_NAME_DSC "control/discover"
 #define CTT_NAME_RPY "control/replay"
+#define CTT_NAME_DGT "control/digest"
+#define CTT_NAME_RSM "control/resume"
+#define CTT_NAME_KAL "control/keepalive"
+
+
+//*********************************
+//     ID OF CONTENT-ENCODING
+//*********************************
+#define ENC_ID_DEFLATE 0x01
+
+
+//*********************************
+//     NAME OF CONTENT-ENCODING
+//*********************************
+#define ENC_NAME_DEFLATE "deflate"
+
+
+//*********************************
+//     STATE OF A PDU READER
+//*********************************
+#define RD_STATE_HEADER  0x01
+#define RD_STATE_CONTENT 0x02
+#define RD_STATE_SOCKS   0x03
 
 
 //*********************************
@@ -125,7 +176,7 @@ typedef struct dchat_header
     char* header_name;
     int   mandatory;
     int (*str_to_pdu)(char*, dchat_pdu_t*);
-    int (*pdu_to_str)(dchat_pdu_t*, char**);
+    int (*pdu_to_str)(dchat_pdu_t*, char*, int);
 } dchat_header_t;
 
 
@@ -139,19 +190,67 @@ typedef struct dchat_v1
 } dchat_v1_t;
 
 
+/*!
+ * Structure of a PDU reader.
+ * Stores bytes received from a file descriptor until a whole
+ * PDU has been decoded.
+ */
+typedef struct pdu_reader
+{
+    char buf[RECV_BUF_LEN + 1]; //!< receive buffer (+1 to terminate lines)
+    int head;                   //!< offset of first byte not decoded yet
+    int tail;                   //!< offset after the last byte received
+    int state;                  //!< decoding headers, content or the SOCKS5 reply
+    int socks;                  //!< stream isolation of the SOCKS5 request (see: expect_socks5_reply())
+    int len;                    //!< length of headers decoded so far
+    dchat_pdu_t pdu;            //!< PDU that is currently decoded
+    dchat_session_t rx;         //!< identity received by DChat V2 frames
+} pdu_reader_t;
+
+
+/*!
+ * Structure of a prepared PDU.
+ * Holds the encoded headers and the content of a PDU, which is
+ * shared by all contacts it is sent to (see: prepare_pdu()).
+ */
+typedef struct wire_pdu
+{
+    int refs;             //!< reference counter
+    int len;              //!< length of encoded headers and content
+    int content_type;     //!< content-type of the encoded PDU
+    struct wire_pdu* v2;  //!< same PDU as DChat V2 frame (see: prepare_frame())
+    struct wire_pdu* deflated; //!< same PDU with compressed content, may be NULL
+    int file_fd;          //!< file the content is sent from (see: prepare_file_pdu())
+    off_t file_off;       //!< offset of the content in the file
+    int file_len;         //!< length of the content sent from the file, 0 if none
+    char data[];          //!< encoded headers followed by the content
+} wire_pdu_t;
+
+
 //*********************************
 //        DECODE FUNCTIONS
 //*********************************
-int decode_header(dchat_pdu_t* pdu, char* line);
+const dchat_header_t* find_header(const char* key, int len);
+int decode_header(dchat_pdu_t* pdu, char* line, int len);
 int read_line(int fd, char** line);
-int read_pdu(int fd, dchat_pdu_t* pdu);
+void init_pdu_reader(pdu_reader_t* rd);
+void free_pdu_reader(pdu_reader_t* rd);
+int fill_pdu_reader(ev_loop_t* loop, int fd, pdu_reader_t* rd);
+int read_pdu(pdu_reader_t* rd, dchat_pdu_t* pdu);
+void expect_socks5_reply(pdu_reader_t* rd, int isolation);
 
 
 //*********************************
 //        ENCODE FUNCTIONS
 //*********************************
-int encode_header(dchat_pdu_t* pdu, int header_id, char** headerline);
+int encode_header(dchat_pdu_t* pdu, int header_id, char* buf, int size);
+int encode_headers(dchat_pdu_t* pdu, char* buf, int size);
 int write_pdu(int fd, dchat_pdu_t* pdu);
+int write_iov(int fd, struct iovec* iov, int cnt);
+wire_pdu_t* prepare_pdu(dchat_pdu_t* pdu);
+wire_pdu_t* ref_wire_pdu(wire_pdu_t* wp);
+void unref_wire_pdu(wire_pdu_t* wp);
+int write_wire_pdu(int fd, wire_pdu_t* wp);
 
 
 //*********************************
@@ -165,15 +264,33 @@ int lnp_str_to_pdu(char* value, dchat_pdu_t* pdu);
 int nic_str_to_pdu(char* value, dchat_pdu_t* pdu);
 int dat_str_to_pdu(char* value, dchat_pdu_t* pdu);
 int srv_str_to_pdu(char* value, dchat_pdu_t* pdu);
-
-int ver_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int ctt_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int ctl_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int oni_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int lnp_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int nic_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int dat_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int srv_pdu_to_str(dchat_pdu_t* pdu, char** value);
+int mid_str_to_pdu(char* value, dchat_pdu_t* pdu);
+int ttl_str_to_pdu(char* value, dchat_pdu_t* pdu);
+int org_str_to_pdu(char* value, dchat_pdu_t* pdu);
+int acv_str_to_pdu(char* value, dchat_pdu_t* pdu);
+int ace_str_to_pdu(char* value, dchat_pdu_t* pdu);
+int cen_str_to_pdu(char* value, dchat_pdu_t* pdu);
+int fnm_str_to_pdu(char* value, dchat_pdu_t* pdu);
+int fsz_str_to_pdu(char* value, dchat_pdu_t* pdu);
+int fof_str_to_pdu(char* value, dchat_pdu_t* pdu);
+
+int ver_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int ctt_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int ctl_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int oni_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int lnp_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int nic_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int dat_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int srv_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int mid_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int ttl_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int org_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int acv_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int ace_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int cen_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int fnm_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int fsz_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int fof_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
 
 
 //*********************************
@@ -195,6 +312,7 @@ int is_valid_version(float version);
 int is_valid_content_type(int content_type);
 int is_valid_content_length(int ctl);
 int is_valid_nickname(char* nickname);
+int is_valid_file_name(char* name);
 void free_pdu(dchat_pdu_t* pdu);
 int get_content_part(dchat_pdu_t* pdu, int offset, char term, char** content);
 
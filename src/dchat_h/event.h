@@ -0,0 +1,276 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/select.h>
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define EV_MAX_EVENTS  64
+#define EV_BACKEND_AMOUNT 4
+#define EV_URING_ENTRIES  256  // submission queue entries of the io_uring backend
+#define EV_URING_CQ_LEN   4096 // completion queue entries of the io_uring backend
+#define EV_URING_BUFS     128  // provided receive buffers of the io_uring backend (power of 2)
+#define EV_URING_BUF_LEN  4096 // size of a provided receive buffer
+#define EV_URING_FILES    8    // files registered with the io_uring backend (see: ev_register_fds())
+#define EV_URING_ACCEPTS  64   // accepted sockets queued per listening socket of the io_uring backend
+
+
+//*********************************
+//         EVENT TYPES
+//*********************************
+#define EV_READ  0x01
+#define EV_WRITE 0x02
+#define EV_RECV   0x04 // socket is read by ev_recv() only, backends may receive in advance
+#define EV_ACCEPT 0x08 // listening socket is accepted by ev_accept() only, backends may accept in advance
+
+
+//*********************************
+//       SOURCE OF EVENT
+//*********************************
+#define EV_SRC_CONTACT 0x00
+#define EV_SRC_INPUT   0x01
+#define EV_SRC_ACCEPT  0x02
+#define EV_SRC_CONNECT 0x03
+#define EV_SRC_SOCKS   0x04
+#define EV_SRC_REACTOR 0x05
+#define EV_SRC_METRICS 0x06
+
+
+//*********************************
+//             MACRO
+//*********************************
+#define EV_ID_GEN(SRC, N, GEN) ((int)(((SRC) << 28) | (((GEN) & 0xFF) << 20) | ((N) & 0xFFFFF)))
+#define EV_ID(SRC, N)   EV_ID_GEN(SRC, N, 0)
+#define EV_ID_SRC(ID)   (((ID) >> 28) & 0xF)
+#define EV_ID_INDEX(ID) ((ID) & 0xFFFFF)
+#define EV_ID_GENERATION(ID)   (((ID) >> 20) & 0xFF)
+#define EV_GENERATION(GEN)     ((GEN) & 0xFF) // generation as stored in an id (see: EV_ID_GEN)
+#define EV_BACKEND(NAME, INIT, DESTROY, CTL, WAIT, RECV, ACCEPT, FILES) \
+    { NAME, INIT, DESTROY, CTL, WAIT, RECV, ACCEPT, FILES }
+
+
+/*!
+ * Structure of an event reported by an event backend.
+ */
+typedef struct ev_event
+{
+    int fd;     //!< file descriptor that became ready
+    int id;     //!< identifier given on registration (see: EV_ID, EV_ID_GEN)
+    int events; //!< EV_READ and/or EV_WRITE
+} ev_event_t;
+
+
+struct ev_loop;
+
+/*!
+ * Structure of an event backend.
+ * Specifies the name of the backend and the functions used to
+ * (un)register file descriptors, to wait for events, to read sockets
+ * registered with EV_RECV, to accept sockets registered with EV_ACCEPT
+ * and to (un)register long-lived files (NULL if the backend does not
+ * receive, accept or register files itself).
+ */
+typedef struct ev_backend
+{
+    char* name;
+    int (*init)(struct ev_loop*);
+    void (*destroy)(struct ev_loop*);
+    int (*ctl)(struct ev_loop*, int op, int fd, int events, int id);
+    int (*wait)(struct ev_loop*, ev_event_t*, int max, int timeout);
+    ssize_t (*recv)(struct ev_loop*, int fd, void* buf, size_t len);
+    int (*accept)(struct ev_loop*, int fd);
+    int (*files)(struct ev_loop*, const int* fds, int n, int add);
+} ev_backend_t;
+
+
+/*!
+ * Structure of an event loop.
+ */
+typedef struct ev_loop
+{
+    const ev_backend_t* backend; //!< backend used by this loop
+    int fd;                      //!< epoll/kqueue descriptor, -1 if unused
+    void* data;                  //!< backend specific state
+} ev_loop_t;
+
+
+/*!
+ * State of the select(2) backend. Registrations are stored per file
+ * descriptor, therefore only descriptors lower than FD_SETSIZE are
+ * supported.
+ */
+typedef struct ev_select
+{
+    pthread_mutex_t mx;       //!< lock, since other threads (un)register fds
+    char used[FD_SETSIZE];    //!< file descriptor is registered
+    int events[FD_SETSIZE];   //!< registered events per file descriptor
+    int id[FD_SETSIZE];       //!< registered id per file descriptor
+    int maxfd;                //!< highest registered file descriptor
+} ev_select_t;
+
+
+/*!
+ * Registration of a file descriptor in the io_uring backend.
+ */
+typedef struct ev_uring_fd
+{
+    int events;    //!< registered events
+    int id;        //!< registered id
+    uint32_t gen;  //!< generation, changes whenever the poll request is replaced
+    unsigned mask; //!< events of the pending poll request
+    uint32_t rgen; //!< generation of the multishot request, changes whenever the fd is (un)registered
+    int rhead;     //!< first received buffer, valid if nbufs > 0
+    int rtail;     //!< last received buffer, valid if nbufs > 0
+    int nbufs;     //!< received buffers, which have not been read yet
+    int roff;      //!< bytes of the first received buffer, which have been read already
+    int naccepted; //!< accepted sockets, which have not been taken yet (see: ev_uring_t.acc)
+    int rerr;      //!< errno of the failed multishot request, 0 if none
+    char reof;     //!< the receive request reported the end of the stream
+    char rarmed;   //!< a multishot request of the current generation is pending
+    char raccept;  //!< the pending multishot request accepts sockets
+    char rcancel;  //!< the pending multishot request is being cancelled
+    char rstall;   //!< no buffers (or too many sockets) were left, the fd is polled until they are taken
+    char rready;   //!< fd is listed in the completed fds (see: ev_uring_t.ready)
+    char used;     //!< file descriptor is registered
+    char armed;    //!< a poll request of the current generation is pending
+    char dirty;    //!< requests have to be armed by the next wait
+} ev_uring_fd_t;
+
+
+/*!
+ * State of the io_uring(7) backend. File descriptors are watched by
+ * single-shot poll requests, which are (re)armed by the same
+ * io_uring_enter(2) call that waits for completions. Sockets registered
+ * with EV_RECV are read by a multishot receive request instead, which
+ * picks buffers of a ring provided to the kernel. Received buffers are
+ * queued per file descriptor until they are read by ev_recv() and
+ * returned to the ring. Listening sockets registered with EV_ACCEPT are
+ * accepted by a multishot accept request, whose sockets are queued until
+ * they are taken by ev_accept(). Requests on long-lived files, which
+ * have been registered by ev_register_fds(), refer to their slot in the
+ * table of registered files. Registrations are stored per file
+ * descriptor, the table grows on demand.
+ */
+typedef struct ev_uring
+{
+    pthread_mutex_t mx;        //!< lock, since other threads (un)register fds
+    unsigned* sq_head;         //!< head of the submission ring (kernel)
+    unsigned* sq_tail;         //!< tail of the submission ring
+    unsigned sq_mask;          //!< mask of submission ring indices
+    unsigned sq_entries;       //!< size of the submission ring
+    unsigned tail;             //!< local tail of the submission ring
+    struct io_uring_sqe* sqes; //!< submission queue entries
+    unsigned* cq_head;         //!< head of the completion ring
+    unsigned* cq_tail;         //!< tail of the completion ring (kernel)
+    unsigned cq_mask;          //!< mask of completion ring indices
+    struct io_uring_cqe* cqes; //!< completion queue entries
+    void* sq_ring;             //!< mapping of the submission ring
+    size_t sq_ring_len;        //!< length of the submission ring mapping
+    void* cq_ring;             //!< mapping of the completion ring, may equal sq_ring
+    size_t cq_ring_len;        //!< length of the completion ring mapping
+    size_t sqes_len;           //!< length of the submission queue entries mapping
+    int waiting;               //!< the loop blocks in io_uring_enter(2)
+    int ring_index;            //!< ring registered by the waiting thread, -1 if none, -2 if untried
+    pthread_t ring_owner;      //!< thread that registered the ring
+    ev_uring_fd_t* reg;        //!< registrations per file descriptor
+    int* dirty;                //!< file descriptors whose poll requests have to be armed
+    int ndirty;                //!< amount of dirty file descriptors
+    int* ready;                //!< file descriptors with received buffers, accepted sockets, an EOF or an error
+    int nready;                //!< amount of completed file descriptors
+    int size;                  //!< size of reg, dirty and ready
+    struct io_uring_buf_ring* br; //!< ring of provided buffers, NULL if not registered
+    char* bufs;                //!< memory of the provided buffers
+    int blen[EV_URING_BUFS];   //!< received bytes per buffer
+    int bnext[EV_URING_BUFS];  //!< next received buffer of the same fd
+    unsigned short btail;      //!< local tail of the ring of provided buffers
+    int held;                  //!< received buffers, which have not been returned yet
+    int norecv;                //!< multishot receive requests are not supported
+    int* acc;                  //!< accepted sockets, pairs of listening and accepted socket
+    int nacc;                  //!< amount of accepted sockets
+    int acc_size;              //!< amount of pairs acc has room for
+    int noaccept;              //!< multishot accept requests are not supported
+    int files[EV_URING_FILES]; //!< registered file descriptors, -1 if the slot is free
+    int nfiles;                //!< slots of the registered files, 0 if the kernel refused them
+} ev_uring_t;
+
+
+//*********************************
+//        CONTROL OPERATIONS
+//*********************************
+#define EV_CTL_ADD 0x01
+#define EV_CTL_MOD 0x02
+#define EV_CTL_DEL 0x03
+
+
+//*********************************
+//        INIT FUNCTIONS
+//*********************************
+int ev_init(ev_loop_t* loop, char* name);
+void ev_destroy(ev_loop_t* loop);
+
+
+//*********************************
+//       CONTROL FUNCTIONS
+//*********************************
+int ev_add(ev_loop_t* loop, int fd, int events, int id);
+int ev_mod(ev_loop_t* loop, int fd, int events, int id);
+int ev_del(ev_loop_t* loop, int fd);
+int ev_wait(ev_loop_t* loop, ev_event_t* events, int max, int timeout);
+ssize_t ev_recv(ev_loop_t* loop, int fd, void* buf, size_t len);
+int ev_accept(ev_loop_t* loop, int fd);
+int ev_register_fds(ev_loop_t* loop, const int* fds, int n);
+int ev_unregister_fds(ev_loop_t* loop, const int* fds, int n);
+int ev_has_backend(const char* name);
+
+
+//*********************************
+//       BACKEND FUNCTIONS
+//*********************************
+int ev_epoll_init(ev_loop_t* loop);
+void ev_epoll_destroy(ev_loop_t* loop);
+int ev_epoll_ctl(ev_loop_t* loop, int op, int fd, int events, int id);
+int ev_epoll_wait(ev_loop_t* loop, ev_event_t* events, int max, int timeout);
+int ev_uring_init(ev_loop_t* loop);
+void ev_uring_destroy(ev_loop_t* loop);
+int ev_uring_ctl(ev_loop_t* loop, int op, int fd, int events, int id);
+int ev_uring_wait(ev_loop_t* loop, ev_event_t* events, int max, int timeout);
+ssize_t ev_uring_recv(ev_loop_t* loop, int fd, void* buf, size_t len);
+int ev_uring_accept(ev_loop_t* loop, int fd);
+int ev_uring_files(ev_loop_t* loop, const int* fds, int n, int add);
+int ev_kqueue_init(ev_loop_t* loop);
+void ev_kqueue_destroy(ev_loop_t* loop);
+int ev_kqueue_ctl(ev_loop_t* loop, int op, int fd, int events, int id);
+int ev_kqueue_wait(ev_loop_t* loop, ev_event_t* events, int max, int timeout);
+int ev_select_init(ev_loop_t* loop);
+void ev_select_destroy(ev_loop_t* loop);
+int ev_select_ctl(ev_loop_t* loop, int op, int fd, int events, int id);
+int ev_select_wait(ev_loop_t* loop, ev_event_t* events, int max, int timeout);
+
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <stdint.h>
+
+#include "types.h"
+#include "decoder.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define V2_MAGIC      0xD2 // first byte of a frame (v1 PDUs begin with 'D')
+#define V2_MAX_HEADER 256  // max. length of a frame without its content
+#define V2_MAX_VARINT 10
+
+
+//*********************************
+//        TYPE OF FRAMES
+//*********************************
+#define V2_TYPE_SESSION 0x00 // only updates the identity of the session
+
+
+//*********************************
+//        FIELDS OF FRAMES
+//*********************************
+#define V2_FLD_ONI 0x01
+#define V2_FLD_LNP 0x02
+#define V2_FLD_NIC 0x04
+#define V2_FLD_SRV 0x08
+#define V2_FLD_MID 0x10
+#define V2_FLD_TTL 0x20
+#define V2_FLD_ORG 0x40
+#define V2_FLD_ENC 0x80
+
+#define V2_FLD_SESSION (V2_FLD_ONI | V2_FLD_LNP | V2_FLD_NIC | V2_FLD_SRV)
+
+
+//*********************************
+//        VARINT FUNCTIONS
+//*********************************
+int put_varint(char* buf, int size, uint64_t value);
+int get_varint(const char* buf, int len, uint64_t* value);
+
+
+//*********************************
+//        FRAME FUNCTIONS
+//*********************************
+int encode_frame(dchat_pdu_t* pdu, int fields, char* buf, int size);
+wire_pdu_t* prepare_frame(dchat_pdu_t* pdu);
+wire_pdu_t* update_session(dchat_session_t* tx);
+int read_frame(pdu_reader_t* rd, dchat_pdu_t* pdu);
+
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef GOSSIP_H
+#define GOSSIP_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define GOSSIP_BUCKETS  32    // buckets of a digest (bits of a bucket mask)
+#define GOSSIP_HEARD    256   // remembered contacts already announced
+#define GOSSIP_ALL      0xFFFFFFFFu
+
+
+//*********************************
+//             MACRO
+//*********************************
+#define GOSSIP_BUCKET(H) ((int)((H) >> 59))
+
+
+/*!
+ * Structure of a digest of the known contacts.
+ * Contacts are distributed to buckets by their hash. For every bucket
+ * the amount of contacts and the sum of their hashes is stored, thus
+ * two peers can determine which buckets of their contactlists differ.
+ */
+typedef struct gossip_digest
+{
+    int count[GOSSIP_BUCKETS];       //!< amount of contacts per bucket
+    uint64_t hash[GOSSIP_BUCKETS];   //!< sum of contact hashes per bucket
+} gossip_digest_t;
+
+
+//*********************************
+//        DIGEST FUNCTIONS
+//*********************************
+uint64_t gossip_hash(char* onion_id, uint16_t lport);
+void build_digest(gossip_digest_t* dg);
+int encode_digest(gossip_digest_t* dg, char* buf, int size);
+int decode_digest(dchat_pdu_t* pdu, gossip_digest_t* dg);
+uint32_t compare_digests(gossip_digest_t* a, gossip_digest_t* b);
+
+
+//*********************************
+//        GOSSIP FUNCTIONS
+//*********************************
+int send_digest(int n);
+int receive_digest(int n, dchat_pdu_t* pdu);
+int announce_contact(int n);
+int gossip_initiates(contact_t* contact);
+void mark_heard(contact_t* contact);
+void forget_heard(contact_t* contact);
+int is_heard(contact_t* contact);
+
+
+#endif
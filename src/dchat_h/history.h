@@ -0,0 +1,121 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define HIST_RING_SIZE    4096                // messages indexed in memory
+#define HIST_INDEX_SIZE   (2 * HIST_RING_SIZE) // slots of the message id index
+#define HIST_INDEX_PROBE  16                  // slots probed per lookup
+#define HIST_SEGMENT_SIZE (4 * 1024 * 1024)   // size of the history file
+#define HIST_REPLAY_MAX   512                 // messages replayed per request
+#define HIST_MAGIC        "DCHATHS1"
+
+
+//*********************************
+//             MACRO
+//*********************************
+#define HIST_ALIGN(LEN) (((LEN) + 7) & ~7)
+
+
+/*!
+ * Structure of the header of the history file. The records are stored
+ * in the order they have been appended from tail to wp. Once the end of
+ * the file has been reached, records are appended at the beginning again
+ * and overwrite the oldest ones, so the records wrap around at end.
+ */
+typedef struct hist_segment
+{
+    char magic[8];     //!< HIST_MAGIC
+    uint64_t size;     //!< size of the file
+    uint64_t tail;     //!< offset of the oldest record
+    uint64_t wp;       //!< offset the next record is appended at
+    uint64_t end;      //!< end of the records before wrapping around
+    uint64_t count;    //!< amount of records
+} hist_segment_t;
+
+
+/*!
+ * Structure of a record of the history file.
+ */
+typedef struct hist_record
+{
+    uint32_t size;     //!< size of the record including padding
+    uint16_t len;      //!< length of the text
+    uint8_t nlen;      //!< length of the nickname of the author
+    uint8_t pad;       //!< unused
+    uint64_t id;       //!< message id
+    int64_t time;      //!< time the message has been stored (ms since epoch)
+    char data[];       //!< nickname of the author followed by the text
+} hist_record_t;
+
+
+/*!
+ * Structure of a message in the history ring. The ring indexes the
+ * latest records of the history file in the order they have been stored.
+ */
+typedef struct hist_entry
+{
+    uint64_t id;       //!< message id
+    int64_t time;      //!< time the message has been stored (ms since epoch)
+    uint64_t off;      //!< offset of the record in the history file
+} hist_entry_t;
+
+
+/*!
+ * Structure of the message history.
+ */
+typedef struct history
+{
+    int fd;                             //!< history file
+    hist_segment_t* seg;                //!< mapped history file
+    hist_entry_t ring[HIST_RING_SIZE];  //!< latest messages
+    unsigned int head;                  //!< messages stored
+    unsigned int tail;                  //!< oldest message still indexed
+    unsigned int index[HIST_INDEX_SIZE]; //!< message id to position in the ring + 1
+} history_t;
+
+
+//*********************************
+//        HISTORY FUNCTIONS
+//*********************************
+int init_history(char* path);
+void destroy_history();
+int store_history(uint64_t id, char* origin, char* text, int len);
+int known_history(uint64_t id);
+
+
+//*********************************
+//        REPLAY FUNCTIONS
+//*********************************
+int request_replay(int n);
+int receive_replay(int n, dchat_pdu_t* pdu);
+
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef KEEPALIVE_H
+#define KEEPALIVE_H
+
+#include "types.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define KA_MAX_INTERVAL 3600 // max. seconds between two keepalives
+#define KA_IDLE_FACTOR  3    // intervals without PDUs until a contact is evicted
+#define KA_RTT_WEIGHT   8    // weight of the smoothed round trip time
+
+
+//*********************************
+//      KEEPALIVE FUNCTIONS
+//*********************************
+void start_keepalive(int n);
+int receive_keepalive(int n, dchat_pdu_t* pdu);
+
+
+#endif
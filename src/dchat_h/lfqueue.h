@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef LFQUEUE_H
+#define LFQUEUE_H
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define LF_RING_SIZE 256   // slots of a ring buffer (power of 2)
+
+
+/*!
+ * Structure of the wakeup of a consumer thread. The consumer waits for
+ * its file descriptor to become readable, which is an eventfd(2) if
+ * supported or the read end of a pipe otherwise. Producers signal it at
+ * most once until the consumer acknowledges the wakeup, thus a batch of
+ * items costs a single write(2) and read(2).
+ */
+typedef struct lf_wake
+{
+    int fd[2];       //!< read and write end, both are the same eventfd
+    int signaled;    //!< wakeup has been written and not acknowledged yet
+} lf_wake_t;
+
+
+/*!
+ * Node of a lock-free queue, which is embedded as first member
+ * into the items of the queue.
+ */
+typedef struct lf_node
+{
+    struct lf_node* next; //!< next node towards the head
+} lf_node_t;
+
+
+/*!
+ * Structure of an unbounded, intrusive multi-producer single-consumer
+ * queue. Producers push without locks by exchanging the head, the
+ * consumer pops at the tail. A stub node keeps the queue non-empty.
+ */
+typedef struct lf_queue
+{
+    lf_node_t* head; //!< last node pushed
+    lf_node_t* tail; //!< next node popped
+    lf_node_t stub;  //!< stub node
+    lf_wake_t wake;  //!< wakeup of the consumer
+} lf_queue_t;
+
+
+/*!
+ * Structure of a bounded single-producer single-consumer ring buffer of
+ * pointers. Producer and consumer only write their own index.
+ */
+typedef struct lf_ring
+{
+    void* item[LF_RING_SIZE]; //!< items of the ring
+    unsigned int head;        //!< items pushed, only written by the producer
+    unsigned int tail;        //!< items popped, only written by the consumer
+    lf_wake_t wake;           //!< wakeup of the consumer
+} lf_ring_t;
+
+
+//*********************************
+//        WAKEUP FUNCTIONS
+//*********************************
+int init_lf_wake(lf_wake_t* w);
+void destroy_lf_wake(lf_wake_t* w);
+void signal_lf_wake(lf_wake_t* w);
+void ack_lf_wake(lf_wake_t* w);
+
+
+//*********************************
+//        QUEUE FUNCTIONS
+//*********************************
+int init_lf_queue(lf_queue_t* q);
+void destroy_lf_queue(lf_queue_t* q);
+void push_lf_queue(lf_queue_t* q, lf_node_t* node);
+lf_node_t* pop_lf_queue(lf_queue_t* q);
+void ack_lf_queue(lf_queue_t* q);
+
+
+//*********************************
+//        RING FUNCTIONS
+//*********************************
+int init_lf_ring(lf_ring_t* r);
+void destroy_lf_ring(lf_ring_t* r);
+int push_lf_ring(lf_ring_t* r, void* item);
+void* pop_lf_ring(lf_ring_t* r);
+void ack_lf_ring(lf_ring_t* r);
+
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdarg.h>
+
+#include "reactor.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define LOG_MAX_THREADS (RT_MAX_REACTORS + 8) // threads with a log buffer
+#define LOG_BUF_SIZE    64    // records of a log buffer (power of 2)
+#define LOG_MSG_LEN     256   // length of a formatted message
+#define LOG_BATCH_LEN   16384 // bytes written at once by the flusher
+#define LOG_RATE_SITES  8     // call sites rate-limited per thread
+#define LOG_RATE_MS     1000  // window of the rate limit
+#define LOG_RATE_BURST  5     // identical messages logged per window
+
+
+/*!
+ * Structure of a log record. Only the message text is formatted by the
+ * logging thread, the level, errno and line are formatted by the flusher.
+ */
+typedef struct log_rec
+{
+    int level;              //!< log priority
+    int err;                //!< errno to append, 0 if none
+    char msg[LOG_MSG_LEN];  //!< formatted message
+} log_rec_t;
+
+
+/*!
+ * Structure of the rate limit of a call site of ui_log(). Call sites
+ * are identified by their format string, thus messages that only differ
+ * in their arguments count as identical.
+ */
+typedef struct log_rate
+{
+    const char* fmt;         //!< format string of the call site, NULL if unused
+    int level;               //!< log priority of the call site
+    long long start;         //!< start of the current window in milliseconds
+    unsigned int count;      //!< messages in the current window
+    unsigned int suppressed; //!< messages suppressed in the current window
+} log_rate_t;
+
+
+/*!
+ * Structure of the log buffer of a thread. It is a single-producer
+ * single-consumer ring: the owning thread pushes records and the
+ * flusher pops them, both only write their own index.
+ */
+typedef struct log_buf
+{
+    log_rec_t rec[LOG_BUF_SIZE];         //!< records of the ring
+    unsigned int head;                   //!< records pushed by the owner
+    unsigned int tail;                   //!< records popped by the flusher
+    unsigned int lost;                   //!< records lost since the ring was full
+    unsigned int reported;               //!< lost records reported by the flusher
+    int state;                           //!< LOG_BUF_FREE, LOG_BUF_USED or LOG_BUF_EXITED
+    log_rate_t rate[LOG_RATE_SITES];     //!< rate limits, only accessed by the owner
+} log_buf_t;
+
+
+//*********************************
+//       STATE OF A LOG BUFFER
+//*********************************
+#define LOG_BUF_FREE   0x00
+#define LOG_BUF_USED   0x01
+#define LOG_BUF_EXITED 0x02
+
+
+//*********************************
+//        LOGGING FUNCTIONS
+//*********************************
+int init_log();
+int queue_log(int level, const char* fmt, va_list ap, int with_errno);
+void* th_log_flusher(void* ptr);
+
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef MESHBENCH_H
+#define MESHBENCH_H
+
+#include <sys/types.h>
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define MB_MAX_NODES      64
+#define MB_LINE_LEN       512
+#define MB_START_TIMEOUT  10000
+#define MB_SYNC_TIMEOUT   20000
+#define MB_IDLE_TIMEOUT   5000
+
+
+//*********************************
+//          DEFAULTS
+//*********************************
+#define MB_DEFAULT_NODES    4
+#define MB_DEFAULT_MESSAGES 2000
+#define MB_DEFAULT_PORT     17000
+#define MB_DEFAULT_DCHAT    "./dchat"
+
+
+//*********************************
+//       TYPE OF UI MESSAGE
+//*********************************
+#define MB_MSG_SYNC  's'
+#define MB_MSG_BENCH 'm'
+
+
+/*!
+ * Structure of a buffered UI socket of a node.
+ */
+typedef struct mb_sock
+{
+    int fd;                 //!< unix socket connected to the node
+    char buf[MB_LINE_LEN];  //!< partially received line
+    int len;                //!< length of the partially received line
+} mb_sock_t;
+
+
+/*!
+ * Structure of a dchat instance of the mesh.
+ */
+typedef struct mb_node
+{
+    pid_t pid;              //!< process id of dchat
+    char dir[128];          //!< directory of the UI sockets
+    char onion_id[32];      //!< fake onion address
+    int lport;              //!< listening port
+    int in_fd;              //!< socket to write user input to
+    mb_sock_t out;          //!< socket of received messages
+    mb_sock_t log;          //!< socket of log messages
+    long long io_start;     //!< read/write syscalls before the benchmark
+    long long io_end;       //!< read/write syscalls after the benchmark
+    int synced;             //!< amount of nodes which received our sync message
+} mb_node_t;
+
+
+/*!
+ * Structure of the mesh benchmark.
+ */
+typedef struct meshbench
+{
+    char* dchat;            //!< path to the dchat executable
+    char dir[64];           //!< temporary directory
+    int nodes;              //!< amount of nodes
+    int messages;           //!< messages sent by each node
+    int port;               //!< listening port of the first node
+    char* reactors;         //!< amount of reactors of every node, NULL for none
+    char* events;           //!< event backend of every node, NULL for the default
+    mb_node_t node[MB_MAX_NODES];
+    char seen[MB_MAX_NODES][MB_MAX_NODES]; //!< sync message of node has been received
+    long long* latency;     //!< delivery latencies in nanoseconds
+    long delivered;         //!< amount of delivered messages
+    long long last;         //!< time of the last delivery
+} meshbench_t;
+
+
+//*********************************
+//        NODE FUNCTIONS
+//*********************************
+int start_node(meshbench_t* mb, int i);
+int connect_node(mb_node_t* node);
+void stop_node(mb_node_t* node);
+long long read_node_io(mb_node_t* node);
+long read_node_rss(mb_node_t* node);
+
+
+//*********************************
+//        BENCH FUNCTIONS
+//*********************************
+int sync_mesh(meshbench_t* mb);
+int poll_mesh(meshbench_t* mb, int timeout);
+int handle_node_line(meshbench_t* mb, int i, char* line);
+void* th_send_messages(void* ptr);
+void report_mesh(meshbench_t* mb, long long elapsed);
+
+
+//*********************************
+//         MISC FUNCTIONS
+//*********************************
+long long get_time_ns();
+int unix_connect(char* dir, char* name);
+int write_line(int fd, char* fmt, ...);
+
+
+#endif
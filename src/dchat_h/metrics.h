@@ -0,0 +1,144 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define MT_SUB_BITS   3  // significant bits of the histogram buckets (~12% precision)
+#define MT_SUB        (1 << MT_SUB_BITS)
+#define MT_MAX_BITS   40 // highest bit of recorded values (~18 min in ns)
+#define MT_BUCKETS    ((MT_MAX_BITS - MT_SUB_BITS + 2) * MT_SUB)
+#define MT_DUMP_LEN   8192 // length of the metrics of all contacts together
+#define MT_DUMP_CONTACT_LEN 2048 // max. length of the metrics of a single contact
+#define MT_MAX_CLIENTS 8   // clients of the metrics socket written at the same time
+#define MT_SOCK_BACKLOG 8
+
+
+//*********************************
+//        ID OF HISTOGRAM
+//*********************************
+#define MT_HIST_DECODE   0x00 // decoding of a received PDU
+#define MT_HIST_DISPATCH 0x01 // handling of a received PDU
+#define MT_HIST_UI_WRITE 0x02 // queueing of a message for the user interface
+#define MT_HIST_CONNECT  0x03 // connecting to a remote host via TOR
+#define MT_HIST_AMOUNT   4
+
+
+/*!
+ * Counters of a contact (and of all contacts together). They are
+ * updated by the main loop and the reactors without locks.
+ */
+typedef struct mt_counters
+{
+    uint64_t pdus_in;       //!< PDUs received
+    uint64_t pdus_out;      //!< PDUs written completely
+    uint64_t bytes_in;      //!< bytes received
+    uint64_t bytes_out;     //!< bytes written
+    uint64_t decode_errors; //!< illegal PDUs received
+    uint64_t dropped;       //!< PDUs dropped due to congestion
+    uint64_t queued;        //!< bytes in the outbound queue (gauge)
+    uint64_t throttled;     //!< times reading has been paused by the rate limits
+    uint64_t refused;       //!< advertised contacts not connected due to the connect budget
+} mt_counters_t;
+
+
+/*!
+ * Histogram of latencies in nanoseconds. Values are counted in buckets
+ * whose width grows with the magnitude of the values, so that every
+ * bucket has MT_SUB_BITS significant bits (like HDR histograms).
+ */
+typedef struct mt_hist
+{
+    uint64_t count;               //!< recorded values
+    uint64_t sum;                 //!< sum of recorded values
+    uint64_t max;                 //!< highest recorded value
+    uint64_t bucket[MT_BUCKETS];  //!< recorded values per bucket
+} mt_hist_t;
+
+
+/*!
+ * Client of the metrics socket, whose metrics are written as soon as
+ * its socket becomes writable.
+ */
+typedef struct mt_client
+{
+    int fd;             //!< connection of the client
+    char* buf;          //!< formatted metrics, NULL if the slot is unused
+    int len;            //!< length of the formatted metrics
+    int off;            //!< length of the metrics written so far
+    int watched;        //!< connection is registered in the event loop
+    long long accepted; //!< time the client has been accepted in ms
+} mt_client_t;
+
+
+/*!
+ * Structure of the global metrics.
+ */
+typedef struct metrics
+{
+    mt_counters_t total;                //!< counters of all contacts
+    uint64_t connects;                  //!< successful connection attempts
+    uint64_t connect_failures;          //!< failed connection attempts
+    mt_hist_t hist[MT_HIST_AMOUNT];     //!< latencies (see: MT_HIST_*)
+    long long started;                  //!< time of startup in ms
+    int fd;                             //!< listening metrics socket, -1 if none
+    mt_client_t client[MT_MAX_CLIENTS]; //!< clients whose metrics are being written
+} metrics_t;
+
+
+//*********************************
+//       COUNTING FUNCTIONS
+//*********************************
+void count_bytes_in(mt_counters_t* c, int bytes);
+void count_pdu_in(mt_counters_t* c, long long decode_ns);
+void count_pdus_out(mt_counters_t* c, int pdus, int bytes);
+void count_decode_error(mt_counters_t* c);
+void count_dropped(mt_counters_t* c, int pdus);
+void count_queued(mt_counters_t* c, int bytes);
+void count_throttled(mt_counters_t* c);
+void count_refused_connects(mt_counters_t* c, int contacts);
+void count_connect(int ok, long long ms);
+void record_latency(int hist, long long ns);
+
+
+//*********************************
+//      REPORTING FUNCTIONS
+//*********************************
+uint64_t hist_quantile(mt_hist_t* h, double q);
+void log_metrics();
+int format_metrics(char* buf, int size);
+
+
+//*********************************
+//        SOCKET FUNCTIONS
+//*********************************
+int init_metrics();
+void handle_metrics_request(int n);
+void destroy_metrics();
+
+
+#endif
@@ -23,6 +23,7 @@
 #define NETWORK_H
 
 #include <stdint.h>
+#include <netinet/in.h>
 
 
 //*********************************
@@ -31,6 +32,7 @@
 #define ONION_ADDRLEN   22
 #define TOR_PORT        9050
 #define TOR_ADDR        "127.0.0.1"
+#define DIRECT_ADDR     "127.0.0.1"
 
 
 //*********************************
@@ -41,6 +43,38 @@
 #define SOCKS_VERSION   0x04
 #define SOCKS_DELIM     0x00
 #define SOCKS_FAKEIP    0x01
+#define SOCKS_GRANTED   90
+
+#define SOCKS4A_REQUEST_LEN  (9 + ONION_ADDRLEN + 1)
+#define SOCKS4A_RESPONSE_LEN 8
+
+
+//*********************************
+//     SOCKS5 FIELDS
+//*********************************
+#define SOCKS5_VERSION     0x05
+#define SOCKS5_AUTH_NONE   0x00
+#define SOCKS5_AUTH_PASSWD 0x02
+#define SOCKS5_AUTH_REJECT 0xFF
+#define SOCKS5_PASSWD_VER  0x01
+#define SOCKS5_ATYP_IPV4   0x01
+#define SOCKS5_ATYP_DOMAIN 0x03
+#define SOCKS5_ATYP_IPV6   0x04
+#define SOCKS5_SUCCEEDED   0x00
+#define SOCKS5_PASSWD      "dchat"
+
+#define SOCKS5_MAX_USER    64
+#define SOCKS5_REQUEST_LEN (3 + 3 + SOCKS5_MAX_USER + sizeof(SOCKS5_PASSWD) + 7 + ONION_ADDRLEN)
+#define SOCKS_REQUEST_LEN  (SOCKS5_REQUEST_LEN > SOCKS4A_REQUEST_LEN ? \
+                            SOCKS5_REQUEST_LEN : SOCKS4A_REQUEST_LEN)
+
+
+//*********************************
+//   SOCKS5 STREAM ISOLATION
+//*********************************
+#define SOCKS_ISO_NONE    0x01 // no authentication, TOR may share circuits
+#define SOCKS_ISO_SESSION 0x02 // one username for all streams of this client
+#define SOCKS_ISO_PEER    0x03 // one username, thus one circuit, per peer
 
 
 /*!
@@ -60,15 +94,19 @@ typedef struct socks4a_pdu
 //*********************************
 //       SOCKS FUNCTIONS
 //*********************************
-int write_socks4a(int s, socks4a_pdu_t* pdu);
-int read_socks4a(int s, socks4a_pdu_t* pdu);
+int encode_socks4a(socks4a_pdu_t* pdu, char* buf, int size);
+void decode_socks4a(char* buf, socks4a_pdu_t* pdu);
 char* parse_socks_status(unsigned char status);
+int encode_socks5(char* hostname, uint16_t port, char* user, char* buf, int size);
+int decode_socks5(char* buf, int len, int auth, int* status);
+char* parse_socks5_status(int status);
 
 
 //*********************************
 //       TOR FUNCTIONS
 //*********************************
-int create_tor_socket(char* hostname, uint16_t rport);
+int create_tor_socket(struct sockaddr_in* tor);
+int create_direct_socket(uint16_t port);
 
 
 //*********************************
@@ -76,6 +114,8 @@ int create_tor_socket(char* hostname, uint16_t rport);
 //*********************************
 int ip_version(struct sockaddr_storage* addr);
 int connect_to(struct sockaddr* sa);
+int connect_async(struct sockaddr* sa);
+int set_nonblocking(int fd, int on);
 int is_valid_port(int port);
 int is_valid_onion(char* onion_id);
 
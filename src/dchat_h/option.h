@@ -29,7 +29,7 @@
 //*********************************
 //            MISC
 //*********************************
-#define CLI_OPT_AMOUNT 6
+#define CLI_OPT_AMOUNT 23
 
 //*********************************
 //  COMMAND LINE OPTIONS (SHORT)
@@ -39,6 +39,23 @@
 #define CLI_OPT_LPRT "l"
 #define CLI_OPT_RONI "d"
 #define CLI_OPT_RPRT "r"
+#define CLI_OPT_OVFL "o"
+#define CLI_OPT_DRCT "x"
+#define CLI_OPT_UDIR "u"
+#define CLI_OPT_GOSP "g"
+#define CLI_OPT_MESH "m"
+#define CLI_OPT_BNRY "b"
+#define CLI_OPT_ZLIB "z"
+#define CLI_OPT_FDIR "f"
+#define CLI_OPT_THRD "t"
+#define CLI_OPT_HIST "y"
+#define CLI_OPT_PEER "p"
+#define CLI_OPT_KPAL "k"
+#define CLI_OPT_EVNT "e"
+#define CLI_OPT_TOR  "T"
+#define CLI_OPT_SCK5 "S"
+#define CLI_OPT_RATE "R"
+#define CLI_OPT_CAPT "c"
 #define CLI_OPT_HELP "h"
 
 
@@ -50,6 +67,23 @@
 #define CLI_LOPT_LPRT "lport"
 #define CLI_LOPT_RONI "ronion"
 #define CLI_LOPT_RPRT "rport"
+#define CLI_LOPT_OVFL "overflow"
+#define CLI_LOPT_DRCT "direct"
+#define CLI_LOPT_UDIR "uidir"
+#define CLI_LOPT_GOSP "gossip"
+#define CLI_LOPT_MESH "mesh"
+#define CLI_LOPT_BNRY "binary"
+#define CLI_LOPT_ZLIB "compress"
+#define CLI_LOPT_FDIR "files"
+#define CLI_LOPT_THRD "threads"
+#define CLI_LOPT_HIST "history"
+#define CLI_LOPT_PEER "peers"
+#define CLI_LOPT_KPAL "keepalive"
+#define CLI_LOPT_EVNT "events"
+#define CLI_LOPT_TOR  "tor"
+#define CLI_LOPT_SCK5 "socks5"
+#define CLI_LOPT_RATE "ratelimit"
+#define CLI_LOPT_CAPT "capture"
 #define CLI_LOPT_HELP "help"
 
 
@@ -61,6 +95,23 @@
 #define CLI_OPT_ARG_LPRT "LOCALPORT"
 #define CLI_OPT_ARG_RONI "REMOTEONIONID"
 #define CLI_OPT_ARG_RPRT "REMOTEPORT"
+#define CLI_OPT_ARG_OVFL "POLICY"
+#define CLI_OPT_ARG_DRCT ""
+#define CLI_OPT_ARG_UDIR "DIRECTORY"
+#define CLI_OPT_ARG_GOSP ""
+#define CLI_OPT_ARG_MESH "NEIGHBOURS"
+#define CLI_OPT_ARG_BNRY ""
+#define CLI_OPT_ARG_ZLIB ""
+#define CLI_OPT_ARG_FDIR "DIRECTORY"
+#define CLI_OPT_ARG_THRD "REACTORS"
+#define CLI_OPT_ARG_HIST "FILE"
+#define CLI_OPT_ARG_PEER "FILE"
+#define CLI_OPT_ARG_KPAL "SECONDS"
+#define CLI_OPT_ARG_EVNT "BACKEND"
+#define CLI_OPT_ARG_TOR  "ADDRESS:PORT"
+#define CLI_OPT_ARG_SCK5 "ISOLATION"
+#define CLI_OPT_ARG_RATE "PDUS:BYTES:CONNECTS"
+#define CLI_OPT_ARG_CAPT "FILE"
 #define CLI_OPT_ARG_HELP ""
 
 
@@ -114,6 +165,23 @@ int nick_parse(char* value, int force);
 int lprt_parse(char* value, int force);
 int roni_parse(char* value, int force);
 int rprt_parse(char* value, int force);
+int ovfl_parse(char* value, int force);
+int drct_parse(char* value, int force);
+int udir_parse(char* value, int force);
+int gosp_parse(char* value, int force);
+int mesh_parse(char* value, int force);
+int bnry_parse(char* value, int force);
+int zlib_parse(char* value, int force);
+int fdir_parse(char* value, int force);
+int thrd_parse(char* value, int force);
+int hist_parse(char* value, int force);
+int peer_parse(char* value, int force);
+int kpal_parse(char* value, int force);
+int evnt_parse(char* value, int force);
+int tor_parse(char* value, int force);
+int sck5_parse(char* value, int force);
+int rate_parse(char* value, int force);
+int capt_parse(char* value, int force);
 int help_parse(char* value, int force);
 
 #endif
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef PEERCACHE_H
+#define PEERCACHE_H
+
+#include <stdint.h>
+
+#include "network.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define PC_SIZE          256     // peers kept in the cache
+#define PC_PRIME         8       // peers connected to at startup
+#define PC_CHECKPOINT_MS 30000   // min. time between two checkpoints
+#define PC_MAGIC         "DCHATPC"
+#define PC_VERSION       1
+#define PC_TMP_SUFFIX    ".tmp"
+
+
+/*!
+ * Structure of a peer in the peer cache, which is stored as is in the
+ * cache file. Only fixed size fields are used, so the file can be read
+ * or mapped as an array of records.
+ */
+typedef struct pc_peer
+{
+    int64_t last_seen;                //!< last time the peer was connected (s since epoch)
+    uint32_t attempts;                //!< connection attempts
+    uint32_t successes;               //!< successful connection attempts
+    uint32_t rtt;                     //!< latest time to connect or round trip time in ms, 0 if unknown
+    uint16_t lport;                   //!< listening port of the peer
+    uint16_t pad;                     //!< unused
+    char onion_id[ONION_ADDRLEN + 2]; //!< onion address of the peer (padded)
+} pc_peer_t;
+
+
+/*!
+ * Structure of the header of the cache file, which is followed by
+ * count records of size pc_peer_t.
+ */
+typedef struct pc_header
+{
+    char magic[8];       //!< PC_MAGIC
+    uint32_t version;    //!< PC_VERSION
+    uint32_t rec_size;   //!< size of a record
+    uint32_t count;      //!< amount of records
+    uint32_t pad;        //!< unused
+} pc_header_t;
+
+
+//*********************************
+//       PEER CACHE FUNCTIONS
+//*********************************
+int load_peer_cache(char* path);
+int prime_peer_cache(int max);
+int save_peer_cache();
+void checkpoint_peer_cache();
+void note_peer_attempt(char* onion_id, uint16_t lport);
+void note_peer_connected(char* onion_id, uint16_t lport, long long rtt);
+void note_peer_rtt(char* onion_id, uint16_t lport, long long rtt);
+void note_peer_seen(char* onion_id, uint16_t lport);
+
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define PL_HDR_LEN    16   // length of the block header, keeps malloc's alignment
+#define PL_MIN_BITS   6    // smallest size class as power of two (64 bytes)
+#define PL_CLASSES    8    // size classes up to 8 KiB
+#define PL_CACHE_LEN  64   // free blocks a thread keeps per size class
+#define PL_BATCH      32   // blocks moved between a thread and the depot at once
+#define PL_DEPOT_LEN  1024 // free blocks kept by the depot per size class
+
+
+//*********************************
+//             MACRO
+//*********************************
+#define PL_CLASS_LEN(CLS) ((size_t) 1 << (PL_MIN_BITS + (CLS)))
+
+
+/*!
+ * Header of a pooled block, which precedes the memory returned by
+ * pool_alloc().
+ */
+typedef struct pl_block
+{
+    struct pl_block* next; //!< next free block of the same size class
+    int cls;               //!< size class, PL_CLASSES if not pooled
+} pl_block_t;
+
+
+/*!
+ * Structure of a list of free blocks of the same size class.
+ */
+typedef struct pl_list
+{
+    pl_block_t* head; //!< first free block
+    int len;          //!< amount of free blocks
+} pl_list_t;
+
+
+/*!
+ * Free blocks of a thread. A thread allocates from and frees to its
+ * own cache without locking, block lists are exchanged with the depot
+ * in batches of PL_BATCH blocks.
+ */
+typedef struct pl_cache
+{
+    pl_list_t cls[PL_CLASSES]; //!< free blocks per size class
+} pl_cache_t;
+
+
+/*!
+ * Free blocks shared by all threads. Blocks freed by a thread other
+ * than the allocating one (e.g. PDUs written by a reactor) flow back
+ * to the allocating thread through the depot.
+ */
+typedef struct pl_depot
+{
+    pthread_mutex_t mx;        //!< lock of the block lists
+    pl_list_t cls[PL_CLASSES]; //!< free blocks per size class
+    uint64_t mallocs;          //!< blocks allocated by malloc(3)
+} pl_depot_t;
+
+
+//*********************************
+//        POOL FUNCTIONS
+//*********************************
+void* pool_alloc(size_t size);
+void pool_free(void* ptr);
+uint64_t pool_mallocs();
+
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define RL_BATCH     16   // PDUs decoded per contact and loop iteration
+#define RL_SCALE     1000 // tokens are counted in thousandths
+#define RL_QUEUE_LEN 64   // initial size of a service queue
+#define RL_MAX_RATE  (1 << 30) // highest rate of a limit
+
+
+/*!
+ * Structure of a token bucket. The bucket is refilled with the rate
+ * of its limit and holds the tokens of one second at most. Received
+ * bytes and PDUs are spent after they have been received, so that the
+ * bucket may be overdrawn, until it has been refilled the socket is
+ * not read anymore.
+ */
+typedef struct rl_bucket
+{
+    long long tokens; //!< thousandths of tokens, negative if overdrawn
+    long long last;   //!< time of the last refill in ms, 0 if unused so far
+} rl_bucket_t;
+
+
+/*!
+ * Admission state of a socket whose PDUs are decoded by the main loop
+ * or by a reactor (see: admit_input()).
+ */
+typedef struct rl_state
+{
+    rl_bucket_t pdus;     //!< PDUs received
+    rl_bucket_t bytes;    //!< bytes received
+    rl_bucket_t connects; //!< connection attempts to contacts advertised by the socket
+    long long due;        //!< time when the queued socket is serviced
+    int throttled;        //!< reading is paused until due
+    int queued;           //!< socket is waiting in a service queue
+    unsigned round;       //!< round of the latest batch of PDUs decoded
+} rl_state_t;
+
+
+/*!
+ * Entry of a service queue.
+ */
+typedef struct rl_entry
+{
+    int n;         //!< index of the socket
+    long long due; //!< time when the socket is serviced
+} rl_entry_t;
+
+
+/*!
+ * Structure of a service queue. Sockets with PDUs left in their buffer
+ * after a batch of RL_BATCH PDUs, and throttled sockets are serviced
+ * round-robin, one batch per socket and loop iteration.
+ */
+typedef struct rl_queue
+{
+    rl_entry_t* entry; //!< ring of queued sockets
+    int head;          //!< index of the first entry
+    int len;           //!< amount of entries
+    int size;          //!< size of the ring
+    unsigned round;    //!< current round, incremented by every service pass
+} rl_queue_t;
+
+
+//*********************************
+//       BUCKET FUNCTIONS
+//*********************************
+void spend_tokens(rl_bucket_t* b, int rate, int n, long long now);
+long long bucket_delay(rl_bucket_t* b, int rate, long long now);
+long long admit_input(rl_state_t* rl, long long now);
+int admit_connect(rl_state_t* rl, long long now);
+
+
+//*********************************
+//        QUEUE FUNCTIONS
+//*********************************
+void init_rl_queue(rl_queue_t* q);
+void destroy_rl_queue(rl_queue_t* q);
+void push_rl_queue(rl_queue_t* q, rl_state_t* rl, int n, long long due);
+int pop_rl_queue(rl_queue_t* q);
+int rl_timeout(rl_queue_t* q, int timeout, long long now);
+
+
+#endif
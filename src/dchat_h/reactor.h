@@ -0,0 +1,135 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+
+#include "types.h"
+#include "decoder.h"
+#include "sendqueue.h"
+#include "event.h"
+#include "lfqueue.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define RT_MAX_REACTORS 64
+
+
+//*********************************
+//   MESSAGES TO THE REACTORS
+//*********************************
+#define RT_MSG_ADD  0x01
+#define RT_MSG_DEL  0x02
+#define RT_MSG_SEND 0x03
+
+
+//*********************************
+//   MESSAGES TO THE MAIN LOOP
+//*********************************
+#define RT_MSG_PDU       0x11
+#define RT_MSG_EOF       0x12
+#define RT_MSG_ILLEGAL   0x13
+#define RT_MSG_RDERR     0x14
+#define RT_MSG_WRERR     0x15
+#define RT_MSG_DRAINED   0x16
+#define RT_MSG_CONGESTED 0x17
+
+
+/*!
+ * Structure of a socket owned by a reactor.
+ * The PDU reader and the outbound queue of the contact are only
+ * accessed by the reactor.
+ */
+typedef struct rt_conn
+{
+    int fd;                 //!< socket of the contact
+    int n;                  //!< index of the contact in the contactlist
+    contact_handle_t h;     //!< handle of the contact
+    pdu_reader_t* reader;   //!< buffer of received PDUs
+    send_queue_t* sq;       //!< outbound queue of PDUs
+    int closed;             //!< EOF or an error has been reported
+    int chunks;             //!< file chunks queued, reported once they have been written
+    rl_state_t rl;          //!< admission control of received PDUs (see: ratelimit.c)
+} rt_conn_t;
+
+
+/*!
+ * Structure of a message exchanged between the main loop and a reactor.
+ */
+typedef struct rt_msg
+{
+    lf_node_t node;         //!< node of the queue (must be the first member)
+    int type;               //!< type of message (see: RT_MSG_*)
+    int n;                  //!< index of the contact in the contactlist
+    contact_handle_t h;     //!< handle of the contact
+    int err;                //!< errno of a failed read or write
+    int chunks;             //!< file chunks written (RT_MSG_DRAINED)
+    rt_conn_t* conn;        //!< socket handed over to a reactor (RT_MSG_ADD)
+    wire_pdu_t* wp;         //!< prepared PDU to send (RT_MSG_SEND)
+    dchat_pdu_t pdu;        //!< PDU received (RT_MSG_PDU)
+} rt_msg_t;
+
+
+/*!
+ * Structure of a reactor.
+ * Every reactor runs an event loop in its own thread, which owns the
+ * sockets of a shard of the contacts. It reads and decodes their PDUs
+ * and writes their outbound queues.
+ */
+typedef struct reactor
+{
+    pthread_t th;           //!< thread running the event loop
+    ev_loop_t ev;           //!< event loop of the reactor
+    lf_queue_t msgs;        //!< messages from the main loop
+    rt_conn_t** conn;       //!< sockets by index of the contact
+    int size;               //!< size of the socket array
+    int conns;              //!< amount of sockets (maintained by the main loop)
+    rl_queue_t rq;          //!< sockets with PDUs left to decode or throttled
+} reactor_t;
+
+
+//*********************************
+//      INIT/DESTROY FUNCTIONS
+//*********************************
+int init_reactors(int amount);
+void destroy_reactors();
+
+
+//*********************************
+//     MAIN LOOP FUNCTIONS
+//*********************************
+int add_reactor_contact(int n);
+void del_reactor_contact(int n);
+void send_reactor_pdu(int n, wire_pdu_t* wp);
+int handle_reactor_msgs();
+
+
+//*********************************
+//      THREAD FUNCTIONS
+//*********************************
+void* th_reactor(void* arg);
+
+
+#endif
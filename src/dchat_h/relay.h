@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define RELAY_TTL            8     // hops of a message sent by the local user
+#define RELAY_MAX_NEIGHBOURS 1024
+#define RELAY_FILTER_SIZE    4096  // slots of a generation of the message filter
+#define RELAY_FILTER_PERIOD  60000 // ms until a generation of the filter expires
+
+
+/*!
+ * Structure of the filter for relayed messages.
+ * Message ids are stored in two generations of open addressed hash
+ * tables. New ids are added to the current generation, which replaces
+ * the previous one when it is half full or expires. Thus an id is
+ * remembered for at least RELAY_FILTER_PERIOD ms or
+ * RELAY_FILTER_SIZE / 2 messages.
+ */
+typedef struct msg_filter
+{
+    uint64_t id[2][RELAY_FILTER_SIZE]; //!< message ids, 0 marks a free slot
+    int cur;                           //!< index of the current generation
+    int used;                          //!< ids in the current generation
+    long long expires;                 //!< time when the current generation expires
+} msg_filter_t;
+
+
+//*********************************
+//        RELAY FUNCTIONS
+//*********************************
+uint64_t new_msg_id();
+int seen_msg_id(uint64_t id);
+int relay_pdu(int n, dchat_pdu_t* pdu);
+int count_neighbours();
+int accepts_neighbour();
+
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <poll.h>
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define RP_MAX_PORTS      64
+#define RP_BUF_LEN        8192   // receive buffer of a stream
+#define RP_POLL_BATCH     64     // records sent between two polls when behind schedule
+#define RP_MAX_PROBES     1048576 // round trip times kept for the report
+
+
+//*********************************
+//          DEFAULTS
+//*********************************
+#define RP_DEFAULT_SPEED    1.0
+#define RP_DEFAULT_INTERVAL 100    // ms between two probes
+#define RP_DEFAULT_WAIT     2000   // ms to wait for answers after the last record
+#define RP_DEFAULT_ADDRESS  "127.0.0.1"
+
+
+/*!
+ * Structure of a recorded PDU.
+ */
+typedef struct rp_record
+{
+    long long t;            //!< time of the record in us since the start of the capture
+    int stream;             //!< index of the stream the record belongs to
+    int len;                //!< length of the PDU
+    char* data;             //!< PDU encoded as DChat V1
+} rp_record_t;
+
+
+/*!
+ * Structure of a stream. Every connection of the captured client and
+ * every direction is replayed by a connection of its own.
+ */
+typedef struct rp_stream
+{
+    uint32_t n;             //!< index of the captured contact
+    uint32_t gen;           //!< generation of the captured contact slot
+    int dir;                //!< direction of the recorded PDUs (see: CP_DIR_*)
+    int port;               //!< port the stream is replayed to
+    int fd;                 //!< connection, -1 if not connected (yet)
+    int closed;             //!< connection has been closed or failed
+    char host[80];          //!< host header of the first PDU (identity used by probes)
+    char lport[16];         //!< listen-port header of the first PDU
+    char nickname[64];      //!< nickname header of the first PDU, empty if none
+    char buf[RP_BUF_LEN];   //!< partially received PDU
+    int len;                //!< length of the partially received PDU
+} rp_stream_t;
+
+
+/*!
+ * Structure of a replay.
+ */
+typedef struct replay
+{
+    char* address;          //!< address of the replayed clients
+    int port[RP_MAX_PORTS]; //!< listening ports of the replayed clients
+    int ports;              //!< amount of ports
+    double speed;           //!< speedup of the replay, 0 for as fast as possible
+    int interval;           //!< ms between two probes, 0 for none
+    int wait;               //!< ms to wait for answers after the last record
+    int outbound;           //!< replay the PDUs sent by the captured client, too
+    char* trace;            //!< content of the trace file
+    rp_record_t* record;    //!< records to replay
+    long records;           //!< amount of records
+    rp_stream_t* stream;    //!< streams to replay
+    int streams;            //!< amount of streams
+    int probe_next;         //!< stream the next probe is sent to
+    long long* lag;         //!< delay of every record behind the schedule in ns
+    long sent;              //!< amount of records sent
+    long long sent_bytes;   //!< amount of bytes sent
+    long received;          //!< amount of PDUs received
+    long long received_bytes; //!< amount of bytes received
+    long long* rtt;         //!< round trip times of the probes in ns
+    long probes;            //!< amount of probes sent
+    long answered;          //!< amount of probes answered
+    int failed;             //!< amount of streams which could not be connected or written
+    int dropped;            //!< amount of streams closed by the replayed clients
+    struct pollfd* pfd;     //!< poll entries of the connected streams
+    int* pfd_stream;        //!< stream of every poll entry
+} replay_t;
+
+
+//*********************************
+//        TRACE FUNCTIONS
+//*********************************
+int load_trace(replay_t* rp, char* path);
+int find_stream(replay_t* rp, uint32_t n, uint32_t gen, int dir);
+
+
+//*********************************
+//       STREAM FUNCTIONS
+//*********************************
+int open_stream(replay_t* rp, rp_stream_t* st);
+void close_stream(rp_stream_t* st);
+int send_record(replay_t* rp, rp_record_t* rec);
+int send_probe(replay_t* rp, rp_stream_t* st, char* word, long long stamp);
+int poll_streams(replay_t* rp, int timeout);
+int handle_stream_pdu(replay_t* rp, rp_stream_t* st, char* pdu, int hdr_len, int ctl);
+
+
+//*********************************
+//       REPLAY FUNCTIONS
+//*********************************
+long long run_replay(replay_t* rp);
+void report_replay(replay_t* rp, long long elapsed);
+
+
+//*********************************
+//         MISC FUNCTIONS
+//*********************************
+long long get_time_ns();
+uint64_t get_le(const unsigned char* p, int len);
+int write_all(int fd, const char* buf, int len);
+int get_header(char* hdr, int len, char* name, char* value, int size);
+
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+
+#include "decoder.h"
+#include "metrics.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define SQ_HIGH_WATERMARK (64 * 1024)
+#define SQ_LOW_WATERMARK  (16 * 1024)
+#define SQ_MAX_IOV        64
+
+
+//*********************************
+//     POLICY FOR SLOW CONTACTS
+//*********************************
+#define SQ_POLICY_DROP       0x01
+#define SQ_POLICY_DISCONNECT 0x02
+#define SQ_POLICY_COALESCE   0x03
+
+#define SQ_POLICY_NAME_DROP       "drop"
+#define SQ_POLICY_NAME_DISCONNECT "disconnect"
+#define SQ_POLICY_NAME_COALESCE   "coalesce"
+
+
+/*!
+ * Entry of an outbound queue referencing a prepared PDU.
+ */
+typedef struct send_entry
+{
+    wire_pdu_t* wp;          //!< prepared pdu (one reference is held)
+    struct send_entry* next; //!< next entry in the queue
+} send_entry_t;
+
+
+/*!
+ * Structure of an outbound queue.
+ * PDUs are queued until the socket of the contact becomes writable.
+ * If more than SQ_HIGH_WATERMARK bytes are queued, the contact is
+ * considered as congested until less than SQ_LOW_WATERMARK bytes
+ * are left.
+ */
+typedef struct send_queue
+{
+    send_entry_t* head; //!< first entry, which is written next
+    send_entry_t* tail; //!< last entry
+    int off;            //!< bytes of the first entry already written
+    int len;            //!< amount of queued entries
+    int bytes;          //!< amount of bytes not written yet
+    int congested;      //!< high watermark has been exceeded
+    int dropped;        //!< amount of pdus dropped due to congestion
+    mt_counters_t* mt;  //!< counters of the contact owning the queue, NULL if none
+} send_queue_t;
+
+
+//*********************************
+//        QUEUE FUNCTIONS
+//*********************************
+void init_send_queue(send_queue_t* sq);
+void free_send_queue(send_queue_t* sq);
+void drop_send_queue(send_queue_t* sq, int content_type, int limit);
+int push_send_queue(send_queue_t* sq, wire_pdu_t* wp, int policy);
+int flush_send_queue(int fd, send_queue_t* sq);
+ssize_t send_file_content(int fd, wire_pdu_t* wp, int off);
+int parse_send_policy(char* name);
+
+
+#endif
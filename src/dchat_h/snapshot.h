@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define SNAP_MAX_READERS 16   // threads reading snapshots
+
+
+/*!
+ * Structure of a contact in a snapshot of the contactlist.
+ */
+typedef struct cl_entry
+{
+    int n;                            //!< index of the contact in the contactlist
+    contact_handle_t h;               //!< handle of the contact
+    char name[MAX_NICKNAME + 1];      //!< nickname
+    char onion_id[ONION_ADDRLEN + 1]; //!< onion address of hidden service
+    uint16_t lport;                   //!< listening port of hidden service
+} cl_entry_t;
+
+
+/*!
+ * Structure of an immutable snapshot of the connected contacts.
+ * Snapshots are published by the main loop whenever the contactlist
+ * has changed and read by other threads without locks. A replaced
+ * snapshot is freed as soon as no reader can still access it.
+ */
+typedef struct cl_snapshot
+{
+    uint64_t version;          //!< version of the contactlist
+    uint64_t retired;          //!< epoch the snapshot has been replaced in
+    struct cl_snapshot* next;  //!< next replaced snapshot, not freed yet
+    int count;                 //!< amount of contacts
+    cl_entry_t entry[];        //!< connected contacts
+} cl_snapshot_t;
+
+
+//*********************************
+//        WRITER FUNCTIONS
+//*********************************
+void touch_cl_snapshot();
+cl_snapshot_t* publish_cl_snapshot();
+void destroy_cl_snapshots();
+
+
+//*********************************
+//        READER FUNCTIONS
+//*********************************
+cl_snapshot_t* enter_cl_snapshot();
+void leave_cl_snapshot();
+
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define TM_TICK_MS 10 // resolution of the timers
+#define TM_BITS    6  // slots per level as power of two
+#define TM_SLOTS   (1 << TM_BITS)
+#define TM_MASK    (TM_SLOTS - 1)
+#define TM_LEVELS  4  // timers expire within TM_SLOTS^TM_LEVELS ticks (~46h)
+
+
+/*!
+ * Structure of a timer. Timers are embedded in the structure they
+ * belong to and linked into the slots of the timer wheel, thus arming
+ * and cancelling a timer never allocates memory. A timer must not be
+ * moved in memory while it is armed.
+ */
+typedef struct tm_timer
+{
+    struct tm_timer* next;   //!< next timer in the same slot
+    struct tm_timer** pprev; //!< link pointing to this timer, NULL if not armed
+    uint64_t expires;        //!< tick when the timer expires
+    void (*cb)(void*);       //!< callback invoked when the timer expires
+    void* arg;               //!< argument of the callback
+} tm_timer_t;
+
+
+/*!
+ * Structure of a hierarchical timer wheel. Level 0 holds the timers
+ * expiring within the next TM_SLOTS ticks, one slot per tick. Each
+ * higher level covers TM_SLOTS times the range of the level below and
+ * its slots are cascaded to the level below, whenever the level below
+ * has completed a round.
+ */
+typedef struct tm_wheel
+{
+    tm_timer_t* slot[TM_LEVELS][TM_SLOTS]; //!< lists of timers
+    uint64_t tick;                         //!< next tick to be processed
+    int armed;                             //!< amount of armed timers
+} tm_wheel_t;
+
+
+//*********************************
+//        TIMER FUNCTIONS
+//*********************************
+void init_timers();
+void init_timer(tm_timer_t* t, void (*cb)(void*), void* arg);
+void arm_timer(tm_timer_t* t, long long ms);
+void cancel_timer(tm_timer_t* t);
+int timer_armed(tm_timer_t* t);
+int run_timers();
+
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <sys/types.h>
+
+#include "types.h"
+#include "decoder.h"
+
+
+//*********************************
+//          LIMITS
+//*********************************
+#define FT_CHUNK_LEN        MAX_CONTENT_LEN // bytes of a file sent per pdu
+#define FT_CHUNKS_PER_FLUSH 16              // chunks written per writable socket
+#define FT_CHUNKS_IN_FLIGHT 8               // chunks passed to a reactor at once
+#define FT_NOTSENT_LOWAT    (16 * 1024)     // unsent bytes buffered by a socket
+#define FT_PART_SUFFIX      ".part"         // suffix of partially received files
+#define FT_MAX_RECV         4               // files received from a contact at the same time
+#define FT_MAX_FILE_SIZE    ((int64_t) 1 << 32) // max. size of a received file (4 GiB)
+
+
+/*!
+ * Structure of a file sent to a contact.
+ * The file is offered first and streamed from the offset the contact
+ * requests by a "control/resume".
+ */
+typedef struct file_send
+{
+    int fd;                         //!< file descriptor of the file
+    char name[MAX_FILE_NAME + 1];   //!< name of the file offered
+    off_t size;                     //!< size of the file
+    off_t off;                      //!< offset of the next chunk
+    int accepted;                   //!< contact requested the file
+    struct file_send* next;         //!< next file sent to the contact
+} file_send_t;
+
+
+/*!
+ * Structure of a file received from a contact.
+ * Chunks are written to "<name>.part", which is renamed once the file
+ * has been received completely.
+ */
+typedef struct file_recv
+{
+    int fd;                         //!< file descriptor of the partial file
+    char name[MAX_FILE_NAME + 1];   //!< name of the file
+    off_t size;                     //!< size of the file
+    off_t off;                      //!< offset of the next chunk
+    struct file_recv* next;         //!< next file received from the contact
+} file_recv_t;
+
+
+/*!
+ * Structure of the file transfers of a contact.
+ */
+typedef struct transfers
+{
+    file_send_t* send;      //!< files sent, the first one is continued next
+    file_recv_t* recv;      //!< files received
+    int in_flight;          //!< chunks passed to the reactor of the contact (see: reactor.c)
+} transfers_t;
+
+
+//*********************************
+//       TRANSFER FUNCTIONS
+//*********************************
+int offer_file(int n, char* path);
+int receive_file_pdu(int n, dchat_pdu_t* pdu);
+int receive_resume(int n, dchat_pdu_t* pdu);
+int queue_file_chunk(int n);
+int send_file_chunks(int n);
+int has_file_chunks(contact_t* contact);
+void free_transfers(contact_t* contact);
+
+
+//*********************************
+//         MISC FUNCTIONS
+//*********************************
+wire_pdu_t* prepare_file_pdu(dchat_pdu_t* pdu, int fd, off_t off, int len);
+
+
+#endif
@@ -24,10 +24,20 @@
 #include <netinet/in.h>
 #include <time.h>
 #include "network.h"
+#include "event.h"
+#include "lfqueue.h"
+#include "contactindex.h"
+#include "timer.h"
+#include "metrics.h"
+#include "ratelimit.h"
 
 #define FRAME_BUF_LEN  4096
-#define INIT_CONTACTS  30
+#define CL_SLAB_SHIFT  5
+#define CL_SLAB_SIZE   (1 << CL_SLAB_SHIFT)
+#define CL_MAX_CONTACTS 0x100000 // indices fit into event ids (see: EV_ID_GEN)
 #define MAX_NICKNAME   31
+#define MAX_SERVER     63
+#define MAX_FILE_NAME  127
 
 
 //*********************************
@@ -47,9 +57,30 @@ typedef struct dchat_pdu
     uint16_t lport;                    //!< listening port of hidden service
     char nickname[MAX_NICKNAME + 1];   //!< nickname of the client
     struct tm sent;                    //!< receive time of pdu (Date header)
-    char* server;                      //!< type of server that crafted this pdu
+    char server[MAX_SERVER + 1];       //!< type of server that crafted this pdu
+    uint64_t msg_id;                   //!< id of a relayed message, 0 if not set
+    int ttl;                           //!< hops a message may still be relayed
+    char origin[MAX_NICKNAME + 1];     //!< nickname of the author of a relayed message
+    float accept_version;              //!< highest version of DChat the peer accepts
+    int accept_encoding;               //!< content-encoding the peer accepts (see: ENC_ID_*)
+    int encoding;                      //!< content-encoding of the content, 0 if none
+    char file_name[MAX_FILE_NAME + 1]; //!< name of a transferred file, empty if none
+    int64_t file_size;                 //!< size of the transferred file
+    int64_t file_offset;               //!< offset of the content in the transferred file
 } dchat_pdu_t;
 
+/*!
+ * Identity of a peer, which is transmitted only once per connection
+ * by DChat V2 frames and whenever it changes (see: framing.c).
+ */
+typedef struct dchat_session
+{
+    char onion_id[ONION_ADDRLEN + 1]; //!< onion address of hidden service
+    uint16_t lport;                   //!< listening port of hidden service
+    char nickname[MAX_NICKNAME + 1];  //!< nickname of the client
+    char server[MAX_SERVER + 1];      //!< type of server
+} dchat_session_t;
+
 /*!
  * Structure for contact information
  */
@@ -60,17 +91,41 @@ typedef struct contact
     uint16_t lport;                   //!< listening port of hidden service
     char name[MAX_NICKNAME + 1];      //!< nickname
     int accepted;                     //!< connect to or accepted contact?
+    struct pdu_reader* reader;        //!< buffer of received PDUs
+    struct send_queue* sq;            //!< outbound queue of PDUs
+    int used;                         //!< slot is used by a contact
+    uint32_t gen;                     //!< generation of the slot
+    int next_free;                    //!< next slot of the free list
+    int v2;                           //!< PDUs are sent as DChat V2 frames
+    int deflate;                      //!< contents are sent compressed
+    dchat_session_t tx;               //!< identity sent by DChat V2 frames
+    struct transfers* ft;             //!< file transfers, NULL if none (see: transfer.c)
+    struct reactor* rt;               //!< reactor owning the socket, NULL if owned by the main loop
+    tm_timer_t keepalive;             //!< sends keepalives and evicts the idle contact
+    long long last_rx;                //!< time when the latest PDU has been received
+    int rtt;                          //!< smoothed round trip time in ms, 0 if unknown
+    mt_counters_t mt;                 //!< counters of the contact (see: metrics.c)
+    rl_state_t rl;                    //!< admission control of received PDUs (see: ratelimit.c)
+    int dropped;                      //!< socket has been shut down, since the contact is congested
 } contact_t;
 
+/*!
+ * Handle of a contact, combining the index of its slot and the
+ * generation of the slot (see: get_contact_handle()).
+ */
+typedef uint64_t contact_handle_t;
+
 /*!
  * Structure storing client contacts
  */
 typedef struct contactlist
 {
-    contact_t* contact;         //!< array of contacts
-    pthread_mutex_t cl_mx;      //!< mutex to signal lock
-    int cl_size;                //!< size of array
+    contact_t** slab;           //!< slabs of CL_SLAB_SIZE contacts
+    int slabs;                  //!< amount of slabs
+    int cl_size;                //!< amount of contact slots
     int used_contacts;          //!< elements used in contact array
+    int free_head;              //!< first slot of the free list, -1 if full
+    contact_index_t index;      //!< hash index of onion address and port
 } contactlist_t;
 
 /*!
@@ -82,12 +137,31 @@ typedef struct dchat_conf
     contact_t me;               //!< local contact information
     struct sockaddr_storage sa; //!< local socket address
     int acpt_fd;                //!< listening socket
+    ev_loop_t ev;               //!< event loop of the main thread
+    int sq_policy;              //!< policy for congested outbound queues
+    int direct;                 //!< connect without TOR (see: drct_parse())
+    struct sockaddr_in tor;     //!< SOCKS port of the TOR client (see: tor_parse())
+    int socks5;                 //!< stream isolation of SOCKS5, 0 for SOCKS4a (see: sck5_parse())
+    char* ui_dir;               //!< directory of the user interface sockets
+    int gossip;                 //!< exchange contact digests (see: gosp_parse())
+    int neighbours;             //!< max. neighbours in partial mesh mode, 0 for a full mesh
+    int binary;                 //!< negotiate DChat V2 frames (see: bnry_parse())
+    int compress;               //!< negotiate compression (see: zlib_parse())
+    char* file_dir;             //!< directory of received files, NULL to refuse files
+    int reactors;               //!< amount of reactor threads, 0 for none (see: thrd_parse())
+    char* hist_file;            //!< history file, NULL to disable the history (see: hist_parse())
+    char* peer_file;            //!< peer cache, NULL to disable the cache (see: peer_parse())
+    int keepalive;              //!< seconds between two keepalives, 0 for none (see: kpal_parse())
+    char* ev_backend;           //!< name of the event backend, NULL for the default (see: ev_init())
+    int rl_pdus;                //!< PDUs per second and contact, 0 for no limit (see: rate_parse())
+    int rl_bytes;               //!< bytes per second and contact, 0 for no limit
+    int rl_connects;            //!< connects per second to contacts advertised by a contact, 0 for no limit
+    rl_queue_t rq;              //!< contacts with PDUs left to decode or throttled (see: service_contacts())
+    char* capture_file;         //!< trace of sent and received PDUs, NULL for none (see: capt_parse())
     int in_fd, out_fd, log_fd;  //!< console input, output and log
-    int connect_fd[2];          //!< pipe to connector
-    int cl_change[2];           //!< pipe to signal wait loop from connect
-    int user_input[2];          //!< pipe to signal a new user input from stdin
-    pthread_t conn_th;          //!< thread responsible for new connections
-    pthread_t select_th;        //!< thread responsible for select(2) fd
+    lf_queue_t connect_q;       //!< connection requests to the main loop (see: request_connect())
+    lf_ring_t user_input;       //!< lines entered by the user to the main loop
+    pthread_t select_th;        //!< thread responsible for the event loop
 } dchat_conf_t;
 
 
@@ -98,4 +172,14 @@ typedef struct dchat_conf
 extern dchat_conf_t* _cnf; //!< pointer to global dchat configƒ
 
 
+//*********************************
+//             MACRO
+//*********************************
+#define CONTACT(N) (&_cnf->cl.slab[(N) >> CL_SLAB_SHIFT][(N) & (CL_SLAB_SIZE - 1)])
+#define CONTACT_HANDLE(N, GEN)   (((contact_handle_t)(GEN) << 32) | (uint32_t)(N))
+#define CONTACT_HANDLE_INDEX(H)  ((int)((H) & 0xFFFFFFFF))
+#define CONTACT_HANDLE_GEN(H)    ((uint32_t)((H) >> 32))
+#define CONTACT_EV_ID(N)         EV_ID_GEN(EV_SRC_CONTACT, (N), CONTACT(N)->gen)
+
+
 #endif
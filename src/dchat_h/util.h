@@ -35,5 +35,7 @@ int max(int a, int b);
 int file_exists(char* filename);
 char* remove_leading_spaces(char* value);
 int iszero(void* ptr, int n);
+long long get_time_ms();
+long long get_time_ns();
 
 #endif
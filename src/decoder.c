@@ -32,108 +32,181 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "dchat_h/decoder.h"
+#include "dchat_h/framing.h"
+#include "dchat_h/compress.h"
 #include "dchat_h/network.h"
 #include "dchat_h/util.h"
+#include "dchat_h/pool.h"
 #include "dchat_h/consoleui.h"
 
 
+//! headers of DChat V1, ordered by their id (see: HDR_ID_*)
+static const dchat_header_t _dchat_v1[HDR_AMOUNT] =
+{
+    HEADER(HDR_ID_VER, HDR_NAME_VER, 1, ver_str_to_pdu, ver_pdu_to_str),
+    HEADER(HDR_ID_CTT, HDR_NAME_CTT, 1, ctt_str_to_pdu, ctt_pdu_to_str),
+    HEADER(HDR_ID_CTL, HDR_NAME_CTL, 1, ctl_str_to_pdu, ctl_pdu_to_str),
+    HEADER(HDR_ID_ONI, HDR_NAME_ONI, 1, oni_str_to_pdu, oni_pdu_to_str),
+    HEADER(HDR_ID_LNP, HDR_NAME_LNP, 1, lnp_str_to_pdu, lnp_pdu_to_str),
+    HEADER(HDR_ID_NIC, HDR_NAME_NIC, 0, nic_str_to_pdu, nic_pdu_to_str),
+    HEADER(HDR_ID_DAT, HDR_NAME_DAT, 0, dat_str_to_pdu, dat_pdu_to_str),
+    HEADER(HDR_ID_SRV, HDR_NAME_SRV, 0, srv_str_to_pdu, srv_pdu_to_str),
+    HEADER(HDR_ID_MID, HDR_NAME_MID, 0, mid_str_to_pdu, mid_pdu_to_str),
+    HEADER(HDR_ID_TTL, HDR_NAME_TTL, 0, ttl_str_to_pdu, ttl_pdu_to_str),
+    HEADER(HDR_ID_ORG, HDR_NAME_ORG, 0, org_str_to_pdu, org_pdu_to_str),
+    HEADER(HDR_ID_ACV, HDR_NAME_ACV, 0, acv_str_to_pdu, acv_pdu_to_str),
+    HEADER(HDR_ID_ACE, HDR_NAME_ACE, 0, ace_str_to_pdu, ace_pdu_to_str),
+    HEADER(HDR_ID_CEN, HDR_NAME_CEN, 0, cen_str_to_pdu, cen_pdu_to_str),
+    HEADER(HDR_ID_FNM, HDR_NAME_FNM, 0, fnm_str_to_pdu, fnm_pdu_to_str),
+    HEADER(HDR_ID_FSZ, HDR_NAME_FSZ, 0, fsz_str_to_pdu, fsz_pdu_to_str),
+    HEADER(HDR_ID_FOF, HDR_NAME_FOF, 0, fof_str_to_pdu, fof_pdu_to_str)
+};
+
+#define HEADER_BY_ID(ID) (&_dchat_v1[(ID) - 1])
+
+//! content-types of DChat, ordered by their id (see: CTT_ID_*)
+static const dchat_content_type_t _dchat_ctt[CTT_AMOUNT] =
+{
+    CONTENT_TYPE(CTT_ID_TXT, CTT_NAME_TXT),
+    CONTENT_TYPE(CTT_ID_BIN, CTT_NAME_BIN),
+    CONTENT_TYPE(CTT_ID_DSC, CTT_NAME_DSC),
+    CONTENT_TYPE(CTT_ID_RPY, CTT_NAME_RPY),
+    CONTENT_TYPE(CTT_ID_DGT, CTT_NAME_DGT),
+    CONTENT_TYPE(CTT_ID_RSM, CTT_NAME_RSM),
+    CONTENT_TYPE(CTT_ID_KAL, CTT_NAME_KAL)
+};
+
+
 /**
- *  Decodes a string into a DChat header.
- *  Attempts to decode the given \\n terminated line and sets
- *  corresponding header attributes in the given pdu.
- *  @param pdu  Pointer to PDU structure where header attributes
- *  will be set
- *  @param line Line to parse for dchat-headers; must be \\n terminated
- *  @return 0 if line is a dchat header, -1 otherwise
+ *  Looks up a DChat V1 header by its name.
+ *  The names of all headers differ in their length or in their first
+ *  character, thus at most one name has to be compared.
+ *  @param key Name of the header (need not be '\\0' terminated)
+ *  @param len Length of the name
+ *  @return Pointer to the header or NULL if there is no such header
  */
-int
-decode_header(dchat_pdu_t* pdu, char* line)
+const dchat_header_t*
+find_header(const char* key, int len)
 {
-    char* temp;
-    char* key;          // header key (e.g. Content-Type)
-    char* value;        // header value (e.g. text/plain)
-    char* delim = ":";  // delimiter char
-    char* save_ptr;     // used for strtok
-    int len;            // length of value
-    int end;            // index of termination chars (\r)\n of value
-    int ret;            // return of parsed value
-    dchat_v1_t proto;   // DChat V1 headers
+    const dchat_header_t* hdr;
 
-    if (line == NULL)
+    switch (len)
     {
-        return -1;
-    }
+        case sizeof(HDR_NAME_ONI) - 1: // Host, Date
+            hdr = key[0] == 'H' ? HEADER_BY_ID(HDR_ID_ONI) : HEADER_BY_ID(HDR_ID_DAT);
+            break;
 
-    // copy line to work with
-    temp = malloc(strlen(line) + 1);
+        case sizeof(HDR_NAME_VER) - 1:
+            hdr = HEADER_BY_ID(HDR_ID_VER);
+            break;
 
-    if (temp == NULL)
-    {
-        ui_fatal("Memory allocation for temporary decoder line failed!");
-    }
+        case sizeof(HDR_NAME_SRV) - 1: // Server, Origin
+            hdr = key[0] == 'S' ? HEADER_BY_ID(HDR_ID_SRV) : HEADER_BY_ID(HDR_ID_ORG);
+            break;
 
-    temp[0] = '\0';
-    strcat(temp, line);
+        case sizeof(HDR_NAME_MID) - 1:
+            hdr = HEADER_BY_ID(HDR_ID_MID);
+            break;
 
-    // split line: header format -> key:value
-    if ((key = strtok_r(temp, delim, &save_ptr)) == NULL)
-    {
-        free(temp);
-        return -1;
-    }
+        case sizeof(HDR_NAME_TTL) - 1:
+            hdr = HEADER_BY_ID(HDR_ID_TTL);
+            break;
 
-    // value token is NULL
-    if (save_ptr == NULL)
-    {
-        free(temp);
-        return -1;
+        case sizeof(HDR_NAME_NIC) - 1: // Nickname, Filename
+            hdr = key[0] == 'N' ? HEADER_BY_ID(HDR_ID_NIC) : HEADER_BY_ID(HDR_ID_FNM);
+            break;
+
+        case sizeof(HDR_NAME_FSZ) - 1:
+            hdr = HEADER_BY_ID(HDR_ID_FSZ);
+            break;
+
+        case sizeof(HDR_NAME_LNP) - 1: // Listen-Port, File-Offset
+            hdr = key[0] == 'L' ? HEADER_BY_ID(HDR_ID_LNP) : HEADER_BY_ID(HDR_ID_FOF);
+            break;
+
+        case sizeof(HDR_NAME_CTT) - 1:
+            hdr = HEADER_BY_ID(HDR_ID_CTT);
+            break;
+
+        case sizeof(HDR_NAME_CTL) - 1: // Content-Length, Accept-Version
+            hdr = key[0] == 'C' ? HEADER_BY_ID(HDR_ID_CTL) : HEADER_BY_ID(HDR_ID_ACV);
+            break;
+
+        case sizeof(HDR_NAME_ACE) - 1:
+            hdr = HEADER_BY_ID(HDR_ID_ACE);
+            break;
+
+        case sizeof(HDR_NAME_CEN) - 1:
+            hdr = HEADER_BY_ID(HDR_ID_CEN);
+            break;
+
+        default:
+            return NULL;
     }
 
-    // key is the very first token of line, whereas
-    // value contains the rest of the line string (inc. possible delim chars e.g. date header)
-    value = save_ptr;
+    return memcmp(key, hdr->header_name, len) ? NULL : hdr;
+}
+
+
+/**
+ *  Decodes a string into a DChat header.
+ *  Attempts to decode the given \\n terminated line and sets
+ *  corresponding header attributes in the given pdu. The line is parsed
+ *  in place: its value is terminated temporarily while it is parsed,
+ *  afterwards the line is restored.
+ *  @param pdu  Pointer to PDU structure where header attributes
+ *  will be set
+ *  @param line Line to parse for dchat-headers; must be \\n terminated
+ *  @param len  Length of the line including the termination characters
+ *  @return 0 if line is a dchat header, -1 otherwise
+ */
+int
+decode_header(dchat_pdu_t* pdu, char* line, int len)
+{
+    const dchat_header_t* hdr; // header of the line
+    char* sep;                 // delimiter between key and value
+    int end;                   // index of termination chars (\r)\n of value
+    char term;                 // first termination character
+    int ret;                   // return of parsed value
 
-    // first character must be a whitespace
-    if (strncmp(value, " ", 1) != 0)
+    // line must end with \n
+    if (line == NULL || len < 1 || line[len - 1] != '\n')
     {
-        free(temp);
         return -1;
     }
 
-    // skip " "
-    value++;
+    end = len - 1;
 
-    if ((ret = is_valid_termination(value)) == -1)
+    if (end > 0 && line[end - 1] == '\r')
     {
-        free(temp);
-        return -1;
+        end--;
     }
 
-    // remove termination characters
-    value[ret] = '\0';
-
-    if (init_dchat_v1(&proto) == -1)
+    // split line: header format -> key: value
+    // value contains the rest of the line (inc. possible delim chars e.g. date header)
+    if ((sep = memchr(line, ':', end)) == NULL || sep[1] != ' ')
     {
-        free(temp);
         return -1;
     }
 
-    // iterate through headers and check if value is valid
-    // if valid parse value and set attributes in the PDU
-    for (int i = 0; i < HDR_AMOUNT; i++)
+    if ((hdr = find_header(line, sep - line)) == NULL)
     {
-        if (!strcmp(key, proto.header[i].header_name))
-        {
-            ret = proto.header[i].str_to_pdu(value, pdu);
-            free(temp);
-            return ret;
-        }
+        return -1;
     }
 
-    free(temp);
-    return -1;
+    // parse value, which begins after ": "
+    term = line[end];
+    line[end] = '\0';
+    ret = hdr->str_to_pdu(sep + 2, pdu);
+    line[end] = term;
+    return ret;
 }
 
 
@@ -188,305 +261,999 @@ read_line(int fd, char** line)
 
 
 /**
- *  Read a whole DChat PDU from a file descriptor.
- *  Read linewise from a file descriptor to form a DChat protocol data unit.
- *  Information read from the file descriptor will be stored in this pdu.
- *  @param fd  File descriptor to read from
- *  @param pdu Pointer to a PDU structure whose headers will be filled.
- *  @return amount of bytes read in total if a protocol data unit has been read successfully, 0 on EOF ,
- *  -1 on error
+ *  Initializes a PDU reader.
+ *  A PDU reader buffers the bytes received from a file descriptor and
+ *  decodes them incrementally, so that partially received PDUs never
+ *  block the caller.
+ *  @param rd Pointer to the PDU reader to initialize
  */
-int
-read_pdu(int fd, dchat_pdu_t* pdu)
-{
-    char* line;     // line read from file descriptor
-    char* contentp; // content pointer
-    int ret;        // return value
-    int b;          // amount of bytes read as content
-    int len = 0;    // amount of bytes read in total
-    // zero out structure
-    memset(pdu, 0, sizeof(*pdu));
+void
+init_pdu_reader(pdu_reader_t* rd)
+{
+    memset(rd, 0, sizeof(*rd));
+    rd->state = RD_STATE_HEADER;
+}
+
 
-    // read each line of the received pdu
-    if ((ret = read_line(fd, &line)) == -1 || !ret)
+/**
+ *  Frees all resources of a PDU reader including the PDU that is
+ *  currently decoded.
+ *  @param rd Pointer to the PDU reader
+ */
+void
+free_pdu_reader(pdu_reader_t* rd)
+{
+    if (rd != NULL)
     {
-        return ret;
+        free_pdu(&rd->pdu);
+        init_pdu_reader(rd);
     }
+}
+
+
+/**
+ *  Fills the receive buffer of a PDU reader.
+ *  Bytes of a PDU that has not been decoded completely are moved to the
+ *  beginning of the buffer, afterwards as many bytes as fit into the buffer
+ *  are read with a single non-blocking recv(2), or from the bytes the event
+ *  loop has received already (see: ev_recv()).
+ *  @param loop Event loop the socket is registered with EV_RECV, or NULL
+ *  @param fd   File descriptor to read from
+ *  @param rd   Pointer to the PDU reader
+ *  @return amount of bytes read, 0 on EOF, -1 on error or -2 if no data
+ *  is available at the moment
+ */
+int
+fill_pdu_reader(ev_loop_t* loop, int fd, pdu_reader_t* rd)
+{
+    int ret;
 
-    // first header must be version header
-    if (decode_header(pdu, line) == -1 || pdu->version != DCHAT_V1)
+    // reclaim space of already decoded bytes
+    if (rd->head > 0)
     {
-        ret = -1;
+        memmove(rd->buf, rd->buf + rd->head, rd->tail - rd->head);
+        rd->tail -= rd->head;
+        rd->head = 0;
     }
 
-    if (ret != -1)
+    // a buffered PDU never exceeds the buffer, see read_pdu()
+    if (rd->tail == RECV_BUF_LEN)
     {
-        len += strlen(line);
-        free(line);
+        return -2;
+    }
 
-        // read header lines from file descriptors, until
-        // an empty line is received
-        while ((ret = read_line(fd, &line)) != -1 || ret == 0)
+    if ((ret = loop != NULL ? ev_recv(loop, fd, rd->buf + rd->tail, RECV_BUF_LEN - rd->tail) :
+                recv(fd, rd->buf + rd->tail, RECV_BUF_LEN - rd->tail, MSG_DONTWAIT)) == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
         {
-            len += strlen(line);
-
-            if (decode_header(pdu, line) == -1)
-            {
-                // if line is not a header, it must be an empty line
-                if (!strcmp(line, "\n") || !strcmp(line, "\r\n"))
-                {
-                    break; // All headers have been read
-                }
-
-                ret = -1;
-                break;
-            }
-
-            free(line);
+            return -2;
         }
+
+        return -1;
     }
 
-    // On error print illegal line
-    if (ret == -1)
+    rd->tail += ret;
+    return ret;
+}
+
+
+/**
+ *  Lets a PDU reader skip the SOCKS5 reply, which precedes the first PDU
+ *  on connections, whose initial PDUs have been sent right behind the
+ *  SOCKS5 request (see: finish_connect()).
+ *  @param rd        Pointer to the PDU reader
+ *  @param isolation Stream isolation of the request (see: SOCKS_ISO_NONE)
+ */
+void
+expect_socks5_reply(pdu_reader_t* rd, int isolation)
+{
+    rd->state = RD_STATE_SOCKS;
+    rd->socks = isolation;
+}
+
+
+/**
+ *  Decodes the SOCKS5 reply from the receive buffer of a PDU reader.
+ *  @param rd Pointer to the PDU reader
+ *  @return 1 if the reply has been decoded, 0 if more data is required,
+ *  -1 if the connection request has failed
+ */
+static int
+read_socks5_reply(pdu_reader_t* rd)
+{
+    int status;
+    int ret;
+
+    if ((ret = decode_socks5(rd->buf + rd->head, rd->tail - rd->head,
+                             rd->socks != SOCKS_ISO_NONE, &status)) == -1)
+    {
+        ui_log(LOG_WARN, "TOR Connection to remote host failed. Status code: %d - '%s'",
+               status, parse_socks5_status(status));
+        return -1;
+    }
+    else if (!ret)
     {
-        ui_log(LOG_ERR, "Illegal PDU header received: '%s'", line);
+        return 0;
     }
 
-    // EOF or ERROR
-    if (ret <= 0)
+    rd->head += ret;
+    rd->state = RD_STATE_HEADER;
+    rd->socks = 0;
+    return 1;
+}
+
+
+/**
+ *  Decodes the next DChat PDU from the receive buffer of a PDU reader.
+ *  Header lines are decoded as soon as they are complete, the content is
+ *  copied as soon as Content-Length bytes have been received. Decoding
+ *  state is kept in the reader, thus this function never blocks. Call it
+ *  repeatedly after fill_pdu_reader() until it returns 0 to get all
+ *  complete PDUs.
+ *  @param rd  Pointer to the PDU reader
+ *  @param pdu Pointer to a PDU structure whose headers and content will be
+ *             set if a complete PDU has been decoded.
+ *  @return amount of bytes of the decoded PDU, 0 if more data is required,
+ *  -1 if an illegal PDU has been received
+ */
+int
+read_pdu(pdu_reader_t* rd, dchat_pdu_t* pdu)
+{
+    char* line;     // current header line
+    char* end;      // end of current header line
+    char term;      // character following the current header line
+    int ret;
+    int len;
+
+    // the SOCKS5 reply precedes the first PDU of optimistic connections
+    if (rd->state == RD_STATE_SOCKS && (ret = read_socks5_reply(rd)) != 1)
     {
-        free(line);
         return ret;
     }
 
+    // DChat V2 frames begin with a magic byte instead of the version header
+    while (rd->state == RD_STATE_HEADER && rd->len == 0 && rd->tail > rd->head &&
+           (unsigned char) rd->buf[rd->head] == V2_MAGIC)
+    {
+        if ((ret = read_frame(rd, pdu)) != -2)
+        {
+            return ret;
+        }
+    }
+
+    while (rd->state == RD_STATE_HEADER)
+    {
+        line = rd->buf + rd->head;
+
+        if ((end = memchr(line, '\n', rd->tail - rd->head)) == NULL)
+        {
+            // header lines must not exceed MAX_HEADERS_LEN in total
+            if (rd->len + rd->tail - rd->head >= MAX_HEADERS_LEN)
+            {
+                ui_log(LOG_ERR, "PDU headers exceed %d bytes!", MAX_HEADERS_LEN);
+                free_pdu_reader(rd);
+                return -1;
+            }
+
+            return 0;
+        }
+
+        len = end - line + 1;
+        rd->head += len;
+        rd->len += len;
+        // terminate line in place, the buffer has one spare byte
+        term = line[len];
+        line[len] = '\0';
+
+        // first header must be version header
+        if (rd->pdu.version == 0)
+        {
+            ret = decode_header(&rd->pdu, line, len) == -1 ||
+                  rd->pdu.version != DCHAT_V1 ? -1 : 0;
+        }
+        // if line is not a header, it must be an empty line
+        else if (!strcmp(line, "\n") || !strcmp(line, "\r\n"))
+        {
+            rd->state = RD_STATE_CONTENT;
+            ret = 0;
+        }
+        else
+        {
+            ret = decode_header(&rd->pdu, line, len);
+        }
+
+        if (ret == -1)
+        {
+            ui_log(LOG_ERR, "Illegal PDU header received: '%s'", line);
+        }
+
+        line[len] = term;
+
+        if (ret == -1 || rd->len > MAX_HEADERS_LEN)
+        {
+            free_pdu_reader(rd);
+            return -1;
+        }
+    }
+
     // has content type, onion-id and listen-port been specified?
-    if (pdu->content_type == 0 || pdu->onion_id == NULL || pdu->lport == 0)
+    if (rd->pdu.content_type == 0 || rd->pdu.onion_id[0] == '\0' ||
+        rd->pdu.lport == 0)
     {
         ui_log(LOG_ERR, "Mandatory PDU headers are missing!");
-        free(line);
+        free_pdu_reader(rd);
         return -1;
     }
 
+    // wait until the whole content has been received
+    if (rd->tail - rd->head < rd->pdu.content_length)
+    {
+        return 0;
+    }
+
     // allocate memory for content
-    pdu->content = malloc(pdu->content_length + 1);
-    contentp = pdu->content; // point to the beginning
+    if ((rd->pdu.content = pool_alloc(rd->pdu.content_length + 1)) == NULL)
+    {
+        ui_fatal("Memory allocation for PDU content failed!");
+    }
 
-    // read content frm file descriptor
-    // read x bytes defined by Content-Length
-    for (b = 0, contentp = pdu->content; b < pdu->content_length;
-         b++, contentp++, len++)
+    memcpy(rd->pdu.content, rd->buf + rd->head, rd->pdu.content_length);
+    rd->pdu.content[rd->pdu.content_length] = '\0'; // NULL terminate potential string
+    rd->head += rd->pdu.content_length;
+    len = rd->len + rd->pdu.content_length;
+    // hand over decoded pdu and reset decoding state
+    memcpy(pdu, &rd->pdu, sizeof(*pdu));
+    memset(&rd->pdu, 0, sizeof(rd->pdu));
+    rd->state = RD_STATE_HEADER;
+    rd->len = 0;
+
+    if (pdu->encoding && inflate_content(pdu) == -1)
     {
-        if ((ret = read(fd, contentp, 1)) == -1 || !ret)
-        {
-            free(pdu->content);
-            return ret;
-        }
+        ui_log(LOG_ERR, "Decompression of PDU content failed!");
+        free_pdu(pdu);
+        return -1;
     }
 
-    *contentp = '\0'; // NULL terminate potential string
-    return len; // amount of bytes read as content == content length
+    return len;
 }
 
 
 /**
- *  Crafts a DChat header string.
- *  Crafts a header string according to the given header_id (see: dchat_encoder.h) together
- *  with the header information stored in the PDU structure.
+ *  Crafts a DChat header line.
+ *  Crafts a header line according to the given header_id (see: decoder.h) together
+ *  with the header information stored in the PDU structure. The line is written
+ *  to the given buffer and terminated with \\n. Like snprintf(3), the returned length
+ *  is the length the header line would have, even if it has been truncated.
  *  @param pdu       Pointer to a message structure that holds header information like
  *                   Content-Type, Content-Length, ...
- *  @param header_id Defines for which header a string should be crafted (Content-Type, ...)
- *  @return  Pointer to a header string (stored on heap -> must be freed) or NULL on error
- *           This string is not terminated with \\n or \\r\\n respectively
+ *  @param header_id Defines for which header a line should be crafted (Content-Type, ...)
+ *  @param buf       Buffer where the header line will be written to
+ *  @param size      Size of the buffer
+ *  @return length of the header line (excluding '\\0'), -2 if an optional header has
+ *          not been set in the PDU or -1 on error
  */
 int
-encode_header(dchat_pdu_t* pdu, int header_id, char** headerline)
+encode_header(dchat_pdu_t* pdu, int header_id, char* buf, int size)
 {
-    dchat_v1_t proto;    // DChat V1 headers
-    char* header = NULL; // header key string
-    char* value  = NULL; // header value string
-    int len;             // length of string in total
+    const dchat_header_t* hdr; // header to encode
+    int klen;                  // length of "key: "
+    int vlen;                  // length of value
     int ret;
 
-    if (init_dchat_v1(&proto) == -1)
+    if (header_id < 1 || header_id > HDR_AMOUNT)
+    {
+        return -1;
+    }
+
+    hdr = HEADER_BY_ID(header_id);
+    // seperate key from value -> "key: value"
+    klen = snprintf(buf, size, "%s: ", hdr->header_name);
+    ret = hdr->pdu_to_str(pdu, klen < size ? buf + klen : NULL,
+                          klen < size ? size - klen : 0);
+
+    // check if header is mandatory, if no value has been set
+    // in the pdu structure
+    if (ret == -2)
+    {
+        // if header is mandatory -> raise error
+        // otherwise just return and do nothing
+        return hdr->mandatory ? -1 : -2;
+    }
+
+    if (ret == -1)
+    {
+        return -1;
+    }
+
+    vlen = ret;
+
+    // terminate header line
+    if (klen + vlen + 1 < size)
+    {
+        buf[klen + vlen] = '\n';
+        buf[klen + vlen + 1] = '\0';
+    }
+
+    return klen + vlen + 1;
+}
+
+
+/**
+ * Encodes the headers of a PDU.
+ * Writes the version header, all other headers set in the PDU and the empty line,
+ * which separates the headers from the content, to the given buffer.
+ * (See specification of the dchat protocol)
+ * @param pdu  Pointer to a PDU structure holding the header data
+ * @param buf  Buffer where the headers will be written to
+ * @param size Size of the buffer
+ * @return length of the encoded headers or -1 if the headers are invalid or do
+ *         not fit into the buffer
+ */
+int
+encode_headers(dchat_pdu_t* pdu, char* buf, int size)
+{
+    int len = 0;      // length of headers so far
+    int ret;          // return value
+
+    // version header is always the first header
+    if ((ret = encode_header(pdu, HDR_ID_VER, buf, size)) < 0 || ret >= size)
     {
         return -1;
     }
 
+    len += ret;
+
     // iterate through supported headers
     for (int i = 0; i < HDR_AMOUNT; i++)
     {
-        if (proto.header[i].header_id == header_id)
+        // get header lines except version header, if set in pdu structure
+        if (_dchat_v1[i].header_id != HDR_ID_VER)
         {
-            header = proto.header[i].header_name;
-            len = strlen(header);
-
-            if ((ret = proto.header[i].pdu_to_str(pdu, &value)) == -1)
-            {
-                return -1;
-            }
+            ret = encode_header(pdu, _dchat_v1[i].header_id, buf + len, size - len);
 
-            // check if header is mandatory, if no value has been set
-            // in the pdu structure
-            if (ret == 1)
+            // header is optional and has not been set
+            if (ret == -2)
             {
-                // if header is mandatory -> raise error
-                // otherwise just return and do nothing
-                if (proto.header[i].mandatory)
-                {
-                    return -1;
-                }
-
-                return 1;
+                continue;
             }
 
-            len += strlen(value);
-            len += 4; // add three bytes for ':', a " ", '\n' and '\0';
-
-            // allocate memory for header string
-            if ((*headerline = malloc(len)) == NULL)
+            if (ret == -1 || ret >= size - len)
             {
-                ui_fatal("Memory allocation for header-value string failed!");
+                return -1;
             }
 
-            // assemble header string
-            *headerline[0] = '\0';
-            strncat(*headerline, header, strlen(header));
-            strncat(*headerline, ":", 1); // seperate key from value -> "key:value"
-            strncat(*headerline, " ", 1); // add a " " after the semicolon -> "key: value"
-            strncat(*headerline, value, strlen(value)); // add value
-            strncat(*headerline, "\n", 1);
-            // free converted pdu structure value
-            free(value);
-            return 0;
+            len += ret;
         }
     }
 
-    return -1;
+    // add empty line
+    if (len + 1 >= size)
+    {
+        return -1;
+    }
+
+    buf[len++] = '\n';
+    buf[len] = '\0';
+    return len;
 }
 
 
 /**
- * Converts a PDU to a string that will be written to a file descriptor.
- * Converts the given PDU to string which then will be written to the given file descriptor.
- * First the headers of the PDU will be written, then an empty line and at last the content.
- * (See specification of the dchat protocol)
+ * Writes a PDU to a file descriptor.
+ * The headers of the PDU are encoded into a buffer on the stack, afterwards
+ * headers and content are written with writev(2), thus the content is never
+ * copied. First the headers of the PDU will be written, then an empty line and
+ * at last the content. (See specification of the dchat protocol)
  * @param fd  File descriptor where the dchat PDU will be written to
  * @param pdu Pointer to a PDU structure holding the header and content data
- * @return Amount of bytes of content that that have been written. This should be equal
- *         to the value defined in the attribute "content_length" of the given PDU structure
- *         or -1 in case of error
+ * @return Amount of bytes that have been written (headers and content) or -1 in
+ *         case of error
  */
 int
 write_pdu(int fd, dchat_pdu_t* pdu)
 {
-    dchat_v1_t proto;                //Available DChat headers
-    char* header;                    //DChat header
-    char* pdu_raw;                   //Final PDU
-    int ret;                         //Return value
-    int pdulen=1;                    //Total length of PDU
+    char headers[MAX_HEADERS_LEN]; // encoded headers
+    struct iovec iov[2];           // headers and content
+    int len;                       // length of headers
 
-    if (init_dchat_v1(&proto) == -1)
+    if ((len = encode_headers(pdu, headers, sizeof(headers))) == -1)
     {
         return -1;
     }
 
-    // get version header string
-    if ((ret = encode_header(pdu, HDR_ID_VER, &header)) == -1 || ret == 1)
+    iov[0].iov_base = headers;
+    iov[0].iov_len  = len;
+    iov[1].iov_base = pdu->content;
+    iov[1].iov_len  = pdu->content_length;
+    return write_iov(fd, iov, pdu->content_length ? 2 : 1);
+}
+
+
+/**
+ * Prepares a PDU for being sent to several file descriptors.
+ * The PDU is encoded once into an immutable, reference counted wire buffer
+ * holding headers and content. The returned buffer has a reference count
+ * of 1 and must be released with unref_wire_pdu().
+ * @param pdu Pointer to a PDU structure holding the header and content data
+ * @return Pointer to the wire buffer or NULL in case of error
+ */
+wire_pdu_t*
+prepare_pdu(dchat_pdu_t* pdu)
+{
+    char headers[MAX_HEADERS_LEN]; // encoded headers
+    wire_pdu_t* wp;                // prepared pdu
+    int len;                       // length of headers
+
+    if ((len = encode_headers(pdu, headers, sizeof(headers))) == -1)
     {
-        return -1;
+        return NULL;
     }
 
-    pdulen += strlen(header);
-
-    if ((pdu_raw = malloc(pdulen)) == NULL)
+    if ((wp = pool_alloc(sizeof(*wp) + len + pdu->content_length)) == NULL)
     {
-        ui_fatal("Memory allocation for pdu failed!");
+        ui_fatal("Memory allocation for prepared PDU failed!");
     }
 
-    // copy version header to raw pdu
-    pdu_raw[0] = '\0';
-    strcat(pdu_raw, header);
-    free(header);
+    wp->refs = 1;
+    wp->len = len + pdu->content_length;
+    wp->content_type = pdu->content_type;
+    wp->v2 = NULL;
+    wp->deflated = NULL;
+    wp->file_fd = -1;
+    wp->file_off = 0;
+    wp->file_len = 0;
+    memcpy(wp->data, headers, len);
+    memcpy(wp->data + len, pdu->content, pdu->content_length);
+    return wp;
+}
 
-    // iterate through supported headers
-    for (int i = 0; i < HDR_AMOUNT; i++)
+
+/**
+ * Acquires a reference of a prepared PDU.
+ * @param wp Pointer to the prepared PDU
+ * @return the given prepared PDU
+ */
+wire_pdu_t*
+ref_wire_pdu(wire_pdu_t* wp)
+{
+    __sync_add_and_fetch(&wp->refs, 1);
+    return wp;
+}
+
+
+/**
+ * Releases a reference of a prepared PDU. The PDU will be freed if the
+ * last reference has been released. The file of a chunk is closed
+ * along with it (see: prepare_file_pdu()).
+ * @param wp Pointer to the prepared PDU
+ */
+void
+unref_wire_pdu(wire_pdu_t* wp)
+{
+    if (wp != NULL && !__sync_sub_and_fetch(&wp->refs, 1))
     {
-        // get header strings except version header, if set in pdu structure
-        if (proto.header[i].header_id != HDR_ID_VER)
+        if (wp->file_len)
         {
-            // get header string
-            if ((ret = encode_header(pdu, proto.header[i].header_id, &header)) == -1)
-            {
-                free(pdu_raw);
-                return -1;
-            }
+            close(wp->file_fd);
+        }
 
-            // if header was mandatory, but value was not set in pdu structure
-            // raise an error
-            if (ret == 1)
-            {
-                if (proto.header[i].mandatory)
-                {
-                    free(pdu_raw);
-                    return -1;
-                }
+        unref_wire_pdu(wp->v2);
+        unref_wire_pdu(wp->deflated);
+        pool_free(wp);
+    }
+}
+
+
+/**
+ * Writes a prepared PDU to a file descriptor.
+ * @param fd File descriptor where the prepared PDU will be written to
+ * @param wp Pointer to the prepared PDU
+ * @return Amount of bytes that have been written or -1 in case of error
+ */
+int
+write_wire_pdu(int fd, wire_pdu_t* wp)
+{
+    struct iovec iov;
+
+    iov.iov_base = wp->data;
+    iov.iov_len  = wp->len;
+    return write_iov(fd, &iov, 1);
+}
 
-                continue;
-            }
 
-            // (re)allocate memory for new header (excluding \0)
-            pdulen += strlen(header);
-            pdu_raw = realloc(pdu_raw, pdulen);
+/**
+ * Writes a vector of buffers to a file descriptor.
+ * Calls writev(2) until all buffers have been written completely.
+ * @param fd  File descriptor to write to
+ * @param iov Buffers to write, which will be modified by this function
+ * @param cnt Amount of buffers
+ * @return Amount of bytes written or -1 in case of error
+ */
+int
+write_iov(int fd, struct iovec* iov, int cnt)
+{
+    ssize_t ret;       // return value of writev
+    int written = 0;   // bytes written in total
 
-            if (pdu_raw == NULL)
+    while (cnt > 0)
+    {
+        if ((ret = writev(fd, iov, cnt)) == -1)
+        {
+            if (errno == EINTR)
             {
-                ui_fatal("Reallocation of pdu failed!");
+                continue;
             }
 
-            // copy header to pdu
-            strcat(pdu_raw, header);
-            free(header);
+            return -1;
+        }
+
+        written += ret;
+
+        // skip buffers that have been written completely
+        while (cnt > 0 && (size_t) ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+
+        if (cnt > 0)
+        {
+            iov->iov_base = (char*) iov->iov_base + ret;
+            iov->iov_len -= ret;
         }
     }
 
-    // (re)allocate memory for empty line and content
-    pdulen += pdu->content_length + 1;
-    pdu_raw = realloc(pdu_raw, pdulen);
+    return written;
+}
+
 
-    if (pdu_raw == NULL)
+/**
+ * Parses the given value to a supported version of DChat
+ * and sets, if valid, its value in the PDU structure.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid version, -1 otherwise
+ */
+int
+ver_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    char* version = "1.0";
+
+    if (!strcmp(value, version))
+    {
+        pdu->version = DCHAT_V1;
+        return 0;
+    }
+
+    return -1;
+}
+
+
+/**
+ * Parses the given value to a supported content-type of DChat
+ * and sets, if valid, its value in the PDU structure..
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid content-type, -1 otherwise
+ */
+int
+ctt_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    for (int i = 0; i < CTT_AMOUNT; i++)
+    {
+        if (!strcmp(value, _dchat_ctt[i].ctt_name))
+        {
+            pdu->content_type = _dchat_ctt[i].ctt_id;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+ * Parses the given value to a content-length and sets its
+ * value, if valid, in the given PDU structure.
+ * A valid content-length does not exceed MAX_CONTENT_LEN.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid content-length, -1 otherwise
+ */
+int
+ctl_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    int length = -1;
+    char* ptr;
+    // convert string to int
+    length = (int) strtol(value, &ptr, 10);
+
+    // check if its a valid content-length
+    if (ptr[0] != '\0' || !is_valid_content_length(length))
+    {
+        return -1;
+    }
+
+    pdu->content_length = length;
+    return 0;
+}
+
+
+/**
+ * Parses the given value to an onion address and sets its value
+ * , if valid, in the given PDU structure.
+ * A valid onion address is max. 16 characters long (22 characters
+ * including the prefix ".onion").
+ * @see is_valid_onion
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid onion address, -1 otherwise
+ */
+int
+oni_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    int len = strlen(value);
+
+    if (len != ONION_ADDRLEN || !is_valid_onion(value))
+    {
+        return -1;
+    }
+
+    // copy onion address bytes
+    pdu->onion_id[0] = '\0';
+    strncat(pdu->onion_id, value, ONION_ADDRLEN);
+    return 0;
+}
+
+
+/**
+ * Parses the given value to a listening port and sets its value,
+ * if valid, in the given PDU structure.
+ * @see is_valid_por
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid listening port, -1 otherwise
+ */
+int
+lnp_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    int lport;
+    char* ptr;
+    // convert string to int
+    lport = (int) strtol(value, &ptr, 10);
+
+    // check if it is a valid port
+    if (ptr[0] != '\0' || !is_valid_port(lport))
+    {
+        return -1;
+    }
+
+    pdu->lport = lport;
+    return 0;
+}
+
+
+/**
+ * Parses the given value to a nickname and sets its value,
+ * if valid, in the given PDU structure.
+ * MAX_NICKNAME characters will be copied to the PDU structure,
+ * thus if the given value is longer the rest will be cut off
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid nickname, -1 otherwise
+ */
+int
+nic_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    int len = strlen(value);
+    pdu->nickname[0] = '\0';
+
+    if (len > MAX_NICKNAME)
+    {
+        len = MAX_NICKNAME;
+    }
+
+    // copy whole nickname
+    strncat(pdu->nickname, value, len);
+    return 0;
+}
+
+
+/**
+ * Parses the given value to a struct tm and sets its value,
+ * if valid, in the given PDU structure
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid datetime string, -1 otherwise
+ */
+int
+dat_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    if (strptime(value, "%a, %d %b %Y %H:%M:%S GMT",
+                 &pdu->sent) == NULL)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Parses the given value to a server field and sets its value,
+ * if valid, in the given PDU structure.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid server string, -1 otherwise
+ */
+int
+srv_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    int len = strlen(value);
+    pdu->server[0] = '\0';
+
+    if (len > MAX_SERVER)
+    {
+        len = MAX_SERVER;
+    }
+
+    strncat(pdu->server, value, len);
+    return 0;
+}
+
+
+/**
+ * Parses the given value to a message id and sets its value,
+ * if valid, in the given PDU structure.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid message id, -1 otherwise
+ */
+int
+mid_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    char* end;
+
+    if (!isxdigit((unsigned char) value[0]))
+    {
+        return -1;
+    }
+
+    errno = 0;
+    pdu->msg_id = strtoull(value, &end, 16);
+
+    // message id 0 is not allowed, since it means "not set"
+    if (errno || *end != '\0' || pdu->msg_id == 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Parses the given value to a TTL and sets its value,
+ * if valid, in the given PDU structure.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid TTL between 1 and MAX_TTL, -1 otherwise
+ */
+int
+ttl_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    char* end;
+    long ttl;
+
+    ttl = strtol(value, &end, 10);
+
+    if (end == value || *end != '\0' || ttl < 1 || ttl > MAX_TTL)
+    {
+        return -1;
+    }
+
+    pdu->ttl = ttl;
+    return 0;
+}
+
+
+/**
+ * Parses the given value to the highest version of DChat accepted by
+ * the peer and sets its value, if valid, in the given PDU structure.
+ * Unknown versions are stored as well, since they are just ignored
+ * during the negotiation.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid version number, -1 otherwise
+ */
+int
+acv_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    char* end;
+    float version = strtof(value, &end);
+
+    if (end == value || *end != '\0' || version < DCHAT_V1)
+    {
+        return -1;
+    }
+
+    pdu->accept_version = version;
+    return 0;
+}
+
+
+/**
+ * Parses the given value to the content-encodings accepted by the peer
+ * and sets it, if valid, in the given PDU structure. The value is a
+ * comma separated list, unknown content-encodings are ignored.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a list of content-encodings, -1 otherwise
+ */
+int
+ace_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    char* enc = value;
+    int len;
+
+    while (*enc != '\0')
+    {
+        enc += strspn(enc, ", ");
+        len = strcspn(enc, ", ");
+
+        if (len == sizeof(ENC_NAME_DEFLATE) - 1 && !strncmp(enc, ENC_NAME_DEFLATE, len))
+        {
+            pdu->accept_encoding = ENC_ID_DEFLATE;
+        }
+
+        enc += len;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Parses the given value to the content-encoding of the content and
+ * sets it, if valid, in the given PDU structure.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a supported content-encoding, -1 otherwise
+ */
+int
+cen_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    if (!strcmp(value, ENC_NAME_DEFLATE) && compression_available())
+    {
+        pdu->encoding = ENC_ID_DEFLATE;
+        return 0;
+    }
+
+    return -1;
+}
+
+
+/**
+ * Parses the given value to the name of a transferred file and sets
+ * its value, if valid, in the given PDU structure.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid file name, -1 otherwise
+ */
+int
+fnm_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    if (!is_valid_file_name(value))
+    {
+        return -1;
+    }
+
+    pdu->file_name[0] = '\0';
+    strncat(pdu->file_name, value, MAX_FILE_NAME);
+    return 0;
+}
+
+
+/**
+ * Parses the given value to a non-negative file size or offset.
+ * @param value String to parse
+ * @param n     Pointer where the parsed value will be stored
+ * @return 0 if value is a valid file size or offset, -1 otherwise
+ */
+static int
+file_pos_str_to_int(char* value, int64_t* n)
+{
+    char* end;
+
+    if (!isdigit((unsigned char) value[0]))
+    {
+        return -1;
+    }
+
+    errno = 0;
+    *n = strtoll(value, &end, 10);
+
+    if (errno || *end != '\0')
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Parses the given value to the size of a transferred file and sets
+ * its value, if valid, in the given PDU structure.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid file size, -1 otherwise
+ */
+int
+fsz_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    return file_pos_str_to_int(value, &pdu->file_size);
+}
+
+
+/**
+ * Parses the given value to the offset of the content in a transferred
+ * file and sets its value, if valid, in the given PDU structure.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid file offset, -1 otherwise
+ */
+int
+fof_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    return file_pos_str_to_int(value, &pdu->file_offset);
+}
+
+
+/**
+ * Parses the given value to the nickname of the author of a relayed
+ * message and sets its value, if valid, in the given PDU structure.
+ * @param value String to parse
+ * @param pdu Pointer to PDU structure
+ * @return 0 if value is a valid nickname, -1 otherwise
+ */
+int
+org_str_to_pdu(char* value, dchat_pdu_t* pdu)
+{
+    if (!is_valid_nickname(value))
     {
-        ui_fatal("Reallocation of pdu failed!");
+        return -1;
     }
 
-    // add empty line
-    strcat(pdu_raw, "\n");
-    // add content
-    strncat(pdu_raw, pdu->content, pdu->content_length);
-    // exclude \0
-    pdulen--;
-    //write pdu to file descriptor
-    ret = write(fd, pdu_raw, strlen(pdu_raw));
-    free(pdu_raw);
-    return pdulen;
+    strcpy(pdu->origin, value);
+    return 0;
 }
 
 
 /**
- * Parses the given value to a supported version of DChat
- * and sets, if valid, its value in the PDU structure.
- * @param value String to parse
+ * Converts the version field in the PDU to a string and writes it to
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @return 0 if value is a valid version, -1 otherwise
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-ver_str_to_pdu(char* value, dchat_pdu_t* pdu)
+ver_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    char* version = "1.0";
+    // nothing has been set
+    if (pdu->version == 0)
+    {
+        return -2;
+    }
 
-    if (!strcmp(value, version))
+    // if version is V1
+    if (pdu->version == DCHAT_V1)
     {
-        pdu->version = DCHAT_V1;
-        return 0;
+        return snprintf(value, size, "%s", "1.0");
     }
 
     return -1;
@@ -494,464 +1261,423 @@ ver_str_to_pdu(char* value, dchat_pdu_t* pdu)
 
 
 /**
- * Parses the given value to a supported content-type of DChat
- * and sets, if valid, its value in the PDU structure..
- * @param value String to parse
+ * Converts the content-type field in the PDU to a string and writes it to
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @return 0 if value is a valid content-type, -1 otherwise
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-ctt_str_to_pdu(char* value, dchat_pdu_t* pdu)
+ctt_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    int found = 0;
-    dchat_content_types_t ctt;
-
-    if (init_dchat_content_types(&ctt) == -1)
+    // content type has not been set
+    if (pdu->content_type == 0)
     {
-        return -1;
+        return -2;
     }
 
+    // iterate through content-types and build a content type string
     for (int i = 0; i < CTT_AMOUNT; i++)
     {
-        if (!strcmp(value, ctt.type[i].ctt_name))
+        if (_dchat_ctt[i].ctt_id == pdu->content_type)
         {
-            pdu->content_type = ctt.type[i].ctt_id;
-            found = 1;
+            return snprintf(value, size, "%s", _dchat_ctt[i].ctt_name);
         }
     }
 
-    return found ? 0 : -1;
+    return -1;
 }
 
 
 /**
- * Parses the given value to a content-length and sets its
- * value, if valid, in the given PDU structure.
- * A valid content-length does not exceed MAX_CONTENT_LEN.
- * @param value String to parse
+ * Converts the content-length field in the PDU to a string and writes it to
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @return 0 if value is a valid content-length, -1 otherwise
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-ctl_str_to_pdu(char* value, dchat_pdu_t* pdu)
+ctl_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    int length = -1;
-    char* ptr;
-    // convert string to int
-    length = (int) strtol(value, &ptr, 10);
-
-    // check if its a valid content-length
-    if (ptr[0] != '\0' || !is_valid_content_length(length))
+    // check if content-length is valid
+    if (!is_valid_content_length(pdu->content_length))
     {
         return -1;
     }
 
-    pdu->content_length = length;
-    return 0;
+    return snprintf(value, size, "%d", pdu->content_length);
 }
 
 
 /**
- * Parses the given value to an onion address and sets its value
- * , if valid, in the given PDU structure.
- * A valid onion address is max. 16 characters long (22 characters
- * including the prefix ".onion").
- * @see is_valid_onion
- * @param value String to parse
+ * Converts the onion-id field in the PDU to a string and writes it to
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @return 0 if value is a valid onion address, -1 otherwise
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-oni_str_to_pdu(char* value, dchat_pdu_t* pdu)
+oni_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    int len = strlen(value);
+    // no onion-id has been set
+    if (pdu->onion_id[0] == '\0')
+    {
+        return -2;
+    }
 
-    if (len != ONION_ADDRLEN || !is_valid_onion(value))
+    // check if set onion id is valid
+    if (!is_valid_onion(pdu->onion_id))
     {
         return -1;
     }
 
-    // copy onion address bytes
-    pdu->onion_id[0] = '\0';
-    strncat(pdu->onion_id, value, ONION_ADDRLEN);
-    return 0;
+    return snprintf(value, size, "%s", pdu->onion_id);
 }
 
 
 /**
- * Parses the given value to a listening port and sets its value,
- * if valid, in the given PDU structure.
- * @see is_valid_por
- * @param value String to parse
+ * Converts the listening-port field in the PDU to a string and writes it to
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @return 0 if value is a valid listening port, -1 otherwise
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-lnp_str_to_pdu(char* value, dchat_pdu_t* pdu)
+lnp_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    int lport;
-    char* ptr;
-    // convert string to int
-    lport = (int) strtol(value, &ptr, 10);
+    // listening port has not been specified
+    if (pdu->lport == 0)
+    {
+        return -2;
+    }
 
-    // check if it is a valid port
-    if (ptr[0] != '\0' || !is_valid_port(lport))
+    // check if listening port is valid
+    if (!is_valid_port(pdu->lport))
     {
         return -1;
     }
 
-    pdu->lport = lport;
-    return 0;
+    return snprintf(value, size, "%d", pdu->lport);
 }
 
 
 /**
- * Parses the given value to a nickname and sets its value,
- * if valid, in the given PDU structure.
- * MAX_NICKNAME characters will be copied to the PDU structure,
- * thus if the given value is longer the rest will be cut off
- * @param value String to parse
+ * Converts the nickname field in the PDU to a string and writes it to
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @return 0 if value is a valid nickname, -1 otherwise
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-nic_str_to_pdu(char* value, dchat_pdu_t* pdu)
+nic_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    int len = strlen(value);
-    pdu->nickname[0] = '\0';
+    if (pdu->nickname[0] == '\0')
+    {
+        return -2;
+    }
 
-    if (len > MAX_NICKNAME)
+    if (!is_valid_nickname(pdu->nickname))
     {
-        len = MAX_NICKNAME;
+        return -1;
     }
 
-    // copy whole nickname
-    strncat(pdu->nickname, value, len);
-    return 0;
+    return snprintf(value, size, "%s", pdu->nickname);
 }
 
 
 /**
- * Parses the given value to a struct tm and sets its value,
- * if valid, in the given PDU structure
- * @param value String to parse
+ * Converts the sent field in the PDU to a string and writes it to
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @return 0 if value is a valid datetime string, -1 otherwise
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-dat_str_to_pdu(char* value, dchat_pdu_t* pdu)
+dat_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    if (strptime(value, "%a, %d %b %Y %H:%M:%S GMT",
-                 &pdu->sent) == NULL)
+    char date[100];
+
+    // check if date field is empty
+    if (iszero(&pdu->sent, sizeof(pdu->sent)))
     {
-        return -1;
+        return -2;
     }
 
-    return 0;
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &pdu->sent);
+    return snprintf(value, size, "%s", date);
 }
 
+
 /**
- * Parses the given value to a server field and sets its value,
- * if valid, in the given PDU structure.
- * @param value String to parse
+ * Converts the server field in the PDU to a string and writes it to
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @return 0 if value is a valid server string, -1 otherwise
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-srv_str_to_pdu(char* value, dchat_pdu_t* pdu)
+srv_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    if ((pdu->server = malloc(strlen(value) + 1)) == NULL)
+    if (pdu->server[0] == '\0')
     {
-        ui_fatal("Memory allocation for server failed!");
+        return -2;
     }
 
-    pdu->server[0] = '\0';
-    strcat(pdu->server, value);
-    return 0;
+    return snprintf(value, size, "%s", pdu->server);
 }
 
 
 /**
- * Converts the version field in the PDU to a string and sets the address of the given
- * value parameter to this string.
+ * Converts the message id in the PDU to a string and writes it to
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure
  */
 int
-ver_pdu_to_str(dchat_pdu_t* pdu, char** value)
+mid_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    char* version = "1.0";
-
-    // nothing has been set
-    if (pdu->version == 0)
-    {
-        return 1;
-    }
-
-    // if version is V1
-    if (pdu->version == DCHAT_V1)
+    if (pdu->msg_id == 0)
     {
-        *value = malloc(strlen(version) + 1);
-
-        if (*value == NULL)
-        {
-            ui_fatal("Memory allocation for version failed!");
-        }
-
-        *value[0] = '\0';
-        strcat(*value, version);
-        return 0;
+        return -2;
     }
 
-    return -1;
+    return snprintf(value, size, "%016" PRIx64, pdu->msg_id);
 }
 
 
 /**
- * Converts the content-type field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the TTL in the PDU to a string and writes it to
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-ctt_pdu_to_str(dchat_pdu_t* pdu, char** value)
+ttl_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    dchat_content_types_t content_types;
-    char* type;
-
-    // content type has not been set
-    if (pdu->content_type == 0)
+    if (pdu->ttl == 0)
     {
-        return 1;
+        return -2;
     }
 
-    // init available content types
-    if (init_dchat_content_types(&content_types) == -1)
+    if (pdu->ttl < 0 || pdu->ttl > MAX_TTL)
     {
         return -1;
     }
 
-    // iterate through content-types and build a content type string
-    for (int i = 0; i < CTT_AMOUNT; i++)
-    {
-        if (content_types.type[i].ctt_id == pdu->content_type)
-        {
-            type = content_types.type[i].ctt_name;
-            *value = malloc(strlen(type) + 1);
+    return snprintf(value, size, "%d", pdu->ttl);
+}
 
-            if (*value == NULL)
-            {
-                ui_fatal("Memory allocation for content-type failed!");
-            }
 
-            *value[0] = '\0';
-            strncat(*value, type, strlen(type));
-            return 0;
-        }
+/**
+ * Converts the highest version of DChat accepted by the local client
+ * to a string and writes it to the given buffer.
+ * @param pdu Pointer to PDU structure
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure
+ */
+int
+acv_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
+{
+    if (pdu->accept_version == 0)
+    {
+        return -2;
     }
 
-    return -1;
+    return snprintf(value, size, "%.1f", pdu->accept_version);
 }
 
 
 /**
- * Converts the content-length field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the content-encoding accepted by the local client to a string
+ * and writes it to the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-ctl_pdu_to_str(dchat_pdu_t* pdu, char** value)
+ace_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    // check if content-length is valid
-    if (!is_valid_content_length(pdu->content_length))
+    if (pdu->accept_encoding == 0)
     {
-        return -1;
+        return -2;
     }
 
-    *value = malloc(MAX_INT_STR + 1);
-
-    if (*value == NULL)
+    if (pdu->accept_encoding != ENC_ID_DEFLATE)
     {
-        ui_fatal("Memory allocation for content-length failed!");
+        return -1;
     }
 
-    snprintf(*value, MAX_INT_STR, "%d", pdu->content_length);
-    return 0;
+    return snprintf(value, size, "%s", ENC_NAME_DEFLATE);
 }
 
 
 /**
- * Converts the onion-id field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the name of a transferred file in the PDU to a string and
+ * writes it to the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-oni_pdu_to_str(dchat_pdu_t* pdu, char** value)
+fnm_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    // no onion-id has been set
-    if (pdu->onion_id[0] == '\0')
+    if (pdu->file_name[0] == '\0')
     {
-        return 1;
+        return -2;
     }
 
-    // check if set onion id is valid
-    if (!is_valid_onion(pdu->onion_id))
+    if (!is_valid_file_name(pdu->file_name))
     {
         return -1;
     }
 
-    //copy onion id
-    *value = malloc(strlen(pdu->onion_id) + 1);
-
-    if (*value == NULL)
-    {
-        ui_fatal("Memory allocation for onion-id failed!");
-    }
-
-    *value[0] = '\0';
-    strcat(*value, pdu->onion_id);
-    return 0;
+    return snprintf(value, size, "%s", pdu->file_name);
 }
 
 
 /**
- * Converts the listening-port field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the size of a transferred file in the PDU to a string and
+ * writes it to the given buffer. The size is only sent along with the
+ * name of the file.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-lnp_pdu_to_str(dchat_pdu_t* pdu, char** value)
+fsz_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    // listening port has not been specified
-    if (pdu->lport == 0)
+    if (pdu->file_name[0] == '\0')
     {
-        return 1;
+        return -2;
     }
 
-    // check if listening port is valid
-    if (!is_valid_port(pdu->lport))
+    if (pdu->file_size < 0)
     {
         return -1;
     }
 
-    *value = malloc(MAX_INT_STR + 1);
-
-    if (*value == NULL)
-    {
-        ui_fatal("Memory allocation for listening-port failed!");
-    }
-
-    snprintf(*value, MAX_INT_STR, "%d", pdu->lport);
-    return 0;
+    return snprintf(value, size, "%" PRId64, pdu->file_size);
 }
 
 
 /**
- * Converts the nickname field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the offset of the content in a transferred file in the PDU
+ * to a string and writes it to the given buffer. The offset is only
+ * sent along with the name of the file.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-nic_pdu_to_str(dchat_pdu_t* pdu, char** value)
+fof_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    if (pdu->nickname[0] == '\0')
+    if (pdu->file_name[0] == '\0')
     {
-        return 1;
+        return -2;
     }
 
-    if (!is_valid_nickname(pdu->nickname))
+    if (pdu->file_offset < 0 || pdu->file_offset > pdu->file_size)
     {
         return -1;
     }
 
-    //copy nickname
-    *value = malloc(strlen(pdu->nickname) + 1);
-
-    if (*value == NULL)
-    {
-        ui_fatal("Memory allocation for nickname failed!");
-    }
-
-    *value[0] = '\0';
-    strcat(*value, pdu->nickname);
-    return 0;
+    return snprintf(value, size, "%" PRId64, pdu->file_offset);
 }
 
 
 /**
- * Converts the sent field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the content-encoding of the content to a string and writes it
+ * to the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-dat_pdu_to_str(dchat_pdu_t* pdu, char** value)
+cen_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    int max_len = 100;
-
-    // check if date field is empty
-    if (iszero(&pdu->sent, sizeof(pdu->sent)))
+    if (pdu->encoding == 0)
     {
-        return 1;
+        return -2;
     }
 
-    *value = malloc(max_len);
-
-    if (*value == NULL)
+    if (pdu->encoding != ENC_ID_DEFLATE)
     {
-        ui_fatal("Memory allocation for date failed!");
+        return -1;
     }
 
-    *value[0] = '\0';
-    strftime(*value, max_len, "%a, %d %b %Y %H:%M:%S GMT", &pdu->sent);
-    return 0;
+    return snprintf(value, size, "%s", ENC_NAME_DEFLATE);
 }
 
 
 /**
- * Converts the server field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the author of a relayed message in the PDU to a string and
+ * writes it to the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer where the string will be written to (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return length of the string (like snprintf(3), it may exceed the size of the buffer),
+ * -2 if the field was not set in pdu structure, -1 in case of error (e.g. illegal value
+ * in pdu structure , ...)
  */
 int
-srv_pdu_to_str(dchat_pdu_t* pdu, char** value)
+org_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    if (pdu->server == NULL)
+    if (pdu->origin[0] == '\0')
     {
-        return 1;
+        return -2;
     }
 
-    *value = malloc(strlen(pdu->server) + 1);
-
-    if (*value == NULL)
+    if (!is_valid_nickname(pdu->origin))
     {
-        ui_fatal("Memory allocation for date failed!");
+        return -1;
     }
 
-    *value[0] = '\0';
-    strcat(*value, pdu->server);
-    return 0;
+    return snprintf(value, size, "%s", pdu->origin);
 }
 
 
@@ -968,24 +1694,7 @@ srv_pdu_to_str(dchat_pdu_t* pdu, char** value)
 int
 init_dchat_content_types(dchat_content_types_t* ctt)
 {
-    int temp_size;
-    int ctt_size;
-    dchat_content_type_t temp[] =
-    {
-        CONTENT_TYPE(CTT_ID_TXT, CTT_NAME_TXT),
-        CONTENT_TYPE(CTT_ID_BIN, CTT_NAME_BIN),
-        CONTENT_TYPE(CTT_ID_DSC, CTT_NAME_DSC),
-        CONTENT_TYPE(CTT_ID_RPY, CTT_NAME_RPY),
-    };
-    temp_size = sizeof(temp) / sizeof(temp[0]);
-
-    if (temp_size > CTT_AMOUNT)
-    {
-        return -1;
-    }
-
-    memset(ctt, 0, sizeof(*ctt));
-    memcpy(ctt->type, &temp, sizeof(temp));
+    memcpy(ctt->type, _dchat_ctt, sizeof(_dchat_ctt));
     return 0;
 }
 
@@ -1002,29 +1711,7 @@ init_dchat_content_types(dchat_content_types_t* ctt)
 int
 init_dchat_v1(dchat_v1_t* proto)
 {
-    int temp_size;
-    int proto_size;
-    // available headers
-    dchat_header_t temp[] =
-    {
-        HEADER(HDR_ID_VER, HDR_NAME_VER, 1, ver_str_to_pdu, ver_pdu_to_str),
-        HEADER(HDR_ID_CTT, HDR_NAME_CTT, 1, ctt_str_to_pdu, ctt_pdu_to_str),
-        HEADER(HDR_ID_CTL, HDR_NAME_CTL, 1, ctl_str_to_pdu, ctl_pdu_to_str),
-        HEADER(HDR_ID_ONI, HDR_NAME_ONI, 1, oni_str_to_pdu, oni_pdu_to_str),
-        HEADER(HDR_ID_LNP, HDR_NAME_LNP, 1, lnp_str_to_pdu, lnp_pdu_to_str),
-        HEADER(HDR_ID_NIC, HDR_NAME_NIC, 0, nic_str_to_pdu, nic_pdu_to_str),
-        HEADER(HDR_ID_DAT, HDR_NAME_DAT, 0, dat_str_to_pdu, dat_pdu_to_str),
-        HEADER(HDR_ID_SRV, HDR_NAME_SRV, 0, srv_str_to_pdu, srv_pdu_to_str)
-    };
-    temp_size = sizeof(temp) / sizeof(temp[0]);
-
-    if (temp_size > HDR_AMOUNT)
-    {
-        return -1;
-    }
-
-    memset(proto, 0, sizeof(*proto));
-    memcpy(proto->header, &temp, sizeof(temp));
+    memcpy(proto->header, _dchat_v1, sizeof(_dchat_v1));
     return 0;
 }
 
@@ -1091,19 +1778,7 @@ init_dchat_pdu(dchat_pdu_t* pdu, float version, int content_type,
     struct tm tm      = *gmtime(&now);
     memcpy(&pdu->sent, &tm, sizeof(struct tm));
     // set servername
-    char* package_name = PACKAGE_NAME;
-    char* package_version = PACKAGE_VERSION;
-    pdu->server = malloc(strlen(package_name)+strlen(package_version)+2);
-
-    if (pdu->server == NULL)
-    {
-        ui_fatal("Memory allocation for server failed!");
-    }
-
-    pdu->server[0] = '\0';
-    strcat(pdu->server, package_name);
-    strcat(pdu->server, "/");
-    strcat(pdu->server, package_version);
+    snprintf(pdu->server, sizeof(pdu->server), "%s/%s", PACKAGE_NAME, PACKAGE_VERSION);
     return 0;
 }
 
@@ -1117,7 +1792,7 @@ init_dchat_pdu(dchat_pdu_t* pdu, float version, int content_type,
 void
 init_dchat_pdu_content(dchat_pdu_t* pdu, char* content, int len)
 {
-    if ((pdu->content = malloc(len)) == NULL)
+    if ((pdu->content = pool_alloc(len)) == NULL)
     {
         ui_fatal("Memory allocation for PDU content failed!");
     }
@@ -1134,7 +1809,7 @@ init_dchat_pdu_content(dchat_pdu_t* pdu, char* content, int len)
 int
 is_valid_version(float version)
 {
-    if (version == DCHAT_V1)
+    if (version == DCHAT_V1 || version == DCHAT_V2)
     {
         return 1;
     }
@@ -1235,6 +1910,41 @@ is_valid_nickname(char* nickname)
 }
 
 
+/**
+ * Checks if the given name is a valid name of a transferred file.
+ * Since received files are stored under this name, it must neither
+ * contain a directory nor be hidden or contain control characters.
+ * @return 1 if valid, 0 otherwise.
+ */
+int
+is_valid_file_name(char* name)
+{
+    int len;
+
+    if (name == NULL || name[0] == '.')
+    {
+        return 0;
+    }
+
+    len = strlen(name);
+
+    if (len == 0 || len > MAX_FILE_NAME)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        if (name[i] == '/' || iscntrl((unsigned char) name[i]))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
 /**
  *  Frees all resources dynamically allocated for a PDU structure.
  *  This function frees the allocated memory for the content. In the
@@ -1246,15 +1956,7 @@ free_pdu(dchat_pdu_t* pdu)
 {
     if (pdu != NULL)
     {
-        if (pdu->content != NULL)
-        {
-            free(pdu->content);
-        }
-
-        if (pdu->server != NULL)
-        {
-            free(pdu->server);
-        }
+        pool_free(pdu->content);
     }
 }
 
@@ -1296,7 +1998,7 @@ get_content_part(dchat_pdu_t* pdu, int offset, char term, char** content)
     }
 
     // reserve enough space for line + \0
-    *content = malloc(line_end + 2); // +1 since its an index and +1 for \0
+    *content = pool_alloc(line_end + 2); // +1 since its an index and +1 for \0
 
     if (*content == NULL)
     {
@@ -0,0 +1,2130 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file event.c
+ *  This file contains the event loop used to wait for readable and writable
+ *  file descriptors.
+ *
+ *  Available backends are:
+ *
+ *  -) epoll(7) on Linux
+ *
+ *  -) io_uring(7) on Linux 5.11 and later, if requested (see: ev_init()),
+ *     which receives sockets registered with EV_RECV on Linux 6.0 and later
+ *     and accepts listening sockets registered with EV_ACCEPT on Linux 5.19
+ *     and later
+ *
+ *  -) kqueue(2) on BSD
+ *
+ *  -) select(2) as fallback, limited to FD_SETSIZE descriptors
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#define EV_HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/syscall.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#define EV_HAVE_URING
+#include <poll.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#endif
+
+#if defined(EV_HAVE_URING) && defined(IORING_RECV_MULTISHOT)
+#define EV_HAVE_URING_RECV
+#endif
+
+#if defined(EV_HAVE_URING) && defined(IORING_ACCEPT_MULTISHOT)
+#define EV_HAVE_URING_ACCEPT
+#endif
+
+#if defined(HAVE_SYS_EVENT_H) && defined(HAVE_KQUEUE)
+#define EV_HAVE_KQUEUE
+#include <sys/types.h>
+#include <sys/event.h>
+#endif
+
+#include "dchat_h/event.h"
+#include "dchat_h/consoleui.h"
+
+
+#ifdef EV_HAVE_EPOLL
+/**
+ * Creates the epoll instance of the given loop.
+ * @param loop Pointer to event loop
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_epoll_init(ev_loop_t* loop)
+{
+    if ((loop->fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Closes the epoll instance of the given loop.
+ * @param loop Pointer to event loop
+ */
+void
+ev_epoll_destroy(ev_loop_t* loop)
+{
+    close(loop->fd);
+    loop->fd = -1;
+}
+
+
+/**
+ * Adds, modifies or removes a file descriptor from the epoll instance.
+ * The id and the file descriptor are both stored in the event data, so that
+ * no lookup is necessary if the file descriptor becomes ready.
+ * @param loop   Pointer to event loop
+ * @param op     EV_CTL_ADD, EV_CTL_MOD or EV_CTL_DEL
+ * @param fd     File descriptor
+ * @param events EV_READ and/or EV_WRITE
+ * @param id     Identifier that will be reported together with the events
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_epoll_ctl(ev_loop_t* loop, int op, int fd, int events, int id)
+{
+    struct epoll_event ev;
+    int epop;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (events & EV_READ ? EPOLLIN : 0) |
+                (events & EV_WRITE ? EPOLLOUT : 0);
+    ev.data.u64 = ((uint64_t)(uint32_t) id << 32) | (uint32_t) fd;
+
+    switch (op)
+    {
+        case EV_CTL_ADD:
+            epop = EPOLL_CTL_ADD;
+            break;
+
+        case EV_CTL_MOD:
+            epop = EPOLL_CTL_MOD;
+            break;
+
+        default:
+            epop = EPOLL_CTL_DEL;
+    }
+
+    return epoll_ctl(loop->fd, epop, fd, &ev);
+}
+
+
+/**
+ * Waits for events on the epoll instance.
+ * @param loop    Pointer to event loop
+ * @param events  Array where ready events will be stored
+ * @param max     Size of the given array
+ * @param timeout Timeout in milliseconds, -1 blocks indefinitely
+ * @return amount of ready events, -1 in case of error
+ */
+int
+ev_epoll_wait(ev_loop_t* loop, ev_event_t* events, int max, int timeout)
+{
+    struct epoll_event ev[EV_MAX_EVENTS];
+    int n;
+
+    if (max > EV_MAX_EVENTS)
+    {
+        max = EV_MAX_EVENTS;
+    }
+
+    if ((n = epoll_wait(loop->fd, ev, max, timeout)) == -1)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        events[i].fd = (int)(uint32_t) ev[i].data.u64;
+        events[i].id = (int)(uint32_t)(ev[i].data.u64 >> 32);
+        events[i].events = 0;
+
+        // errors and hangups are reported as readable, so that the
+        // following read(2) returns the error or the EOF
+        if (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        {
+            events[i].events |= EV_READ;
+        }
+
+        if (ev[i].events & EPOLLOUT)
+        {
+            events[i].events |= EV_WRITE;
+        }
+    }
+
+    return n;
+}
+#endif
+
+
+#ifdef EV_HAVE_URING
+//! user data of requests whose completions are ignored
+#define EV_URING_IGNORE  UINT64_MAX
+//! flag in the user data of receive requests
+#define EV_URING_RECV    ((uint64_t) 1 << 63)
+//! flag in the user data of accept requests
+#define EV_URING_ACCEPT  ((uint64_t) 1 << 62)
+//! bits of the generation stored in the user data
+#define EV_URING_GEN_MASK 0x3FFFFFFF
+//! user data of the poll or multishot request of a file descriptor
+#define EV_URING_DATA(FD, GEN) ((((uint64_t)(GEN) & EV_URING_GEN_MASK) << 32) | (uint32_t)(FD))
+//! generation stored in the user data of a request
+#define EV_URING_GEN(DATA)     ((uint32_t)((DATA) >> 32) & EV_URING_GEN_MASK)
+//! group of the provided buffers
+#define EV_URING_BGID    0
+
+
+/**
+ * Invokes io_uring_enter(2), through the registered ring if the calling
+ * thread has registered it.
+ * @param u         Pointer to the state of the backend
+ * @param fd        File descriptor of the ring
+ * @param submit    Amount of submission queue entries to submit
+ * @param wait      Amount of completions to wait for
+ * @param flags     IORING_ENTER_* flags
+ * @param arg       Timeout (see: IORING_ENTER_EXT_ARG) or NULL
+ * @return amount of submitted entries, -1 in case of error
+ */
+static int
+uring_enter(ev_uring_t* u, int fd, unsigned submit, unsigned wait, unsigned flags,
+            struct io_uring_getevents_arg* arg)
+{
+#ifdef IORING_ENTER_REGISTERED_RING
+    if (u->ring_index >= 0 && pthread_equal(u->ring_owner, pthread_self()))
+    {
+        fd = u->ring_index;
+        flags |= IORING_ENTER_REGISTERED_RING;
+    }
+#endif
+
+    if (arg != NULL)
+    {
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    return (int) syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg,
+                         arg != NULL ? sizeof(*arg) : 0);
+}
+
+
+/**
+ * Submits the queued entries, which have not been consumed by the
+ * kernel yet. Must be called with the lock held.
+ * @param loop Pointer to event loop
+ * @return 0 on success, -1 in case of error
+ */
+static int
+uring_submit(ev_loop_t* loop)
+{
+    ev_uring_t* u = loop->data;
+    unsigned n = u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+
+    return !n || uring_enter(u, loop->fd, n, 0, 0, NULL) != -1 ? 0 : -1;
+}
+
+
+/**
+ * Returns the next free submission queue entry, which is cleared. The
+ * entry is queued by uring_push(). Must be called with the lock held.
+ * @param loop Pointer to event loop
+ * @return Pointer to the entry or NULL in case of error
+ */
+static struct io_uring_sqe*
+uring_sqe(ev_loop_t* loop)
+{
+    ev_uring_t* u = loop->data;
+    struct io_uring_sqe* sqe;
+
+    // the ring is full, let the kernel consume the entries queued so far
+    if (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries &&
+        uring_submit(loop) == -1)
+    {
+        return NULL;
+    }
+
+    sqe = &u->sqes[u->tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+
+/**
+ * Queues the entry returned by uring_sqe(), queued entries are submitted
+ * by the next wait. Must be called with the lock held.
+ * @param u Pointer to the state of the backend
+ */
+static void
+uring_push(ev_uring_t* u)
+{
+    __atomic_store_n(u->sq_tail, ++u->tail, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Sets the file of a submission queue entry. Files registered by
+ * ev_register_fds() are referred to by their slot, which saves the
+ * lookup of the file by the kernel. Must be called with the lock held.
+ * @param u   Pointer to the state of the backend
+ * @param sqe Submission queue entry
+ * @param fd  File descriptor
+ */
+static void
+uring_file(ev_uring_t* u, struct io_uring_sqe* sqe, int fd)
+{
+    int i;
+
+    for (i = 0; i < u->nfiles && u->files[i] != fd; i++);
+
+    sqe->fd = i < u->nfiles ? i : fd;
+    sqe->flags |= i < u->nfiles ? IOSQE_FIXED_FILE : 0;
+}
+
+
+/**
+ * Marks the requests of a file descriptor to be armed by the next wait.
+ * Must be called with the lock held.
+ * @param u  Pointer to the state of the backend
+ * @param fd File descriptor
+ */
+static void
+uring_mark(ev_uring_t* u, int fd)
+{
+    if (!u->reg[fd].dirty)
+    {
+        u->reg[fd].dirty = 1;
+        u->dirty[u->ndirty++] = fd;
+    }
+}
+
+
+/**
+ * Queues a submission queue entry, queued entries are submitted by the
+ * next wait. Must be called with the lock held.
+ * @param loop      Pointer to event loop
+ * @param opcode    IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE or IORING_OP_ASYNC_CANCEL
+ * @param fd        Polled file descriptor
+ * @param mask      Polled events
+ * @param addr      User data of the request to remove
+ * @param user_data User data reported with the completion
+ * @return 0 on success, -1 in case of error
+ */
+static int
+uring_queue(ev_loop_t* loop, int opcode, int fd, unsigned mask, uint64_t addr,
+            uint64_t user_data)
+{
+    struct io_uring_sqe* sqe;
+
+    if ((sqe = uring_sqe(loop)) == NULL)
+    {
+        return -1;
+    }
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+
+    if (fd >= 0)
+    {
+        uring_file(loop->data, sqe, fd);
+    }
+
+    sqe->poll32_events = mask;
+    sqe->addr = addr;
+    sqe->user_data = user_data;
+    uring_push(loop->data);
+    return 0;
+}
+
+
+#ifdef EV_HAVE_URING_RECV
+/**
+ * Returns a buffer to the ring of provided buffers. Must be called with
+ * the lock held.
+ * @param u   Pointer to the state of the backend
+ * @param bid Index of the buffer
+ */
+static void
+uring_give_buffer(ev_uring_t* u, int bid)
+{
+    struct io_uring_buf* b = &u->br->bufs[u->btail & (EV_URING_BUFS - 1)];
+
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t) bid * EV_URING_BUF_LEN);
+    b->len = EV_URING_BUF_LEN;
+    b->bid = bid;
+    __atomic_store_n(&u->br->tail, ++u->btail, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Registers the ring of provided buffers, which is used by the receive
+ * requests of sockets registered with EV_RECV. The buffers are allocated
+ * once the first of these sockets is registered. Must be called with the
+ * lock held.
+ * @param loop Pointer to event loop
+ * @return 0 on success, -1 if the kernel does not provide buffers (Linux 5.19)
+ */
+static int
+uring_init_buffers(ev_loop_t* loop)
+{
+    ev_uring_t* u = loop->data;
+    struct io_uring_buf_reg reg;
+    int i;
+
+    if ((u->br = mmap(NULL, EV_URING_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    {
+        u->br = NULL;
+        return -1;
+    }
+
+    if ((u->bufs = malloc((size_t) EV_URING_BUFS * EV_URING_BUF_LEN)) == NULL)
+    {
+        ui_fatal("Memory allocation for io_uring backend failed!");
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t) u->br;
+    reg.ring_entries = EV_URING_BUFS;
+    reg.bgid = EV_URING_BGID;
+
+    if (syscall(__NR_io_uring_register, loop->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+        munmap(u->br, EV_URING_BUFS * sizeof(struct io_uring_buf));
+        free(u->bufs);
+        u->br = NULL;
+        u->bufs = NULL;
+        return -1;
+    }
+
+    for (i = 0; i < EV_URING_BUFS; i++)
+    {
+        uring_give_buffer(u, i);
+    }
+
+    return 0;
+}
+
+
+/**
+ * Queues the multishot receive request of a socket, which picks buffers
+ * of the ring of provided buffers. Must be called with the lock held.
+ * @param loop Pointer to event loop
+ * @param fd   Socket
+ * @return 0 on success, -1 in case of error
+ */
+static int
+uring_queue_recv(ev_loop_t* loop, int fd)
+{
+    ev_uring_t* u = loop->data;
+    struct io_uring_sqe* sqe;
+
+    if ((sqe = uring_sqe(loop)) == NULL)
+    {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    uring_file(u, sqe, fd);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = EV_URING_BGID;
+    sqe->user_data = EV_URING_RECV | EV_URING_DATA(fd, u->reg[fd].rgen);
+    uring_push(u);
+    return 0;
+}
+
+
+/**
+ * Reads the buffers received for a file descriptor and returns the
+ * buffers, which have been read completely, to the ring of provided
+ * buffers. Must be called with the lock held.
+ * @param u   Pointer to the state of the backend
+ * @param r   Registration of the file descriptor
+ * @param buf Buffer to store the bytes, NULL to drop all received buffers
+ * @param len Size of the buffer
+ * @return amount of bytes read
+ */
+static size_t
+uring_read_buffers(ev_uring_t* u, ev_uring_fd_t* r, char* buf, size_t len)
+{
+    size_t n = 0;
+    size_t k;
+    int bid;
+
+    while ((buf == NULL || n < len) && r->nbufs)
+    {
+        bid = r->rhead;
+        k = (size_t)(u->blen[bid] - r->roff);
+        k = buf == NULL || k < len - n ? k : len - n;
+
+        if (buf != NULL)
+        {
+            memcpy(buf + n, u->bufs + (size_t) bid * EV_URING_BUF_LEN + r->roff, k);
+            n += k;
+        }
+
+        if ((r->roff += k) == u->blen[bid])
+        {
+            r->rhead = u->bnext[bid];
+            r->roff = 0;
+            r->nbufs--;
+            u->held--;
+            uring_give_buffer(u, bid);
+        }
+    }
+
+    return n;
+}
+
+
+/**
+ * Handles the completion of a receive request. Received buffers are
+ * queued, until they are read by ev_uring_recv(), and reported as
+ * readable by the following waits. Must be called with the lock held.
+ * @param u   Pointer to the state of the backend
+ * @param cqe Completion of the receive request
+ */
+static void
+uring_received(ev_uring_t* u, struct io_uring_cqe* cqe)
+{
+    int fd = (int)(uint32_t) cqe->user_data;
+    ev_uring_fd_t* r = fd < u->size ? &u->reg[fd] : NULL;
+    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    // buffers of removed sockets are returned at once
+    if (r == NULL || !r->used || EV_URING_GEN(cqe->user_data) != (r->rgen & EV_URING_GEN_MASK))
+    {
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+        {
+            uring_give_buffer(u, bid);
+        }
+
+        return;
+    }
+
+    // the request has terminated, it is rearmed if the socket is still read
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        r->rarmed = 0;
+        r->rcancel = 0;
+        uring_mark(u, fd);
+    }
+
+    if (cqe->res > 0 && cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        if (r->nbufs)
+        {
+            u->bnext[r->rtail] = bid;
+        }
+        else
+        {
+            r->rhead = bid;
+        }
+
+        u->blen[bid] = cqe->res;
+        r->rtail = bid;
+        r->nbufs++;
+        u->held++;
+    }
+    else if (!cqe->res)
+    {
+        r->reof = 1;
+    }
+    // the socket is polled until the ring has been refilled
+    else if (cqe->res == -ENOBUFS)
+    {
+        r->rstall = 1;
+        return;
+    }
+    // multishot receive requests require Linux 6.0
+    else if (cqe->res == -EINVAL)
+    {
+        u->norecv = 1;
+        return;
+    }
+    else if (cqe->res != -ECANCELED)
+    {
+        r->rerr = -cqe->res;
+    }
+    else
+    {
+        return;
+    }
+
+    if (!r->rready)
+    {
+        r->rready = 1;
+        u->ready[u->nready++] = fd;
+    }
+}
+#else
+// the headers lack multishot receive requests, sockets are always polled
+#define uring_init_buffers(LOOP)           (-1)
+#define uring_queue_recv(LOOP, FD)         (-1)
+#define uring_read_buffers(U, R, BUF, LEN) ((size_t) 0)
+#define uring_received(U, CQE)
+#endif
+
+
+#ifdef EV_HAVE_URING_ACCEPT
+/**
+ * Queues the multishot accept request of a listening socket. Must be
+ * called with the lock held.
+ * @param loop Pointer to event loop
+ * @param fd   Listening socket
+ * @return 0 on success, -1 in case of error
+ */
+static int
+uring_queue_accept(ev_loop_t* loop, int fd)
+{
+    ev_uring_t* u = loop->data;
+    struct io_uring_sqe* sqe;
+
+    if ((sqe = uring_sqe(loop)) == NULL)
+    {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    uring_file(u, sqe, fd);
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = EV_URING_ACCEPT | EV_URING_DATA(fd, u->reg[fd].rgen);
+    uring_push(u);
+    return 0;
+}
+
+
+/**
+ * Handles the completion of an accept request. Accepted sockets are
+ * queued, until they are taken by ev_uring_accept(), and the listening
+ * socket is reported as readable by the following waits. Must be called
+ * with the lock held.
+ * @param u   Pointer to the state of the backend
+ * @param cqe Completion of the accept request
+ */
+static void
+uring_accepted(ev_uring_t* u, struct io_uring_cqe* cqe)
+{
+    int fd = (int)(uint32_t) cqe->user_data;
+    ev_uring_fd_t* r = fd < u->size ? &u->reg[fd] : NULL;
+    int* acc;
+    int size;
+
+    // sockets accepted for removed listening sockets are closed at once
+    if (r == NULL || !r->used || EV_URING_GEN(cqe->user_data) != (r->rgen & EV_URING_GEN_MASK))
+    {
+        if (cqe->res >= 0)
+        {
+            close(cqe->res);
+        }
+
+        return;
+    }
+
+    // the request has terminated, it is rearmed if the socket is still accepted
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        r->rarmed = 0;
+        r->rcancel = 0;
+        uring_mark(u, fd);
+    }
+
+    if (cqe->res >= 0)
+    {
+        if (u->nacc == u->acc_size)
+        {
+            size = u->acc_size ? u->acc_size * 2 : EV_URING_ACCEPTS;
+
+            if ((acc = realloc(u->acc, size * 2 * sizeof(*acc))) == NULL)
+            {
+                ui_fatal("Memory allocation for io_uring backend failed!");
+            }
+
+            u->acc = acc;
+            u->acc_size = size;
+        }
+
+        u->acc[u->nacc * 2] = fd;
+        u->acc[u->nacc * 2 + 1] = cqe->res;
+        u->nacc++;
+
+        // the socket is polled until the queued sockets have been taken,
+        // like the backlog of listen(2) bounds pending connections
+        if (++r->naccepted == EV_URING_ACCEPTS)
+        {
+            r->rstall = 1;
+            uring_mark(u, fd);
+        }
+    }
+    // multishot accept requests require Linux 5.19
+    else if (cqe->res == -EINVAL)
+    {
+        u->noaccept = 1;
+        return;
+    }
+    else if (cqe->res != -ECANCELED)
+    {
+        r->rerr = -cqe->res;
+    }
+    else
+    {
+        return;
+    }
+
+    if (!r->rready)
+    {
+        r->rready = 1;
+        u->ready[u->nready++] = fd;
+    }
+}
+
+
+/**
+ * Removes the first queued socket, which has been accepted for a given
+ * listening socket. Must be called with the lock held.
+ * @param u  Pointer to the state of the backend
+ * @param fd Listening socket
+ * @return accepted socket, -1 if none is queued
+ */
+static int
+uring_take_accepted(ev_uring_t* u, int fd)
+{
+    int s;
+    int i;
+
+    for (i = 0; i < u->nacc && u->acc[i * 2] != fd; i++);
+
+    if (i == u->nacc)
+    {
+        return -1;
+    }
+
+    s = u->acc[i * 2 + 1];
+    memmove(&u->acc[i * 2], &u->acc[i * 2 + 2], (u->nacc - i - 1) * 2 * sizeof(*u->acc));
+    u->nacc--;
+    u->reg[fd].naccepted--;
+    return s;
+}
+#else
+// the headers lack multishot accept requests, listening sockets are always polled
+#define uring_queue_accept(LOOP, FD) (-1)
+#define uring_accepted(U, CQE)
+#define uring_take_accepted(U, FD)   (-1)
+#endif
+
+
+/**
+ * Checks whether a file descriptor is read by a multishot receive or
+ * accept request.
+ * @param u Pointer to the state of the backend
+ * @param r Registration of the file descriptor
+ * @return 1 if it is read by a multishot request, 0 if it is polled
+ */
+static int
+uring_multishot(ev_uring_t* u, ev_uring_fd_t* r)
+{
+    if (r->rstall)
+    {
+        return 0;
+    }
+
+    if (r->events & EV_ACCEPT)
+    {
+        return !u->noaccept;
+    }
+
+    return (r->events & EV_RECV) && u->br != NULL && !u->norecv;
+}
+
+
+/**
+ * Returns the user data of the multishot request of a file descriptor.
+ * @param r  Registration of the file descriptor
+ * @param fd File descriptor
+ * @return user data
+ */
+static uint64_t
+uring_multishot_data(ev_uring_fd_t* r, int fd)
+{
+    return (r->raccept ? EV_URING_ACCEPT : EV_URING_RECV) | EV_URING_DATA(fd, r->rgen);
+}
+
+
+/**
+ * Returns the events a file descriptor has to be polled for. Sockets,
+ * which are read by a multishot request, are polled for EV_WRITE only.
+ * @param u Pointer to the state of the backend
+ * @param r Registration of the file descriptor
+ * @return POLLIN and/or POLLOUT, 0 if it has not to be polled
+ */
+static unsigned
+uring_poll_mask(ev_uring_t* u, ev_uring_fd_t* r)
+{
+    return (r->events & EV_READ && !uring_multishot(u, r) ? POLLIN : 0) |
+           (r->events & EV_WRITE ? POLLOUT : 0);
+}
+
+
+/**
+ * Arms the poll and multishot requests of all dirty file descriptors and
+ * replaces or cancels the requests, which do not match the registered
+ * events anymore. Must be called with the lock held.
+ * @param loop Pointer to event loop
+ * @return 0 on success, -1 in case of error
+ */
+static int
+uring_arm(ev_loop_t* loop)
+{
+    ev_uring_t* u = loop->data;
+    ev_uring_fd_t* r;
+    unsigned mask;
+    int fd;
+
+    while (u->ndirty)
+    {
+        fd = u->dirty[--u->ndirty];
+        r = &u->reg[fd];
+        r->dirty = 0;
+
+        if (!r->used)
+        {
+            continue;
+        }
+
+        // a stalled socket is received again as soon as its buffers have been
+        // read and the other sockets left enough buffers in the ring, a
+        // listening socket as soon as its accepted sockets have been taken
+        if (r->rstall && !r->nbufs && !r->naccepted &&
+            (r->events & EV_ACCEPT || u->held < EV_URING_BUFS / 2))
+        {
+            r->rstall = 0;
+        }
+
+        mask = uring_poll_mask(u, r);
+
+        // the pending poll request is replaced, whose completion will be ignored
+        if (r->armed && r->mask != mask)
+        {
+            if (uring_queue(loop, IORING_OP_POLL_REMOVE, -1, 0, EV_URING_DATA(fd, r->gen),
+                            EV_URING_IGNORE) == -1)
+            {
+                return -1;
+            }
+
+            r->armed = 0;
+            r->gen++;
+        }
+
+        if (!r->armed && mask)
+        {
+            if (uring_queue(loop, IORING_OP_POLL_ADD, fd, mask, 0, EV_URING_DATA(fd, r->gen)) == -1)
+            {
+                return -1;
+            }
+
+            r->armed = 1;
+            r->mask = mask;
+        }
+
+        // the multishot request stops with the end of the stream or an error
+        if (uring_multishot(u, r) && r->events & EV_READ && !r->reof && !r->rerr)
+        {
+            if (!r->rarmed)
+            {
+                r->raccept = (r->events & EV_ACCEPT) != 0;
+
+                if ((r->raccept ? uring_queue_accept(loop, fd) : uring_queue_recv(loop, fd)) == -1)
+                {
+                    return -1;
+                }
+            }
+
+            r->rarmed = 1;
+        }
+        // buffers and sockets received until the cancellation completes are
+        // still queued
+        else if (r->rarmed && !r->rcancel)
+        {
+            if (uring_queue(loop, IORING_OP_ASYNC_CANCEL, -1, 0, uring_multishot_data(r, fd),
+                            EV_URING_IGNORE) == -1)
+            {
+                return -1;
+            }
+
+            r->rcancel = 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Removes the pending requests of a file descriptor. Completions of the
+ * removed requests will be ignored, received buffers, which have not
+ * been read, are dropped and accepted sockets, which have not been
+ * taken, are closed. Must be called with the lock held.
+ * @param loop Pointer to event loop
+ * @param fd   File descriptor
+ * @return 0 on success, -1 in case of error
+ */
+static int
+uring_forget(ev_loop_t* loop, int fd)
+{
+    ev_uring_t* u = loop->data;
+    ev_uring_fd_t* r = &u->reg[fd];
+    int ret = 0;
+
+    if (r->armed)
+    {
+        ret = uring_queue(loop, IORING_OP_POLL_REMOVE, -1, 0, EV_URING_DATA(fd, r->gen),
+                          EV_URING_IGNORE);
+        r->armed = 0;
+    }
+
+    if (r->rarmed && !r->rcancel && ret != -1)
+    {
+        ret = uring_queue(loop, IORING_OP_ASYNC_CANCEL, -1, 0, uring_multishot_data(r, fd),
+                          EV_URING_IGNORE);
+    }
+
+    uring_read_buffers(u, r, NULL, 0);
+
+    while (r->naccepted)
+    {
+        close(uring_take_accepted(u, fd));
+    }
+
+    r->gen++;
+    r->rgen++;
+    r->rarmed = 0;
+    r->rcancel = 0;
+    r->rstall = 0;
+    r->reof = 0;
+    r->rerr = 0;
+    return ret;
+}
+
+
+/**
+ * Reports the file descriptors, which have buffers, accepted sockets, an
+ * EOF or an error waiting to be read, as readable. File descriptors that have been read
+ * completely are removed from the list. Must be called with the lock held.
+ * @param u      Pointer to the state of the backend
+ * @param events Array where ready events will be stored
+ * @param n      Amount of events stored already
+ * @param max    Size of the given array
+ * @return amount of ready events
+ */
+static int
+uring_report(ev_uring_t* u, ev_event_t* events, int n, int max)
+{
+    ev_uring_fd_t* r;
+    int i, j;
+
+    for (i = 0; i < u->nready; )
+    {
+        r = &u->reg[u->ready[i]];
+
+        if (!r->used || (!r->nbufs && !r->naccepted && !r->reof && !r->rerr))
+        {
+            r->rready = 0;
+            u->ready[i] = u->ready[--u->nready];
+            continue;
+        }
+
+        // sockets, which are not read at the moment (e.g. throttled
+        // contacts), keep their buffers
+        if (r->events & EV_READ)
+        {
+            for (j = 0; j < n && events[j].fd != u->ready[i]; j++);
+
+            if (j == n && n == max)
+            {
+                break;
+            }
+
+            events[j].fd = u->ready[i];
+            events[j].id = r->id;
+            events[j].events = (j == n ? 0 : events[j].events) | EV_READ;
+            n += j == n;
+        }
+
+        i++;
+    }
+
+    return n;
+}
+
+
+/**
+ * Unmaps the rings and closes the io_uring instance of a loop.
+ * @param loop Pointer to event loop
+ */
+static void
+uring_unmap(ev_loop_t* loop)
+{
+    ev_uring_t* u = loop->data;
+
+    if (u->sqes != NULL)
+    {
+        munmap(u->sqes, u->sqes_len);
+    }
+
+    if (u->cq_ring != NULL && u->cq_ring != u->sq_ring)
+    {
+        munmap(u->cq_ring, u->cq_ring_len);
+    }
+
+    if (u->sq_ring != NULL)
+    {
+        munmap(u->sq_ring, u->sq_ring_len);
+    }
+
+    if (loop->fd != -1)
+    {
+        close(loop->fd);
+        loop->fd = -1;
+    }
+
+#ifdef EV_HAVE_URING_RECV
+    // the buffers are released after the ring, which references them
+    if (u->br != NULL)
+    {
+        munmap(u->br, EV_URING_BUFS * sizeof(struct io_uring_buf));
+        free(u->bufs);
+        u->br = NULL;
+        u->bufs = NULL;
+    }
+#endif
+}
+
+
+/**
+ * Creates the io_uring instance of the given loop and maps its rings.
+ * Timeouts of the wait require IORING_FEAT_EXT_ARG (Linux 5.11).
+ * @param loop Pointer to event loop
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_uring_init(ev_loop_t* loop)
+{
+    struct io_uring_params p;
+    ev_uring_t* u;
+    unsigned* array;
+    unsigned i;
+
+    if ((u = malloc(sizeof(*u))) == NULL)
+    {
+        ui_fatal("Memory allocation for io_uring backend failed!");
+    }
+
+    memset(u, 0, sizeof(*u));
+    u->ring_index = -2;
+    loop->data = u;
+    memset(&p, 0, sizeof(p));
+    // every registered file descriptor has at most one pending poll request
+    // and one receive request, which completes once per received buffer
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = EV_URING_CQ_LEN;
+    loop->fd = (int) syscall(__NR_io_uring_setup, EV_URING_ENTRIES, &p);
+
+    if (loop->fd == -1 || !(p.features & IORING_FEAT_EXT_ARG) ||
+        pthread_mutex_init(&u->mx, NULL))
+    {
+        uring_unmap(loop);
+        free(u);
+        loop->data = NULL;
+        return -1;
+    }
+
+    u->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        u->sq_ring_len = u->cq_ring_len = u->sq_ring_len > u->cq_ring_len ?
+                                          u->sq_ring_len : u->cq_ring_len;
+    }
+
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if ((u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           loop->fd, IORING_OFF_SQ_RING)) == MAP_FAILED ||
+        (u->cq_ring = p.features & IORING_FEAT_SINGLE_MMAP ? u->sq_ring :
+                      mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           loop->fd, IORING_OFF_CQ_RING)) == MAP_FAILED ||
+        (u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        loop->fd, IORING_OFF_SQES)) == MAP_FAILED)
+    {
+        u->sq_ring = u->sq_ring == MAP_FAILED ? NULL : u->sq_ring;
+        u->cq_ring = u->cq_ring == MAP_FAILED ? NULL : u->cq_ring;
+        u->sqes = u->sqes == MAP_FAILED ? NULL : u->sqes;
+        uring_unmap(loop);
+        pthread_mutex_destroy(&u->mx);
+        free(u);
+        loop->data = NULL;
+        return -1;
+    }
+
+    u->sq_head = (unsigned*)((char*) u->sq_ring + p.sq_off.head);
+    u->sq_tail = (unsigned*)((char*) u->sq_ring + p.sq_off.tail);
+    u->sq_mask = *(unsigned*)((char*) u->sq_ring + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->tail = *u->sq_tail;
+    u->cq_head = (unsigned*)((char*) u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned*)((char*) u->cq_ring + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)((char*) u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)((char*) u->cq_ring + p.cq_off.cqes);
+    // submission queue entries are used in ring order
+    array = (unsigned*)((char*) u->sq_ring + p.sq_off.array);
+
+    for (i = 0; i < p.sq_entries; i++)
+    {
+        array[i] = i;
+    }
+
+    // the slots of long-lived files are filled by ev_register_fds()
+    for (i = 0; i < EV_URING_FILES; i++)
+    {
+        u->files[i] = -1;
+    }
+
+    u->nfiles = syscall(__NR_io_uring_register, loop->fd, IORING_REGISTER_FILES, u->files,
+                        EV_URING_FILES) == -1 ? 0 : EV_URING_FILES;
+#ifndef EV_HAVE_URING_ACCEPT
+    u->noaccept = 1;
+#endif
+    return 0;
+}
+
+
+/**
+ * Closes the io_uring instance of the given loop. Pending poll and
+ * multishot requests and registered files are removed first, since they
+ * keep their files open until the ring has been released asynchronously
+ * by the kernel.
+ * @param loop Pointer to event loop
+ */
+void
+ev_uring_destroy(ev_loop_t* loop)
+{
+    ev_uring_t* u = loop->data;
+    int fd;
+
+    pthread_mutex_lock(&u->mx);
+
+    for (fd = 0; fd < u->size; fd++)
+    {
+        uring_forget(loop, fd);
+    }
+
+    uring_submit(loop);
+
+    if (u->nfiles)
+    {
+        syscall(__NR_io_uring_register, loop->fd, IORING_UNREGISTER_FILES, NULL, 0);
+    }
+
+#ifdef IORING_ENTER_REGISTERED_RING
+    if (u->ring_index >= 0 && pthread_equal(u->ring_owner, pthread_self()))
+    {
+        struct io_uring_rsrc_update upd;
+        memset(&upd, 0, sizeof(upd));
+        upd.offset = u->ring_index;
+        syscall(__NR_io_uring_register, loop->fd, IORING_UNREGISTER_RING_FDS, &upd, 1);
+    }
+#endif
+    pthread_mutex_unlock(&u->mx);
+    uring_unmap(loop);
+    pthread_mutex_destroy(&u->mx);
+    free(u->reg);
+    free(u->dirty);
+    free(u->ready);
+    free(u->acc);
+    free(u);
+    loop->data = NULL;
+}
+
+
+/**
+ * Adds, modifies or removes a file descriptor from the io_uring backend.
+ * Changes are queued and submitted by the next wait, unless the loop is
+ * blocked already. Modifying the id only does not touch the ring.
+ * @param loop   Pointer to event loop
+ * @param op     EV_CTL_ADD, EV_CTL_MOD or EV_CTL_DEL
+ * @param fd     File descriptor
+ * @param events EV_READ and/or EV_WRITE, EV_RECV to receive the socket,
+ *               EV_ACCEPT to accept the listening socket
+ * @param id     Identifier that will be reported together with the events
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_uring_ctl(ev_loop_t* loop, int op, int fd, int events, int id)
+{
+    ev_uring_t* u = loop->data;
+    ev_uring_fd_t* r;
+    ev_uring_fd_t* reg;
+    int* dirty;
+    int* ready;
+    int size;
+    int ret = 0;
+
+    if (fd < 0)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    pthread_mutex_lock(&u->mx);
+
+    if (fd >= u->size)
+    {
+        for (size = u->size ? u->size : FD_SETSIZE; size <= fd; size *= 2);
+
+        if ((reg = realloc(u->reg, size * sizeof(*reg))) == NULL)
+        {
+            ui_fatal("Memory allocation for io_uring backend failed!");
+        }
+
+        memset(reg + u->size, 0, (size - u->size) * sizeof(*reg));
+        u->reg = reg;
+
+        if ((dirty = realloc(u->dirty, size * sizeof(*dirty))) == NULL)
+        {
+            ui_fatal("Memory allocation for io_uring backend failed!");
+        }
+
+        u->dirty = dirty;
+
+        if ((ready = realloc(u->ready, size * sizeof(*ready))) == NULL)
+        {
+            ui_fatal("Memory allocation for io_uring backend failed!");
+        }
+
+        u->ready = ready;
+        u->size = size;
+    }
+
+    r = &u->reg[fd];
+
+    if (op != EV_CTL_ADD && !r->used)
+    {
+        pthread_mutex_unlock(&u->mx);
+        errno = ENOENT;
+        return -1;
+    }
+
+    // the pending requests are removed (a registration of a file descriptor
+    // closed without ev_del() is replaced too), changes of the events are
+    // applied by uring_arm()
+    if (op != EV_CTL_MOD)
+    {
+        ret = uring_forget(loop, fd);
+
+        // a pending request holds a reference of the file, which would keep
+        // the socket open after close(2)
+        if (op == EV_CTL_DEL && ret != -1)
+        {
+            ret = uring_submit(loop);
+        }
+    }
+
+    r->used = op != EV_CTL_DEL;
+    r->events = events;
+    r->id = id;
+
+    if (r->used)
+    {
+        // the provided buffers are registered with the first received socket
+        if (events & EV_RECV && u->br == NULL && !u->norecv)
+        {
+            u->norecv = uring_init_buffers(loop) == -1;
+        }
+
+        uring_mark(u, fd);
+    }
+
+    // the waiting thread only submits entries queued before it blocked
+    if (u->waiting && ret != -1)
+    {
+        ret = uring_arm(loop) == -1 || uring_submit(loop) == -1 ? -1 : 0;
+    }
+
+    pthread_mutex_unlock(&u->mx);
+    return ret;
+}
+
+
+/**
+ * Waits for completions of the io_uring instance. Queued changes and the
+ * poll requests of the file descriptors reported by the last call are
+ * submitted by the same system call, which waits for the completions.
+ * Sockets with received buffers, that have not been read completely, and
+ * listening sockets with accepted sockets, that have not been taken, are
+ * reported again without waiting.
+ * @param loop    Pointer to event loop
+ * @param events  Array where ready events will be stored
+ * @param max     Size of the given array
+ * @param timeout Timeout in milliseconds, -1 blocks indefinitely
+ * @return amount of ready events, -1 in case of error
+ */
+int
+ev_uring_wait(ev_loop_t* loop, ev_event_t* events, int max, int timeout)
+{
+    ev_uring_t* u = loop->data;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    struct io_uring_cqe* cqe;
+    ev_uring_fd_t* r;
+    unsigned head;
+    unsigned submit;
+    int polled;
+    int cancel;
+    int ready;
+    int fd;
+    int n = 0;
+    int ret;
+
+#ifdef IORING_ENTER_REGISTERED_RING
+    // the ring is registered by the waiting thread, saving a lookup per call
+    if (u->ring_index == -2)
+    {
+        struct io_uring_rsrc_update upd;
+        memset(&upd, 0, sizeof(upd));
+        upd.offset = -1U;
+        upd.data = loop->fd;
+        u->ring_owner = pthread_self();
+        u->ring_index = syscall(__NR_io_uring_register, loop->fd, IORING_REGISTER_RING_FDS,
+                                &upd, 1) == 1 ? (int) upd.offset : -1;
+    }
+#endif
+
+    pthread_mutex_lock(&u->mx);
+
+    if (uring_arm(loop) == -1)
+    {
+        pthread_mutex_unlock(&u->mx);
+        return -1;
+    }
+
+    // buffers, which have not been read completely, are reported at once
+    submit = u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    ready = *u->cq_head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) ||
+            uring_report(u, events, 0, max);
+    u->waiting = !ready;
+    pthread_mutex_unlock(&u->mx);
+    memset(&arg, 0, sizeof(arg));
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000LL;
+    arg.ts = timeout < 0 ? 0 : (uint64_t)(uintptr_t) &ts;
+
+    // completions that have not been reaped yet are returned at once
+    if (!ready)
+    {
+        // unlike epoll_wait(2), the system call is no cancellation point
+        pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &cancel);
+        ret = uring_enter(u, loop->fd, submit, 1, IORING_ENTER_GETEVENTS, &arg);
+        pthread_setcanceltype(cancel, NULL);
+    }
+    else
+    {
+        ret = submit ? uring_enter(u, loop->fd, submit, 0, 0, NULL) : 0;
+    }
+
+    pthread_mutex_lock(&u->mx);
+    u->waiting = 0;
+
+    if (ret == -1 && errno != ETIME)
+    {
+        pthread_mutex_unlock(&u->mx);
+        return -1;
+    }
+
+    for (head = *u->cq_head; n < max && head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+         head++)
+    {
+        cqe = &u->cqes[head & u->cq_mask];
+        fd = (int)(uint32_t) cqe->user_data;
+
+        // received buffers and accepted sockets are reported below
+        if (cqe->user_data != EV_URING_IGNORE && cqe->user_data & EV_URING_RECV)
+        {
+            uring_received(u, cqe);
+            continue;
+        }
+
+        if (cqe->user_data != EV_URING_IGNORE && cqe->user_data & EV_URING_ACCEPT)
+        {
+            uring_accepted(u, cqe);
+            continue;
+        }
+
+        // completions of removals and replaced poll requests
+        if (cqe->user_data == EV_URING_IGNORE || fd >= u->size || !u->reg[fd].used ||
+            (u->reg[fd].gen & EV_URING_GEN_MASK) != EV_URING_GEN(cqe->user_data))
+        {
+            continue;
+        }
+
+        r = &u->reg[fd];
+        r->armed = 0;
+        // poll requests are single-shot, thus readiness is level-triggered
+        uring_mark(u, fd);
+
+        // errors and hangups are reported as readable, so that the
+        // following read(2) returns the error or the EOF, unless the socket
+        // is received (its multishot request reports them), events that are
+        // no longer watched are not reported (see: uring_arm())
+        polled = !uring_multishot(u, r);
+
+        if (cqe->res < 0)
+        {
+            events[n].events = polled ? EV_READ : 0;
+        }
+        else
+        {
+            events[n].events =
+                (polled && ((cqe->res & POLLIN && r->events & EV_READ) ||
+                            cqe->res & (POLLERR | POLLHUP)) ? EV_READ : 0) |
+                (cqe->res & POLLOUT && r->events & EV_WRITE ? EV_WRITE : 0);
+        }
+
+        if (events[n].events)
+        {
+            events[n].fd = fd;
+            events[n].id = r->id;
+            n++;
+        }
+    }
+
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    n = uring_report(u, events, n, max);
+    pthread_mutex_unlock(&u->mx);
+    return n;
+}
+
+
+/**
+ * Reads the buffers received for a socket registered with EV_RECV and
+ * returns them to the ring of provided buffers. Sockets, that are polled
+ * (e.g. after the ring ran out of buffers), are read by a non-blocking
+ * recv(2) once their buffers have been read.
+ * @param loop Pointer to event loop
+ * @param fd   Socket
+ * @param buf  Buffer to store the bytes
+ * @param len  Size of the buffer
+ * @return amount of bytes read, 0 on EOF or -1 in case of error (EAGAIN
+ *         if no bytes have been received yet)
+ */
+ssize_t
+ev_uring_recv(ev_loop_t* loop, int fd, void* buf, size_t len)
+{
+    ev_uring_t* u = loop->data;
+    ev_uring_fd_t* r;
+    ssize_t n;
+
+    pthread_mutex_lock(&u->mx);
+
+    if (fd < 0 || fd >= u->size || !u->reg[fd].used)
+    {
+        pthread_mutex_unlock(&u->mx);
+        return recv(fd, buf, len, MSG_DONTWAIT);
+    }
+
+    r = &u->reg[fd];
+
+    n = uring_read_buffers(u, r, buf, len);
+
+    // the end of the stream and errors follow the received bytes
+    if (!n && (r->reof || r->rerr))
+    {
+        errno = r->rerr;
+        n = r->reof ? 0 : -1;
+    }
+    // the next bytes are received by the pending request
+    else if (!n && r->rarmed)
+    {
+        errno = EAGAIN;
+        n = -1;
+    }
+    else if (!n)
+    {
+        pthread_mutex_unlock(&u->mx);
+        return recv(fd, buf, len, MSG_DONTWAIT);
+    }
+
+    pthread_mutex_unlock(&u->mx);
+    return n;
+}
+
+
+/**
+ * Takes the next socket accepted for a listening socket registered with
+ * EV_ACCEPT. Listening sockets, that are polled (e.g. if the kernel does
+ * not accept in advance), are accepted by accept(2) once their queued
+ * sockets have been taken.
+ * @param loop Pointer to event loop
+ * @param fd   Listening socket
+ * @return accepted socket, -1 in case of error (EAGAIN if no socket has
+ *         been accepted yet)
+ */
+int
+ev_uring_accept(ev_loop_t* loop, int fd)
+{
+    ev_uring_t* u = loop->data;
+    ev_uring_fd_t* r;
+    int s;
+
+    pthread_mutex_lock(&u->mx);
+
+    if (fd < 0 || fd >= u->size || !u->reg[fd].used)
+    {
+        pthread_mutex_unlock(&u->mx);
+        return accept(fd, NULL, NULL);
+    }
+
+    r = &u->reg[fd];
+
+    if ((s = uring_take_accepted(u, fd)) != -1)
+    {
+        // a stalled listening socket is accepted again (see: uring_arm())
+        if (r->rstall && !r->naccepted)
+        {
+            uring_mark(u, fd);
+        }
+    }
+    // the error is reported once, the request is rearmed by the next wait
+    else if (r->rerr)
+    {
+        errno = r->rerr;
+        r->rerr = 0;
+        uring_mark(u, fd);
+    }
+    // the next sockets are accepted by the pending request
+    else if (r->rarmed)
+    {
+        errno = EAGAIN;
+    }
+    else
+    {
+        pthread_mutex_unlock(&u->mx);
+        return accept(fd, NULL, NULL);
+    }
+
+    pthread_mutex_unlock(&u->mx);
+    return s;
+}
+
+
+/**
+ * Fills or clears slots of the table of registered files. Entries, which
+ * have been queued already, are submitted first, since they might refer
+ * to a slot that changes.
+ * @param loop Pointer to event loop
+ * @param fds  File descriptors
+ * @param n    Amount of file descriptors
+ * @param add  1 to register the file descriptors, 0 to unregister them
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_uring_files(ev_loop_t* loop, const int* fds, int n, int add)
+{
+    ev_uring_t* u = loop->data;
+    struct io_uring_files_update upd;
+    int fd;
+    int ret;
+    int i, j;
+
+    pthread_mutex_lock(&u->mx);
+    ret = uring_submit(loop);
+
+    for (i = 0; i < n && ret != -1; i++)
+    {
+        // files are registered once, files without a free slot are looked up
+        // by every request
+        for (j = 0; add && j < u->nfiles && u->files[j] != fds[i]; j++);
+
+        if (fds[i] < 0 || (add && j < u->nfiles))
+        {
+            continue;
+        }
+
+        for (j = 0; j < u->nfiles && u->files[j] != (add ? -1 : fds[i]); j++);
+
+        if (j == u->nfiles)
+        {
+            continue;
+        }
+
+        fd = add ? fds[i] : -1;
+        memset(&upd, 0, sizeof(upd));
+        upd.offset = j;
+        upd.fds = (uint64_t)(uintptr_t) &fd;
+
+        if (syscall(__NR_io_uring_register, loop->fd, IORING_REGISTER_FILES_UPDATE, &upd, 1) == -1)
+        {
+            ret = -1;
+            break;
+        }
+
+        u->files[j] = fd;
+    }
+
+    pthread_mutex_unlock(&u->mx);
+    return ret;
+}
+#endif
+
+
+#ifdef EV_HAVE_KQUEUE
+/**
+ * Creates the kqueue of the given loop.
+ * @param loop Pointer to event loop
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_kqueue_init(ev_loop_t* loop)
+{
+    if ((loop->fd = kqueue()) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Closes the kqueue of the given loop.
+ * @param loop Pointer to event loop
+ */
+void
+ev_kqueue_destroy(ev_loop_t* loop)
+{
+    close(loop->fd);
+    loop->fd = -1;
+}
+
+
+/**
+ * Adds, modifies or removes a file descriptor from the kqueue.
+ * Read and write filters are always registered together, the filter that
+ * has not been requested will be disabled.
+ * @param loop   Pointer to event loop
+ * @param op     EV_CTL_ADD, EV_CTL_MOD or EV_CTL_DEL
+ * @param fd     File descriptor
+ * @param events EV_READ and/or EV_WRITE
+ * @param id     Identifier that will be reported together with the events
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_kqueue_ctl(ev_loop_t* loop, int op, int fd, int events, int id)
+{
+    struct kevent kev[2];
+    void* udata = (void*)(intptr_t) id;
+
+    if (op == EV_CTL_DEL)
+    {
+        // a filter that has never been added results in ENOENT
+        EV_SET(&kev[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+        EV_SET(&kev[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+        kevent(loop->fd, &kev[0], 1, NULL, 0, NULL);
+        kevent(loop->fd, &kev[1], 1, NULL, 0, NULL);
+        return 0;
+    }
+
+    EV_SET(&kev[0], fd, EVFILT_READ,
+           EV_ADD | (events & EV_READ ? EV_ENABLE : EV_DISABLE), 0, 0, udata);
+    EV_SET(&kev[1], fd, EVFILT_WRITE,
+           EV_ADD | (events & EV_WRITE ? EV_ENABLE : EV_DISABLE), 0, 0, udata);
+    return kevent(loop->fd, kev, 2, NULL, 0, NULL) == -1 ? -1 : 0;
+}
+
+
+/**
+ * Waits for events on the kqueue.
+ * @param loop    Pointer to event loop
+ * @param events  Array where ready events will be stored
+ * @param max     Size of the given array
+ * @param timeout Timeout in milliseconds, -1 blocks indefinitely
+ * @return amount of ready events, -1 in case of error
+ */
+int
+ev_kqueue_wait(ev_loop_t* loop, ev_event_t* events, int max, int timeout)
+{
+    struct kevent kev[EV_MAX_EVENTS];
+    struct timespec ts;
+    int n;
+
+    if (max > EV_MAX_EVENTS)
+    {
+        max = EV_MAX_EVENTS;
+    }
+
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+
+    if ((n = kevent(loop->fd, NULL, 0, kev, max, timeout < 0 ? NULL : &ts)) == -1)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        events[i].fd = (int) kev[i].ident;
+        events[i].id = (int)(intptr_t) kev[i].udata;
+        events[i].events = kev[i].filter == EVFILT_WRITE ? EV_WRITE : EV_READ;
+    }
+
+    return n;
+}
+#endif
+
+
+/**
+ * Initializes the state of the select(2) backend.
+ * @param loop Pointer to event loop
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_select_init(ev_loop_t* loop)
+{
+    ev_select_t* sel;
+
+    if ((sel = malloc(sizeof(*sel))) == NULL)
+    {
+        ui_fatal("Memory allocation for select backend failed!");
+    }
+
+    memset(sel, 0, sizeof(*sel));
+    sel->maxfd = -1;
+
+    if (pthread_mutex_init(&sel->mx, NULL))
+    {
+        free(sel);
+        return -1;
+    }
+
+    loop->fd = -1;
+    loop->data = sel;
+    return 0;
+}
+
+
+/**
+ * Frees the state of the select(2) backend.
+ * @param loop Pointer to event loop
+ */
+void
+ev_select_destroy(ev_loop_t* loop)
+{
+    ev_select_t* sel = loop->data;
+    pthread_mutex_destroy(&sel->mx);
+    free(sel);
+    loop->data = NULL;
+}
+
+
+/**
+ * Adds, modifies or removes a file descriptor from the select(2) backend.
+ * @param loop   Pointer to event loop
+ * @param op     EV_CTL_ADD, EV_CTL_MOD or EV_CTL_DEL
+ * @param fd     File descriptor
+ * @param events EV_READ and/or EV_WRITE
+ * @param id     Identifier that will be reported together with the events
+ * @return 0 on success, -1 in case of error (e.g. fd exceeds FD_SETSIZE)
+ */
+int
+ev_select_ctl(ev_loop_t* loop, int op, int fd, int events, int id)
+{
+    ev_select_t* sel = loop->data;
+
+    if (fd < 0 || fd >= FD_SETSIZE)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    pthread_mutex_lock(&sel->mx);
+
+    if (op == EV_CTL_DEL)
+    {
+        sel->used[fd] = 0;
+        sel->events[fd] = 0;
+
+        // determine new highest file descriptor
+        while (sel->maxfd >= 0 && !sel->used[sel->maxfd])
+        {
+            sel->maxfd--;
+        }
+    }
+    else
+    {
+        sel->used[fd] = 1;
+        sel->events[fd] = events;
+        sel->id[fd] = id;
+
+        if (fd > sel->maxfd)
+        {
+            sel->maxfd = fd;
+        }
+    }
+
+    pthread_mutex_unlock(&sel->mx);
+    return 0;
+}
+
+
+/**
+ * Waits for events using select(2).
+ * The fd sets are built from the registered file descriptors on every call.
+ * @param loop    Pointer to event loop
+ * @param events  Array where ready events will be stored
+ * @param max     Size of the given array
+ * @param timeout Timeout in milliseconds, -1 blocks indefinitely
+ * @return amount of ready events, -1 in case of error
+ */
+int
+ev_select_wait(ev_loop_t* loop, ev_event_t* events, int max, int timeout)
+{
+    ev_select_t* sel = loop->data;
+    fd_set rset, wset;
+    struct timeval tv;
+    int nfds;
+    int n = 0;
+    FD_ZERO(&rset);
+    FD_ZERO(&wset);
+    pthread_mutex_lock(&sel->mx);
+    nfds = sel->maxfd + 1;
+
+    for (int fd = 0; fd < nfds; fd++)
+    {
+        if (sel->events[fd] & EV_READ)
+        {
+            FD_SET(fd, &rset);
+        }
+
+        if (sel->events[fd] & EV_WRITE)
+        {
+            FD_SET(fd, &wset);
+        }
+    }
+
+    pthread_mutex_unlock(&sel->mx);
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+
+    if (select(nfds, &rset, &wset, NULL, timeout < 0 ? NULL : &tv) == -1)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&sel->mx);
+
+    for (int fd = 0; fd < nfds && n < max; fd++)
+    {
+        // skip fds that have been removed in the meantime
+        if (!sel->used[fd])
+        {
+            continue;
+        }
+
+        events[n].events = (FD_ISSET(fd, &rset) ? EV_READ : 0) |
+                           (FD_ISSET(fd, &wset) ? EV_WRITE : 0);
+
+        if (events[n].events)
+        {
+            events[n].fd = fd;
+            events[n].id = sel->id[fd];
+            n++;
+        }
+    }
+
+    pthread_mutex_unlock(&sel->mx);
+    return n;
+}
+
+
+/**
+ * Available event backends, sorted by preference. Since select(2) is
+ * always available, backends listed after it have to be requested by name.
+ */
+static const ev_backend_t backends_[EV_BACKEND_AMOUNT] =
+{
+#ifdef EV_HAVE_EPOLL
+    EV_BACKEND("epoll", ev_epoll_init, ev_epoll_destroy, ev_epoll_ctl, ev_epoll_wait, NULL, NULL,
+               NULL),
+#endif
+#ifdef EV_HAVE_KQUEUE
+    EV_BACKEND("kqueue", ev_kqueue_init, ev_kqueue_destroy, ev_kqueue_ctl, ev_kqueue_wait, NULL,
+               NULL, NULL),
+#endif
+    EV_BACKEND("select", ev_select_init, ev_select_destroy, ev_select_ctl, ev_select_wait, NULL,
+               NULL, NULL),
+#ifdef EV_HAVE_URING
+    EV_BACKEND("uring", ev_uring_init, ev_uring_destroy, ev_uring_ctl, ev_uring_wait, ev_uring_recv,
+               ev_uring_accept, ev_uring_files)
+#endif
+};
+
+
+/**
+ * Initializes an event loop.
+ * If no backend name is given, the first backend that can be initialized
+ * will be used (epoll, kqueue, select). The io_uring backend is only used
+ * if it is requested by name ("uring").
+ * @param loop Pointer to event loop
+ * @param name Name of the backend to use or NULL
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_init(ev_loop_t* loop, char* name)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->fd = -1;
+
+    for (int i = 0; i < EV_BACKEND_AMOUNT; i++)
+    {
+        if (backends_[i].name == NULL)
+        {
+            break;
+        }
+
+        if (name != NULL && strcmp(name, backends_[i].name) != 0)
+        {
+            continue;
+        }
+
+        if (backends_[i].init(loop) == 0)
+        {
+            loop->backend = &backends_[i];
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+ * Checks whether a backend of the given name has been compiled in.
+ * @param name Name of the backend
+ * @return 1 if the backend is available, 0 otherwise
+ */
+int
+ev_has_backend(const char* name)
+{
+    for (int i = 0; i < EV_BACKEND_AMOUNT && backends_[i].name != NULL; i++)
+    {
+        if (strcmp(name, backends_[i].name) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Frees all resources used by an event loop.
+ * @param loop Pointer to event loop
+ */
+void
+ev_destroy(ev_loop_t* loop)
+{
+    if (loop->backend != NULL)
+    {
+        loop->backend->destroy(loop);
+        loop->backend = NULL;
+    }
+}
+
+
+/**
+ * Registers a file descriptor in the event loop.
+ * @param loop   Pointer to event loop
+ * @param fd     File descriptor
+ * @param events EV_READ and/or EV_WRITE
+ * @param id     Identifier that will be reported together with the events
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_add(ev_loop_t* loop, int fd, int events, int id)
+{
+    return loop->backend->ctl(loop, EV_CTL_ADD, fd, events, id);
+}
+
+
+/**
+ * Changes the events or the identifier of a registered file descriptor.
+ * @param loop   Pointer to event loop
+ * @param fd     File descriptor
+ * @param events EV_READ and/or EV_WRITE
+ * @param id     Identifier that will be reported together with the events
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_mod(ev_loop_t* loop, int fd, int events, int id)
+{
+    return loop->backend->ctl(loop, EV_CTL_MOD, fd, events, id);
+}
+
+
+/**
+ * Removes a file descriptor from the event loop. This has to be done
+ * before the file descriptor is closed.
+ * @param loop Pointer to event loop
+ * @param fd   File descriptor
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_del(ev_loop_t* loop, int fd)
+{
+    return loop->backend->ctl(loop, EV_CTL_DEL, fd, 0, 0);
+}
+
+
+/**
+ * Waits until at least one registered file descriptor is ready or the
+ * timeout expired.
+ * @param loop    Pointer to event loop
+ * @param events  Array where ready events will be stored
+ * @param max     Size of the given array
+ * @param timeout Timeout in milliseconds, -1 blocks indefinitely
+ * @return amount of ready events (0 on timeout), -1 in case of error
+ */
+int
+ev_wait(ev_loop_t* loop, ev_event_t* events, int max, int timeout)
+{
+    return loop->backend->wait(loop, events, max, timeout);
+}
+
+
+/**
+ * Reads a socket without blocking. Sockets registered with EV_RECV have
+ * to be read by this function, since the backend may have received their
+ * bytes already (see: ev_uring_recv()).
+ * @param loop Pointer to event loop
+ * @param fd   Socket
+ * @param buf  Buffer to store the bytes
+ * @param len  Size of the buffer
+ * @return amount of bytes read, 0 on EOF or -1 in case of error (EAGAIN
+ *         if no bytes are available)
+ */
+ssize_t
+ev_recv(ev_loop_t* loop, int fd, void* buf, size_t len)
+{
+    if (loop->backend->recv != NULL)
+    {
+        return loop->backend->recv(loop, fd, buf, len);
+    }
+
+    return recv(fd, buf, len, MSG_DONTWAIT);
+}
+
+
+/**
+ * Accepts a connection of a listening socket. Listening sockets
+ * registered with EV_ACCEPT have to be accepted by this function, since
+ * the backend may have accepted their connections already (see:
+ * ev_uring_accept()).
+ * @param loop Pointer to event loop
+ * @param fd   Listening socket
+ * @return accepted socket, -1 in case of error
+ */
+int
+ev_accept(ev_loop_t* loop, int fd)
+{
+    if (loop->backend->accept != NULL)
+    {
+        return loop->backend->accept(loop, fd);
+    }
+
+    return accept(fd, NULL, NULL);
+}
+
+
+/**
+ * Registers long-lived files with the backend, which then refers to them
+ * without looking them up per request (see: ev_uring_files()). The files
+ * have to be unregistered before they are closed, since the backend
+ * keeps them open. Backends without registered files ignore the call.
+ * @param loop Pointer to event loop
+ * @param fds  File descriptors
+ * @param n    Amount of file descriptors
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_register_fds(ev_loop_t* loop, const int* fds, int n)
+{
+    if (loop->backend == NULL || loop->backend->files == NULL)
+    {
+        return 0;
+    }
+
+    return loop->backend->files(loop, fds, n, 1);
+}
+
+
+/**
+ * Unregisters files registered by ev_register_fds().
+ * @param loop Pointer to event loop
+ * @param fds  File descriptors
+ * @param n    Amount of file descriptors
+ * @return 0 on success, -1 in case of error
+ */
+int
+ev_unregister_fds(ev_loop_t* loop, const int* fds, int n)
+{
+    if (loop->backend == NULL || loop->backend->files == NULL)
+    {
+        return 0;
+    }
+
+    return loop->backend->files(loop, fds, n, 0);
+}
@@ -0,0 +1,551 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file framing.c
+ *  This file contains the compact binary framing of DChat V2. Peers that
+ *  accept DChat V2 (see: "Accept-Version" header) are sent frames instead
+ *  of textual V1 PDUs. A frame is laid out as follows:
+ *
+ *      magic   1 byte, V2_MAGIC
+ *      length  varint, length of the rest of the frame
+ *      type    1 byte, content-type or V2_TYPE_SESSION
+ *      fields  1 byte, mask of the fields that follow (see: V2_FLD_*)
+ *      [onion id, listening port, nickname, server, message id, ttl, origin,
+ *       content-encoding]
+ *      content
+ *
+ *  Strings are prefixed by their length as varint, the listening port, the
+ *  TTL and the content-encoding are varints and the message id is 8 bytes in network byte order.
+ *  The identity of a peer (onion id, listening port, nickname and server)
+ *  is part of the session state of a connection: it is sent with the first
+ *  frame and whenever it changes, otherwise it is omitted. Since readers
+ *  distinguish frames from V1 PDUs by their first byte, both may be mixed
+ *  on a connection.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dchat_h/framing.h"
+#include "dchat_h/compress.h"
+#include "dchat_h/network.h"
+#include "dchat_h/pool.h"
+#include "dchat_h/consoleui.h"
+
+
+/**
+ *  Encodes an unsigned integer as varint (7 bits per byte, least
+ *  significant group first).
+ *  @param buf   Buffer where the varint will be written to
+ *  @param size  Size of the buffer
+ *  @param value Value to encode
+ *  @return length of the varint or -1 if the buffer is too small
+ */
+int
+put_varint(char* buf, int size, uint64_t value)
+{
+    int len = 0;
+
+    do
+    {
+        if (len >= size)
+        {
+            return -1;
+        }
+
+        buf[len++] = (char)((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+        value >>= 7;
+    }
+    while (value);
+
+    return len;
+}
+
+
+/**
+ *  Decodes a varint.
+ *  @param buf   Buffer holding the varint
+ *  @param len   Amount of bytes available in the buffer
+ *  @param value Pointer where the decoded value will be stored
+ *  @return length of the varint, 0 if the varint is incomplete or -1 if
+ *  it is malformed
+ */
+int
+get_varint(const char* buf, int len, uint64_t* value)
+{
+    uint64_t v = 0;
+
+    for (int i = 0; i < len && i < V2_MAX_VARINT; i++)
+    {
+        v |= (uint64_t)(buf[i] & 0x7F) << (7 * i);
+
+        if (!(buf[i] & 0x80))
+        {
+            *value = v;
+            return i + 1;
+        }
+    }
+
+    return len >= V2_MAX_VARINT ? -1 : 0;
+}
+
+
+/**
+ *  Appends a string prefixed by its length to a frame.
+ *  @return length of the encoded string or -1 if the buffer is too small
+ */
+static int
+put_string(char* buf, int size, char* str)
+{
+    int len = strlen(str);
+    int ret;
+
+    if ((ret = put_varint(buf, size, len)) == -1 || ret + len > size)
+    {
+        return -1;
+    }
+
+    memcpy(buf + ret, str, len);
+    return ret + len;
+}
+
+
+/**
+ *  Decodes a string prefixed by its length.
+ *  @param buf Buffer holding the string
+ *  @param len Amount of bytes available in the buffer
+ *  @param str Buffer where the '\\0' terminated string will be stored
+ *  @param max Max. length of the string
+ *  @return length of the encoded string or -1 if it is malformed
+ */
+static int
+get_string(const char* buf, int len, char* str, int max)
+{
+    uint64_t slen;
+    int ret;
+
+    if ((ret = get_varint(buf, len, &slen)) <= 0 || slen > (uint64_t) max ||
+        ret + (int) slen > len)
+    {
+        return -1;
+    }
+
+    memcpy(str, buf + ret, slen);
+    str[slen] = '\0';
+    return ret + slen;
+}
+
+
+/**
+ *  Decodes a varint, which must lie between 1 and the given maximum.
+ *  @return length of the varint or -1 if it is malformed
+ */
+static int
+get_number(const char* buf, int len, uint64_t* value, uint64_t max)
+{
+    int ret = get_varint(buf, len, value);
+
+    if (ret <= 0 || *value == 0 || *value > max)
+    {
+        *value = 0;
+        return -1;
+    }
+
+    return ret;
+}
+
+
+/**
+ *  Encodes the header of a frame, i.e. everything except its content.
+ *  The message id, TTL and origin of the PDU are encoded if they are set,
+ *  the fields of the session only if they are requested.
+ *  @param pdu    PDU to encode
+ *  @param fields Mask of the session fields to encode (see: V2_FLD_SESSION)
+ *  @param buf    Buffer where the header will be written to
+ *  @param size   Size of the buffer
+ *  @return length of the header or -1 on error
+ */
+int
+encode_frame(dchat_pdu_t* pdu, int fields, char* buf, int size)
+{
+    char body[V2_MAX_HEADER];
+    int len = 2;
+    int ret = 0;
+    int off;
+
+    fields &= V2_FLD_SESSION;
+    fields |= (pdu->msg_id ? V2_FLD_MID : 0) | (pdu->ttl ? V2_FLD_TTL : 0) |
+              (pdu->origin[0] != '\0' ? V2_FLD_ORG : 0) | (pdu->encoding ? V2_FLD_ENC : 0);
+    body[0] = (char) pdu->content_type;
+    body[1] = (char) fields;
+
+    if (fields & V2_FLD_ONI)
+    {
+        ret = put_string(body + len, sizeof(body) - len, pdu->onion_id);
+        len += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_LNP))
+    {
+        ret = put_varint(body + len, sizeof(body) - len, pdu->lport);
+        len += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_NIC))
+    {
+        ret = put_string(body + len, sizeof(body) - len, pdu->nickname);
+        len += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_SRV))
+    {
+        ret = put_string(body + len, sizeof(body) - len, pdu->server);
+        len += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_MID))
+    {
+        if ((ret = len + 8 > (int) sizeof(body) ? -1 : 8) != -1)
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                body[len + i] = (char)(pdu->msg_id >> (56 - 8 * i));
+            }
+        }
+
+        len += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_TTL))
+    {
+        ret = put_varint(body + len, sizeof(body) - len, pdu->ttl);
+        len += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_ORG))
+    {
+        ret = put_string(body + len, sizeof(body) - len, pdu->origin);
+        len += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_ENC))
+    {
+        ret = put_varint(body + len, sizeof(body) - len, pdu->encoding);
+        len += ret;
+    }
+
+    if (ret == -1 || pdu->content_length < 0 || pdu->content_length > MAX_CONTENT_LEN ||
+        size < 1)
+    {
+        return -1;
+    }
+
+    buf[0] = (char) V2_MAGIC;
+
+    if ((off = put_varint(buf + 1, size - 1, len + pdu->content_length)) == -1 ||
+        1 + off + len > size)
+    {
+        return -1;
+    }
+
+    memcpy(buf + 1 + off, body, len);
+    return 1 + off + len;
+}
+
+
+/**
+ *  Prepares a PDU as DChat V2 frame. Like prepare_pdu(), the frame is
+ *  shared by all contacts it is sent to, therefore the session fields
+ *  are omitted (see: update_session()).
+ *  @param pdu PDU to prepare
+ *  @return Pointer to the prepared frame or NULL in case of error
+ */
+wire_pdu_t*
+prepare_frame(dchat_pdu_t* pdu)
+{
+    char header[V2_MAX_HEADER + V2_MAX_VARINT + 1];
+    wire_pdu_t* wp;
+    int len;
+
+    if ((len = encode_frame(pdu, 0, header, sizeof(header))) == -1)
+    {
+        return NULL;
+    }
+
+    if ((wp = pool_alloc(sizeof(*wp) + len + pdu->content_length)) == NULL)
+    {
+        ui_fatal("Memory allocation for prepared frame failed!");
+    }
+
+    wp->refs = 1;
+    wp->len = len + pdu->content_length;
+    wp->content_type = pdu->content_type;
+    wp->v2 = NULL;
+    wp->deflated = NULL;
+    wp->file_fd = -1;
+    wp->file_off = 0;
+    wp->file_len = 0;
+    memcpy(wp->data, header, len);
+    memcpy(wp->data + len, pdu->content, pdu->content_length);
+    return wp;
+}
+
+
+/**
+ *  Prepares a session frame, if the identity of the local client differs
+ *  from the identity sent on a connection so far. Only the fields that
+ *  changed are sent.
+ *  @param tx Identity sent on the connection, which will be updated
+ *  @return Pointer to the prepared frame or NULL if the identity did not
+ *  change (or in case of error)
+ */
+wire_pdu_t*
+update_session(dchat_session_t* tx)
+{
+    dchat_pdu_t pdu;
+    int fields = 0;
+    wire_pdu_t* wp;
+
+    memset(&pdu, 0, sizeof(pdu));
+    pdu.content_type = V2_TYPE_SESSION;
+    strcpy(pdu.onion_id, _cnf->me.onion_id);
+    pdu.lport = _cnf->me.lport;
+    strcpy(pdu.nickname, _cnf->me.name);
+    snprintf(pdu.server, sizeof(pdu.server), "%s/%s", PACKAGE_NAME, PACKAGE_VERSION);
+
+    fields |= strcmp(tx->onion_id, pdu.onion_id) ? V2_FLD_ONI : 0;
+    fields |= tx->lport != pdu.lport ? V2_FLD_LNP : 0;
+    fields |= strcmp(tx->nickname, pdu.nickname) ? V2_FLD_NIC : 0;
+    fields |= strcmp(tx->server, pdu.server) ? V2_FLD_SRV : 0;
+
+    if (!fields)
+    {
+        return NULL;
+    }
+
+    // the session frame is sent by reusing the header of a frame without content
+    if ((wp = pool_alloc(sizeof(*wp) + V2_MAX_HEADER + V2_MAX_VARINT + 1)) == NULL)
+    {
+        ui_fatal("Memory allocation for session frame failed!");
+    }
+
+    if ((wp->len = encode_frame(&pdu, fields, wp->data,
+                                V2_MAX_HEADER + V2_MAX_VARINT + 1)) == -1)
+    {
+        pool_free(wp);
+        return NULL;
+    }
+
+    wp->refs = 1;
+    wp->content_type = V2_TYPE_SESSION;
+    wp->v2 = NULL;
+    wp->deflated = NULL;
+    wp->file_fd = -1;
+    wp->file_off = 0;
+    wp->file_len = 0;
+    strcpy(tx->onion_id, pdu.onion_id);
+    tx->lport = pdu.lport;
+    strcpy(tx->nickname, pdu.nickname);
+    strcpy(tx->server, pdu.server);
+    return wp;
+}
+
+
+/**
+ *  Decodes the fields of a frame and updates the session of the reader.
+ *  @return offset of the content or -1 if the frame is malformed
+ */
+static int
+decode_fields(pdu_reader_t* rd, const char* body, int len, dchat_pdu_t* pdu)
+{
+    int fields = (unsigned char) body[1];
+    uint64_t value = 0;
+    int off = 2;
+    int ret = 0;
+
+    if (fields & V2_FLD_ONI)
+    {
+        ret = get_string(body + off, len - off, rd->rx.onion_id, ONION_ADDRLEN);
+        off += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_LNP))
+    {
+        ret = get_number(body + off, len - off, &value, 0xFFFF);
+        rd->rx.lport = value;
+        off += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_NIC))
+    {
+        ret = get_string(body + off, len - off, rd->rx.nickname, MAX_NICKNAME);
+        off += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_SRV))
+    {
+        ret = get_string(body + off, len - off, rd->rx.server, MAX_SERVER);
+        off += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_MID))
+    {
+        if ((ret = off + 8 > len ? -1 : 8) != -1)
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                pdu->msg_id = (pdu->msg_id << 8) | (unsigned char) body[off + i];
+            }
+        }
+
+        off += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_TTL))
+    {
+        ret = get_number(body + off, len - off, &value, MAX_TTL);
+        pdu->ttl = value;
+        off += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_ORG))
+    {
+        ret = get_string(body + off, len - off, pdu->origin, MAX_NICKNAME);
+        off += ret;
+    }
+
+    if (ret != -1 && (fields & V2_FLD_ENC))
+    {
+        ret = get_number(body + off, len - off, &value, ENC_ID_DEFLATE);
+        pdu->encoding = value;
+        off += ret;
+    }
+
+    if (ret == -1 ||
+        ((fields & V2_FLD_ONI) && !is_valid_onion(rd->rx.onion_id)) ||
+        ((fields & V2_FLD_MID) && !pdu->msg_id) ||
+        ((fields & V2_FLD_ORG) && pdu->origin[0] == '\0'))
+    {
+        return -1;
+    }
+
+    return off;
+}
+
+
+/**
+ *  Decodes the next DChat V2 frame from the receive buffer of a PDU reader
+ *  (see: read_pdu()). The identity of the peer is taken from the session
+ *  of the reader, thus the decoded PDU looks like a complete V1 PDU.
+ *  @param rd  Pointer to the PDU reader, whose buffered data begins with
+ *             V2_MAGIC
+ *  @param pdu Pointer to a PDU structure that will be set if a complete
+ *             frame has been decoded.
+ *  @return amount of bytes of the decoded frame, 0 if more data is required,
+ *  -1 if an illegal frame has been received or -2 if a session frame has
+ *  been decoded
+ */
+int
+read_frame(pdu_reader_t* rd, dchat_pdu_t* pdu)
+{
+    const char* frame = rd->buf + rd->head;
+    int avail = rd->tail - rd->head;
+    dchat_pdu_t dec;
+    uint64_t len;
+    int off;
+    int ret;
+
+    if ((off = get_varint(frame + 1, avail - 1, &len)) == 0)
+    {
+        return 0;
+    }
+
+    if (off == -1 || len < 2 || 1 + off + len > RECV_BUF_LEN)
+    {
+        ui_log(LOG_ERR, "Illegal length of DChat V2 frame received!");
+        free_pdu_reader(rd);
+        return -1;
+    }
+
+    // wait until the whole frame has been received
+    if ((uint64_t) avail < 1 + off + len)
+    {
+        return 0;
+    }
+
+    memset(&dec, 0, sizeof(dec));
+    frame += 1 + off;
+
+    if ((ret = decode_fields(rd, frame, len, &dec)) == -1 ||
+        len - ret > MAX_CONTENT_LEN)
+    {
+        ui_log(LOG_ERR, "Illegal DChat V2 frame received!");
+        free_pdu_reader(rd);
+        return -1;
+    }
+
+    rd->head += 1 + off + len;
+
+    if ((unsigned char) frame[0] == V2_TYPE_SESSION)
+    {
+        return -2;
+    }
+
+    dec.content_type = (unsigned char) frame[0];
+
+    if (!is_valid_content_type(dec.content_type) || rd->rx.onion_id[0] == '\0' ||
+        rd->rx.lport == 0)
+    {
+        ui_log(LOG_ERR, "Illegal DChat V2 frame received (missing session)!");
+        free_pdu_reader(rd);
+        return -1;
+    }
+
+    dec.version = DCHAT_V2;
+    strcpy(dec.onion_id, rd->rx.onion_id);
+    dec.lport = rd->rx.lport;
+    strcpy(dec.nickname, rd->rx.nickname);
+    strcpy(dec.server, rd->rx.server);
+    dec.content_length = len - ret;
+
+    if ((dec.content = pool_alloc(dec.content_length + 1)) == NULL)
+    {
+        ui_fatal("Memory allocation for PDU content failed!");
+    }
+
+    memcpy(dec.content, frame + ret, dec.content_length);
+    dec.content[dec.content_length] = '\0'; // NULL terminate potential string
+    memcpy(pdu, &dec, sizeof(*pdu));
+
+    if (pdu->encoding && inflate_content(pdu) == -1)
+    {
+        ui_log(LOG_ERR, "Decompression of DChat V2 frame failed!");
+        free_pdu(pdu);
+        return -1;
+    }
+
+    return 1 + off + len;
+}
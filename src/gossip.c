@@ -0,0 +1,427 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file gossip.c
+ *  This file contains the digest based exchange of contactlists (gossip).
+ *  Instead of the whole contactlist, peers send a digest of their contacts
+ *  when they get connected. Only contacts of buckets, whose digests differ,
+ *  are sent afterwards (see: send_contact_list()). Newly accepted contacts
+ *  are announced to all other contacts once. Contacts will not be gossiped
+ *  when they are removed, since every peer notices the loss of its own
+ *  connection to a contact.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "dchat_h/gossip.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/consoleui.h"
+
+
+static uint64_t _heard[GOSSIP_HEARD]; //!< hashes of contacts already announced
+static int _heard_pos;                //!< next slot of _heard to overwrite
+
+
+/**
+ *  Calculates the 64 bit FNV-1a hash of a contact, which is used to
+ *  distribute contacts to the buckets of a digest.
+ *  @param onion_id Onion address of the contact
+ *  @param lport    Listening port of the contact
+ *  @return hash of the contact
+ */
+uint64_t
+gossip_hash(char* onion_id, uint16_t lport)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (; *onion_id != '\0'; onion_id++)
+    {
+        h = (h ^ (unsigned char) *onion_id) * 1099511628211ULL;
+    }
+
+    h = (h ^ (lport & 0xFF)) * 1099511628211ULL;
+    h = (h ^ (lport >> 8)) * 1099511628211ULL;
+    return h;
+}
+
+
+/**
+ *  Adds a contact to a digest.
+ *  @param dg       Pointer to the digest
+ *  @param onion_id Onion address of the contact
+ *  @param lport    Listening port of the contact
+ */
+static void
+add_digest(gossip_digest_t* dg, char* onion_id, uint16_t lport)
+{
+    uint64_t h = gossip_hash(onion_id, lport);
+    dg->count[GOSSIP_BUCKET(h)]++;
+    dg->hash[GOSSIP_BUCKET(h)] += h;
+}
+
+
+/**
+ *  Builds the digest of the local contactlist. The local client is part
+ *  of the digest too, since it is known by the peers.
+ *  @param dg Pointer to the digest to build
+ */
+void
+build_digest(gossip_digest_t* dg)
+{
+    contact_t* contact;
+    int i;
+
+    memset(dg, 0, sizeof(*dg));
+    add_digest(dg, _cnf->me.onion_id, _cnf->me.lport);
+
+    for (i = 0; i < _cnf->cl.cl_size; i++)
+    {
+        contact = CONTACT(i);
+
+        if (contact->fd > 0 && contact->lport != 0)
+        {
+            add_digest(dg, contact->onion_id, contact->lport);
+        }
+    }
+}
+
+
+/**
+ *  Encodes a digest. Every bucket holding contacts is encoded as line:
+ *  "<bucket> <count> <hash>\n", whereas the hash is hex encoded.
+ *  @param dg   Pointer to the digest
+ *  @param buf  Buffer where the digest will be written to
+ *  @param size Size of the buffer
+ *  @return length of the encoded digest or -1 if the buffer is too small
+ */
+int
+encode_digest(gossip_digest_t* dg, char* buf, int size)
+{
+    int len = 0;
+    int ret;
+    int i;
+
+    for (i = 0; i < GOSSIP_BUCKETS; i++)
+    {
+        if (!dg->count[i])
+        {
+            continue;
+        }
+
+        ret = snprintf(buf + len, size - len, "%d %d %016" PRIx64 "\n", i,
+                       dg->count[i], dg->hash[i]);
+
+        if (ret < 0 || ret >= size - len)
+        {
+            return -1;
+        }
+
+        len += ret;
+    }
+
+    return len;
+}
+
+
+/**
+ *  Decodes the digest stored in the content of a "control/digest" PDU.
+ *  @param pdu PDU holding the digest
+ *  @param dg  Pointer to the decoded digest
+ *  @return 0 on success, -1 if the digest is invalid
+ */
+int
+decode_digest(dchat_pdu_t* pdu, gossip_digest_t* dg)
+{
+    char line[64];
+    char* end;
+    int begin = 0;
+    int bucket, count;
+    uint64_t hash;
+    int len;
+
+    memset(dg, 0, sizeof(*dg));
+
+    while (begin < pdu->content_length)
+    {
+        if ((end = memchr(pdu->content + begin, '\n', pdu->content_length - begin)) == NULL)
+        {
+            return -1;
+        }
+
+        if ((len = end - (pdu->content + begin)) >= (int) sizeof(line))
+        {
+            return -1;
+        }
+
+        memcpy(line, pdu->content + begin, len);
+        line[len] = '\0';
+
+        if (sscanf(line, "%d %d %" SCNx64, &bucket, &count, &hash) != 3 ||
+            bucket < 0 || bucket >= GOSSIP_BUCKETS || count < 0)
+        {
+            return -1;
+        }
+
+        dg->count[bucket] = count;
+        dg->hash[bucket] = hash;
+        begin += len + 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Compares two digests.
+ *  @return mask of the buckets which differ
+ */
+uint32_t
+compare_digests(gossip_digest_t* a, gossip_digest_t* b)
+{
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < GOSSIP_BUCKETS; i++)
+    {
+        if (a->count[i] != b->count[i] || a->hash[i] != b->hash[i])
+        {
+            mask |= 1u << i;
+        }
+    }
+
+    return mask;
+}
+
+
+/**
+ *  Sends the digest of the local contactlist as "control/digest" PDU to a
+ *  contact. Like the "control/discover" sent without gossip, this PDU
+ *  identifies the local client.
+ *  @param n Index of the contact
+ *  @return length of the digest or -1 on error
+ */
+int
+send_digest(int n)
+{
+    char content[MAX_CONTENT_LEN];
+    gossip_digest_t dg;
+    dchat_pdu_t pdu;
+    wire_pdu_t* wp;
+    int len;
+    int ret;
+
+    build_digest(&dg);
+
+    if ((len = encode_digest(&dg, content, sizeof(content))) == -1 ||
+        init_dchat_pdu(&pdu, DCHAT_V1, CTT_ID_DGT, _cnf->me.onion_id, _cnf->me.lport,
+                       _cnf->me.name) == -1)
+    {
+        ui_log(LOG_ERR, "Encoding of contact digest failed!");
+        return -1;
+    }
+
+    pdu.content = content;
+    pdu.content_length = len;
+    ret = (wp = prepare_wire_pdu(&pdu)) == NULL || send_wire_pdu(n, wp) == -1 ? -1 : len;
+    unref_wire_pdu(wp);
+
+    if (ret == -1)
+    {
+        ui_log(LOG_ERR, "Sending of contact digest failed!");
+    }
+
+    return ret;
+}
+
+
+/**
+ *  Handles the digest received from a contact. Our contacts of all buckets
+ *  which differ from the digest of the contact will be sent to it.
+ *  @param n   Index of the contact
+ *  @param pdu "control/digest" PDU received from the contact
+ *  @return amount of bytes sent as content, -1 on error
+ */
+int
+receive_digest(int n, dchat_pdu_t* pdu)
+{
+    gossip_digest_t remote;
+    gossip_digest_t local;
+    uint32_t mask;
+
+    if (decode_digest(pdu, &remote) == -1)
+    {
+        ui_log(LOG_ERR, "Invalid contact digest received from '%s'!", CONTACT(n)->name);
+        return -1;
+    }
+
+    build_digest(&local);
+
+    if (!(mask = compare_digests(&local, &remote)))
+    {
+        return 0;
+    }
+
+    return send_contact_list(n, mask);
+}
+
+
+/**
+ *  Announces a newly identified contact to all other contacts, unless it
+ *  has already been announced by another one.
+ *  @param n Index of the new contact
+ *  @return amount of contacts the new contact has been announced to, -1 on error
+ */
+int
+announce_contact(int n)
+{
+    dchat_pdu_t pdu;
+    wire_pdu_t* wp;
+    char* contact_str;
+    int sent = 0;
+    int i;
+
+    if (is_heard(CONTACT(n)))
+    {
+        return 0;
+    }
+
+    mark_heard(CONTACT(n));
+
+    if ((contact_str = contact_to_string(CONTACT(n))) == NULL)
+    {
+        return -1;
+    }
+
+    if (init_dchat_pdu(&pdu, DCHAT_V1, CTT_ID_DSC, _cnf->me.onion_id, _cnf->me.lport,
+                       _cnf->me.name) == -1)
+    {
+        free(contact_str);
+        return -1;
+    }
+
+    // the announcement is encoded once for all contacts
+    pdu.content = contact_str;
+    pdu.content_length = strlen(contact_str);
+    wp = prepare_wire_pdu(&pdu);
+    free(contact_str);
+
+    if (wp == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < _cnf->cl.cl_size; i++)
+    {
+        if (i != n && CONTACT(i)->fd > 0 && CONTACT(i)->lport != 0 &&
+            send_wire_pdu(i, wp) != -1)
+        {
+            sent++;
+        }
+    }
+
+    unref_wire_pdu(wp);
+    return sent;
+}
+
+
+/**
+ *  Determines whether we connect to a contact learned by gossip or wait
+ *  for the contact to connect to us. Since both peers learn about each
+ *  other, only the one with the greater onion address (and listening port)
+ *  connects, which avoids duplicate connections.
+ *  @param contact Learned contact
+ *  @return 1 if we connect to the contact, 0 otherwise
+ */
+int
+gossip_initiates(contact_t* contact)
+{
+    int ret = strcmp(_cnf->me.onion_id, contact->onion_id);
+    return ret > 0 || (!ret && _cnf->me.lport > contact->lport);
+}
+
+
+/**
+ *  Remembers that a contact has been announced, either by another peer
+ *  or by ourselves.
+ *  @param contact Announced contact
+ */
+void
+mark_heard(contact_t* contact)
+{
+    if (is_heard(contact))
+    {
+        return;
+    }
+
+    _heard[_heard_pos] = gossip_hash(contact->onion_id, contact->lport);
+    _heard_pos = (_heard_pos + 1) % GOSSIP_HEARD;
+}
+
+
+/**
+ *  Forgets the announcement of a contact, e.g. because it has been removed.
+ *  @param contact Contact to forget
+ */
+void
+forget_heard(contact_t* contact)
+{
+    uint64_t h = gossip_hash(contact->onion_id, contact->lport);
+    int i;
+
+    for (i = 0; i < GOSSIP_HEARD; i++)
+    {
+        if (_heard[i] == h)
+        {
+            _heard[i] = 0;
+        }
+    }
+}
+
+
+/**
+ *  Checks whether a contact has been announced recently.
+ *  @param contact Contact to check
+ *  @return 1 if the contact has been announced, 0 otherwise
+ */
+int
+is_heard(contact_t* contact)
+{
+    uint64_t h = gossip_hash(contact->onion_id, contact->lport);
+    int i;
+
+    for (i = 0; i < GOSSIP_HEARD; i++)
+    {
+        if (_heard[i] == h)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,661 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file history.c
+ *  This file contains the history of text messages and the replay of it
+ *  ("control/replay"). Messages are appended to a memory-mapped history
+ *  file and the latest of them are indexed by a ring in memory, so storing
+ *  a message allocates nothing. Whenever a contact has been identified, it
+ *  is asked for everything since the latest message we know. The contact
+ *  answers with the messages stored after it, packed into as few PDUs as
+ *  possible.
+ *
+ *  A request is a single line "since <message id> <time>\n". A reply is a
+ *  sequence of "msg <message id> <time> <length> <nickname>\n<text>\n".
+ *  Since message ids are unique, a contact which does not know the id in
+ *  a request replays the messages it has stored after the given time.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dchat_h/history.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/relay.h"
+#include "dchat_h/consoleui.h"
+
+
+static history_t _hist = { .fd = -1 }; //!< history of this client
+
+
+/**
+ *  Returns the current time of the real time clock.
+ *  @return milliseconds since the epoch
+ */
+static int64_t
+get_wall_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ *  Returns the slot of the message id index a lookup starts at.
+ *  @param id Message id
+ *  @return slot of the index
+ */
+static unsigned int
+index_slot(uint64_t id)
+{
+    return (unsigned int)((id * 0x9E3779B97F4A7C15ULL) >> 32) & (HIST_INDEX_SIZE - 1);
+}
+
+
+/**
+ *  Checks if a position of the ring still indexes a message.
+ *  @param pos Position of the ring
+ *  @return 1 if the position is valid, 0 otherwise
+ */
+static int
+valid_pos(unsigned int pos)
+{
+    return pos - _hist.tail < _hist.head - _hist.tail;
+}
+
+
+/**
+ *  Looks up a message in the ring by its id. Slots of the index are
+ *  never cleared, slots of messages dropped from the ring are detected
+ *  by their position.
+ *  @param id Message id
+ *  @return position of the message in the ring, -1 if not found
+ */
+static long
+find_history(uint64_t id)
+{
+    unsigned int s = index_slot(id);
+    unsigned int pos;
+
+    for (int i = 0; i < HIST_INDEX_PROBE; i++, s = (s + 1) & (HIST_INDEX_SIZE - 1))
+    {
+        if (!_hist.index[s])
+        {
+            break;
+        }
+
+        pos = _hist.index[s] - 1;
+
+        if (valid_pos(pos) && _hist.ring[pos % HIST_RING_SIZE].id == id)
+        {
+            return pos;
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+ *  Adds the message at a position of the ring to the index. A free or
+ *  stale slot is used, otherwise the slot of the oldest message probed.
+ *  @param pos Position of the message in the ring
+ */
+static void
+index_history(unsigned int pos)
+{
+    unsigned int s = index_slot(_hist.ring[pos % HIST_RING_SIZE].id);
+    unsigned int oldest = s;
+
+    for (int i = 0; i < HIST_INDEX_PROBE; i++, s = (s + 1) & (HIST_INDEX_SIZE - 1))
+    {
+        if (!_hist.index[s] || !valid_pos(_hist.index[s] - 1))
+        {
+            oldest = s;
+            break;
+        }
+
+        if (_hist.index[s] - 1 - _hist.tail < _hist.index[oldest] - 1 - _hist.tail)
+        {
+            oldest = s;
+        }
+    }
+
+    _hist.index[oldest] = pos + 1;
+}
+
+
+/**
+ *  Adds a record of the history file to the ring. If the ring is full,
+ *  the oldest message is dropped from it.
+ *  @param off Offset of the record in the history file
+ */
+static void
+push_history(uint64_t off)
+{
+    hist_record_t* rec = (hist_record_t*)((char*) _hist.seg + off);
+    hist_entry_t* e;
+
+    if (_hist.head - _hist.tail == HIST_RING_SIZE)
+    {
+        _hist.tail++;
+    }
+
+    e = &_hist.ring[_hist.head % HIST_RING_SIZE];
+    e->id = rec->id;
+    e->time = rec->time;
+    e->off = off;
+    _hist.head++;
+    index_history(_hist.head - 1);
+}
+
+
+/**
+ *  Drops the oldest record of the history file, to free space for a new
+ *  one. If the record is still indexed, it is dropped from the ring too.
+ */
+static void
+drop_record()
+{
+    hist_segment_t* seg = _hist.seg;
+    hist_record_t* rec = (hist_record_t*)((char*) seg + seg->tail);
+
+    if (_hist.head != _hist.tail && _hist.ring[_hist.tail % HIST_RING_SIZE].off == seg->tail)
+    {
+        _hist.tail++;
+    }
+
+    seg->tail += rec->size;
+    seg->count--;
+
+    if (seg->tail >= seg->end)
+    {
+        seg->tail = sizeof(*seg);
+    }
+}
+
+
+/**
+ *  Checks if the history file holds a valid record at an offset.
+ *  @param off Offset of the record
+ *  @param end Offset the record must end before
+ *  @return 1 if the record is valid, 0 otherwise
+ */
+static int
+valid_record(uint64_t off, uint64_t end)
+{
+    hist_record_t* rec = (hist_record_t*)((char*) _hist.seg + off);
+
+    return off + sizeof(*rec) <= end && rec->size >= sizeof(*rec) &&
+           rec->size == HIST_ALIGN(sizeof(*rec) + rec->nlen + rec->len) &&
+           off + rec->size <= end && rec->nlen <= MAX_NICKNAME && rec->id;
+}
+
+
+/**
+ *  Indexes the records of a mapped history file. A file whose records
+ *  are inconsistent (e.g. after a crash) is truncated to its valid ones.
+ */
+static void
+load_history()
+{
+    hist_segment_t* seg = _hist.seg;
+    uint64_t off = seg->tail;
+    uint64_t count = 0;
+
+    while (count < seg->count)
+    {
+        // records wrap around at the end of the older ones
+        if (off == seg->end && off != seg->wp)
+        {
+            off = sizeof(*seg);
+        }
+
+        if (!valid_record(off, off < seg->wp ? seg->wp : seg->end))
+        {
+            local_log(LOG_WARN, "History file is inconsistent, dropped %" PRIu64 " messages!",
+                   seg->count - count);
+            break;
+        }
+
+        push_history(off);
+        off += ((hist_record_t*)((char*) seg + off))->size;
+        count++;
+    }
+
+    seg->count = count;
+    seg->wp = count ? off : sizeof(*seg);
+
+    if (!count)
+    {
+        seg->tail = seg->end = sizeof(*seg);
+    }
+}
+
+
+/**
+ *  Opens and maps the history file, which is created if it does not
+ *  exist, and indexes the messages stored in it. Since this happens
+ *  before the user interface is connected, errors are logged locally.
+ *  @param path Path of the history file
+ *  @return 0 on success, -1 in case of error
+ */
+int
+init_history(char* path)
+{
+    struct stat st;
+    hist_segment_t* seg;
+
+    if ((_hist.fd = open(path, O_RDWR | O_CREAT, 0600)) == -1)
+    {
+        local_log_errno(LOG_ERR, "Could not open history file '%s'!", path);
+        return -1;
+    }
+
+    if (fstat(_hist.fd, &st) == -1 ||
+        (st.st_size != HIST_SEGMENT_SIZE && ftruncate(_hist.fd, HIST_SEGMENT_SIZE) == -1))
+    {
+        local_log_errno(LOG_ERR, "Could not resize history file '%s'!", path);
+        destroy_history();
+        return -1;
+    }
+
+    if ((seg = mmap(NULL, HIST_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, _hist.fd,
+                    0)) == MAP_FAILED)
+    {
+        local_log_errno(LOG_ERR, "Could not map history file '%s'!", path);
+        destroy_history();
+        return -1;
+    }
+
+    _hist.seg = seg;
+
+    // new or foreign file
+    if (memcmp(seg->magic, HIST_MAGIC, sizeof(seg->magic)) ||
+        seg->size != HIST_SEGMENT_SIZE || seg->tail < sizeof(*seg) ||
+        seg->wp < sizeof(*seg) || seg->end > seg->size)
+    {
+        memcpy(seg->magic, HIST_MAGIC, sizeof(seg->magic));
+        seg->size = HIST_SEGMENT_SIZE;
+        seg->count = 0;
+    }
+
+    load_history();
+    local_log(LOG_INFO, "History holds %" PRIu64 " messages!", seg->count);
+    return 0;
+}
+
+
+/**
+ *  Unmaps and closes the history file.
+ */
+void
+destroy_history()
+{
+    if (_hist.seg != NULL)
+    {
+        munmap(_hist.seg, HIST_SEGMENT_SIZE);
+        _hist.seg = NULL;
+    }
+
+    if (_hist.fd != -1)
+    {
+        close(_hist.fd);
+        _hist.fd = -1;
+    }
+}
+
+
+/**
+ *  Appends a text message to the history file and indexes it. The oldest
+ *  messages are overwritten, if the file is full.
+ *  @param id     Message id
+ *  @param origin Nickname of the author
+ *  @param text   Text of the message
+ *  @param len    Length of the text
+ *  @return 0 on success, -1 if the history is disabled
+ */
+int
+store_history(uint64_t id, char* origin, char* text, int len)
+{
+    hist_segment_t* seg = _hist.seg;
+    hist_record_t* rec;
+    int nlen = strnlen(origin, MAX_NICKNAME);
+    uint64_t size = HIST_ALIGN(sizeof(*rec) + nlen + len);
+
+    if (seg == NULL)
+    {
+        return -1;
+    }
+
+    // find space for the record behind the newest one
+    while (1)
+    {
+        if (!seg->count)
+        {
+            seg->tail = seg->wp = seg->end = sizeof(*seg);
+        }
+
+        if (seg->tail < seg->wp || !seg->count)
+        {
+            if (seg->wp + size <= seg->size)
+            {
+                break;
+            }
+
+            // wrap around, the space in front of the oldest record is free
+            seg->end = seg->wp;
+            seg->wp = sizeof(*seg);
+        }
+        else if (seg->wp + size <= seg->tail)
+        {
+            break;
+        }
+        else
+        {
+            drop_record();
+        }
+    }
+
+    rec = (hist_record_t*)((char*) seg + seg->wp);
+    rec->size = size;
+    rec->len = len;
+    rec->nlen = nlen;
+    rec->pad = 0;
+    rec->id = id;
+    rec->time = get_wall_ms();
+    memcpy(rec->data, origin, nlen);
+    memcpy(rec->data + nlen, text, len);
+
+    if (!seg->count)
+    {
+        seg->tail = seg->wp;
+    }
+
+    push_history(seg->wp);
+    seg->wp += size;
+    seg->count++;
+
+    if (seg->tail < seg->wp)
+    {
+        seg->end = seg->wp;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Checks if a message is stored in the history ring.
+ *  @param id Message id
+ *  @return 1 if the message is known, 0 otherwise
+ */
+int
+known_history(uint64_t id)
+{
+    return _hist.seg != NULL && find_history(id) != -1;
+}
+
+
+/**
+ *  Sends a "control/replay" to a contact.
+ *  @param n       Index of the contact in the contactlist
+ *  @param content Content of the PDU
+ *  @param len     Length of the content
+ *  @return 0 on success, -1 in case of error
+ */
+static int
+send_replay_pdu(int n, char* content, int len)
+{
+    dchat_pdu_t pdu;
+    wire_pdu_t* wp;
+    int ret;
+
+    if (init_dchat_pdu(&pdu, DCHAT_V1, CTT_ID_RPY, _cnf->me.onion_id, _cnf->me.lport,
+                       _cnf->me.name) == -1)
+    {
+        return -1;
+    }
+
+    init_dchat_pdu_content(&pdu, content, len);
+    wp = prepare_wire_pdu(&pdu);
+    free_pdu(&pdu);
+
+    if (wp == NULL)
+    {
+        ui_log(LOG_ERR, "Encoding of PDU failed!");
+        return -1;
+    }
+
+    ret = send_wire_pdu(n, wp);
+    unref_wire_pdu(wp);
+    return ret;
+}
+
+
+/**
+ *  Asks a contact for the messages it has stored since the latest
+ *  message of our history.
+ *  @param n Index of the contact in the contactlist
+ *  @return 0 on success, -1 in case of error
+ */
+int
+request_replay(int n)
+{
+    char buf[64];
+    hist_entry_t* e = NULL;
+    int len;
+
+    if (_hist.seg == NULL)
+    {
+        return 0;
+    }
+
+    if (_hist.head != _hist.tail)
+    {
+        e = &_hist.ring[(_hist.head - 1) % HIST_RING_SIZE];
+    }
+
+    len = snprintf(buf, sizeof(buf), "since %016" PRIx64 " %" PRId64 "\n", e ? e->id : 0,
+                   e ? e->time : 0);
+    return send_replay_pdu(n, buf, len);
+}
+
+
+/**
+ *  Answers a request of a contact with the messages stored after the
+ *  given message, or after the given time if the message is unknown.
+ *  At most HIST_REPLAY_MAX of the latest of them are replayed, packed
+ *  into PDUs of up to MAX_CONTENT_LEN bytes. Messages too long to fit
+ *  into a PDU along with their header line are skipped.
+ *  @param n    Index of the contact in the contactlist
+ *  @param id   Message id of the latest message known by the contact
+ *  @param time Time of the latest message known by the contact
+ *  @return 0 on success, -1 in case of error
+ */
+static int
+answer_replay(int n, uint64_t id, int64_t time)
+{
+    char buf[MAX_CONTENT_LEN];
+    hist_record_t* rec;
+    unsigned int pos;
+    long found;
+    int len = 0;
+    int hlen;
+    int sent = 0;
+
+    if ((found = id ? find_history(id) : -1) != -1)
+    {
+        pos = found + 1;
+    }
+    else
+    {
+        // the ring is in the order of storage, as are the times
+        for (pos = _hist.head; pos != _hist.tail &&
+             _hist.ring[(pos - 1) % HIST_RING_SIZE].time > time; pos--);
+    }
+
+    if (_hist.head - pos > HIST_REPLAY_MAX)
+    {
+        pos = _hist.head - HIST_REPLAY_MAX;
+    }
+
+    for (; pos != _hist.head; pos++)
+    {
+        rec = (hist_record_t*)((char*) _hist.seg + _hist.ring[pos % HIST_RING_SIZE].off);
+
+        // record and its header line do not fit anymore
+        if (len > 0 && len + 96 + rec->len > MAX_CONTENT_LEN)
+        {
+            if (send_replay_pdu(n, buf, len) == -1)
+            {
+                return -1;
+            }
+
+            len = 0;
+        }
+
+        hlen = snprintf(buf + len, sizeof(buf) - len, "msg %016" PRIx64 " %" PRId64 " %d %.*s\n",
+                        rec->id, rec->time, rec->len, rec->nlen, rec->data);
+
+        if (len + hlen + rec->len + 1 > MAX_CONTENT_LEN)
+        {
+            continue;
+        }
+
+        len += hlen;
+        memcpy(buf + len, rec->data + rec->nlen, rec->len);
+        len += rec->len;
+        buf[len++] = '\n';
+        sent++;
+    }
+
+    if (len > 0 && send_replay_pdu(n, buf, len) == -1)
+    {
+        return -1;
+    }
+
+    if (sent)
+    {
+        ui_log(LOG_INFO, "Replayed %d messages to '%s'!", sent, CONTACT(n)->name);
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Handles a "control/replay" received from a contact, which is either a
+ *  request or a reply. Replayed messages, which are not known yet, are
+ *  printed and stored in the history.
+ *  @param n   Index of the contact in the contactlist
+ *  @param pdu "control/replay" received from the contact
+ *  @return 0 on success, -1 if the PDU is malformed
+ */
+int
+receive_replay(int n, dchat_pdu_t* pdu)
+{
+    char* content = pdu->content;
+    char* end = content + pdu->content_length;
+    char origin[MAX_NICKNAME + 1];
+    char line[128];
+    char* nl;
+    char* text;
+    uint64_t id;
+    int64_t time;
+    int len;
+    int off;
+    int shown = 0;
+
+    if (_hist.seg == NULL)
+    {
+        return 0;
+    }
+
+    while (content < end)
+    {
+        if ((nl = memchr(content, '\n', end - content)) == NULL ||
+            nl - content >= (long) sizeof(line))
+        {
+            return -1;
+        }
+
+        memcpy(line, content, nl - content);
+        line[nl - content] = '\0';
+        content = nl + 1;
+        off = 0;
+
+        if (sscanf(line, "since %" SCNx64 " %" SCNd64, &id, &time) == 2)
+        {
+            return answer_replay(n, id, time);
+        }
+
+        // the nickname is the rest of the line
+        if (sscanf(line, "msg %" SCNx64 " %" SCNd64 " %d %n", &id, &time, &len, &off) != 3 ||
+            !off || !id || len < 0 || len >= end - content)
+        {
+            return -1;
+        }
+
+        origin[0] = '\0';
+        strncat(origin, line + off, MAX_NICKNAME);
+
+        text = content;
+        content += len + 1;
+
+        if (text[len] != '\n')
+        {
+            return -1;
+        }
+
+        // replayed by several contacts or already received
+        if (known_history(id) || seen_msg_id(id))
+        {
+            continue;
+        }
+
+        text[len] = '\0';
+        ui_write(origin, text);
+        store_history(id, origin, text, len);
+        shown++;
+    }
+
+    if (shown)
+    {
+        ui_log(LOG_INFO, "'%s' replayed %d messages!", CONTACT(n)->name, shown);
+    }
+
+    return 0;
+}
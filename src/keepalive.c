@@ -0,0 +1,175 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file keepalive.c
+ *  This file contains the keepalives (see: kpal_parse()). Every contact
+ *  is sent a "control/keepalive" ping periodically, which it answers
+ *  with a pong echoing the time of the ping, so that the round trip time
+ *  can be measured. Contacts, which have not sent any PDU for
+ *  KA_IDLE_FACTOR intervals, are considered dead, since their socket
+ *  may be half-open, and are evicted.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dchat_h/keepalive.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/peercache.h"
+#include "dchat_h/timer.h"
+#include "dchat_h/util.h"
+#include "dchat_h/consoleui.h"
+
+
+/**
+ *  Sends a "control/keepalive" to a contact.
+ *  @param n     Index of the contact in the contactlist
+ *  @param word  "ping" or "pong"
+ *  @param stamp Time of the ping
+ *  @return 0 on success, -1 in case of error
+ */
+static int
+send_keepalive(int n, char* word, long long stamp)
+{
+    char buf[64];
+    dchat_pdu_t pdu;
+    wire_pdu_t* wp;
+    int ret;
+
+    if (init_dchat_pdu(&pdu, DCHAT_V1, CTT_ID_KAL, _cnf->me.onion_id, _cnf->me.lport,
+                       _cnf->me.name) == -1)
+    {
+        return -1;
+    }
+
+    init_dchat_pdu_content(&pdu, buf, snprintf(buf, sizeof(buf), "%s %lld\n", word, stamp));
+    wp = prepare_wire_pdu(&pdu);
+    free_pdu(&pdu);
+
+    if (wp == NULL)
+    {
+        ui_log(LOG_ERR, "Encoding of PDU failed!");
+        return -1;
+    }
+
+    ret = send_wire_pdu(n, wp);
+    unref_wire_pdu(wp);
+    return ret;
+}
+
+
+/**
+ *  Evicts a contact, which has been idle for too long, or pings it.
+ *  Called by the keepalive timer of the contact.
+ *  @param arg Index of the contact in the contactlist
+ */
+static void
+check_keepalive(void* arg)
+{
+    int n = (int) (intptr_t) arg;
+    contact_t* contact = CONTACT(n);
+    long long interval = (long long) _cnf->keepalive * 1000;
+
+    if (get_time_ms() - contact->last_rx >= KA_IDLE_FACTOR * interval)
+    {
+        ui_log(LOG_WARN, "'%s' did not send anything for %lld seconds - removing it!",
+               contact->name, (get_time_ms() - contact->last_rx) / 1000);
+        del_contact(n, DEL_EVICTED);
+        return;
+    }
+
+    if (send_keepalive(n, "ping", get_time_ms()) == -1)
+    {
+        ui_log(LOG_WARN, "Could not send keepalive to '%s'!", contact->name);
+    }
+
+    arm_timer(&contact->keepalive, interval);
+}
+
+
+/**
+ *  Starts to send keepalives to a newly added contact, if keepalives
+ *  are enabled. The timer is cancelled by del_contact().
+ *  @param n Index of the contact in the contactlist
+ */
+void
+start_keepalive(int n)
+{
+    contact_t* contact = CONTACT(n);
+
+    contact->last_rx = get_time_ms();
+
+    if (_cnf->keepalive)
+    {
+        init_timer(&contact->keepalive, check_keepalive, (void*) (intptr_t) n);
+        arm_timer(&contact->keepalive, (long long) _cnf->keepalive * 1000);
+    }
+}
+
+
+/**
+ *  Handles a "control/keepalive" received from a contact. Pings are
+ *  answered, pongs update the smoothed round trip time of the contact
+ *  and the round trip time of the peer in the peer cache.
+ *  @param n   Index of the contact in the contactlist
+ *  @param pdu Received PDU
+ *  @return 0 on success, -1 if the content is illegal or could not be answered
+ */
+int
+receive_keepalive(int n, dchat_pdu_t* pdu)
+{
+    contact_t* contact = CONTACT(n);
+    char line[64];
+    long long stamp;
+    long long rtt;
+    int len = pdu->content_length;
+
+    if (len <= 0 || len >= (int) sizeof(line) || pdu->content[len - 1] != '\n')
+    {
+        return -1;
+    }
+
+    memcpy(line, pdu->content, len);
+    line[len] = '\0';
+
+    if (sscanf(line, "ping %lld", &stamp) == 1)
+    {
+        return send_keepalive(n, "pong", stamp);
+    }
+
+    if (sscanf(line, "pong %lld", &stamp) != 1 || stamp > get_time_ms())
+    {
+        return -1;
+    }
+
+    rtt = get_time_ms() - stamp;
+    rtt = rtt > 0 ? rtt : 1;
+    contact->rtt = contact->rtt ? (int) ((contact->rtt * (KA_RTT_WEIGHT - 1) + rtt) /
+                                         KA_RTT_WEIGHT) : (int) rtt;
+    note_peer_rtt(contact->onion_id, contact->lport, contact->rtt);
+    return 0;
+}
@@ -0,0 +1,341 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file lfqueue.c
+ *  This file contains the lock-free queues, which pass messages between
+ *  threads: an unbounded multi-producer single-consumer queue (e.g. for
+ *  the reactors, see: reactor.c) and a bounded single-producer
+ *  single-consumer ring buffer (e.g. for the user input).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include "dchat_h/lfqueue.h"
+#include "dchat_h/network.h"
+
+
+/**
+ *  Initializes the wakeup of a consumer.
+ *  @param w Pointer to the wakeup
+ *  @return 0 on success, -1 if the file descriptor could not be created
+ */
+int
+init_lf_wake(lf_wake_t* w)
+{
+    w->signaled = 0;
+
+#ifdef HAVE_SYS_EVENTFD_H
+    if ((w->fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+    {
+        return -1;
+    }
+
+    w->fd[1] = w->fd[0];
+#else
+    if (pipe(w->fd) == -1)
+    {
+        return -1;
+    }
+
+    // the consumer drains the pipe without blocking
+    if (set_nonblocking(w->fd[0], 1) == -1)
+    {
+        destroy_lf_wake(w);
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+
+/**
+ *  Closes the file descriptors of a wakeup.
+ *  @param w Pointer to the wakeup
+ */
+void
+destroy_lf_wake(lf_wake_t* w)
+{
+    close(w->fd[0]);
+
+    if (w->fd[1] != w->fd[0])
+    {
+        close(w->fd[1]);
+    }
+}
+
+
+/**
+ *  Wakes the consumer, unless it has been woken already. May be called
+ *  by any thread.
+ *  @param w Pointer to the wakeup
+ */
+void
+signal_lf_wake(lf_wake_t* w)
+{
+    uint64_t one = 1;
+
+    // the pipe is never full, since it is written once per wakeup
+    if (!__atomic_exchange_n(&w->signaled, 1, __ATOMIC_SEQ_CST) &&
+        write(w->fd[1], &one, sizeof(one)) == -1)
+    {
+        __atomic_store_n(&w->signaled, 0, __ATOMIC_RELEASE);
+    }
+}
+
+
+/**
+ *  Acknowledges the wakeup of the consumer. Must be called by the
+ *  consumer before it pops the items of its queue, so that items pushed
+ *  afterwards wake it again.
+ *  @param w Pointer to the wakeup
+ */
+void
+ack_lf_wake(lf_wake_t* w)
+{
+    uint64_t buf[8];
+
+    while (read(w->fd[0], buf, sizeof(buf)) > 0);
+
+    __atomic_store_n(&w->signaled, 0, __ATOMIC_SEQ_CST);
+    // items are popped after the acknowledgement is visible to producers
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+
+/**
+ *  Initializes an empty queue and the wakeup of its consumer.
+ *  @param q Pointer to the queue
+ *  @return 0 on success, -1 if the wakeup could not be created
+ */
+int
+init_lf_queue(lf_queue_t* q)
+{
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+    return init_lf_wake(&q->wake);
+}
+
+
+/**
+ *  Closes the wakeup of a queue. Items left in the queue are not released.
+ *  @param q Pointer to the queue
+ */
+void
+destroy_lf_queue(lf_queue_t* q)
+{
+    destroy_lf_wake(&q->wake);
+}
+
+
+/**
+ *  Links a node as new head of a queue without waking the consumer.
+ *  @param q    Pointer to the queue
+ *  @param node Node to append
+ */
+static void
+link_lf_node(lf_queue_t* q, lf_node_t* node)
+{
+    lf_node_t* prev;
+
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&q->head, node, __ATOMIC_ACQ_REL);
+    // until the node is linked, the consumer stops at the previous one
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+
+/**
+ *  Appends a node to a queue and wakes the consumer, unless it has been
+ *  woken already. May be called by any thread.
+ *  @param q    Pointer to the queue
+ *  @param node Node to append
+ */
+void
+push_lf_queue(lf_queue_t* q, lf_node_t* node)
+{
+    link_lf_node(q, node);
+    signal_lf_wake(&q->wake);
+}
+
+
+/**
+ *  Removes the oldest node from a queue. Must only be called by the
+ *  consumer of the queue. A node, that is being pushed concurrently,
+ *  might not be returned yet, but its producer will wake the consumer
+ *  again.
+ *  @param q Pointer to the queue
+ *  @return oldest node or NULL if the queue is empty
+ */
+lf_node_t*
+pop_lf_queue(lf_queue_t* q)
+{
+    lf_node_t* tail = q->tail;
+    lf_node_t* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    // skip the stub node
+    if (tail == &q->stub)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next != NULL)
+    {
+        q->tail = next;
+        return tail;
+    }
+
+    // a producer has exchanged the head, but not linked its node yet
+    if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+
+    // the last node can only be removed, if another node follows it
+    link_lf_node(q, &q->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (next != NULL)
+    {
+        q->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+
+/**
+ *  Acknowledges the wakeup of the consumer of a queue (see:
+ *  ack_lf_wake()).
+ *  @param q Pointer to the queue
+ */
+void
+ack_lf_queue(lf_queue_t* q)
+{
+    ack_lf_wake(&q->wake);
+}
+
+
+/**
+ *  Initializes an empty ring buffer and the wakeup of its consumer.
+ *  @param r Pointer to the ring buffer
+ *  @return 0 on success, -1 if the wakeup could not be created
+ */
+int
+init_lf_ring(lf_ring_t* r)
+{
+    r->head = 0;
+    r->tail = 0;
+    return init_lf_wake(&r->wake);
+}
+
+
+/**
+ *  Closes the wakeup of a ring buffer. Items left in the ring buffer
+ *  are not released.
+ *  @param r Pointer to the ring buffer
+ */
+void
+destroy_lf_ring(lf_ring_t* r)
+{
+    destroy_lf_wake(&r->wake);
+}
+
+
+/**
+ *  Appends an item to a ring buffer and wakes the consumer, unless it
+ *  has been woken already. Must only be called by the producer of the
+ *  ring buffer.
+ *  @param r    Pointer to the ring buffer
+ *  @param item Item to append
+ *  @return 0 on success, -1 if the ring buffer is full
+ */
+int
+push_lf_ring(lf_ring_t* r, void* item)
+{
+    unsigned int head = r->head;
+
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == LF_RING_SIZE)
+    {
+        return -1;
+    }
+
+    r->item[head & (LF_RING_SIZE - 1)] = item;
+    // the item is stored before the consumer sees the new head
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    signal_lf_wake(&r->wake);
+    return 0;
+}
+
+
+/**
+ *  Removes the oldest item from a ring buffer. Must only be called by
+ *  the consumer of the ring buffer.
+ *  @param r Pointer to the ring buffer
+ *  @return oldest item or NULL if the ring buffer is empty
+ */
+void*
+pop_lf_ring(lf_ring_t* r)
+{
+    unsigned int tail = r->tail;
+    void* item;
+
+    if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+
+    item = r->item[tail & (LF_RING_SIZE - 1)];
+    // the slot may be reused by the producer after the new tail is visible
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+
+/**
+ *  Acknowledges the wakeup of the consumer of a ring buffer (see:
+ *  ack_lf_wake()).
+ *  @param r Pointer to the ring buffer
+ */
+void
+ack_lf_ring(lf_ring_t* r)
+{
+    ack_lf_wake(&r->wake);
+}
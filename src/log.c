@@ -0,0 +1,341 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file log.c
+ *  This file contains the logging pipeline behind ui_log(). Every thread
+ *  that logs owns a buffer of records, which it fills without locks or
+ *  system calls. The flusher thread formats the records of all buffers
+ *  to lines and writes them in batches to the log file descriptor.
+ *  Identical messages of a call site are rate-limited, so that a peer
+ *  flooding us with malformed PDUs only costs a counter increment.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "dchat_h/log.h"
+#include "dchat_h/lfqueue.h"
+#include "dchat_h/consoleui.h"
+#include "dchat_h/util.h"
+
+
+static log_buf_t _buf[LOG_MAX_THREADS]; //!< log buffers of the threads
+static __thread log_buf_t* _own;        //!< log buffer of the calling thread
+static pthread_key_t _key;              //!< releases the buffer of an exiting thread
+static lf_wake_t _wake;                 //!< wakeup of the flusher
+static pthread_t _th_flush;             //!< flusher thread
+static int _running;                    //!< flusher has been started
+
+
+/**
+ *  Marks the log buffer of an exiting thread, the flusher frees it as
+ *  soon as it has popped the remaining records.
+ *  @param ptr Pointer to the log buffer
+ */
+static void
+release_log_buf(void* ptr)
+{
+    log_buf_t* b = ptr;
+
+    __atomic_store_n(&b->state, LOG_BUF_EXITED, __ATOMIC_SEQ_CST);
+    signal_lf_wake(&_wake);
+}
+
+
+/**
+ *  Returns the log buffer of the calling thread. The first call of a
+ *  thread claims a free buffer.
+ *  @return Pointer to the log buffer, NULL if all buffers are in use
+ */
+static log_buf_t*
+get_log_buf()
+{
+    int state;
+
+    for (int i = 0; _own == NULL && i < LOG_MAX_THREADS; i++)
+    {
+        state = LOG_BUF_FREE;
+
+        if (__atomic_compare_exchange_n(&_buf[i].state, &state, LOG_BUF_USED, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            _own = &_buf[i];
+            memset(_own->rate, 0, sizeof(_own->rate));
+            pthread_setspecific(_key, _own);
+        }
+    }
+
+    return _own;
+}
+
+
+/**
+ *  Returns the next free record of a log buffer. The record is
+ *  published by commit_log_rec().
+ *  @param b Pointer to the log buffer of the calling thread
+ *  @return Pointer to the record, NULL if the buffer is full
+ */
+static log_rec_t*
+next_log_rec(log_buf_t* b)
+{
+    if (b->head - __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE) == LOG_BUF_SIZE)
+    {
+        __atomic_store_n(&b->lost, b->lost + 1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    return &b->rec[b->head % LOG_BUF_SIZE];
+}
+
+
+/**
+ *  Publishes the record returned by next_log_rec() and wakes the flusher.
+ *  @param b Pointer to the log buffer of the calling thread
+ */
+static void
+commit_log_rec(log_buf_t* b)
+{
+    __atomic_store_n(&b->head, b->head + 1, __ATOMIC_RELEASE);
+    signal_lf_wake(&_wake);
+}
+
+
+/**
+ *  Logs how many messages of a call site have been suppressed in the
+ *  current window of its rate limit.
+ *  @param b Pointer to the log buffer of the calling thread
+ *  @param r Pointer to the rate limit of the call site
+ */
+static void
+report_suppressed(log_buf_t* b, log_rate_t* r)
+{
+    log_rec_t* rec;
+
+    if (r->suppressed && (rec = next_log_rec(b)) != NULL)
+    {
+        rec->level = r->level;
+        rec->err = -1;
+        snprintf(rec->msg, sizeof(rec->msg), "Suppressed %u similar messages: %s",
+                 r->suppressed, r->fmt);
+        commit_log_rec(b);
+    }
+
+    r->suppressed = 0;
+}
+
+
+/**
+ *  Counts a message of a call site against its rate limit. Only the
+ *  first LOG_RATE_BURST messages of a window of LOG_RATE_MS are logged,
+ *  the remaining ones are counted and reported with the next window.
+ *  @param b Pointer to the log buffer of the calling thread
+ *  @param level Log priority
+ *  @param fmt Format string, which identifies the call site
+ *  @return 1 if the message has to be suppressed, 0 otherwise
+ */
+static int
+limit_log_rate(log_buf_t* b, int level, const char* fmt)
+{
+    log_rate_t* r = &b->rate[((uintptr_t) fmt >> 3) % LOG_RATE_SITES];
+    long long now = get_time_ms();
+
+    if (r->fmt != fmt || r->level != level || now - r->start >= LOG_RATE_MS)
+    {
+        report_suppressed(b, r);
+        r->fmt = fmt;
+        r->level = level;
+        r->start = now;
+        r->count = 0;
+    }
+
+    if (++r->count > LOG_RATE_BURST)
+    {
+        r->suppressed++;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Starts the flusher thread. Until it has been started, queue_log()
+ *  refuses all messages.
+ *  @return 0 on success, -1 in case of error
+ */
+int
+init_log()
+{
+    if (init_lf_wake(&_wake) == -1)
+    {
+        return -1;
+    }
+
+    if (pthread_key_create(&_key, release_log_buf) != 0)
+    {
+        destroy_lf_wake(&_wake);
+        return -1;
+    }
+
+    if (pthread_create(&_th_flush, NULL, th_log_flusher, NULL) != 0)
+    {
+        pthread_key_delete(_key);
+        destroy_lf_wake(&_wake);
+        return -1;
+    }
+
+    __atomic_store_n(&_running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+/**
+ *  Queues a message in the log buffer of the calling thread. Only the
+ *  message text is formatted, everything else is left to the flusher.
+ *  This function never blocks: if the buffer is full, the message is
+ *  lost and counted.
+ *  @param level Log priority
+ *  @param fmt Format string
+ *  @param ap Variable parameter list, untouched if -2 is returned
+ *  @param with_errno Flag if errno should be logged too
+ *  @return 0 on success, -1 if the message has been lost, -2 if the
+ *          message has to be written synchronously by the caller
+ */
+int
+queue_log(int level, const char* fmt, va_list ap, int with_errno)
+{
+    int err = errno;
+    log_buf_t* b;
+    log_rec_t* rec;
+
+    if (!__atomic_load_n(&_running, __ATOMIC_ACQUIRE) || (b = get_log_buf()) == NULL)
+    {
+        return -2;
+    }
+
+    if (limit_log_rate(b, level, fmt))
+    {
+        return 0;
+    }
+
+    if ((rec = next_log_rec(b)) == NULL)
+    {
+        return -1;
+    }
+
+    rec->level = level;
+    rec->err = with_errno ? err : -1;
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+    commit_log_rec(b);
+    return 0;
+}
+
+
+/**
+ *  Thread that pops the records of all log buffers, formats them and
+ *  writes them to the log file descriptor, up to LOG_BATCH_LEN bytes
+ *  at once (see: ui_write_log()).
+ */
+void*
+th_log_flusher(void* ptr)
+{
+    struct pollfd pfd = { .fd = _wake.fd[0], .events = POLLIN };
+    char out[LOG_BATCH_LEN];  // formatted lines
+    char msg[LOG_MSG_LEN];    // message about lost records
+    unsigned int head;        // records pushed to a buffer
+    unsigned int lost;        // records lost by a buffer
+    log_buf_t* b;
+    log_rec_t* rec;
+    int state;
+    int len;
+
+    while (1)
+    {
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+        {
+            ui_fatal("Polling the wakeup of the log flusher failed!");
+        }
+
+        ack_lf_wake(&_wake);
+        len = 0;
+
+        for (int i = 0; i < LOG_MAX_THREADS; i++)
+        {
+            b = &_buf[i];
+
+            if ((state = __atomic_load_n(&b->state, __ATOMIC_SEQ_CST)) == LOG_BUF_FREE)
+            {
+                continue;
+            }
+
+            if ((lost = __atomic_load_n(&b->lost, __ATOMIC_ACQUIRE)) != b->reported)
+            {
+                snprintf(msg, sizeof(msg), "%u log messages have been lost!",
+                         lost - b->reported);
+                len += format_log_line(out + len, sizeof(out) - len, LOG_WARN, msg, -1);
+                b->reported = lost;
+            }
+
+            head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+
+            for (; b->tail != head; __atomic_store_n(&b->tail, b->tail + 1, __ATOMIC_RELEASE))
+            {
+                // a formatted line is shorter than twice a message
+                if (sizeof(out) - len < 2 * LOG_MSG_LEN)
+                {
+                    ui_write_log(out, len);
+                    len = 0;
+                }
+
+                rec = &b->rec[b->tail % LOG_BUF_SIZE];
+                len += format_log_line(out + len, sizeof(out) - len, rec->level, rec->msg,
+                                       rec->err);
+            }
+
+            // buffer of an exited thread has been emptied
+            if (state == LOG_BUF_EXITED)
+            {
+                __atomic_store_n(&b->state, LOG_BUF_FREE, __ATOMIC_SEQ_CST);
+            }
+
+            if (sizeof(out) - len < 2 * LOG_MSG_LEN)
+            {
+                ui_write_log(out, len);
+                len = 0;
+            }
+        }
+
+        if (len > 0)
+        {
+            ui_write_log(out, len);
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,826 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file meshbench.c
+ *  This file contains a benchmark of a local mesh of dchat clients. The
+ *  clients are connected directly on the loopback interface (see:
+ *  drct_parse()), every client broadcasts messages via its user interface
+ *  sockets and the delivery of these messages to all other clients is
+ *  measured. It is run by "make bench".
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "dchat_h/meshbench.h"
+#include "dchat_h/consoleui.h"
+
+
+/**
+ *  Returns the time of the monotonic clock in nanoseconds. The clock is
+ *  shared by all processes, thus timestamps can be compared between nodes.
+ *  @return time in nanoseconds
+ */
+long long
+get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/**
+ *  Connects to a unix socket of a node.
+ *  @param dir  Directory of the socket
+ *  @param name Name of the socket
+ *  @return connected socket or -1 on error
+ */
+int
+unix_connect(char* dir, char* name)
+{
+    struct sockaddr_un sa;
+    int fd;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    snprintf(sa.sun_path, sizeof(sa.sun_path), "%s/%s", dir, name);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*) &sa, sizeof(sa)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/**
+ *  Writes a formatted line to a file descriptor.
+ *  @param fd  File descriptor
+ *  @param fmt Format string
+ *  @return 0 on success, -1 on error
+ */
+int
+write_line(int fd, char* fmt, ...)
+{
+    char line[MB_LINE_LEN];
+    va_list ap;
+    int len;
+    int off = 0;
+    int ret;
+
+    va_start(ap, fmt);
+    len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    if (len < 0 || len >= (int) sizeof(line))
+    {
+        return -1;
+    }
+
+    while (off < len)
+    {
+        if ((ret = write(fd, line + off, len - off)) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        off += ret;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Starts the dchat client of a node. Every node except the first one
+ *  connects to the first node, which propagates the other contacts.
+ *  @param mb Mesh benchmark
+ *  @param i  Index of the node
+ *  @return 0 on success, -1 on error
+ */
+int
+start_node(meshbench_t* mb, int i)
+{
+    mb_node_t* node = &mb->node[i];
+    char nickname[16], lport[8], rport[8], log[160];
+    char* argv[24];
+    int argc = 0;
+    int fd;
+
+    snprintf(node->dir, sizeof(node->dir), "%s/node%d", mb->dir, i);
+    snprintf(node->onion_id, sizeof(node->onion_id), "meshbenchnode%c%c%c.onion",
+             'a' + i / 676 % 26, 'a' + i / 26 % 26, 'a' + i % 26);
+    snprintf(nickname, sizeof(nickname), "node%d", i);
+    node->lport = mb->port + i;
+    snprintf(lport, sizeof(lport), "%d", node->lport);
+    snprintf(rport, sizeof(rport), "%d", mb->port);
+    snprintf(log, sizeof(log), "%s/dchat.log", node->dir);
+
+    if (mkdir(node->dir, 0700) == -1)
+    {
+        perror("mkdir");
+        return -1;
+    }
+
+    argv[argc++] = mb->dchat;
+    argv[argc++] = "-s";
+    argv[argc++] = node->onion_id;
+    argv[argc++] = "-n";
+    argv[argc++] = nickname;
+    argv[argc++] = "-l";
+    argv[argc++] = lport;
+    argv[argc++] = "-x";
+    argv[argc++] = "-u";
+    argv[argc++] = node->dir;
+
+    if (mb->reactors != NULL)
+    {
+        argv[argc++] = "-t";
+        argv[argc++] = mb->reactors;
+    }
+
+    if (mb->events != NULL)
+    {
+        argv[argc++] = "-e";
+        argv[argc++] = mb->events;
+    }
+
+    if (i > 0)
+    {
+        argv[argc++] = "-d";
+        argv[argc++] = mb->node[0].onion_id;
+        argv[argc++] = "-r";
+        argv[argc++] = rport;
+    }
+
+    argv[argc] = NULL;
+
+    if ((node->pid = fork()) == -1)
+    {
+        perror("fork");
+        return -1;
+    }
+
+    if (!node->pid)
+    {
+        // local log messages of dchat are written to stdout
+        if ((fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0600)) != -1)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+        }
+
+        if ((fd = open("/dev/null", O_RDONLY)) != -1)
+        {
+            dup2(fd, STDIN_FILENO);
+        }
+
+        execv(argv[0], argv);
+        perror("execv");
+        _exit(127);
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Connects to the user interface sockets of a node. The sockets are
+ *  created by dchat after its listening socket, thus the node accepts
+ *  connections afterwards.
+ *  @param node Node to connect to
+ *  @return 0 on success, -1 if the node did not start in time
+ */
+int
+connect_node(mb_node_t* node)
+{
+    long long deadline = get_time_ns() + MB_START_TIMEOUT * 1000000LL;
+    int fd[3] = { -1, -1, -1 };
+    char* name[3] = { UI_SOCK_INP, UI_SOCK_OUT, UI_SOCK_LOG };
+    int i;
+
+    for (i = 0; i < 3; )
+    {
+        if ((fd[i] = unix_connect(node->dir, name[i])) != -1)
+        {
+            i++;
+            continue;
+        }
+
+        if (get_time_ns() > deadline || waitpid(node->pid, NULL, WNOHANG) == node->pid)
+        {
+            fprintf(stderr, "Node '%s' did not start (see: %s/dchat.log)!\n",
+                    node->onion_id, node->dir);
+            return -1;
+        }
+
+        usleep(10000);
+    }
+
+    // messages are written to the input socket of dchat
+    node->out.fd = fd[0];
+    node->in_fd = fd[1];
+    node->log.fd = fd[2];
+    return 0;
+}
+
+
+/**
+ *  Stops the dchat client of a node and removes its files.
+ *  @param node Node to stop
+ */
+void
+stop_node(mb_node_t* node)
+{
+    char path[UI_PATH_LEN + 32];
+    char* name[4] = { UI_SOCK_INP, UI_SOCK_OUT, UI_SOCK_LOG, "dchat.log" };
+    int i;
+
+    if (node->pid > 0)
+    {
+        kill(node->pid, SIGTERM);
+        waitpid(node->pid, NULL, 0);
+    }
+
+    close(node->in_fd);
+    close(node->out.fd);
+    close(node->log.fd);
+
+    for (i = 0; i < 4; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", node->dir, name[i]);
+        unlink(path);
+    }
+
+    rmdir(node->dir);
+}
+
+
+/**
+ *  Reads the amount of read and write syscalls of the client of a node
+ *  (see: proc(5) - /proc/[pid]/io).
+ *  @param node Node
+ *  @return amount of syscalls or -1 if it could not be read
+ */
+long long
+read_node_io(mb_node_t* node)
+{
+    char path[64], line[128];
+    long long value, sum = 0;
+    int found = 0;
+    FILE* f;
+
+    snprintf(path, sizeof(path), "/proc/%d/io", (int) node->pid);
+
+    if ((f = fopen(path, "r")) == NULL)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "syscr: %lld", &value) == 1 ||
+            sscanf(line, "syscw: %lld", &value) == 1)
+        {
+            sum += value;
+            found++;
+        }
+    }
+
+    fclose(f);
+    return found == 2 ? sum : -1;
+}
+
+
+/**
+ *  Reads the resident set size of the client of a node
+ *  (see: proc(5) - /proc/[pid]/status).
+ *  @param node Node
+ *  @return resident set size in kB or -1 if it could not be read
+ */
+long
+read_node_rss(mb_node_t* node)
+{
+    char path[64], line[128];
+    long rss = -1;
+    FILE* f;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int) node->pid);
+
+    if ((f = fopen(path, "r")) == NULL)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "VmRSS: %ld", &rss) == 1)
+        {
+            break;
+        }
+    }
+
+    fclose(f);
+    return rss;
+}
+
+
+/**
+ *  Handles a message line ("<nickname>;<message>") printed by the client
+ *  of a node.
+ *  @param mb   Mesh benchmark
+ *  @param i    Index of the receiving node
+ *  @param line Received line without \\n
+ *  @return 0 on success, -1 if the line is invalid
+ */
+int
+handle_node_line(meshbench_t* mb, int i, char* line)
+{
+    char* msg;
+    long long sent;
+    int sender, seq;
+
+    if ((msg = strchr(line, ';')) == NULL)
+    {
+        return -1;
+    }
+
+    msg++;
+
+    switch (msg[0])
+    {
+        // empty line written on (re)connection of the ui
+        case '\0':
+            return 0;
+
+        case MB_MSG_SYNC:
+            if (sscanf(msg + 1, "%d", &sender) != 1 || sender < 0 || sender >= mb->nodes)
+            {
+                return -1;
+            }
+
+            if (!mb->seen[sender][i])
+            {
+                mb->seen[sender][i] = 1;
+                mb->node[sender].synced++;
+            }
+
+            return 0;
+
+        case MB_MSG_BENCH:
+            if (sscanf(msg + 1, "%d %d %lld", &sender, &seq, &sent) != 3)
+            {
+                return -1;
+            }
+
+            if (mb->delivered < (long) mb->nodes * (mb->nodes - 1) * mb->messages)
+            {
+                mb->last = get_time_ns();
+                mb->latency[mb->delivered++] = mb->last - sent;
+            }
+
+            return 0;
+    }
+
+    return -1;
+}
+
+
+/**
+ *  Reads available lines from a socket of a node.
+ *  @param mb   Mesh benchmark
+ *  @param i    Index of the node
+ *  @param sock Socket to read from
+ *  @param msg  Lines are messages (otherwise they are discarded)
+ *  @return 0 on success, -1 if the node has closed the socket
+ */
+static int
+read_node_sock(meshbench_t* mb, int i, mb_sock_t* sock, int msg)
+{
+    char* end;
+    char* line;
+    int ret;
+
+    if ((ret = read(sock->fd, sock->buf + sock->len,
+                    sizeof(sock->buf) - sock->len - 1)) <= 0)
+    {
+        return ret == -1 && errno == EINTR ? 0 : -1;
+    }
+
+    sock->len += ret;
+    sock->buf[sock->len] = '\0';
+    line = sock->buf;
+
+    while ((end = strchr(line, '\n')) != NULL)
+    {
+        *end = '\0';
+
+        if (msg && handle_node_line(mb, i, line) == -1)
+        {
+            fprintf(stderr, "Invalid message '%s' from '%s'!\n", line, mb->node[i].onion_id);
+        }
+
+        line = end + 1;
+    }
+
+    sock->len -= line - sock->buf;
+    memmove(sock->buf, line, sock->len);
+
+    // discard lines that do not fit into the buffer
+    if (sock->len == sizeof(sock->buf) - 1)
+    {
+        sock->len = 0;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Waits for lines printed by the nodes and handles them. Log messages
+ *  are read too, since the clients block if they are not read.
+ *  @param mb      Mesh benchmark
+ *  @param timeout Timeout in milliseconds
+ *  @return 0 on success, -1 if a node has terminated
+ */
+int
+poll_mesh(meshbench_t* mb, int timeout)
+{
+    struct pollfd pfd[2 * MB_MAX_NODES];
+    int i, ret;
+
+    for (i = 0; i < mb->nodes; i++)
+    {
+        pfd[2 * i].fd = mb->node[i].out.fd;
+        pfd[2 * i].events = POLLIN;
+        pfd[2 * i + 1].fd = mb->node[i].log.fd;
+        pfd[2 * i + 1].events = POLLIN;
+    }
+
+    if ((ret = poll(pfd, 2 * mb->nodes, timeout)) == -1)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    for (i = 0; i < mb->nodes && ret > 0; i++)
+    {
+        if ((pfd[2 * i].revents && read_node_sock(mb, i, &mb->node[i].out, 1) == -1) ||
+            (pfd[2 * i + 1].revents && read_node_sock(mb, i, &mb->node[i].log, 0) == -1))
+        {
+            fprintf(stderr, "Node '%s' terminated (see: %s/dchat.log)!\n",
+                    mb->node[i].onion_id, mb->node[i].dir);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Waits until the mesh has been established, i.e. a sync message of
+ *  every node has been received by all other nodes.
+ *  @param mb Mesh benchmark
+ *  @return 0 on success, -1 if the mesh could not be established in time
+ */
+int
+sync_mesh(meshbench_t* mb)
+{
+    long long deadline = get_time_ns() + MB_SYNC_TIMEOUT * 1000000LL;
+    long long next = 0;
+    int synced = 0;
+    int i;
+
+    while (synced < mb->nodes)
+    {
+        if (get_time_ns() > deadline)
+        {
+            fprintf(stderr, "Mesh could not be established (%d of %d nodes)!\n",
+                    synced, mb->nodes);
+            return -1;
+        }
+
+        // repeat sync messages of nodes, which are not known by everyone
+        if (get_time_ns() > next)
+        {
+            for (i = 0; i < mb->nodes; i++)
+            {
+                if (mb->node[i].synced < mb->nodes - 1 &&
+                    write_line(mb->node[i].in_fd, "%c %d\n", MB_MSG_SYNC, i) == -1)
+                {
+                    return -1;
+                }
+            }
+
+            next = get_time_ns() + 250000000LL;
+        }
+
+        if (poll_mesh(mb, 50) == -1)
+        {
+            return -1;
+        }
+
+        for (i = 0, synced = 0; i < mb->nodes; i++)
+        {
+            synced += mb->node[i].synced == mb->nodes - 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Writes the benchmark messages of all nodes. Every message holds its
+ *  sender, sequence number and time of sending.
+ *  @param ptr Mesh benchmark
+ */
+void*
+th_send_messages(void* ptr)
+{
+    meshbench_t* mb = ptr;
+    int seq, i;
+
+    for (seq = 0; seq < mb->messages; seq++)
+    {
+        for (i = 0; i < mb->nodes; i++)
+        {
+            if (write_line(mb->node[i].in_fd, "%c %d %d %lld\n", MB_MSG_BENCH, i, seq,
+                           get_time_ns()) == -1)
+            {
+                fprintf(stderr, "Writing to node '%s' failed!\n", mb->node[i].onion_id);
+                return NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ *  Compares two latencies (see: qsort(3)).
+ */
+static int
+cmp_latency(const void* a, const void* b)
+{
+    long long x = *(const long long*) a;
+    long long y = *(const long long*) b;
+    return x < y ? -1 : x > y;
+}
+
+
+/**
+ *  Prints the results of the benchmark.
+ *  @param mb      Mesh benchmark
+ *  @param elapsed Duration of the benchmark in nanoseconds
+ */
+void
+report_mesh(meshbench_t* mb, long long elapsed)
+{
+    long expected = (long) mb->nodes * (mb->nodes - 1) * mb->messages;
+    long long io = 0;
+    long rss, rss_max = 0, rss_sum = 0;
+    int i;
+
+    for (i = 0; i < mb->nodes; i++)
+    {
+        if (io != -1)
+        {
+            io = mb->node[i].io_start == -1 || mb->node[i].io_end == -1 ? -1 :
+                 io + mb->node[i].io_end - mb->node[i].io_start;
+        }
+
+        if ((rss = read_node_rss(&mb->node[i])) > 0)
+        {
+            rss_max = rss > rss_max ? rss : rss_max;
+            rss_sum += rss;
+        }
+    }
+
+    qsort(mb->latency, mb->delivered, sizeof(long long), cmp_latency);
+    printf("nodes:              %d\n", mb->nodes);
+    printf("messages sent:      %ld\n", (long) mb->nodes * mb->messages);
+    printf("messages delivered: %ld of %ld\n", mb->delivered, expected);
+    printf("elapsed:            %.3f s\n", elapsed / 1e9);
+    printf("throughput:         %.0f msg/s\n", mb->delivered * 1e9 / (elapsed ? elapsed : 1));
+
+    if (mb->delivered)
+    {
+        printf("latency p50:        %.1f us\n", mb->latency[mb->delivered / 2] / 1e3);
+        printf("latency p99:        %.1f us\n", mb->latency[mb->delivered * 99 / 100] / 1e3);
+    }
+
+    if (io != -1 && mb->delivered)
+    {
+        printf("syscalls/msg:       %.2f (read/write syscalls of all nodes)\n",
+               (double) io / mb->delivered);
+    }
+
+    printf("rss:                %ld kB max, %ld kB total\n", rss_max, rss_sum);
+}
+
+
+static void
+mb_usage(char* name)
+{
+    fprintf(stderr, "usage: %s [-b DCHAT] [-n NODES] [-m MESSAGES] [-p PORT] [-t REACTORS]\n"
+            "       [-e BACKEND]\n"
+            "    -b  dchat executable (default: %s)\n"
+            "    -n  amount of nodes (default: %d, max: %d)\n"
+            "    -m  messages sent by every node (default: %d)\n"
+            "    -p  listening port of the first node (default: %d)\n"
+            "    -t  reactor threads of every node (default: none)\n"
+            "    -e  event backend of every node (default: the default of dchat)\n",
+            name, MB_DEFAULT_DCHAT, MB_DEFAULT_NODES, MB_MAX_NODES,
+            MB_DEFAULT_MESSAGES, MB_DEFAULT_PORT);
+    exit(EXIT_FAILURE);
+}
+
+
+int
+main(int argc, char** argv)
+{
+    meshbench_t* mb;
+    pthread_t th;
+    long long start;
+    long expected;
+    int started = 0;
+    int ret = EXIT_FAILURE;
+    int opt, i;
+
+    if ((mb = calloc(1, sizeof(*mb))) == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    mb->dchat = MB_DEFAULT_DCHAT;
+    mb->nodes = MB_DEFAULT_NODES;
+    mb->messages = MB_DEFAULT_MESSAGES;
+    mb->port = MB_DEFAULT_PORT;
+
+    while ((opt = getopt(argc, argv, "b:n:m:p:t:e:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                mb->dchat = optarg;
+                break;
+
+            case 'n':
+                mb->nodes = atoi(optarg);
+                break;
+
+            case 'm':
+                mb->messages = atoi(optarg);
+                break;
+
+            case 'p':
+                mb->port = atoi(optarg);
+                break;
+
+            case 't':
+                mb->reactors = optarg;
+                break;
+
+            case 'e':
+                mb->events = optarg;
+                break;
+
+            default:
+                mb_usage(argv[0]);
+        }
+    }
+
+    if (optind < argc || mb->nodes < 2 || mb->nodes > MB_MAX_NODES || mb->messages < 1 ||
+        mb->port < 1 || mb->port + mb->nodes > 65535)
+    {
+        mb_usage(argv[0]);
+    }
+
+    expected = (long) mb->nodes * (mb->nodes - 1) * mb->messages;
+
+    if ((mb->latency = malloc(expected * sizeof(long long))) == NULL)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    strcpy(mb->dir, "/tmp/dchat-meshbench.XXXXXX");
+
+    if (mkdtemp(mb->dir) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // every node has to listen, before the next one connects to the mesh
+    for (started = 0; started < mb->nodes; started++)
+    {
+        if (start_node(mb, started) == -1 || connect_node(&mb->node[started]) == -1)
+        {
+            started++;
+            goto cleanup;
+        }
+    }
+
+    if (sync_mesh(mb) == -1)
+    {
+        goto cleanup;
+    }
+
+    for (i = 0; i < mb->nodes; i++)
+    {
+        mb->node[i].io_start = read_node_io(&mb->node[i]);
+    }
+
+    start = mb->last = get_time_ns();
+
+    if (pthread_create(&th, NULL, th_send_messages, mb) != 0)
+    {
+        perror("pthread_create");
+        goto cleanup;
+    }
+
+    // wait until all messages have been delivered or nothing happens anymore
+    while (mb->delivered < expected && get_time_ns() - mb->last < MB_IDLE_TIMEOUT * 1000000LL)
+    {
+        if (poll_mesh(mb, 100) == -1)
+        {
+            break;
+        }
+    }
+
+    pthread_join(th, NULL);
+
+    for (i = 0; i < mb->nodes; i++)
+    {
+        mb->node[i].io_end = read_node_io(&mb->node[i]);
+    }
+
+    report_mesh(mb, mb->last - start);
+    ret = mb->delivered == expected ? EXIT_SUCCESS : EXIT_FAILURE;
+
+cleanup:
+    for (i = 0; i < started; i++)
+    {
+        stop_node(&mb->node[i]);
+    }
+
+    rmdir(mb->dir);
+    free(mb->latency);
+    free(mb);
+    return ret;
+}
@@ -0,0 +1,780 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file metrics.c
+ *  This file contains the runtime metrics of the client: counters of PDUs
+ *  and bytes per contact and for all contacts together, and histograms of
+ *  the latencies of decoding and handling received PDUs, of queueing
+ *  messages for the user interface and of connecting to remote hosts.
+ *  Counters and histograms are updated by the main loop and the reactors
+ *  without locks. They are reported by the "/stats" command and written
+ *  in the text format of Prometheus to every client of the metrics socket,
+ *  which is created next to the sockets of the user interface.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "dchat_h/metrics.h"
+#include "dchat_h/types.h"
+#include "dchat_h/connector.h"
+#include "dchat_h/event.h"
+#include "dchat_h/network.h"
+#include "dchat_h/pool.h"
+#include "dchat_h/util.h"
+#include "dchat_h/consoleui.h"
+
+
+static metrics_t _mt = { .fd = -1 }; //!< global metrics
+
+static char _path[UI_PATH_LEN];    //!< path of the metrics socket
+
+//! names of the histograms (see: MT_HIST_*)
+static const char* _hist_name[MT_HIST_AMOUNT] =
+{
+    "decode", "dispatch", "ui_write", "connect"
+};
+
+
+/**
+ *  Adds a value to a counter.
+ *  @param ctr Pointer to the counter
+ *  @param v   Value to add
+ */
+static void
+add(uint64_t* ctr, uint64_t v)
+{
+    __atomic_fetch_add(ctr, v, __ATOMIC_RELAXED);
+}
+
+
+/**
+ *  Reads a counter.
+ *  @param ctr Pointer to the counter
+ *  @return value of the counter
+ */
+static uint64_t
+get(uint64_t* ctr)
+{
+    return __atomic_load_n(ctr, __ATOMIC_RELAXED);
+}
+
+
+/**
+ *  Returns the bucket of a histogram a value is counted in. Values
+ *  lower than MT_SUB have a bucket of their own, higher values share
+ *  a bucket with the values having the same MT_SUB_BITS highest bits.
+ *  @param v Value
+ *  @return index of the bucket
+ */
+static int
+hist_bucket(uint64_t v)
+{
+    int shift;
+
+    if (v < MT_SUB)
+    {
+        return v;
+    }
+
+    if (v >> (MT_MAX_BITS + 1))
+    {
+        return MT_BUCKETS - 1;
+    }
+
+    shift = 63 - __builtin_clzll(v) - MT_SUB_BITS;
+    return (shift + 1) * MT_SUB + ((v >> shift) & (MT_SUB - 1));
+}
+
+
+/**
+ *  Returns the value, which represents a bucket of a histogram (the
+ *  middle of the values counted in the bucket).
+ *  @param b Index of the bucket
+ *  @return value of the bucket
+ */
+static uint64_t
+bucket_value(int b)
+{
+    int shift;
+
+    if (b < MT_SUB)
+    {
+        return b;
+    }
+
+    shift = b / MT_SUB - 1;
+    return ((uint64_t) (MT_SUB + b % MT_SUB) << shift) + ((1ULL << shift) >> 1);
+}
+
+
+/**
+ *  Counts bytes received from a contact.
+ *  @param c     Counters of the contact, NULL if none
+ *  @param bytes Amount of bytes
+ */
+void
+count_bytes_in(mt_counters_t* c, int bytes)
+{
+    if (c != NULL)
+    {
+        add(&c->bytes_in, bytes);
+    }
+
+    add(&_mt.total.bytes_in, bytes);
+}
+
+
+/**
+ *  Counts a PDU received from a contact.
+ *  @param c         Counters of the contact, NULL if none
+ *  @param decode_ns Time it took to decode the PDU
+ */
+void
+count_pdu_in(mt_counters_t* c, long long decode_ns)
+{
+    if (c != NULL)
+    {
+        add(&c->pdus_in, 1);
+    }
+
+    add(&_mt.total.pdus_in, 1);
+    record_latency(MT_HIST_DECODE, decode_ns);
+}
+
+
+/**
+ *  Counts PDUs and bytes written to a contact.
+ *  @param c     Counters of the contact, NULL if none
+ *  @param pdus  PDUs written completely
+ *  @param bytes Bytes written
+ */
+void
+count_pdus_out(mt_counters_t* c, int pdus, int bytes)
+{
+    if (c != NULL)
+    {
+        add(&c->pdus_out, pdus);
+        add(&c->bytes_out, bytes);
+    }
+
+    add(&_mt.total.pdus_out, pdus);
+    add(&_mt.total.bytes_out, bytes);
+}
+
+
+/**
+ *  Counts an illegal PDU received from a contact.
+ *  @param c Counters of the contact, NULL if none
+ */
+void
+count_decode_error(mt_counters_t* c)
+{
+    if (c != NULL)
+    {
+        add(&c->decode_errors, 1);
+    }
+
+    add(&_mt.total.decode_errors, 1);
+}
+
+
+/**
+ *  Counts a contact, whose reading has been paused by the rate limits
+ *  (see: ratelimit.c).
+ *  @param c Counters of the contact, NULL if none
+ */
+void
+count_throttled(mt_counters_t* c)
+{
+    if (c != NULL)
+    {
+        add(&c->throttled, 1);
+    }
+
+    add(&_mt.total.throttled, 1);
+}
+
+
+/**
+ *  Counts contacts advertised by a contact, which have not been
+ *  connected, since the connect budget of the contact was exhausted.
+ *  @param c        Counters of the contact, NULL if none
+ *  @param contacts Amount of contacts not connected
+ */
+void
+count_refused_connects(mt_counters_t* c, int contacts)
+{
+    if (c != NULL)
+    {
+        add(&c->refused, contacts);
+    }
+
+    add(&_mt.total.refused, contacts);
+}
+
+
+/**
+ *  Counts PDUs dropped from the outbound queue of a contact.
+ *  @param c    Counters of the contact, NULL if none
+ *  @param pdus Amount of PDUs dropped
+ */
+void
+count_dropped(mt_counters_t* c, int pdus)
+{
+    if (c != NULL)
+    {
+        add(&c->dropped, pdus);
+    }
+
+    add(&_mt.total.dropped, pdus);
+}
+
+
+/**
+ *  Updates the bytes in the outbound queue of a contact.
+ *  @param c     Counters of the contact, NULL if none
+ *  @param bytes Bytes queued
+ */
+void
+count_queued(mt_counters_t* c, int bytes)
+{
+    if (c != NULL)
+    {
+        __atomic_store_n(&c->queued, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+
+/**
+ *  Counts a finished connection attempt.
+ *  @param ok 1 if the remote host has been connected, 0 if the attempt failed
+ *  @param ms Time it took to connect (ignored for failed attempts)
+ */
+void
+count_connect(int ok, long long ms)
+{
+    if (!ok)
+    {
+        add(&_mt.connect_failures, 1);
+        return;
+    }
+
+    add(&_mt.connects, 1);
+    record_latency(MT_HIST_CONNECT, ms * 1000000);
+}
+
+
+/**
+ *  Records a latency in a histogram.
+ *  @param hist Histogram (see: MT_HIST_*)
+ *  @param ns   Latency in nanoseconds
+ */
+void
+record_latency(int hist, long long ns)
+{
+    mt_hist_t* h = &_mt.hist[hist];
+    uint64_t v = ns > 0 ? ns : 0;
+    uint64_t max = get(&h->max);
+
+    add(&h->count, 1);
+    add(&h->sum, v);
+    add(&h->bucket[hist_bucket(v)], 1);
+
+    while (v > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+/**
+ *  Returns a quantile of the values recorded in a histogram.
+ *  @param h Pointer to the histogram
+ *  @param q Quantile (e.g. 0.99)
+ *  @return value of the quantile, 0 if no value has been recorded
+ */
+uint64_t
+hist_quantile(mt_hist_t* h, double q)
+{
+    uint64_t count = get(&h->count);
+    uint64_t rank = (uint64_t) (q * count + 0.5);
+    uint64_t seen = 0;
+    uint64_t v;
+
+    rank = rank ? rank : 1;
+
+    for (int b = 0; b < MT_BUCKETS && count; b++)
+    {
+        if ((seen += get(&h->bucket[b])) >= rank)
+        {
+            // the quantile never exceeds the highest value recorded
+            v = bucket_value(b);
+            return v < get(&h->max) ? v : get(&h->max);
+        }
+    }
+
+    return get(&h->max);
+}
+
+
+/**
+ *  Reports the metrics as notices (see: "/stats" command). Must be
+ *  called by the main loop, since the contactlist is read.
+ */
+void
+log_metrics()
+{
+    mt_counters_t* t = &_mt.total;
+    mt_counters_t* c;
+    mt_hist_t* h;
+    contact_t* contact;
+    int i;
+
+    ui_log(LOG_NOTICE, "Uptime.................%llds",
+           (get_time_ms() - _mt.started) / 1000);
+    ui_log(LOG_NOTICE, "Contacts...............%d (%d connecting)",
+           _cnf->cl.used_contacts, pending_connects());
+    ui_log(LOG_NOTICE, "PDUs in/out............%llu / %llu",
+           (unsigned long long) get(&t->pdus_in), (unsigned long long) get(&t->pdus_out));
+    ui_log(LOG_NOTICE, "Bytes in/out...........%llu / %llu",
+           (unsigned long long) get(&t->bytes_in), (unsigned long long) get(&t->bytes_out));
+    ui_log(LOG_NOTICE, "Illegal/dropped PDUs...%llu / %llu",
+           (unsigned long long) get(&t->decode_errors), (unsigned long long) get(&t->dropped));
+    ui_log(LOG_NOTICE, "Throttled/refused......%llu / %llu",
+           (unsigned long long) get(&t->throttled), (unsigned long long) get(&t->refused));
+    ui_log(LOG_NOTICE, "Connects...............%llu (%llu failed)",
+           (unsigned long long) get(&_mt.connects),
+           (unsigned long long) get(&_mt.connect_failures));
+    ui_log(LOG_NOTICE, "Pool allocations.......%llu", (unsigned long long) pool_mallocs());
+
+    for (i = 0; i < MT_HIST_AMOUNT; i++)
+    {
+        h = &_mt.hist[i];
+        ui_log(LOG_NOTICE, "%-8s p50/p99/max...%.1f / %.1f / %.1f us (%llu)", _hist_name[i],
+               hist_quantile(h, 0.5) / 1000.0, hist_quantile(h, 0.99) / 1000.0,
+               get(&h->max) / 1000.0, (unsigned long long) get(&h->count));
+    }
+
+    for (i = 0; i < _cnf->cl.cl_size; i++)
+    {
+        contact = CONTACT(i);
+
+        if (contact->fd <= 0)
+        {
+            continue;
+        }
+
+        c = &contact->mt;
+        ui_log(LOG_NOTICE, "");
+        ui_log(LOG_NOTICE, "Contact................%s", contact->name);
+        ui_log(LOG_NOTICE, "PDUs in/out............%llu / %llu",
+               (unsigned long long) get(&c->pdus_in), (unsigned long long) get(&c->pdus_out));
+        ui_log(LOG_NOTICE, "Bytes in/out...........%llu / %llu",
+               (unsigned long long) get(&c->bytes_in), (unsigned long long) get(&c->bytes_out));
+        ui_log(LOG_NOTICE, "Illegal/dropped PDUs...%llu / %llu",
+               (unsigned long long) get(&c->decode_errors), (unsigned long long) get(&c->dropped));
+        ui_log(LOG_NOTICE, "Throttled/refused......%llu / %llu",
+               (unsigned long long) get(&c->throttled), (unsigned long long) get(&c->refused));
+        ui_log(LOG_NOTICE, "Queued bytes...........%llu", (unsigned long long) get(&c->queued));
+        ui_log(LOG_NOTICE, "Round trip time........%d ms", contact->rtt);
+    }
+}
+
+
+/**
+ *  Appends a formatted line to a buffer, as long as it fits.
+ *  @param buf  Buffer
+ *  @param size Size of the buffer
+ *  @param len  Length of the buffer already used
+ *  @param fmt  Format string
+ *  @return new length of the buffer
+ */
+static int
+append(char* buf, int size, int len, const char* fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start(ap, fmt);
+    ret = vsnprintf(buf + len, size - len, fmt, ap);
+    va_end(ap);
+
+    // a truncated line is discarded
+    if (ret < 0 || ret >= size - len)
+    {
+        buf[len] = '\0';
+        return len;
+    }
+
+    return len + ret;
+}
+
+
+/**
+ *  Formats the counters of a contact or of all contacts.
+ *  @param buf    Buffer
+ *  @param size   Size of the buffer
+ *  @param len    Length of the buffer already used
+ *  @param prefix Prefix of the names of the metrics
+ *  @param labels Labels of the metrics, including the braces, or ""
+ *  @param c      Counters
+ *  @return new length of the buffer
+ */
+static int
+format_counters(char* buf, int size, int len, const char* prefix, const char* labels,
+                mt_counters_t* c)
+{
+    const char* name[] =
+    {
+        "pdus_in_total", "pdus_out_total", "bytes_in_total", "bytes_out_total",
+        "decode_errors_total", "pdus_dropped_total", "queued_bytes", "throttled_total",
+        "connects_refused_total"
+    };
+    uint64_t value[] =
+    {
+        get(&c->pdus_in), get(&c->pdus_out), get(&c->bytes_in), get(&c->bytes_out),
+        get(&c->decode_errors), get(&c->dropped), get(&c->queued), get(&c->throttled),
+        get(&c->refused)
+    };
+
+    for (int i = 0; i < (int) (sizeof(value) / sizeof(value[0])); i++)
+    {
+        len = append(buf, size, len, "%s%s%s %llu\n", prefix, name[i], labels,
+                     (unsigned long long) value[i]);
+    }
+
+    return len;
+}
+
+
+/**
+ *  Formats the metrics in the text format of Prometheus. Must be called
+ *  by the main loop, since the contactlist is read.
+ *  @param buf  Buffer
+ *  @param size Size of the buffer
+ *  @return length of the formatted metrics, which are truncated at the
+ *  end of the last line fitting into the buffer
+ */
+int
+format_metrics(char* buf, int size)
+{
+    const double q[] = { 0.5, 0.9, 0.99, 0.999 };
+    char labels[ONION_ADDRLEN + MAX_NICKNAME + 64];
+    contact_t* contact;
+    mt_hist_t* h;
+    int len = 0;
+    int i, j, k;
+
+    buf[0] = '\0';
+    len = append(buf, size, len, "dchat_uptime_seconds %lld\n",
+                 (get_time_ms() - _mt.started) / 1000);
+    len = append(buf, size, len, "dchat_contacts %d\n", _cnf->cl.used_contacts);
+    len = append(buf, size, len, "dchat_pending_connects %d\n", pending_connects());
+    len = append(buf, size, len, "dchat_connects_total %llu\n",
+                 (unsigned long long) get(&_mt.connects));
+    len = append(buf, size, len, "dchat_connect_failures_total %llu\n",
+                 (unsigned long long) get(&_mt.connect_failures));
+    len = append(buf, size, len, "dchat_pool_mallocs_total %llu\n",
+                 (unsigned long long) pool_mallocs());
+    len = format_counters(buf, size, len, "dchat_", "", &_mt.total);
+
+    for (i = 0; i < MT_HIST_AMOUNT; i++)
+    {
+        h = &_mt.hist[i];
+
+        for (j = 0; j < (int) (sizeof(q) / sizeof(q[0])); j++)
+        {
+            len = append(buf, size, len, "dchat_%s_ns{quantile=\"%g\"} %llu\n", _hist_name[i],
+                         q[j], (unsigned long long) hist_quantile(h, q[j]));
+        }
+
+        len = append(buf, size, len, "dchat_%s_ns_max %llu\n", _hist_name[i],
+                     (unsigned long long) get(&h->max));
+        len = append(buf, size, len, "dchat_%s_ns_sum %llu\n", _hist_name[i],
+                     (unsigned long long) get(&h->sum));
+        len = append(buf, size, len, "dchat_%s_ns_count %llu\n", _hist_name[i],
+                     (unsigned long long) get(&h->count));
+    }
+
+    for (i = 0; i < _cnf->cl.cl_size; i++)
+    {
+        contact = CONTACT(i);
+
+        if (contact->fd <= 0)
+        {
+            continue;
+        }
+
+        k = snprintf(labels, sizeof(labels), "{onion=\"%s\",port=\"%hu\",nickname=\"",
+                     contact->onion_id, contact->lport);
+
+        // quotes and backslashes of nicknames would end the label
+        for (j = 0; contact->name[j] != '\0'; j++)
+        {
+            labels[k++] = contact->name[j] == '"' || contact->name[j] == '\\' ? '_' :
+                          contact->name[j];
+        }
+
+        snprintf(labels + k, sizeof(labels) - k, "\"}");
+        len = format_counters(buf, size, len, "dchat_contact_", labels, &contact->mt);
+        len = append(buf, size, len, "dchat_contact_rtt_ms%s %d\n", labels, contact->rtt);
+    }
+
+    return len;
+}
+
+
+/**
+ *  Creates the metrics socket, which is a unix socket next to the
+ *  sockets of the user interface (see: udir_parse()), and registers it
+ *  in the event loop of the main loop. Since this happens before the
+ *  user interface is connected, errors are reported locally. The client
+ *  runs without metrics socket, if it could not be created.
+ *  @return 0 on success, -1 in case of error
+ */
+int
+init_metrics()
+{
+    struct sockaddr_un addr;
+    int len;
+
+    _mt.started = get_time_ms();
+
+    if (_cnf->ui_dir != NULL)
+    {
+        len = snprintf(_path, sizeof(_path), "%s/%s", _cnf->ui_dir, UI_SOCK_MET);
+    }
+    else
+    {
+        len = snprintf(_path, sizeof(_path), "%s", MET_SOCK_PATH);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = PF_LOCAL;
+
+    // a truncated path would bind (and remove) another socket
+    if (len < 0 || len >= (int) sizeof(_path) ||
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", _path) >= (int) sizeof(addr.sun_path))
+    {
+        local_log(LOG_WARN, "Path of the metrics socket is too long!");
+        return -1;
+    }
+
+    if (unlink(_path) == -1 && errno != ENOENT)
+    {
+        local_log_errno(LOG_WARN, "Could not remove the old metrics socket!");
+        return -1;
+    }
+
+    if ((_mt.fd = socket(PF_LOCAL, SOCK_STREAM, 0)) == -1)
+    {
+        local_log_errno(LOG_WARN, "Creation of metrics socket failed!");
+        return -1;
+    }
+
+    if (bind(_mt.fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 ||
+        listen(_mt.fd, MT_SOCK_BACKLOG) == -1 || set_nonblocking(_mt.fd, 1) == -1 ||
+        ev_add(&_cnf->ev, _mt.fd, EV_READ, EV_ID(EV_SRC_METRICS, 0)) == -1)
+    {
+        local_log_errno(LOG_WARN, "Could not listen on metrics socket '%s'!", _path);
+        close(_mt.fd);
+        _mt.fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Closes the connection of a client of the metrics socket and frees
+ *  its slot.
+ *  @param cl Client of the metrics socket
+ */
+static void
+close_metrics_client(mt_client_t* cl)
+{
+    if (cl->watched)
+    {
+        ev_del(&_cnf->ev, cl->fd);
+    }
+
+    close(cl->fd);
+    free(cl->buf);
+    memset(cl, 0, sizeof(*cl));
+}
+
+
+/**
+ *  Writes the metrics left of a client without blocking the main loop.
+ *  If the socket of the client is full, the client is registered in the
+ *  event loop and written again as soon as it becomes writable. The
+ *  connection is closed, after all metrics have been written.
+ *  @param n Slot of the client
+ */
+static void
+write_metrics_client(int n)
+{
+    mt_client_t* cl = &_mt.client[n];
+    int ret;
+
+    while (cl->off < cl->len)
+    {
+        if ((ret = send(cl->fd, cl->buf + cl->off, cl->len - cl->off,
+                        MSG_DONTWAIT | MSG_NOSIGNAL)) != -1)
+        {
+            cl->off += ret;
+            continue;
+        }
+
+        if (errno == EINTR)
+        {
+            continue;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            ui_log_errno(LOG_WARN, "Writing to a client of the metrics socket failed!");
+            break;
+        }
+
+        // wait until the socket of the client becomes writable
+        if (!cl->watched &&
+            ev_add(&_cnf->ev, cl->fd, EV_WRITE, EV_ID(EV_SRC_METRICS, n + 1)) == -1)
+        {
+            ui_log_errno(LOG_WARN, "Metrics written to the metrics socket have been truncated!");
+            break;
+        }
+
+        cl->watched = 1;
+        return;
+    }
+
+    close_metrics_client(cl);
+}
+
+
+/**
+ *  Accepts the new clients of the metrics socket and writes the metrics
+ *  to them. The buffer of the metrics is sized by the amount of contacts.
+ *  If all slots are used, the client accepted first, which apparently
+ *  does not read its metrics, is dropped.
+ */
+static void
+accept_metrics_clients()
+{
+    mt_client_t* cl;
+    int size;
+    int fd;
+    int n;
+
+    while ((fd = accept(_mt.fd, NULL, NULL)) != -1)
+    {
+        // use a free slot or the slot of the client accepted first
+        cl = &_mt.client[0];
+
+        for (n = 1; n < MT_MAX_CLIENTS && cl->buf != NULL; n++)
+        {
+            if (_mt.client[n].buf == NULL || _mt.client[n].accepted < cl->accepted)
+            {
+                cl = &_mt.client[n];
+            }
+        }
+
+        if (cl->buf != NULL)
+        {
+            ui_log(LOG_WARN, "Dropping a client of the metrics socket, which does not read!");
+            close_metrics_client(cl);
+        }
+
+        size = MT_DUMP_LEN + _cnf->cl.used_contacts * MT_DUMP_CONTACT_LEN;
+
+        if ((cl->buf = malloc(size)) == NULL)
+        {
+            ui_fatal("Memory allocation for metrics failed!");
+        }
+
+        cl->fd = fd;
+        cl->len = format_metrics(cl->buf, size);
+        cl->off = 0;
+        cl->watched = 0;
+        cl->accepted = get_time_ms();
+        write_metrics_client(cl - _mt.client);
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+        ui_log_errno(LOG_ERR, "Accepting on metrics socket failed!");
+    }
+}
+
+
+/**
+ *  Handles an event of the metrics socket: new clients of the socket
+ *  are accepted, clients waiting for their metrics are written.
+ *  @param n 0 for the listening socket, otherwise slot of the client + 1
+ */
+void
+handle_metrics_request(int n)
+{
+    if (!n)
+    {
+        accept_metrics_clients();
+    }
+    else if (n <= MT_MAX_CLIENTS && _mt.client[n - 1].buf != NULL)
+    {
+        write_metrics_client(n - 1);
+    }
+}
+
+
+/**
+ *  Closes the connections of the clients of the metrics socket, then
+ *  closes and removes the metrics socket.
+ */
+void
+destroy_metrics()
+{
+    for (int i = 0; i < MT_MAX_CLIENTS; i++)
+    {
+        if (_mt.client[i].buf != NULL)
+        {
+            close_metrics_client(&_mt.client[i]);
+        }
+    }
+
+    if (_mt.fd != -1)
+    {
+        close(_mt.fd);
+        unlink(_path);
+        _mt.fd = -1;
+    }
+}
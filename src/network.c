@@ -31,77 +31,63 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 
 #include "dchat_h/network.h"
 #include "dchat_h/consoleui.h"
 
 
 /**
- * Writes a SOCKS PDU to the given socket.
- * @param s   Socket where the PDU will be written to
- * @param pdu SOCKS PDU that will be written
- * @return 0 on success, -1 in case of error
+ * Encodes a SOCKS request PDU into the given buffer.
+ * @param pdu  SOCKS PDU that will be encoded
+ * @param buf  Buffer where the PDU will be written to
+ * @param size Size of the buffer
+ * @return length of the encoded PDU or -1 if the buffer is too small
  */
 int
-write_socks4a(int s, socks4a_pdu_t* pdu)
+encode_socks4a(socks4a_pdu_t* pdu, char* buf, int size)
 {
     // convert ip and port to network byte order
     uint16_t rport  = htons(pdu->port);
     uint32_t fakeip = htonl(pdu->fakeip);
+    int hlen = strlen(pdu->hostname);
 
-    if (write(s, &pdu->version, 1) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, &pdu->command, 1) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, &rport, 2) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, &fakeip, 4) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, &pdu->delim, 1) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, pdu->hostname, strlen(pdu->hostname)) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, &pdu->delim, 1) == -1)
+    if (9 + hlen + 1 > size)
     {
         return -1;
     }
 
-    return 0;
+    buf[0] = pdu->version;
+    buf[1] = pdu->command;
+    memcpy(buf + 2, &rport, 2);
+    memcpy(buf + 4, &fakeip, 4);
+    buf[8] = pdu->delim;
+    memcpy(buf + 9, pdu->hostname, hlen);
+    buf[9 + hlen] = pdu->delim;
+    return 9 + hlen + 1;
 }
 
 
 /**
- * Reads a SOCKS response PDU from the given socket.
- * @param s Socket to read from
- * @param
+ * Decodes a SOCKS response PDU of SOCKS4A_RESPONSE_LEN bytes.
+ * @param buf Buffer holding the response
+ * @param pdu SOCKS PDU whose fields will be set
  */
-int
-read_socks4a(int s, socks4a_pdu_t* pdu)
+void
+decode_socks4a(char* buf, socks4a_pdu_t* pdu)
 {
-    int ret;
-
-    // read SOCKS4a response (see SOCKS4a protocol)
-    if ((ret = read(s, pdu, 8)) <= 0)
-    {
-        //return ret;
-    }
-
+    uint16_t port;
+    uint32_t ip;
+
+    memset(pdu, 0, sizeof(*pdu));
+    pdu->version = buf[0];
+    pdu->command = buf[1];
+    memcpy(&port, buf + 2, 2);
+    memcpy(&ip, buf + 4, 4);
     // convert port and ip to host byte order
-    pdu->port   = ntohs(pdu->port);
-    pdu->fakeip = ntohl(pdu->fakeip);
-    return ret;
+    pdu->port   = ntohs(port);
+    pdu->fakeip = ntohl(ip);
 }
 
 
@@ -134,76 +120,272 @@ parse_socks_status(unsigned char status)
 
 
 /**
- * Creates a TOR socket.
- * This function creates a TOR socket by establishing a connection to the listening
- * address and port of the TOR client and sending a SOCKS connection request so that
- * a curcuit to the remote host will be created.
- * @param hostname The hostname of the destination
- * @param rport    The port to connect to
- * @return open socket whose traffic will be relayed through TOR or -1 in case of error
+ * Encodes a SOCKS5 connection request to a domain name into the given
+ * buffer. The greeting, the username/password authentication (RFC 1929)
+ * and the CONNECT request are encoded back to back, so that the whole
+ * request can be sent with a single write, without waiting for the
+ * replies in between. TOR uses the credentials to isolate streams on
+ * separate circuits (see: IsolateSOCKSAuth), but does not verify them.
+ * @param hostname Domain name of the remote host
+ * @param port     Port of the remote host
+ * @param user     Username, NULL to offer no authentication
+ * @param buf      Buffer where the request will be written to
+ * @param size     Size of the buffer
+ * @return length of the encoded request or -1 if the buffer is too small
  */
 int
-create_tor_socket(char* hostname, uint16_t rport)
+encode_socks5(char* hostname, uint16_t port, char* user, char* buf, int size)
 {
-    int s;                 // tor socket
-    struct sockaddr_in da; // destination address to connec to
-    socks4a_pdu_t pdu;     // SOCKS request
-    int ret;
-    memset(&da, 0, sizeof(da));
+    uint16_t rport = htons(port);
+    int hlen = strlen(hostname);
+    int ulen = user != NULL ? strlen(user) : 0;
+    int plen = strlen(SOCKS5_PASSWD);
+    int len = 0;
+
+    if (hlen > 255 || ulen > SOCKS5_MAX_USER ||
+        3 + (user != NULL ? 3 + ulen + plen : 0) + 7 + hlen > size)
+    {
+        return -1;
+    }
 
-    // socket address for connection to the TOR client
-    if (inet_pton(AF_INET, TOR_ADDR, &da.sin_addr) != 1)
+    // greeting offering a single authentication method
+    buf[len++] = SOCKS5_VERSION;
+    buf[len++] = 1;
+    buf[len++] = user != NULL ? SOCKS5_AUTH_PASSWD : SOCKS5_AUTH_NONE;
+
+    if (user != NULL)
+    {
+        buf[len++] = SOCKS5_PASSWD_VER;
+        buf[len++] = ulen;
+        memcpy(buf + len, user, ulen);
+        len += ulen;
+        buf[len++] = plen;
+        memcpy(buf + len, SOCKS5_PASSWD, plen);
+        len += plen;
+    }
+
+    // the hostname is resolved by the SOCKS server
+    buf[len++] = SOCKS5_VERSION;
+    buf[len++] = SOCKS_CONNECT;
+    buf[len++] = 0;
+    buf[len++] = SOCKS5_ATYP_DOMAIN;
+    buf[len++] = hlen;
+    memcpy(buf + len, hostname, hlen);
+    len += hlen;
+    memcpy(buf + len, &rport, 2);
+    return len + 2;
+}
+
+
+/**
+ * Decodes the replies to a SOCKS5 connection request (see: encode_socks5()),
+ * which are the selected authentication method, the result of the
+ * authentication, if any, and the reply to the CONNECT request.
+ * @param buf    Buffer holding the received bytes
+ * @param len    Amount of received bytes
+ * @param auth   Username/password authentication has been offered
+ * @param status Will be set to the reply code, if the request failed
+ * @return length of the replies, 0 if more bytes are required or -1 if the
+ * request failed
+ */
+int
+decode_socks5(char* buf, int len, int auth, int* status)
+{
+    unsigned char* p = (unsigned char*) buf;
+    int off = 2; // offset of the next reply
+    int alen;    // length of the bound address
+
+    *status = SOCKS5_AUTH_REJECT;
+
+    if (len < off)
+    {
+        return 0;
+    }
+
+    if (p[0] != SOCKS5_VERSION || p[1] != (auth ? SOCKS5_AUTH_PASSWD : SOCKS5_AUTH_NONE))
     {
-        ui_log(LOG_ERR, "Invalid ip address '%s'!", TOR_ADDR);
         return -1;
     }
 
-    da.sin_family = AF_INET;
-    da.sin_port = htons(TOR_PORT);
+    if (auth)
+    {
+        if (len < off + 2)
+        {
+            return 0;
+        }
 
-    // connect to TOR client
-    if ((s = connect_to((struct sockaddr*) &da)) == -1)
+        if (p[off + 1] != SOCKS5_SUCCEEDED)
+        {
+            return -1;
+        }
+
+        off += 2;
+    }
+
+    // version, reply, reserved, address type and first byte of the address
+    if (len < off + 5)
+    {
+        return 0;
+    }
+
+    if (p[off] != SOCKS5_VERSION)
     {
-        ui_log(LOG_ERR, "Could not create TOR socket!");
         return -1;
     }
 
-    // craft SOCKS request pdu
-    memset(&pdu, 0, sizeof(pdu));
-    pdu.version = SOCKS_VERSION;
-    pdu.command = SOCKS_CONNECT;
-    pdu.port    = rport;
-    pdu.fakeip  = SOCKS_FAKEIP;
-    pdu.delim   = SOCKS_DELIM;
-    pdu.hostname = hostname;
-
-    // send connection request to TOR
-    if (write_socks4a(s, &pdu) == -1)
+    if (p[off + 1] != SOCKS5_SUCCEEDED)
     {
-        ui_log_errno(LOG_ERR, "Could not write SOCKS connection request!");
+        *status = p[off + 1];
         return -1;
     }
 
-    // read response code from TOR
-    memset(&pdu, 0, sizeof(pdu));
+    switch (p[off + 3])
+    {
+        case SOCKS5_ATYP_IPV4:
+            alen = 4;
+            break;
+
+        case SOCKS5_ATYP_IPV6:
+            alen = 16;
+            break;
+
+        case SOCKS5_ATYP_DOMAIN:
+            alen = 1 + p[off + 4];
+            break;
+
+        default:
+            return -1;
+    }
+
+    // bound address and port follow
+    off += 4 + alen + 2;
+    *status = SOCKS5_SUCCEEDED;
+    return len < off ? 0 : off;
+}
+
 
-    if ((ret = read_socks4a(s, &pdu)) == -1)
+/**
+ * Parses given SOCKS5 reply code and returns its corresponding status
+ * message, including the extended codes of TOR (see: ExtendedErrors).
+ * @param status Status whose status message will be returned
+ * @return Status message
+ */
+char*
+parse_socks5_status(int status)
+{
+    switch (status)
     {
-        ui_log(LOG_ERR, "Could not read SOCKS connection response!");
+        case 0x00:
+            return "Request granted";
+
+        case 0x01:
+            return "General SOCKS server failure";
+
+        case 0x02:
+            return "Connection not allowed by ruleset";
+
+        case 0x03:
+            return "Network unreachable";
+
+        case 0x04:
+            return "Host unreachable";
+
+        case 0x05:
+            return "Connection refused";
+
+        case 0x06:
+            return "TTL expired";
+
+        case 0x07:
+            return "Command not supported";
+
+        case 0x08:
+            return "Address type not supported";
+
+        case 0xF0:
+            return "Onion service descriptor can not be found";
+
+        case 0xF1:
+            return "Onion service descriptor is invalid";
+
+        case 0xF2:
+            return "Onion service introduction failed";
+
+        case 0xF3:
+            return "Onion service rendezvous failed";
+
+        case 0xF4:
+            return "Onion service missing client authorization";
+
+        case 0xF5:
+            return "Onion service wrong client authorization";
+
+        case 0xF6:
+            return "Onion service address is invalid";
+
+        case 0xF7:
+            return "Onion service introduction timed out";
+
+        case SOCKS5_AUTH_REJECT:
+            return "Malformed reply or authentication rejected";
+
+        default:
+            return "Unknown status";
+    }
+}
+
+
+/**
+ * Creates a TOR socket.
+ * This function creates a non-blocking socket and starts to establish a
+ * connection to the SOCKS port of the TOR client. The SOCKS
+ * connection request has to be sent as soon as the socket becomes writable
+ * (see: connector.c).
+ * @param tor Address of the SOCKS port of the TOR client (see: tor_parse())
+ * @return socket whose connection is in progress or -1 in case of error
+ */
+int
+create_tor_socket(struct sockaddr_in* tor)
+{
+    int s; // tor socket
+
+    // connect to TOR client
+    if ((s = connect_async((struct sockaddr*) tor)) == -1)
+    {
+        ui_log(LOG_ERR, "Could not create TOR socket!");
         return -1;
     }
 
-    if (!ret)
+    return s;
+}
+
+
+/**
+ * Creates a socket connected directly to a port on the loopback interface.
+ * Like create_tor_socket(), the connection is established asynchronously,
+ * but no SOCKS request is required (see: drct_parse()).
+ * @param port Destination port to connect to
+ * @return socket whose connection is in progress or -1 in case of error
+ */
+int
+create_direct_socket(uint16_t port)
+{
+    int s;                 // direct socket
+    struct sockaddr_in da; // destination address to connec to
+    memset(&da, 0, sizeof(da));
+
+    if (inet_pton(AF_INET, DIRECT_ADDR, &da.sin_addr) != 1)
     {
-        ui_log(LOG_ERR, "Connection to TOR client has been closed!");
+        ui_log(LOG_ERR, "Invalid ip address '%s'!", DIRECT_ADDR);
         return -1;
     }
 
-    if (pdu.command != 90)
+    da.sin_family = AF_INET;
+    da.sin_port = htons(port);
+
+    if ((s = connect_async((struct sockaddr*) &da)) == -1)
     {
-        ui_log(LOG_WARN,
-               "TOR Connection to remote host failed. Status code: %d - '%s'", pdu.command,
-               parse_socks_status(pdu.command));
+        ui_log(LOG_ERR, "Could not create direct socket!");
         return -1;
     }
 
@@ -261,6 +443,62 @@ connect_to(struct sockaddr* sa)
 }
 
 
+/**
+ * Starts to connect to a remote socket without blocking.
+ * @param sa Pointer to initalized sockaddr structure.
+ * @return file descriptor of new non-blocking socket, whose connection
+ * may still be in progress, or -1 in case of error
+ */
+int
+connect_async(struct sockaddr* sa)
+{
+    int s; // socket file descriptor
+
+    if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "socket() failed in connect_async()");
+        return -1;
+    }
+
+    if (set_nonblocking(s, 1) == -1)
+    {
+        ui_log_errno(LOG_ERR, "fcntl() failed in connect_async()");
+        close(s);
+        return -1;
+    }
+
+    if (connect(s, sa, sizeof(struct sockaddr_in)) == -1 && errno != EINPROGRESS)
+    {
+        ui_log_errno(LOG_ERR, "connect() failed");
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+
+
+/**
+ * Enables or disables the non-blocking mode of a file descriptor.
+ * @param fd  File descriptor
+ * @param on  1 to enable, 0 to disable non-blocking mode
+ * @return 0 on success, -1 in case of error
+ */
+int
+set_nonblocking(int fd, int on)
+{
+    int flags;
+
+    if ((flags = fcntl(fd, F_GETFL)) == -1)
+    {
+        return -1;
+    }
+
+    flags = on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    return fcntl(fd, F_SETFL, flags);
+}
+
+
 /**
  * Checks wether the given port is a valid TCP port.
  * Valid ports are between 1 and 65536.
@@ -30,10 +30,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
 
 #include "dchat_h/option.h"
 #include "dchat_h/decoder.h"
 #include "dchat_h/contact.h"
+#include "dchat_h/sendqueue.h"
+#include "dchat_h/relay.h"
+#include "dchat_h/compress.h"
+#include "dchat_h/reactor.h"
+#include "dchat_h/keepalive.h"
+#include "dchat_h/event.h"
+#include "dchat_h/ratelimit.h"
 #include "dchat_h/consoleui.h"
 #include "dchat_h/util.h"
 
@@ -83,7 +92,8 @@ get_short_options(cli_options_t* options)
 struct option*
 get_long_options(cli_options_t* options)
 {
-    struct option* long_options = malloc(CLI_OPT_AMOUNT * sizeof(struct option));
+    // +1 for the terminating zero entry required by getopt_long
+    struct option* long_options = calloc(CLI_OPT_AMOUNT + 1, sizeof(struct option));
 
     if (long_options == NULL)
     {
@@ -122,6 +132,23 @@ init_cli_options(cli_options_t* options)
         OPTION(CLI_OPT_LPRT, CLI_LOPT_LPRT, CLI_OPT_ARG_LPRT, 0, "Set the local listening port.", lprt_parse),
         OPTION(CLI_OPT_RONI, CLI_LOPT_RONI, CLI_OPT_ARG_RONI, 0, "Set the onion id of the remote host to whom a connection should be established.", roni_parse),
         OPTION(CLI_OPT_RPRT, CLI_LOPT_RPRT, CLI_OPT_ARG_RPRT, 0, "Set the remote port of the remote host who will accept connections on this port.", rprt_parse),
+        OPTION(CLI_OPT_OVFL, CLI_LOPT_OVFL, CLI_OPT_ARG_OVFL, 0, "Set the policy for congested contacts: drop (oldest messages, default), disconnect or coalesce (control messages).", ovfl_parse),
+        OPTION(CLI_OPT_DRCT, CLI_LOPT_DRCT, CLI_OPT_ARG_DRCT, 0, "Connect to remote hosts directly on the loopback interface instead of using TOR (for testing only).", drct_parse),
+        OPTION(CLI_OPT_UDIR, CLI_LOPT_UDIR, CLI_OPT_ARG_UDIR, 0, "Set the directory of the user interface sockets.", udir_parse),
+        OPTION(CLI_OPT_GOSP, CLI_LOPT_GOSP, CLI_OPT_ARG_GOSP, 0, "Exchange digests of the contactlists instead of whole contactlists (all peers have to use this option).", gosp_parse),
+        OPTION(CLI_OPT_MESH, CLI_LOPT_MESH, CLI_OPT_ARG_MESH, 0, "Connect to at most NEIGHBOURS of the known contacts and relay messages to the others (all peers have to use this option).", mesh_parse),
+        OPTION(CLI_OPT_BNRY, CLI_LOPT_BNRY, CLI_OPT_ARG_BNRY, 0, "Negotiate compact binary DChat V2 frames with peers that support them.", bnry_parse),
+        OPTION(CLI_OPT_ZLIB, CLI_LOPT_ZLIB, CLI_OPT_ARG_ZLIB, 0, "Negotiate compressed contents with peers that support them.", zlib_parse),
+        OPTION(CLI_OPT_FDIR, CLI_LOPT_FDIR, CLI_OPT_ARG_FDIR, 0, "Accept files offered by contacts and store them in DIRECTORY.", fdir_parse),
+        OPTION(CLI_OPT_THRD, CLI_LOPT_THRD, CLI_OPT_ARG_THRD, 0, "Spread the sockets of the contacts across REACTORS threads, which read and write them in parallel.", thrd_parse),
+        OPTION(CLI_OPT_HIST, CLI_LOPT_HIST, CLI_OPT_ARG_HIST, 0, "Keep the latest messages in the history FILE and replay missed messages to reconnecting contacts.", hist_parse),
+        OPTION(CLI_OPT_PEER, CLI_LOPT_PEER, CLI_OPT_ARG_PEER, 0, "Remember the peers in FILE and connect to the best ranked of them at startup.", peer_parse),
+        OPTION(CLI_OPT_KPAL, CLI_LOPT_KPAL, CLI_OPT_ARG_KPAL, 0, "Ping the contacts every SECONDS and remove contacts that stay silent for three intervals (all peers have to use this option).", kpal_parse),
+        OPTION(CLI_OPT_EVNT, CLI_LOPT_EVNT, CLI_OPT_ARG_EVNT, 0, "Wait for events with BACKEND: epoll, kqueue, select or uring (io_uring on Linux 5.11 and later).", evnt_parse),
+        OPTION(CLI_OPT_TOR, CLI_LOPT_TOR, CLI_OPT_ARG_TOR, 0, "Connect to the SOCKS port of the TOR client on ADDRESS:PORT (default: 127.0.0.1:9050).", tor_parse),
+        OPTION(CLI_OPT_SCK5, CLI_LOPT_SCK5, CLI_OPT_ARG_SCK5, 0, "Connect via SOCKS5 and send the first PDU without waiting for the SOCKS reply. ISOLATION is none, session (own circuits for this client) or peer (own circuit per peer).", sck5_parse),
+        OPTION(CLI_OPT_RATE, CLI_LOPT_RATE, CLI_OPT_ARG_RATE, 0, "Read at most PDUS and BYTES per second from every contact and connect to at most CONNECTS of the contacts it advertises per second (0 for no limit).", rate_parse),
+        OPTION(CLI_OPT_CAPT, CLI_LOPT_CAPT, CLI_OPT_ARG_CAPT, 0, "Record the PDUs sent and received by this client in the trace FILE, which can be replayed by dchat-replay.", capt_parse),
         OPTION(CLI_OPT_HELP, CLI_LOPT_HELP, CLI_OPT_ARG_HELP, 0, "Display help.", help_parse)
     };
     temp_size = sizeof(temp) / sizeof(temp[0]);
@@ -372,7 +399,7 @@ lprt_parse(char* value, int force)
 int
 roni_parse(char* value, int force)
 {
-    int n;
+    int n = 0;
 
     if (_cnf->cl.used_contacts > 1)
     {
@@ -386,7 +413,7 @@ roni_parse(char* value, int force)
 
     if (!_cnf->cl.used_contacts)
     {
-        n = add_contact(0); // create fake contact
+        n = add_contact(0, 0); // create fake contact
 
         if (n != 0)
         {
@@ -395,10 +422,10 @@ roni_parse(char* value, int force)
         }
     }
 
-    if (force || !is_valid_onion(_cnf->cl.contact[n].onion_id))
+    if (force || !is_valid_onion(CONTACT(n)->onion_id))
     {
-        _cnf->cl.contact[n].onion_id[0] = '\0';
-        strncat(_cnf->cl.contact[n].onion_id, value, ONION_ADDRLEN);
+        CONTACT(n)->onion_id[0] = '\0';
+        strncat(CONTACT(n)->onion_id, value, ONION_ADDRLEN);
         return 0;
     }
 
@@ -436,7 +463,7 @@ rprt_parse(char* value, int force)
 
     if (!_cnf->cl.used_contacts)
     {
-        n = add_contact(0); // create fake contact
+        n = add_contact(0, 0); // create fake contact
 
         if (n != 0)
         {
@@ -445,9 +472,9 @@ rprt_parse(char* value, int force)
         }
     }
 
-    if (force || !is_valid_port(_cnf->cl.contact[n].lport))
+    if (force || !is_valid_port(CONTACT(n)->lport))
     {
-        _cnf->cl.contact[n].lport = rport;
+        CONTACT(n)->lport = rport;
         return 0;
     }
 
@@ -455,6 +482,430 @@ rprt_parse(char* value, int force)
 }
 
 
+/**
+ * Parses the terminal command line argument string to a policy
+ * for congested outbound queues and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+ovfl_parse(char* value, int force)
+{
+    int policy;
+
+    if ((policy = parse_send_policy(value)) == -1)
+    {
+        return -1;
+    }
+
+    _cnf->sq_policy = policy;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line option, which lets the client
+ * connect to remote hosts directly on the loopback interface
+ * (e.g. to test or benchmark a local mesh without TOR).
+ * @param value Pointer to argument string (unused)
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+drct_parse(char* value, int force)
+{
+    _cnf->direct = 1;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the directory
+ * of the user interface sockets and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+udir_parse(char* value, int force)
+{
+    // the longest socket path must fit into a unix socket address
+    if (value == NULL || !strlen(value) ||
+        strlen(value) + sizeof(UI_SOCK_INP) + 1 > UI_PATH_LEN)
+    {
+        return -1;
+    }
+
+    _cnf->ui_dir = value;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line option, which lets the client
+ * exchange digests of the contactlists with its peers (see: gossip.c).
+ * @param value Pointer to argument string (unused)
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+gosp_parse(char* value, int force)
+{
+    _cnf->gossip = 1;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the maximum
+ * amount of neighbours in the partial mesh mode (see: relay.c) and
+ * stores it in the global dchat configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+mesh_parse(char* value, int force)
+{
+    char* term;
+    int n = (int) strtol(value, &term, 10);
+
+    if (n < 1 || n > RELAY_MAX_NEIGHBOURS || *term != '\0')
+    {
+        return -1;
+    }
+
+    _cnf->neighbours = n;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line option, which lets the client
+ * negotiate DChat V2 frames with its peers (see: framing.c).
+ * @param value Pointer to argument string (unused)
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+bnry_parse(char* value, int force)
+{
+    _cnf->binary = 1;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line option, which lets the client
+ * negotiate compressed contents with its peers (see: compress.c).
+ * @param value Pointer to argument string (unused)
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 if compression is not supported.
+ */
+int
+zlib_parse(char* value, int force)
+{
+    if (!compression_available())
+    {
+        return -1;
+    }
+
+    _cnf->compress = 1;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the directory
+ * of received files (see: transfer.c) and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 if the directory does not exist.
+ */
+int
+fdir_parse(char* value, int force)
+{
+    struct stat st;
+
+    if (value == NULL || stat(value, &st) == -1 || !S_ISDIR(st.st_mode))
+    {
+        return -1;
+    }
+
+    _cnf->file_dir = value;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the amount of
+ * reactor threads (see: reactor.c) and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+thrd_parse(char* value, int force)
+{
+    char* term;
+    int n = (int) strtol(value, &term, 10);
+
+    if (n < 1 || n > RT_MAX_REACTORS || *term != '\0')
+    {
+        return -1;
+    }
+
+    _cnf->reactors = n;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the path of the
+ * history file (see: history.c) and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+hist_parse(char* value, int force)
+{
+    if (value == NULL || value[0] == '\0')
+    {
+        return -1;
+    }
+
+    _cnf->hist_file = value;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the path of the
+ * peer cache (see: peercache.c) and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+peer_parse(char* value, int force)
+{
+    if (value == NULL || value[0] == '\0')
+    {
+        return -1;
+    }
+
+    _cnf->peer_file = value;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the seconds
+ * between two keepalives (see: keepalive.c) and stores it in the global
+ * dchat configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+kpal_parse(char* value, int force)
+{
+    char* term;
+    int n = (int) strtol(value, &term, 10);
+
+    if (n < 1 || n > KA_MAX_INTERVAL || *term != '\0')
+    {
+        return -1;
+    }
+
+    _cnf->keepalive = n;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the name of the
+ * event backend (see: event.c) and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+evnt_parse(char* value, int force)
+{
+    if (value == NULL || !ev_has_backend(value))
+    {
+        return -1;
+    }
+
+    _cnf->ev_backend = value;
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the address and
+ * port of the SOCKS port of the TOR client and stores it in the global
+ * dchat configuration.
+ * @param value Pointer to argument string (e.g. 127.0.0.1:9150)
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+tor_parse(char* value, int force)
+{
+    char addr[INET_ADDRSTRLEN];
+    char* colon;
+    char* term;
+    int port;
+
+    if (value == NULL || (colon = strrchr(value, ':')) == NULL ||
+        colon - value >= (int) sizeof(addr))
+    {
+        return -1;
+    }
+
+    port = (int) strtol(colon + 1, &term, 10);
+    memcpy(addr, value, colon - value);
+    addr[colon - value] = '\0';
+
+    if (colon[1] == '\0' || *term != '\0' || !is_valid_port(port) ||
+        inet_pton(AF_INET, addr, &_cnf->tor.sin_addr) != 1)
+    {
+        return -1;
+    }
+
+    _cnf->tor.sin_port = htons(port);
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the stream
+ * isolation of SOCKS5 connection requests (see: SOCKS_ISO_NONE) and stores
+ * it in the global dchat configuration.
+ * @param value Pointer to argument string (none, session or peer)
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+sck5_parse(char* value, int force)
+{
+    if (value == NULL)
+    {
+        return -1;
+    }
+    else if (!strcmp(value, "none"))
+    {
+        _cnf->socks5 = SOCKS_ISO_NONE;
+    }
+    else if (!strcmp(value, "session"))
+    {
+        _cnf->socks5 = SOCKS_ISO_SESSION;
+    }
+    else if (!strcmp(value, "peer"))
+    {
+        _cnf->socks5 = SOCKS_ISO_PEER;
+    }
+    else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the rate limits
+ * of every contact (see: ratelimit.c) and stores them in the global
+ * dchat configuration.
+ * @param value Pointer to argument string (e.g. 100:65536:5)
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+rate_parse(char* value, int force)
+{
+    int rate[3];
+    char* term = value;
+    char* start;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (value == NULL || (i && *term++ != ':'))
+        {
+            return -1;
+        }
+
+        start = term;
+        rate[i] = (int) strtol(start, &term, 10);
+
+        if (term == start || rate[i] < 0 || rate[i] > RL_MAX_RATE)
+        {
+            return -1;
+        }
+    }
+
+    if (*term != '\0')
+    {
+        return -1;
+    }
+
+    _cnf->rl_pdus = rate[0];
+    _cnf->rl_bytes = rate[1];
+    _cnf->rl_connects = rate[2];
+    return 0;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the trace file
+ * of the capture (see: capture.c) and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success or -1 on error.
+ */
+int
+capt_parse(char* value, int force)
+{
+    if (value == NULL || value[0] == '\0')
+    {
+        return -1;
+    }
+
+    _cnf->capture_file = value;
+    return 0;
+}
+
+
 /**
  * Parses the terminal command line string and if it is the
  * help option, the usage of this program will be printed.
@@ -0,0 +1,367 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file peercache.c
+ *  This file contains the peer cache, which remembers the peers we have
+ *  been connected to across restarts. For every peer the connection
+ *  attempts, their success and the time to connect are recorded. The
+ *  cache is checkpointed to a file by the main loop, which is replaced
+ *  atomically. At startup the best ranked peers of the file are connected
+ *  to in parallel, so that a restarted client does not have to rediscover
+ *  the mesh through its remote host first.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "dchat_h/peercache.h"
+#include "dchat_h/types.h"
+#include "dchat_h/connector.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/util.h"
+#include "dchat_h/consoleui.h"
+
+
+static pc_peer_t _peer[PC_SIZE]; //!< cached peers
+static int _count;               //!< amount of cached peers
+static char* _path;              //!< cache file, NULL if the cache is disabled
+static int _dirty;               //!< cache changed since the last checkpoint
+static long long _saved;         //!< time of the last checkpoint
+
+
+/**
+ *  Compares two peers by their rank. Peers are ranked by the ratio of
+ *  successful connection attempts (with one success and one failure
+ *  assumed for every peer), then by the time they have been seen last,
+ *  then by their time to connect.
+ *  @return < 0 if a is ranked better than b, > 0 if b is ranked better,
+ *          0 if both are ranked equally
+ */
+static int
+compare_peers(const void* a, const void* b)
+{
+    const pc_peer_t* pa = a;
+    const pc_peer_t* pb = b;
+    uint64_t ra = (uint64_t)(pa->successes + 1) * (pb->attempts + 2);
+    uint64_t rb = (uint64_t)(pb->successes + 1) * (pa->attempts + 2);
+    uint32_t ta, tb;
+
+    if (ra != rb)
+    {
+        return ra > rb ? -1 : 1;
+    }
+
+    if (pa->last_seen != pb->last_seen)
+    {
+        return pa->last_seen > pb->last_seen ? -1 : 1;
+    }
+
+    // unknown times to connect are ranked last
+    ta = pa->rtt ? pa->rtt : UINT32_MAX;
+    tb = pb->rtt ? pb->rtt : UINT32_MAX;
+    return (ta > tb) - (ta < tb);
+}
+
+
+/**
+ *  Looks up a peer in the cache and adds it, if it is not cached yet. If
+ *  the cache is full, the worst ranked peer is replaced.
+ *  @param onion_id Onion address of the peer
+ *  @param lport    Listening port of the peer
+ *  @return Pointer to the cached peer or NULL if the cache is disabled or
+ *          the peer is the local client
+ */
+static pc_peer_t*
+find_peer(char* onion_id, uint16_t lport)
+{
+    pc_peer_t* p;
+    int worst = 0;
+
+    if (_path == NULL || (lport == _cnf->me.lport && !strcmp(onion_id, _cnf->me.onion_id)))
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < _count; i++)
+    {
+        if (_peer[i].lport == lport && !strcmp(_peer[i].onion_id, onion_id))
+        {
+            return &_peer[i];
+        }
+
+        if (compare_peers(&_peer[i], &_peer[worst]) > 0)
+        {
+            worst = i;
+        }
+    }
+
+    p = &_peer[_count < PC_SIZE ? _count++ : worst];
+    memset(p, 0, sizeof(*p));
+    strncat(p->onion_id, onion_id, ONION_ADDRLEN);
+    p->lport = lport;
+    return p;
+}
+
+
+/**
+ *  Loads the peers of the cache file. A missing file is not an error,
+ *  since it is created by the first checkpoint. Since this happens before
+ *  the user interface is connected, errors are logged locally.
+ *  @param path Path of the cache file
+ *  @return 0 on success, -1 if the file could not be read
+ */
+int
+load_peer_cache(char* path)
+{
+    pc_header_t hdr;
+    int fd;
+    ssize_t len;
+
+    _path = path;
+    _count = 0;
+    _saved = get_time_ms();
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+    {
+        return 0;
+    }
+
+    len = read(fd, &hdr, sizeof(hdr));
+
+    if (len != sizeof(hdr) || memcmp(hdr.magic, PC_MAGIC, sizeof(PC_MAGIC)) ||
+        hdr.version != PC_VERSION || hdr.rec_size != sizeof(pc_peer_t) ||
+        hdr.count > PC_SIZE)
+    {
+        local_log(LOG_WARN, "Ignoring invalid peer cache '%s'!", path);
+        close(fd);
+        return 0;
+    }
+
+    if ((len = read(fd, _peer, hdr.count * sizeof(pc_peer_t))) == -1)
+    {
+        local_log_errno(LOG_ERR, "Could not read peer cache '%s'!", path);
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    _count = len / sizeof(pc_peer_t);
+
+    // never trust the onion addresses read to be terminated or valid
+    for (int i = 0; i < _count; i++)
+    {
+        _peer[i].onion_id[ONION_ADDRLEN] = '\0';
+
+        if (!is_valid_onion(_peer[i].onion_id) || !is_valid_port(_peer[i].lport))
+        {
+            _peer[i--] = _peer[--_count];
+        }
+    }
+
+    local_log(LOG_INFO, "Peer cache holds %d peers!", _count);
+    return 0;
+}
+
+
+/**
+ *  Requests connections to the best ranked peers of the cache, which are
+ *  established in parallel by the connector.
+ *  @param max Max. amount of peers to connect to
+ *  @return amount of peers requested to connect to
+ */
+int
+prime_peer_cache(int max)
+{
+    pc_peer_t ranked[PC_SIZE];
+    int i;
+
+    memcpy(ranked, _peer, _count * sizeof(pc_peer_t));
+    qsort(ranked, _count, sizeof(pc_peer_t), compare_peers);
+
+    for (i = 0; i < _count && i < max; i++)
+    {
+        request_connect(ranked[i].onion_id, ranked[i].lport);
+    }
+
+    return i;
+}
+
+
+/**
+ *  Writes the cache to a temporary file, which replaces the cache file
+ *  once it has been written completely.
+ *  @return 0 on success, -1 in case of error
+ */
+int
+save_peer_cache()
+{
+    char tmp[PATH_MAX];
+    pc_header_t hdr;
+    struct iovec iov[2];
+    int fd;
+
+    if (_path == NULL)
+    {
+        return 0;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PC_MAGIC, sizeof(PC_MAGIC));
+    hdr.version = PC_VERSION;
+    hdr.rec_size = sizeof(pc_peer_t);
+    hdr.count = _count;
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = _peer;
+    iov[1].iov_len = _count * sizeof(pc_peer_t);
+    snprintf(tmp, sizeof(tmp), "%s%s", _path, PC_TMP_SUFFIX);
+
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Could not create peer cache '%s'!", tmp);
+        return -1;
+    }
+
+    if (write_iov(fd, iov, 2) == -1 || fsync(fd) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Could not write peer cache '%s'!", tmp);
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    close(fd);
+
+    if (rename(tmp, _path) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Could not replace peer cache '%s'!", _path);
+        unlink(tmp);
+        return -1;
+    }
+
+    _dirty = 0;
+    _saved = get_time_ms();
+    return 0;
+}
+
+
+/**
+ *  Saves the cache, if it has changed and the last checkpoint is at
+ *  least PC_CHECKPOINT_MS ago. Called by the main loop after every batch
+ *  of events.
+ */
+void
+checkpoint_peer_cache()
+{
+    if (_dirty && get_time_ms() - _saved >= PC_CHECKPOINT_MS)
+    {
+        save_peer_cache();
+    }
+}
+
+
+/**
+ *  Records that a connection attempt to a peer has been started.
+ *  @param onion_id Onion address of the peer
+ *  @param lport    Listening port of the peer
+ */
+void
+note_peer_attempt(char* onion_id, uint16_t lport)
+{
+    pc_peer_t* p;
+
+    if ((p = find_peer(onion_id, lport)) != NULL)
+    {
+        p->attempts++;
+        _dirty = 1;
+    }
+}
+
+
+/**
+ *  Records that a connection attempt to a peer has succeeded.
+ *  @param onion_id Onion address of the peer
+ *  @param lport    Listening port of the peer
+ *  @param rtt      Time it took to connect in milliseconds
+ */
+void
+note_peer_connected(char* onion_id, uint16_t lport, long long rtt)
+{
+    pc_peer_t* p;
+
+    if ((p = find_peer(onion_id, lport)) != NULL)
+    {
+        p->successes++;
+        p->rtt = rtt > 0 ? rtt : 1;
+        p->last_seen = time(NULL);
+        _dirty = 1;
+    }
+}
+
+
+/**
+ *  Records the round trip time of a peer measured by keepalives (see:
+ *  keepalive.c).
+ *  @param onion_id Onion address of the peer
+ *  @param lport    Listening port of the peer
+ *  @param rtt      Round trip time in milliseconds
+ */
+void
+note_peer_rtt(char* onion_id, uint16_t lport, long long rtt)
+{
+    pc_peer_t* p;
+
+    if ((p = find_peer(onion_id, lport)) != NULL && p->rtt != rtt)
+    {
+        p->rtt = rtt > 0 ? rtt : 1;
+        _dirty = 1;
+    }
+}
+
+
+/**
+ *  Records that a peer has been seen, i.e. it got connected or
+ *  disconnected.
+ *  @param onion_id Onion address of the peer
+ *  @param lport    Listening port of the peer
+ */
+void
+note_peer_seen(char* onion_id, uint16_t lport)
+{
+    pc_peer_t* p;
+
+    if ((p = find_peer(onion_id, lport)) != NULL)
+    {
+        p->last_seen = time(NULL);
+        _dirty = 1;
+    }
+}
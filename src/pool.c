@@ -0,0 +1,275 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file pool.c
+ *  This file contains the memory pool of the message path. PDU contents,
+ *  prepared PDUs, queue entries and reactor messages are allocated from
+ *  power of two size classes. Freed blocks are kept in a cache of the
+ *  freeing thread and in a shared depot and are reused by the next
+ *  allocation of the same size class, thus a node exchanging messages
+ *  at a steady rate does not call malloc(3) at all. The depot releases
+ *  blocks exceeding PL_DEPOT_LEN, so bursts do not pin memory forever.
+ *  Blocks larger than the largest size class are passed to malloc(3).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "dchat_h/pool.h"
+
+
+static pl_depot_t _depot = { PTHREAD_MUTEX_INITIALIZER, { { NULL, 0 } }, 0 };
+static pthread_key_t _key;          //!< returns the cache of an exiting thread
+static pthread_once_t _once = PTHREAD_ONCE_INIT;
+static __thread pl_cache_t _cache;  //!< free blocks of the calling thread
+static __thread int _registered;    //!< cache has been registered with _key
+
+
+/**
+ *  Returns the size class of a block holding the given amount of bytes.
+ *  @param size Amount of bytes requested by the caller
+ *  @return size class, PL_CLASSES if the block is not pooled
+ */
+static int
+size_class(size_t size)
+{
+    int cls = 0;
+
+    while (cls < PL_CLASSES && PL_CLASS_LEN(cls) - PL_HDR_LEN < size)
+    {
+        cls++;
+    }
+
+    return cls;
+}
+
+
+/**
+ *  Moves up to n blocks of a list of the calling thread to the depot.
+ *  Blocks the depot has no room for are freed.
+ *  @param l   List of free blocks of the calling thread
+ *  @param cls Size class of the list
+ *  @param n   Amount of blocks to move
+ */
+static void
+spill_blocks(pl_list_t* l, int cls, int n)
+{
+    pl_list_t* d = &_depot.cls[cls];
+    pl_block_t* excess = NULL;
+    pl_block_t* b;
+
+    pthread_mutex_lock(&_depot.mx);
+
+    for (; n > 0 && (b = l->head) != NULL; n--)
+    {
+        l->head = b->next;
+        l->len--;
+
+        if (d->len < PL_DEPOT_LEN)
+        {
+            b->next = d->head;
+            d->head = b;
+            d->len++;
+        }
+        else
+        {
+            b->next = excess;
+            excess = b;
+        }
+    }
+
+    pthread_mutex_unlock(&_depot.mx);
+
+    while ((b = excess) != NULL)
+    {
+        excess = b->next;
+        free(b);
+    }
+}
+
+
+/**
+ *  Moves up to PL_BATCH blocks of the depot to a list of the calling thread.
+ *  @param l   Empty list of free blocks of the calling thread
+ *  @param cls Size class of the list
+ */
+static void
+refill_blocks(pl_list_t* l, int cls)
+{
+    pl_list_t* d = &_depot.cls[cls];
+    pl_block_t* b;
+    int n;
+
+    pthread_mutex_lock(&_depot.mx);
+
+    for (n = 0; n < PL_BATCH && (b = d->head) != NULL; n++)
+    {
+        d->head = b->next;
+        d->len--;
+        b->next = l->head;
+        l->head = b;
+        l->len++;
+    }
+
+    pthread_mutex_unlock(&_depot.mx);
+}
+
+
+/**
+ *  Returns all blocks of an exiting thread to the depot.
+ *  @param ptr Pointer to the cache of the thread
+ */
+static void
+release_cache(void* ptr)
+{
+    pl_cache_t* c = ptr;
+    int i;
+
+    for (i = 0; i < PL_CLASSES; i++)
+    {
+        spill_blocks(&c->cls[i], i, c->cls[i].len);
+    }
+}
+
+
+/**
+ *  Creates the key used to return the caches of exiting threads.
+ */
+static void
+create_key()
+{
+    pthread_key_create(&_key, release_cache);
+}
+
+
+/**
+ *  Returns the cache of the calling thread. The first call of a thread
+ *  registers the cache, such that it is returned to the depot as soon
+ *  as the thread exits.
+ *  @return Pointer to the cache
+ */
+static pl_cache_t*
+get_cache()
+{
+    if (!_registered)
+    {
+        pthread_once(&_once, create_key);
+        pthread_setspecific(_key, &_cache);
+        _registered = 1;
+    }
+
+    return &_cache;
+}
+
+
+/**
+ *  Allocates memory from the pool. The memory must be released with
+ *  pool_free(), which may be called by any thread.
+ *  @param size Amount of bytes to allocate
+ *  @return Pointer to the allocated memory, NULL if malloc(3) failed
+ */
+void*
+pool_alloc(size_t size)
+{
+    int cls = size_class(size);
+    pl_block_t* b = NULL;
+    pl_list_t* l;
+
+    if (cls < PL_CLASSES)
+    {
+        l = &get_cache()->cls[cls];
+
+        if (l->head == NULL)
+        {
+            refill_blocks(l, cls);
+        }
+
+        if ((b = l->head) != NULL)
+        {
+            l->head = b->next;
+            l->len--;
+            return (char*) b + PL_HDR_LEN;
+        }
+
+        size = PL_CLASS_LEN(cls) - PL_HDR_LEN;
+    }
+
+    if ((b = malloc(PL_HDR_LEN + size)) == NULL)
+    {
+        return NULL;
+    }
+
+    __atomic_add_fetch(&_depot.mallocs, 1, __ATOMIC_RELAXED);
+    b->cls = cls;
+    return (char*) b + PL_HDR_LEN;
+}
+
+
+/**
+ *  Releases memory allocated by pool_alloc(). The block is kept in the
+ *  cache of the calling thread, half of the cache is moved to the depot
+ *  once it exceeds PL_CACHE_LEN blocks.
+ *  @param ptr Pointer to the memory, may be NULL
+ */
+void
+pool_free(void* ptr)
+{
+    pl_block_t* b;
+    pl_list_t* l;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    b = (pl_block_t*) ((char*) ptr - PL_HDR_LEN);
+
+    if (b->cls == PL_CLASSES)
+    {
+        free(b);
+        return;
+    }
+
+    l = &get_cache()->cls[b->cls];
+    b->next = l->head;
+    l->head = b;
+
+    if (++l->len > PL_CACHE_LEN)
+    {
+        spill_blocks(l, b->cls, PL_BATCH);
+    }
+}
+
+
+/**
+ *  Returns the amount of blocks the pool has allocated by malloc(3).
+ *  The value stops growing as soon as the pool covers the working set.
+ *  @return amount of allocations
+ */
+uint64_t
+pool_mallocs()
+{
+    return __atomic_load_n(&_depot.mallocs, __ATOMIC_RELAXED);
+}
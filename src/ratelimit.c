@@ -0,0 +1,269 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file ratelimit.c
+ *  This file contains the admission control of received PDUs (see:
+ *  rate_parse()). Every contact is limited by token buckets for the PDUs
+ *  and bytes per second it sends and for the connection attempts per
+ *  second caused by the contacts it advertises. The limits are checked
+ *  before a PDU is decoded, a contact that exceeds them is not read until
+ *  its buckets have been refilled. Contacts with pending work are serviced
+ *  round-robin by a service queue, one batch of PDUs per loop iteration.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dchat_h/ratelimit.h"
+#include "dchat_h/types.h"
+#include "dchat_h/consoleui.h"
+
+
+/**
+ *  Refills a token bucket with the tokens earned since its last refill.
+ *  An unused bucket starts full.
+ *  @param b    Pointer to the bucket
+ *  @param rate Tokens per second
+ *  @param now  Current time in ms
+ */
+static void
+refill_bucket(rl_bucket_t* b, int rate, long long now)
+{
+    long long max = (long long) rate * RL_SCALE;
+
+    if (!b->last)
+    {
+        b->tokens = max;
+    }
+    else if (now > b->last)
+    {
+        // rate tokens per second are rate thousandths per ms
+        b->tokens += (now - b->last) * rate;
+        b->tokens = b->tokens > max ? max : b->tokens;
+    }
+
+    b->last = now;
+}
+
+
+/**
+ *  Spends tokens of a bucket, which may be overdrawn afterwards.
+ *  @param b    Pointer to the bucket
+ *  @param rate Tokens per second, 0 for no limit
+ *  @param n    Amount of tokens
+ *  @param now  Current time in ms
+ */
+void
+spend_tokens(rl_bucket_t* b, int rate, int n, long long now)
+{
+    if (!rate)
+    {
+        return;
+    }
+
+    refill_bucket(b, rate, now);
+    b->tokens -= (long long) n * RL_SCALE;
+}
+
+
+/**
+ *  Returns the time until a bucket is no longer overdrawn.
+ *  @param b    Pointer to the bucket
+ *  @param rate Tokens per second, 0 for no limit
+ *  @param now  Current time in ms
+ *  @return 0 if tokens are left, otherwise the delay in ms
+ */
+long long
+bucket_delay(rl_bucket_t* b, int rate, long long now)
+{
+    if (!rate)
+    {
+        return 0;
+    }
+
+    refill_bucket(b, rate, now);
+    // the bucket earns rate thousandths per ms
+    return b->tokens > 0 ? 0 : -b->tokens / rate + 1;
+}
+
+
+/**
+ *  Checks whether the next PDU of a socket may be decoded.
+ *  @param rl  Admission state of the socket
+ *  @param now Current time in ms
+ *  @return 0 if the PDU may be decoded, otherwise the delay in ms until
+ *  the PDU and byte limits admit the socket again
+ */
+long long
+admit_input(rl_state_t* rl, long long now)
+{
+    long long pdus = bucket_delay(&rl->pdus, _cnf->rl_pdus, now);
+    long long bytes = bucket_delay(&rl->bytes, _cnf->rl_bytes, now);
+
+    return pdus > bytes ? pdus : bytes;
+}
+
+
+/**
+ *  Checks whether a contact advertised by a socket may be connected and
+ *  spends a token if it may.
+ *  @param rl  Admission state of the socket
+ *  @param now Current time in ms
+ *  @return 1 if the contact may be connected, 0 otherwise
+ */
+int
+admit_connect(rl_state_t* rl, long long now)
+{
+    if (bucket_delay(&rl->connects, _cnf->rl_connects, now))
+    {
+        return 0;
+    }
+
+    spend_tokens(&rl->connects, _cnf->rl_connects, 1, now);
+    return 1;
+}
+
+
+/**
+ *  Initializes an empty service queue.
+ *  @param q Pointer to the queue
+ */
+void
+init_rl_queue(rl_queue_t* q)
+{
+    memset(q, 0, sizeof(*q));
+}
+
+
+/**
+ *  Frees the entries of a service queue.
+ *  @param q Pointer to the queue
+ */
+void
+destroy_rl_queue(rl_queue_t* q)
+{
+    free(q->entry);
+    init_rl_queue(q);
+}
+
+
+/**
+ *  Appends a socket to a service queue, unless it is already queued.
+ *  A queued socket is only serviced earlier, if due is earlier.
+ *  @param q   Pointer to the queue
+ *  @param rl  Admission state of the socket
+ *  @param n   Index of the socket
+ *  @param due Time when the socket should be serviced
+ */
+void
+push_rl_queue(rl_queue_t* q, rl_state_t* rl, int n, long long due)
+{
+    rl_entry_t* entry;
+    int size;
+
+    if (rl->queued)
+    {
+        rl->due = due < rl->due ? due : rl->due;
+        return;
+    }
+
+    // grow the ring, the entries are moved to its beginning
+    if (q->len == q->size)
+    {
+        size = q->size ? q->size * 2 : RL_QUEUE_LEN;
+
+        if ((entry = malloc(size * sizeof(*entry))) == NULL)
+        {
+            ui_fatal("Memory allocation for service queue failed!");
+        }
+
+        for (int i = 0; i < q->len; i++)
+        {
+            entry[i] = q->entry[(q->head + i) % q->size];
+        }
+
+        free(q->entry);
+        q->entry = entry;
+        q->size = size;
+        q->head = 0;
+    }
+
+    entry = &q->entry[(q->head + q->len++) % q->size];
+    entry->n = n;
+    entry->due = due;
+    rl->due = due;
+    rl->queued = 1;
+}
+
+
+/**
+ *  Removes the first socket from a service queue. The caller has to
+ *  check whether the socket still exists and clear its queued flag.
+ *  @param q Pointer to the queue
+ *  @return index of the socket or -1 if the queue is empty
+ */
+int
+pop_rl_queue(rl_queue_t* q)
+{
+    int n;
+
+    if (!q->len)
+    {
+        return -1;
+    }
+
+    n = q->entry[q->head].n;
+    q->head = (q->head + 1) % q->size;
+    q->len--;
+    return n;
+}
+
+
+/**
+ *  Shortens the timeout of an event loop, so that it wakes up when the
+ *  first socket of a service queue is due.
+ *  @param q       Pointer to the queue
+ *  @param timeout Timeout in ms, -1 for none
+ *  @param now     Current time in ms
+ *  @return shortened timeout in ms, -1 for none
+ */
+int
+rl_timeout(rl_queue_t* q, int timeout, long long now)
+{
+    long long due;
+
+    for (int i = 0; i < q->len; i++)
+    {
+        due = q->entry[(q->head + i) % q->size].due - now;
+        due = due < 0 ? 0 : due;
+
+        if (timeout == -1 || due < timeout)
+        {
+            timeout = due;
+        }
+    }
+
+    return timeout;
+}
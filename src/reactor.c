@@ -0,0 +1,807 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file reactor.c
+ *  This file contains the reactors, which spread the socket I/O of the
+ *  contacts across several threads (see: thrd_parse()). Every contact
+ *  socket is owned by one reactor, which reads and decodes its PDUs and
+ *  writes its outbound queue. The main loop still owns the contactlist
+ *  and handles every decoded PDU. Reactors and main loop exchange
+ *  messages through lock-free queues: the main loop hands over sockets
+ *  and prepared PDUs, the reactors report decoded PDUs and closed or
+ *  drained sockets. Thus a PDU broadcast to all contacts is encoded only
+ *  once, but written by all reactors in parallel.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "dchat_h/reactor.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/dchat.h"
+#include "dchat_h/network.h"
+#include "dchat_h/transfer.h"
+#include "dchat_h/metrics.h"
+#include "dchat_h/pool.h"
+#include "dchat_h/ratelimit.h"
+#include "dchat_h/util.h"
+#include "dchat_h/consoleui.h"
+
+
+static reactor_t* _rt;   //!< reactors
+static int _nrt;         //!< amount of reactors
+static lf_queue_t _main; //!< messages to the main loop
+
+
+/**
+ *  Allocates a message exchanged between the main loop and a reactor.
+ *  @param type Type of message (see: RT_MSG_*)
+ *  @param n    Index of the contact in the contactlist
+ *  @param h    Handle of the contact
+ *  @return new message
+ */
+static rt_msg_t*
+new_rt_msg(int type, int n, contact_handle_t h)
+{
+    rt_msg_t* msg;
+
+    if ((msg = pool_alloc(sizeof(*msg))) == NULL)
+    {
+        ui_fatal("Memory allocation for reactor message failed!");
+    }
+
+    msg->type = type;
+    msg->n = n;
+    msg->h = h;
+    msg->err = 0;
+    msg->chunks = 0;
+    return msg;
+}
+
+
+/**
+ *  Creates the reactor threads. The queue of messages to the main loop
+ *  is registered in the event loop of the main thread.
+ *  @param amount Amount of reactors
+ *  @return 0 on success, -1 in case of error
+ */
+int
+init_reactors(int amount)
+{
+    if ((_rt = calloc(amount, sizeof(*_rt))) == NULL)
+    {
+        ui_fatal("Memory allocation for reactors failed!");
+    }
+
+    if (init_lf_queue(&_main) == -1 ||
+        ev_add(&_cnf->ev, _main.wake.fd[0], EV_READ, EV_ID(EV_SRC_REACTOR, 0)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Creation of reactor queue failed!");
+        return -1;
+    }
+
+    for (_nrt = 0; _nrt < amount; _nrt++)
+    {
+        init_rl_queue(&_rt[_nrt].rq);
+
+        if (ev_init(&_rt[_nrt].ev, _cnf->ev_backend) == -1)
+        {
+            ui_log_errno(LOG_ERR, "Initialization of event loop failed!");
+            return -1;
+        }
+
+        if (init_lf_queue(&_rt[_nrt].msgs) == -1 ||
+            ev_add(&_rt[_nrt].ev, _rt[_nrt].msgs.wake.fd[0], EV_READ,
+                   EV_ID(EV_SRC_REACTOR, 0)) == -1)
+        {
+            ui_log_errno(LOG_ERR, "Creation of reactor queue failed!");
+            ev_destroy(&_rt[_nrt].ev);
+            return -1;
+        }
+
+        if (pthread_create(&_rt[_nrt].th, NULL, th_reactor, &_rt[_nrt]))
+        {
+            ui_log(LOG_ERR, "Creation of reactor thread failed!");
+            destroy_lf_queue(&_rt[_nrt].msgs);
+            ev_destroy(&_rt[_nrt].ev);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Terminates the reactor threads and releases the buffers of their
+ *  sockets. The sockets are closed by the main loop (see:
+ *  cleanup_th_main_loop()).
+ */
+void
+destroy_reactors()
+{
+    rt_conn_t* c;
+
+    for (int i = 0; i < _nrt; i++)
+    {
+        pthread_cancel(_rt[i].th);
+        pthread_join(_rt[i].th, NULL);
+
+        for (int n = 0; n < _rt[i].size; n++)
+        {
+            if ((c = _rt[i].conn[n]) != NULL)
+            {
+                free_pdu_reader(c->reader);
+                free(c->reader);
+                free_send_queue(c->sq);
+                free(c->sq);
+                free(c);
+            }
+        }
+
+        free(_rt[i].conn);
+        destroy_rl_queue(&_rt[i].rq);
+        destroy_lf_queue(&_rt[i].msgs);
+        ev_destroy(&_rt[i].ev);
+    }
+
+    if (_rt != NULL)
+    {
+        destroy_lf_queue(&_main);
+        free(_rt);
+        _rt = NULL;
+    }
+
+    _nrt = 0;
+}
+
+
+/**
+ *  Hands over the socket of a newly added contact to the reactor that
+ *  owns the least sockets. Its PDU reader and outbound queue are handed
+ *  over as well and must not be accessed by the main loop anymore.
+ *  @param n Index of the contact in the contactlist
+ *  @return 0 on success, -1 in case of error
+ */
+int
+add_reactor_contact(int n)
+{
+    contact_t* contact = CONTACT(n);
+    reactor_t* rt = &_rt[0];
+    rt_msg_t* msg;
+    rt_conn_t* c;
+
+    for (int i = 1; i < _nrt; i++)
+    {
+        if (_rt[i].conns < rt->conns)
+        {
+            rt = &_rt[i];
+        }
+    }
+
+    // a reactor must never block (see: send_file_content())
+    if (set_nonblocking(contact->fd, 1) == -1)
+    {
+        ui_log_errno(LOG_ERR, "fcntl() failed in add_reactor_contact()");
+        return -1;
+    }
+
+    if ((c = malloc(sizeof(*c))) == NULL)
+    {
+        ui_fatal("Memory allocation for reactor socket failed!");
+    }
+
+    c->fd = contact->fd;
+    c->n = n;
+    c->h = get_contact_handle(n);
+    c->reader = contact->reader;
+    c->sq = contact->sq;
+    c->closed = 0;
+    c->chunks = 0;
+    memset(&c->rl, 0, sizeof(c->rl));
+    contact->reader = NULL;
+    contact->sq = NULL;
+    contact->rt = rt;
+    rt->conns++;
+
+    msg = new_rt_msg(RT_MSG_ADD, n, c->h);
+    msg->conn = c;
+    push_lf_queue(&rt->msgs, &msg->node);
+    return 0;
+}
+
+
+/**
+ *  Requests the reactor of a contact, that is being removed, to close
+ *  its socket and to release its buffers.
+ *  @param n Index of the contact in the contactlist
+ */
+void
+del_reactor_contact(int n)
+{
+    contact_t* contact = CONTACT(n);
+    rt_msg_t* msg;
+
+    msg = new_rt_msg(RT_MSG_DEL, n, get_contact_handle(n));
+    contact->rt->conns--;
+    push_lf_queue(&contact->rt->msgs, &msg->node);
+    contact->rt = NULL;
+}
+
+
+/**
+ *  Passes a prepared PDU to the reactor of a contact, which queues it in
+ *  the outbound queue of the contact.
+ *  @param n  Index of the contact in the contactlist
+ *  @param wp Prepared PDU, a reference will be acquired
+ */
+void
+send_reactor_pdu(int n, wire_pdu_t* wp)
+{
+    rt_msg_t* msg;
+
+    msg = new_rt_msg(RT_MSG_SEND, n, get_contact_handle(n));
+    msg->wp = ref_wire_pdu(wp);
+    push_lf_queue(&CONTACT(n)->rt->msgs, &msg->node);
+}
+
+
+/**
+ *  Handles all messages the reactors have sent to the main loop.
+ *  Messages of contacts, which have been removed in the meantime, are
+ *  discarded.
+ *  @return 0
+ */
+int
+handle_reactor_msgs()
+{
+    contact_t* contact;
+    rt_msg_t* msg;
+    long long start;
+    int ret;
+    int n;
+
+    ack_lf_queue(&_main);
+
+    while ((msg = (rt_msg_t*) pop_lf_queue(&_main)) != NULL)
+    {
+        n = msg->n;
+
+        if (resolve_contact_handle(msg->h) != n)
+        {
+            if (msg->type == RT_MSG_PDU)
+            {
+                free_pdu(&msg->pdu);
+            }
+
+            pool_free(msg);
+            continue;
+        }
+
+        contact = CONTACT(n);
+
+        switch (msg->type)
+        {
+            case RT_MSG_PDU:
+                start = get_time_ns();
+                ret = handle_remote_pdu(n, &msg->pdu);
+                record_latency(MT_HIST_DISPATCH, get_time_ns() - start);
+
+                if (ret == -1)
+                {
+                    del_contact(n, DEL_DROPPED);
+                }
+
+                free_pdu(&msg->pdu);
+                break;
+
+            case RT_MSG_EOF:
+                ui_log(LOG_INFO, "'%s' disconnected!", contact->name);
+                del_contact(n, DEL_CLOSED);
+                break;
+
+            case RT_MSG_ILLEGAL:
+                ui_log(LOG_ERR, "Illegal PDU from '%s'!", contact->name);
+                del_contact(n, DEL_DROPPED);
+                break;
+
+            case RT_MSG_RDERR:
+                errno = msg->err;
+                ui_log_errno(LOG_ERR, "Reading from '%s' failed!", contact->name);
+                del_contact(n, DEL_CLOSED);
+                break;
+
+            case RT_MSG_WRERR:
+                errno = msg->err;
+                ui_log_errno(LOG_ERR, "Writing to '%s' failed!", contact->name);
+                del_contact(n, DEL_CLOSED);
+                break;
+
+            case RT_MSG_CONGESTED:
+                ui_log(LOG_WARN, "Disconnecting congested contact '%s'!", contact->name);
+                del_contact(n, DEL_DROPPED);
+                break;
+
+            // chunks of files have been written
+            case RT_MSG_DRAINED:
+                if (contact->ft != NULL)
+                {
+                    contact->ft->in_flight -= msg->chunks;
+
+                    if (send_file_chunks(n) == -1)
+                    {
+                        ui_log(LOG_WARN, "Could not send the file to '%s'!", contact->name);
+                    }
+                }
+
+                break;
+        }
+
+        pool_free(msg);
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Returns the events a socket of a reactor is waiting for.
+ *  @param c Socket of the contact
+ *  @return EV_READ unless the socket is throttled, combined with EV_WRITE
+ *  if PDUs are waiting to be written, always combined with EV_RECV (see:
+ *  read_rt_conn())
+ */
+static int
+rt_events(rt_conn_t* c)
+{
+    return (c->rl.throttled ? 0 : EV_READ) | (c->sq->head != NULL ? EV_WRITE : 0) | EV_RECV;
+}
+
+
+/**
+ *  Stops watching a socket of a reactor, that has been closed by the
+ *  remote host or failed, and reports it to the main loop, which will
+ *  remove the contact.
+ *  @param rt   Pointer to the reactor
+ *  @param c    Socket of the contact
+ *  @param type RT_MSG_EOF, RT_MSG_ILLEGAL, RT_MSG_RDERR, RT_MSG_WRERR or
+ *              RT_MSG_CONGESTED
+ *  @param err  errno of the failed read or write
+ */
+static void
+close_rt_conn(reactor_t* rt, rt_conn_t* c, int type, int err)
+{
+    rt_msg_t* msg;
+
+    c->closed = 1;
+    ev_del(&rt->ev, c->fd);
+    msg = new_rt_msg(type, c->n, c->h);
+    msg->err = err;
+    push_lf_queue(&_main, &msg->node);
+}
+
+
+/**
+ *  Queues a prepared PDU in the outbound queue of a socket of a reactor.
+ *  @param rt Pointer to the reactor
+ *  @param c  Socket of the contact
+ *  @param wp Prepared PDU, a reference will be acquired
+ */
+static void
+queue_rt_conn(reactor_t* rt, rt_conn_t* c, wire_pdu_t* wp)
+{
+    int empty = c->sq->head == NULL;
+
+    // the main loop queues the next chunks of a file, once the
+    // outbound queue has been drained
+    if (wp->file_len)
+    {
+        c->chunks++;
+    }
+
+    if (push_send_queue(c->sq, wp, _cnf->sq_policy) == -1)
+    {
+        close_rt_conn(rt, c, RT_MSG_CONGESTED, 0);
+        return;
+    }
+
+    // wait until the socket becomes writable
+    if (empty && ev_mod(&rt->ev, c->fd, rt_events(c), EV_ID(EV_SRC_CONTACT, c->n)) == -1)
+    {
+        close_rt_conn(rt, c, RT_MSG_WRERR, errno);
+    }
+}
+
+
+/**
+ *  Writes the outbound queue of a socket of a reactor without blocking.
+ *  @param rt Pointer to the reactor
+ *  @param c  Socket of the contact
+ */
+static void
+flush_rt_conn(reactor_t* rt, rt_conn_t* c)
+{
+    rt_msg_t* msg;
+
+    if (flush_send_queue(c->fd, c->sq) == -1)
+    {
+        close_rt_conn(rt, c, RT_MSG_WRERR, errno);
+        return;
+    }
+
+    if (c->sq->head != NULL)
+    {
+        return;
+    }
+
+    if (ev_mod(&rt->ev, c->fd, rt_events(c), EV_ID(EV_SRC_CONTACT, c->n)) == -1)
+    {
+        close_rt_conn(rt, c, RT_MSG_WRERR, errno);
+        return;
+    }
+
+    if (c->chunks)
+    {
+        msg = new_rt_msg(RT_MSG_DRAINED, c->n, c->h);
+        msg->chunks = c->chunks;
+        c->chunks = 0;
+        push_lf_queue(&_main, &msg->node);
+    }
+}
+
+
+/**
+ *  Pauses reading from a socket of a reactor, which has exceeded the
+ *  rate limits of its contact. The socket is serviced again after the
+ *  given delay (see: service_rt_conns()).
+ *  @param rt    Pointer to the reactor
+ *  @param c     Socket of the contact
+ *  @param delay Time in ms until the socket is read again
+ */
+static void
+throttle_rt_conn(reactor_t* rt, rt_conn_t* c, long long delay)
+{
+    if (!c->rl.throttled)
+    {
+        c->rl.throttled = 1;
+        count_throttled(c->sq->mt);
+
+        if (ev_mod(&rt->ev, c->fd, rt_events(c), EV_ID(EV_SRC_CONTACT, c->n)) == -1)
+        {
+            close_rt_conn(rt, c, RT_MSG_RDERR, errno);
+            return;
+        }
+    }
+
+    push_rl_queue(&rt->rq, &c->rl, c->n, get_time_ms() + delay);
+}
+
+
+/**
+ *  Decodes up to RL_BATCH PDUs buffered by the PDU reader of a socket of
+ *  a reactor, as long as the rate limits admit them (see: admit_input()),
+ *  and passes them to the main loop.
+ *  @param rt Pointer to the reactor
+ *  @param c  Socket of the contact
+ */
+static void
+decode_rt_conn(reactor_t* rt, rt_conn_t* c)
+{
+    rt_msg_t* msg = NULL;
+    long long start;
+    long long delay;
+    int ret;
+
+    c->rl.round = rt->rq.round;
+
+    for (int i = 0; ; i++)
+    {
+        // remaining pdus are decoded in the next loop iteration
+        if (i == RL_BATCH)
+        {
+            push_rl_queue(&rt->rq, &c->rl, c->n, get_time_ms());
+            break;
+        }
+
+        // the limits are checked before the pdu is decoded
+        if ((delay = admit_input(&c->rl, get_time_ms())) > 0)
+        {
+            throttle_rt_conn(rt, c, delay);
+            break;
+        }
+
+        if (msg == NULL)
+        {
+            msg = new_rt_msg(RT_MSG_PDU, c->n, c->h);
+        }
+
+        start = get_time_ns();
+
+        if ((ret = read_pdu(c->reader, &msg->pdu)) == -1)
+        {
+            pool_free(msg);
+            count_decode_error(c->sq->mt);
+            close_rt_conn(rt, c, RT_MSG_ILLEGAL, 0);
+            return;
+        }
+        // pdu has not been received completely yet
+        else if (!ret)
+        {
+            break;
+        }
+
+        count_pdu_in(c->sq->mt, get_time_ns() - start);
+        spend_tokens(&c->rl.pdus, _cnf->rl_pdus, 1, get_time_ms());
+
+        push_lf_queue(&_main, &msg->node);
+        msg = NULL;
+    }
+
+    pool_free(msg);
+}
+
+
+/**
+ *  Reads available bytes from a socket of a reactor and passes the PDUs,
+ *  that have been received completely, to the main loop (see:
+ *  decode_rt_conn()).
+ *  @param rt Pointer to the reactor
+ *  @param c  Socket of the contact
+ */
+static void
+read_rt_conn(reactor_t* rt, rt_conn_t* c)
+{
+    int ret;
+
+    // read available bytes (-2 indicates that no data is available)
+    if ((ret = fill_pdu_reader(&rt->ev, c->fd, c->reader)) == -1)
+    {
+        close_rt_conn(rt, c, RT_MSG_RDERR, errno);
+        return;
+    }
+    else if (ret == -2)
+    {
+        return;
+    }
+    else if (!ret)
+    {
+        close_rt_conn(rt, c, RT_MSG_EOF, 0);
+        return;
+    }
+
+    count_bytes_in(c->sq->mt, ret);
+    spend_tokens(&c->rl.bytes, _cnf->rl_bytes, ret, get_time_ms());
+    decode_rt_conn(rt, c);
+}
+
+
+/**
+ *  Services the sockets in the service queue of a reactor, which are due.
+ *  Every socket decodes at most one batch of PDUs per loop iteration and
+ *  throttled sockets are read again (see: service_contacts()).
+ *  @param rt Pointer to the reactor
+ */
+static void
+service_rt_conns(reactor_t* rt)
+{
+    rl_queue_t* q = &rt->rq;
+    long long now = get_time_ms();
+    int cnt = q->len;
+    rt_conn_t* c;
+    int n;
+
+    while (cnt-- > 0 && (n = pop_rl_queue(q)) != -1)
+    {
+        // the socket may have been removed while it was queued
+        if (n >= rt->size || (c = rt->conn[n]) == NULL || c->closed || !c->rl.queued)
+        {
+            continue;
+        }
+
+        c->rl.queued = 0;
+
+        if (c->rl.due > now || c->rl.round == q->round)
+        {
+            push_rl_queue(q, &c->rl, n, c->rl.due);
+            continue;
+        }
+
+        if (c->rl.throttled)
+        {
+            c->rl.throttled = 0;
+
+            if (ev_mod(&rt->ev, c->fd, rt_events(c), EV_ID(EV_SRC_CONTACT, c->n)) == -1)
+            {
+                close_rt_conn(rt, c, RT_MSG_RDERR, errno);
+                continue;
+            }
+        }
+
+        decode_rt_conn(rt, c);
+    }
+
+    q->round++;
+}
+
+
+/**
+ *  Handles all messages the main loop has sent to a reactor.
+ *  @param rt Pointer to the reactor
+ */
+static void
+handle_rt_msgs(reactor_t* rt)
+{
+    rt_conn_t** conn;
+    rt_conn_t* c;
+    rt_msg_t* msg;
+    int size;
+
+    ack_lf_queue(&rt->msgs);
+
+    while ((msg = (rt_msg_t*) pop_lf_queue(&rt->msgs)) != NULL)
+    {
+        c = msg->n < rt->size ? rt->conn[msg->n] : NULL;
+
+        switch (msg->type)
+        {
+            case RT_MSG_ADD:
+                if (msg->n >= rt->size)
+                {
+                    for (size = rt->size ? rt->size : CL_SLAB_SIZE; size <= msg->n; size *= 2);
+
+                    if ((conn = realloc(rt->conn, size * sizeof(*conn))) == NULL)
+                    {
+                        ui_fatal("Memory allocation for reactor sockets failed!");
+                    }
+
+                    memset(conn + rt->size, 0, (size - rt->size) * sizeof(*conn));
+                    rt->conn = conn;
+                    rt->size = size;
+                }
+
+                c = msg->conn;
+                rt->conn[msg->n] = c;
+
+                if (ev_add(&rt->ev, c->fd, EV_READ | EV_RECV, EV_ID(EV_SRC_CONTACT, c->n)) == -1)
+                {
+                    c->closed = 1;
+                    msg->type = RT_MSG_RDERR;
+                    msg->err = errno;
+                    push_lf_queue(&_main, &msg->node);
+                    continue;
+                }
+
+                break;
+
+            case RT_MSG_DEL:
+                if (c == NULL)
+                {
+                    break;
+                }
+
+                if (!c->closed)
+                {
+                    ev_del(&rt->ev, c->fd);
+                }
+
+                close(c->fd);
+                free_pdu_reader(c->reader);
+                free(c->reader);
+                free_send_queue(c->sq);
+                free(c->sq);
+                free(c);
+                rt->conn[msg->n] = NULL;
+                break;
+
+            case RT_MSG_SEND:
+                if (c != NULL && !c->closed)
+                {
+                    queue_rt_conn(rt, c, msg->wp);
+                }
+
+                unref_wire_pdu(msg->wp);
+                break;
+        }
+
+        pool_free(msg);
+    }
+}
+
+
+/**
+ *  Event loop of a reactor. Waits for messages from the main loop and
+ *  for events of the sockets owned by the reactor. The reactor can only
+ *  be cancelled while it is waiting.
+ *  @param arg Pointer to the reactor
+ *  @return NULL
+ */
+void*
+th_reactor(void* arg)
+{
+    ev_event_t events[EV_MAX_EVENTS]; // ready file descriptors
+    reactor_t* rt = arg;              // reactor of this thread
+    rt_conn_t* c;
+    int nev, n;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    for (;;)
+    {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        nev = ev_wait(&rt->ev, events, EV_MAX_EVENTS, rl_timeout(&rt->rq, -1, get_time_ms()));
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        if (nev == -1)
+        {
+            // something interrupted the event loop - try again
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            ui_log_errno(LOG_ERR, "ev_wait() failed in reactor!");
+            break;
+        }
+
+        for (int i = 0; i < nev; i++)
+        {
+            if (EV_ID_SRC(events[i].id) == EV_SRC_REACTOR)
+            {
+                handle_rt_msgs(rt);
+                continue;
+            }
+
+            n = EV_ID_INDEX(events[i].id);
+
+            // the socket may have been removed while handling
+            // previous events
+            if (n >= rt->size || (c = rt->conn[n]) == NULL || c->fd != events[i].fd ||
+                c->closed)
+            {
+                continue;
+            }
+
+            // write queued pdus, if the socket is writable
+            if (events[i].events & EV_WRITE)
+            {
+                flush_rt_conn(rt, c);
+            }
+
+            // read pdus, if the socket is readable
+            if (!c->closed && (events[i].events & EV_READ))
+            {
+                read_rt_conn(rt, c);
+            }
+        }
+
+        // sockets with pdus left to decode or whose throttle has
+        // expired get their next turn
+        service_rt_conns(rt);
+    }
+
+    return NULL;
+}
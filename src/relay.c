@@ -0,0 +1,221 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file relay.c
+ *  This file contains the overlay routing of the partial mesh mode (see:
+ *  mesh_parse()). Instead of connecting to every known contact, a client
+ *  keeps a limited amount of neighbours. Text messages carry a message id
+ *  and a TTL and are relayed by every client to its other neighbours
+ *  until their TTL is exhausted. A filter of recently seen message ids
+ *  suppresses duplicates.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dchat_h/relay.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/connector.h"
+#include "dchat_h/gossip.h"
+#include "dchat_h/util.h"
+#include "dchat_h/consoleui.h"
+
+
+static msg_filter_t _filter; //!< recently seen message ids
+static uint64_t _id_state;   //!< state of the message id generator
+
+
+/**
+ *  Creates a new message id. Ids are generated by splitmix64, which is
+ *  seeded with the address of the local client, the time and the pid,
+ *  so ids of different clients do not collide.
+ *  @return new message id, never 0
+ */
+uint64_t
+new_msg_id()
+{
+    uint64_t z;
+
+    if (!_id_state)
+    {
+        _id_state = gossip_hash(_cnf->me.onion_id, _cnf->me.lport) ^
+                    (uint64_t) get_time_ms() ^ ((uint64_t) getpid() << 32);
+    }
+
+    do
+    {
+        z = (_id_state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+    }
+    while (!z);
+
+    return z;
+}
+
+
+/**
+ *  Looks up a message id in a generation of the filter.
+ *  @param gen Generation of the filter
+ *  @param id  Message id
+ *  @return slot of the id or of the free slot where it has to be stored
+ */
+static int
+find_msg_id(uint64_t* gen, uint64_t id)
+{
+    int i = (int)(id % RELAY_FILTER_SIZE);
+
+    while (gen[i] && gen[i] != id)
+    {
+        i = (i + 1) % RELAY_FILTER_SIZE;
+    }
+
+    return i;
+}
+
+
+/**
+ *  Checks whether a message has been seen recently and remembers it
+ *  otherwise.
+ *  @param id Message id
+ *  @return 1 if the message has been seen, 0 otherwise
+ */
+int
+seen_msg_id(uint64_t id)
+{
+    uint64_t* cur = _filter.id[_filter.cur];
+    uint64_t* prev = _filter.id[!_filter.cur];
+    long long now = get_time_ms();
+    int i;
+
+    if (cur[i = find_msg_id(cur, id)] == id || prev[find_msg_id(prev, id)] == id)
+    {
+        return 1;
+    }
+
+    // the current generation replaces the previous one
+    if (_filter.used >= RELAY_FILTER_SIZE / 2 || _filter.expires <= now)
+    {
+        _filter.cur = !_filter.cur;
+        _filter.used = 0;
+        _filter.expires = now + RELAY_FILTER_PERIOD;
+        cur = prev;
+        memset(cur, 0, sizeof(_filter.id[0]));
+        i = find_msg_id(cur, id);
+    }
+
+    cur[i] = id;
+    _filter.used++;
+    return 0;
+}
+
+
+/**
+ *  Relays a text message received from a contact to all other neighbours.
+ *  The relayed PDU is sent on behalf of the local client, the author of
+ *  the message is kept in the "Origin" header and its TTL is decremented.
+ *  @param n   Index of the contact the message has been received from
+ *  @param pdu Received text message
+ *  @return amount of neighbours the message has been relayed to, -1 on error
+ */
+int
+relay_pdu(int n, dchat_pdu_t* pdu)
+{
+    dchat_pdu_t relay;
+    wire_pdu_t* wp;
+    int sent = 0;
+    int i;
+
+    if (init_dchat_pdu(&relay, DCHAT_V1, pdu->content_type, _cnf->me.onion_id,
+                       _cnf->me.lport, _cnf->me.name) == -1)
+    {
+        return -1;
+    }
+
+    relay.content = pdu->content;
+    relay.content_length = pdu->content_length;
+    relay.msg_id = pdu->msg_id;
+    relay.ttl = pdu->ttl - 1;
+    strcpy(relay.origin, pdu->origin[0] != '\0' ? pdu->origin : pdu->nickname);
+
+    // encode the relayed message only once for all neighbours
+    if ((wp = prepare_wire_pdu(&relay)) == NULL)
+    {
+        ui_log(LOG_ERR, "Encoding of relayed PDU failed!");
+        return -1;
+    }
+
+    for (i = 0; i < _cnf->cl.cl_size; i++)
+    {
+        if (i != n && CONTACT(i)->fd > 0 && CONTACT(i)->lport != 0 &&
+            send_wire_pdu(i, wp) != -1)
+        {
+            sent++;
+        }
+    }
+
+    unref_wire_pdu(wp);
+    return sent;
+}
+
+
+/**
+ *  Counts the neighbours of the local client, including the pending
+ *  connection attempts.
+ *  @return amount of neighbours
+ */
+int
+count_neighbours()
+{
+    int cnt = pending_connects();
+
+    for (int i = 0; i < _cnf->cl.cl_size; i++)
+    {
+        if (CONTACT(i)->fd > 0)
+        {
+            cnt++;
+        }
+    }
+
+    return cnt;
+}
+
+
+/**
+ *  Checks whether the local client connects to another contact it has
+ *  learned about. In the partial mesh mode only up to the configured
+ *  amount of neighbours are connected, otherwise every contact is.
+ *  Contacts connecting to us and contacts the user connects to are
+ *  always accepted.
+ *  @return 1 if a new neighbour may be connected, 0 otherwise
+ */
+int
+accepts_neighbour()
+{
+    return !_cnf->neighbours || count_neighbours() < _cnf->neighbours;
+}
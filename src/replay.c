@@ -0,0 +1,893 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+
+/** @file replay.c
+ *  This file contains a load generator, which replays a trace captured by
+ *  a dchat client (see: capt_parse()) against running dchat clients. Every
+ *  connection of the trace is replayed by a connection of its own, the
+ *  connections are spread round-robin across the given ports. The PDUs are
+ *  sent at the recorded times, optionally accelerated, while keepalive
+ *  pings interleaved with the replayed PDUs measure the round trip time of
+ *  the replayed clients under load. Replayed clients should be started
+ *  without the peers of the captured client (e.g. "dchat -x -s ..."),
+ *  since messages they have already received are discarded.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "dchat_h/replay.h"
+#include "dchat_h/capture.h"
+#include "dchat_h/decoder.h"
+
+
+/**
+ *  Returns the time of the monotonic clock in nanoseconds.
+ *  @return time in nanoseconds
+ */
+long long
+get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/**
+ *  Loads an integer stored in little endian byte order.
+ *  @param p   Source
+ *  @param len Amount of bytes to load
+ *  @return loaded integer
+ */
+uint64_t
+get_le(const unsigned char* p, int len)
+{
+    uint64_t v = 0;
+
+    for (int i = len - 1; i >= 0; i--)
+    {
+        v = v << 8 | p[i];
+    }
+
+    return v;
+}
+
+
+/**
+ *  Writes a whole buffer to a file descriptor.
+ *  @param fd  File descriptor
+ *  @param buf Buffer
+ *  @param len Length of the buffer
+ *  @return 0 on success, -1 on error
+ */
+int
+write_all(int fd, const char* buf, int len)
+{
+    int off = 0;
+    int ret;
+
+    while (off < len)
+    {
+        if ((ret = send(fd, buf + off, len - off, MSG_NOSIGNAL)) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        off += ret;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Looks up the value of a header of an encoded PDU.
+ *  @param hdr   Encoded headers, which need not be terminated
+ *  @param len   Length of the encoded headers
+ *  @param name  Name of the header (see: HDR_NAME_*)
+ *  @param value Buffer the value is copied to
+ *  @param size  Size of the buffer
+ *  @return 0 if the header has been found, -1 otherwise
+ */
+int
+get_header(char* hdr, int len, char* name, char* value, int size)
+{
+    int nlen = strlen(name);
+    char* end = hdr + len;
+    char* eol;
+    int vlen;
+
+    while (hdr < end && *hdr != '\n')
+    {
+        if ((eol = memchr(hdr, '\n', end - hdr)) == NULL)
+        {
+            return -1;
+        }
+
+        if (eol - hdr > nlen + 1 && !strncmp(hdr, name, nlen) && hdr[nlen] == ':')
+        {
+            hdr += nlen + 1;
+            hdr += *hdr == ' ';
+            vlen = eol - hdr < size - 1 ? eol - hdr : size - 1;
+            memcpy(value, hdr, vlen);
+            value[vlen] = '\0';
+            return 0;
+        }
+
+        hdr = eol + 1;
+    }
+
+    return -1;
+}
+
+
+/**
+ *  Returns the stream of a recorded connection and direction. Unknown
+ *  streams are added and assigned to the next port.
+ *  @param rp  Replay
+ *  @param n   Index of the captured contact
+ *  @param gen Generation of the captured contact slot
+ *  @param dir Direction of the record
+ *  @return index of the stream or -1 on error
+ */
+int
+find_stream(replay_t* rp, uint32_t n, uint32_t gen, int dir)
+{
+    rp_stream_t* st;
+    int i;
+
+    for (i = rp->streams - 1; i >= 0; i--)
+    {
+        if (rp->stream[i].n == n && rp->stream[i].gen == gen && rp->stream[i].dir == dir)
+        {
+            return i;
+        }
+    }
+
+    if (!(rp->streams & (rp->streams - 1)))
+    {
+        st = realloc(rp->stream, (rp->streams ? rp->streams * 2 : 16) * sizeof(*st));
+
+        if (st == NULL)
+        {
+            perror("realloc");
+            return -1;
+        }
+
+        rp->stream = st;
+    }
+
+    st = &rp->stream[rp->streams];
+    memset(st, 0, sizeof(*st));
+    st->n = n;
+    st->gen = gen;
+    st->dir = dir;
+    st->port = rp->port[rp->streams % rp->ports];
+    st->fd = -1;
+    return rp->streams++;
+}
+
+
+/**
+ *  Loads the records of a trace file. A truncated record at the end of
+ *  the trace (e.g. of a client that has been killed) is ignored.
+ *  @param rp   Replay
+ *  @param path Path of the trace file
+ *  @return 0 on success, -1 on error
+ */
+int
+load_trace(replay_t* rp, char* path)
+{
+    unsigned char* p;
+    unsigned char* rec;
+    rp_record_t* r;
+    rp_stream_t* st;
+    FILE* f;
+    long size, off;
+    long long t = 0;
+    int hdr_len, len, dir, s;
+
+    if ((f = fopen(path, "r")) == NULL || fseek(f, 0, SEEK_END) == -1 ||
+        (size = ftell(f)) == -1 || fseek(f, 0, SEEK_SET) == -1)
+    {
+        perror(path);
+        return -1;
+    }
+
+    if ((rp->trace = malloc(size + 1)) == NULL || fread(rp->trace, 1, size, f) != (size_t) size)
+    {
+        perror(path);
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+    p = (unsigned char*) rp->trace;
+
+    if (size < CP_HEADER_LEN || memcmp(p, CP_MAGIC, 4) || get_le(p + 4, 2) != CP_VERSION ||
+        (hdr_len = get_le(p + 6, 2)) < CP_RECORD_LEN)
+    {
+        fprintf(stderr, "'%s' is not a trace file of version %d!\n", path, CP_VERSION);
+        return -1;
+    }
+
+    for (off = CP_HEADER_LEN; off + hdr_len <= size; off += hdr_len + len)
+    {
+        rec = p + off;
+        t += get_le(rec, 4);
+        len = get_le(rec + 14, 4);
+        dir = rec[12];
+
+        if (len > size - off - hdr_len)
+        {
+            fprintf(stderr, "Ignoring truncated record at the end of '%s'!\n", path);
+            break;
+        }
+
+        if (dir != CP_DIR_IN && (!rp->outbound || dir != CP_DIR_OUT))
+        {
+            continue;
+        }
+
+        if ((s = find_stream(rp, get_le(rec + 4, 4), get_le(rec + 8, 4), dir)) == -1)
+        {
+            return -1;
+        }
+
+        // the identity of the first pdu is used by the probes of the stream
+        st = &rp->stream[s];
+
+        if (st->host[0] == '\0')
+        {
+            get_header((char*) rec + hdr_len, len, HDR_NAME_ONI, st->host, sizeof(st->host));
+            get_header((char*) rec + hdr_len, len, HDR_NAME_LNP, st->lport, sizeof(st->lport));
+            get_header((char*) rec + hdr_len, len, HDR_NAME_NIC, st->nickname, sizeof(st->nickname));
+        }
+
+        if (!(rp->records & (rp->records - 1)))
+        {
+            if ((r = realloc(rp->record, (rp->records ? rp->records * 2 : 1024) * sizeof(*r))) == NULL)
+            {
+                perror("realloc");
+                return -1;
+            }
+
+            rp->record = r;
+        }
+
+        r = &rp->record[rp->records++];
+        r->t = t;
+        r->stream = s;
+        r->len = len;
+        r->data = (char*) rec + hdr_len;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Connects a stream to its replayed client.
+ *  @param rp Replay
+ *  @param st Stream
+ *  @return 0 on success, -1 on error
+ */
+int
+open_stream(replay_t* rp, rp_stream_t* st)
+{
+    struct sockaddr_in sa;
+    int on = 1;
+    int fd;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(st->port);
+
+    if (inet_pton(AF_INET, rp->address, &sa.sin_addr) != 1)
+    {
+        fprintf(stderr, "Invalid address '%s'!\n", rp->address);
+        return -1;
+    }
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    // probes must not wait for the acknowledgement of replayed pdus
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (connect(fd, (struct sockaddr*) &sa, sizeof(sa)) == -1)
+    {
+        fprintf(stderr, "Connecting to %s:%d failed: %s\n", rp->address, st->port,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    st->fd = fd;
+    return 0;
+}
+
+
+/**
+ *  Closes the connection of a stream. Later records of the stream are
+ *  skipped.
+ *  @param st Stream
+ */
+void
+close_stream(rp_stream_t* st)
+{
+    if (st->fd != -1)
+    {
+        close(st->fd);
+    }
+
+    st->fd = -1;
+    st->closed = 1;
+}
+
+
+/**
+ *  Sends a record to the replayed client of its stream, the stream is
+ *  connected by its first record.
+ *  @param rp  Replay
+ *  @param rec Record
+ *  @return 0 if the record has been sent, -1 otherwise
+ */
+int
+send_record(replay_t* rp, rp_record_t* rec)
+{
+    rp_stream_t* st = &rp->stream[rec->stream];
+
+    if (st->closed)
+    {
+        return -1;
+    }
+
+    if (st->fd == -1 && open_stream(rp, st) == -1)
+    {
+        rp->failed++;
+        close_stream(st);
+        return -1;
+    }
+
+    if (write_all(st->fd, rec->data, rec->len) == -1)
+    {
+        fprintf(stderr, "Writing to %s:%d failed: %s\n", rp->address, st->port,
+                strerror(errno));
+        rp->failed++;
+        close_stream(st);
+        return -1;
+    }
+
+    rp->sent++;
+    rp->sent_bytes += rec->len;
+    return 0;
+}
+
+
+/**
+ *  Sends a keepalive on a stream, which carries the identity of the
+ *  first record of the stream.
+ *  @param rp    Replay
+ *  @param st    Connected stream
+ *  @param word  "ping" or "pong"
+ *  @param stamp Stamp of the keepalive
+ *  @return 0 on success, -1 on error
+ */
+int
+send_probe(replay_t* rp, rp_stream_t* st, char* word, long long stamp)
+{
+    char buf[512];
+    char content[64];
+    char nickname[80] = "";
+    int clen, len;
+
+    clen = snprintf(content, sizeof(content), "%s %lld\n", word, stamp);
+
+    if (st->nickname[0] != '\0')
+    {
+        snprintf(nickname, sizeof(nickname), "%s: %s\n", HDR_NAME_NIC, st->nickname);
+    }
+
+    len = snprintf(buf, sizeof(buf), "%s: 1.0\n%s: %s\n%s: %d\n%s: %s\n%s: %s\n%s\n%s",
+                   HDR_NAME_VER, HDR_NAME_CTT, CTT_NAME_KAL, HDR_NAME_CTL, clen,
+                   HDR_NAME_ONI, st->host, HDR_NAME_LNP, st->lport, nickname, content);
+
+    if (len >= (int) sizeof(buf) || write_all(st->fd, buf, len) == -1)
+    {
+        rp->failed++;
+        close_stream(st);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Handles a PDU received on a stream. Pongs of probes are measured and
+ *  pings of the replayed client are answered.
+ *  @param rp      Replay
+ *  @param st      Stream
+ *  @param pdu     Received PDU
+ *  @param hdr_len Length of the headers of the PDU
+ *  @param ctl     Length of the content of the PDU
+ *  @return 0 on success, -1 on error
+ */
+int
+handle_stream_pdu(replay_t* rp, rp_stream_t* st, char* pdu, int hdr_len, int ctl)
+{
+    char ctt[64];
+    char line[64];
+    long long stamp;
+    long long now;
+
+    rp->received++;
+    rp->received_bytes += hdr_len + ctl;
+
+    if (get_header(pdu, hdr_len, HDR_NAME_CTT, ctt, sizeof(ctt)) == -1 ||
+        strcmp(ctt, CTT_NAME_KAL) || ctl >= (int) sizeof(line))
+    {
+        return 0;
+    }
+
+    memcpy(line, pdu + hdr_len, ctl);
+    line[ctl] = '\0';
+    now = get_time_ns();
+
+    if (sscanf(line, "pong %lld", &stamp) == 1 && stamp > 0 && stamp <= now)
+    {
+        if (rp->answered < RP_MAX_PROBES)
+        {
+            rp->rtt[rp->answered] = now - stamp;
+        }
+
+        rp->answered++;
+    }
+    else if (sscanf(line, "ping %lld", &stamp) == 1)
+    {
+        return send_probe(rp, st, "pong", stamp);
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Reads the PDUs the replayed clients have sent to the streams.
+ *  @param rp      Replay
+ *  @param timeout Max. time to wait in ms
+ *  @return 0 on success, -1 on error
+ */
+int
+poll_streams(replay_t* rp, int timeout)
+{
+    rp_stream_t* st;
+    char* end;
+    char value[16];
+    int nfds = 0;
+    int hdr_len, ctl, len;
+
+    for (int i = 0; i < rp->streams; i++)
+    {
+        if (rp->stream[i].fd != -1)
+        {
+            rp->pfd[nfds].fd = rp->stream[i].fd;
+            rp->pfd[nfds].events = POLLIN;
+            rp->pfd_stream[nfds++] = i;
+        }
+    }
+
+    if (poll(rp->pfd, nfds, timeout) == -1)
+    {
+        if (errno == EINTR)
+        {
+            return 0;
+        }
+
+        perror("poll");
+        return -1;
+    }
+
+    for (int i = 0; i < nfds; i++)
+    {
+        st = &rp->stream[rp->pfd_stream[i]];
+
+        if (!rp->pfd[i].revents || st->fd == -1)
+        {
+            continue;
+        }
+
+        if ((len = recv(st->fd, st->buf + st->len, RP_BUF_LEN - st->len, MSG_DONTWAIT)) <= 0)
+        {
+            if (len == -1 && (errno == EAGAIN || errno == EINTR))
+            {
+                continue;
+            }
+
+            rp->dropped++;
+            close_stream(st);
+            continue;
+        }
+
+        st->len += len;
+
+        // headers end with an empty line and are followed by the content
+        while (st->fd != -1)
+        {
+            end = NULL;
+
+            for (int j = 1; j < st->len; j++)
+            {
+                if (st->buf[j] == '\n' && st->buf[j - 1] == '\n')
+                {
+                    end = st->buf + j + 1;
+                    break;
+                }
+            }
+
+            if (end == NULL)
+            {
+                if (st->len == RP_BUF_LEN)
+                {
+                    fprintf(stderr, "Invalid PDU received from %s:%d!\n", rp->address, st->port);
+                    rp->dropped++;
+                    close_stream(st);
+                }
+
+                break;
+            }
+
+            hdr_len = end - st->buf;
+
+            if (get_header(st->buf, hdr_len, HDR_NAME_CTL, value, sizeof(value)) == -1 ||
+                (ctl = atoi(value)) < 0 || ctl > RP_BUF_LEN - hdr_len)
+            {
+                fprintf(stderr, "Invalid PDU received from %s:%d!\n", rp->address, st->port);
+                rp->dropped++;
+                close_stream(st);
+                break;
+            }
+
+            if (st->len < hdr_len + ctl)
+            {
+                break;
+            }
+
+            if (handle_stream_pdu(rp, st, st->buf, hdr_len, ctl) == -1)
+            {
+                break;
+            }
+
+            st->len -= hdr_len + ctl;
+            memmove(st->buf, st->buf + hdr_len + ctl, st->len);
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Replays the records at their recorded times divided by the speed of
+ *  the replay, records that are behind the schedule are sent at once.
+ *  Every interval a probe is sent to the next connected stream.
+ *  Afterwards the answers of pending probes are awaited.
+ *  @param rp Replay
+ *  @return time from the start until the last record has been sent in ns
+ */
+long long
+run_replay(replay_t* rp)
+{
+    long long start, now, due, next_probe, elapsed, deadline;
+    long long t0 = rp->records ? rp->record[0].t : 0;
+    long batch = 0;
+    long i = 0;
+    int timeout;
+    int s;
+
+    start = get_time_ns();
+    next_probe = start + rp->interval * 1000000LL;
+
+    while (i < rp->records)
+    {
+        now = get_time_ns();
+        due = rp->speed > 0 ? start + (long long) ((rp->record[i].t - t0) * 1000 / rp->speed) : now;
+
+        if (due <= now)
+        {
+            if (send_record(rp, &rp->record[i]) == 0)
+            {
+                rp->lag[rp->sent - 1] = now - due;
+            }
+
+            i++;
+
+            // poll now and then, if the replay is behind the schedule
+            if (++batch % RP_POLL_BATCH)
+            {
+                continue;
+            }
+
+            timeout = 0;
+        }
+        else
+        {
+            // rounded down, the last fraction of a ms is polled without waiting
+            timeout = (due - now) / 1000000;
+        }
+
+        if (rp->interval && now >= next_probe)
+        {
+            for (int j = 0; j < rp->streams; j++)
+            {
+                s = rp->probe_next++ % rp->streams;
+
+                if (rp->stream[s].fd != -1)
+                {
+                    rp->probes += send_probe(rp, &rp->stream[s], "ping", get_time_ns()) == 0;
+                    break;
+                }
+            }
+
+            next_probe = now + rp->interval * 1000000LL;
+        }
+
+        if (rp->interval && (next_probe - now) / 1000000 < timeout)
+        {
+            timeout = (next_probe - now) / 1000000;
+        }
+
+        if (poll_streams(rp, timeout) == -1)
+        {
+            break;
+        }
+    }
+
+    elapsed = get_time_ns() - start;
+    deadline = get_time_ns() + rp->wait * 1000000LL;
+
+    // wait for the answers of pending probes
+    while (rp->answered < rp->probes && (now = get_time_ns()) < deadline)
+    {
+        if (poll_streams(rp, (deadline - now) / 1000000 + 1) == -1)
+        {
+            break;
+        }
+    }
+
+    return elapsed;
+}
+
+
+/**
+ *  Compares two durations (see: qsort(3)).
+ */
+static int
+cmp_duration(const void* a, const void* b)
+{
+    long long x = *(const long long*) a;
+    long long y = *(const long long*) b;
+    return x < y ? -1 : x > y;
+}
+
+
+/**
+ *  Prints the results of the replay.
+ *  @param rp      Replay
+ *  @param elapsed Duration of the replay in nanoseconds
+ */
+void
+report_replay(replay_t* rp, long long elapsed)
+{
+    long rtts = rp->answered < RP_MAX_PROBES ? rp->answered : RP_MAX_PROBES;
+    double secs = (elapsed ? elapsed : 1) / 1e9;
+
+    qsort(rp->lag, rp->sent, sizeof(long long), cmp_duration);
+    qsort(rp->rtt, rtts, sizeof(long long), cmp_duration);
+    printf("streams:            %d (%d failed, %d closed by the clients)\n", rp->streams,
+           rp->failed, rp->dropped);
+    printf("records replayed:   %ld of %ld\n", rp->sent, rp->records);
+
+    if (rp->speed > 0)
+    {
+        printf("elapsed:            %.3f s (speed %gx)\n", secs, rp->speed);
+    }
+    else
+    {
+        printf("elapsed:            %.3f s (as fast as possible)\n", secs);
+    }
+
+    printf("throughput:         %.0f PDU/s, %.1f kB/s\n", rp->sent / secs,
+           rp->sent_bytes / secs / 1024);
+
+    if (rp->sent)
+    {
+        printf("schedule lag p50:   %.1f us\n", rp->lag[rp->sent / 2] / 1e3);
+        printf("schedule lag p99:   %.1f us\n", rp->lag[rp->sent * 99 / 100] / 1e3);
+        printf("schedule lag max:   %.1f us\n", rp->lag[rp->sent - 1] / 1e3);
+    }
+
+    printf("PDUs received:      %ld (%.1f kB)\n", rp->received, rp->received_bytes / 1024.0);
+    printf("probes answered:    %ld of %ld\n", rp->answered, rp->probes);
+
+    if (rtts)
+    {
+        printf("rtt p50:            %.1f us\n", rp->rtt[rtts / 2] / 1e3);
+        printf("rtt p99:            %.1f us\n", rp->rtt[rtts * 99 / 100] / 1e3);
+        printf("rtt max:            %.1f us\n", rp->rtt[rtts - 1] / 1e3);
+    }
+}
+
+
+static void
+rp_usage(char* name)
+{
+    fprintf(stderr, "usage: %s [-s SPEED] [-i INTERVAL] [-w WAIT] [-a ADDRESS] [-o] TRACE PORT...\n"
+            "    -s  speedup of the replay, 0 for as fast as possible (default: %g)\n"
+            "    -i  ms between two latency probes, 0 for none (default: %d)\n"
+            "    -w  ms to wait for pending probes after the last record (default: %d)\n"
+            "    -a  address of the replayed clients (default: %s)\n"
+            "    -o  replay the PDUs sent by the captured client, too\n"
+            "    the connections of the trace are spread across the clients listening\n"
+            "    on PORT... (at most %d)\n",
+            name, RP_DEFAULT_SPEED, RP_DEFAULT_INTERVAL, RP_DEFAULT_WAIT, RP_DEFAULT_ADDRESS,
+            RP_MAX_PORTS);
+    exit(EXIT_FAILURE);
+}
+
+
+int
+main(int argc, char** argv)
+{
+    replay_t* rp;
+    long long elapsed;
+    char* end;
+    int ret = EXIT_FAILURE;
+    int opt;
+
+    if ((rp = calloc(1, sizeof(*rp))) == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    rp->address = RP_DEFAULT_ADDRESS;
+    rp->speed = RP_DEFAULT_SPEED;
+    rp->interval = RP_DEFAULT_INTERVAL;
+    rp->wait = RP_DEFAULT_WAIT;
+
+    while ((opt = getopt(argc, argv, "s:i:w:a:oh")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                rp->speed = strtod(optarg, &end);
+
+                if (*end != '\0' || end == optarg || rp->speed < 0)
+                {
+                    rp_usage(argv[0]);
+                }
+
+                break;
+
+            case 'i':
+                rp->interval = atoi(optarg);
+                break;
+
+            case 'w':
+                rp->wait = atoi(optarg);
+                break;
+
+            case 'a':
+                rp->address = optarg;
+                break;
+
+            case 'o':
+                rp->outbound = 1;
+                break;
+
+            default:
+                rp_usage(argv[0]);
+        }
+    }
+
+    if (argc - optind < 2 || argc - optind - 1 > RP_MAX_PORTS || rp->interval < 0 || rp->wait < 0)
+    {
+        rp_usage(argv[0]);
+    }
+
+    for (int i = optind + 1; i < argc; i++)
+    {
+        rp->port[rp->ports] = (int) strtol(argv[i], &end, 10);
+
+        if (*end != '\0' || rp->port[rp->ports] < 1 || rp->port[rp->ports] > 65535)
+        {
+            rp_usage(argv[0]);
+        }
+
+        rp->ports++;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (load_trace(rp, argv[optind]) == -1)
+    {
+        goto cleanup;
+    }
+
+    if ((rp->lag = malloc((rp->records + 1) * sizeof(long long))) == NULL ||
+        (rp->rtt = malloc(RP_MAX_PROBES * sizeof(long long))) == NULL ||
+        (rp->pfd = malloc((rp->streams + 1) * sizeof(struct pollfd))) == NULL ||
+        (rp->pfd_stream = malloc((rp->streams + 1) * sizeof(int))) == NULL)
+    {
+        perror("malloc");
+        goto cleanup;
+    }
+
+    elapsed = run_replay(rp);
+    report_replay(rp, elapsed);
+    ret = rp->failed || rp->sent < rp->records ? EXIT_FAILURE : EXIT_SUCCESS;
+
+cleanup:
+    for (int i = 0; i < rp->streams; i++)
+    {
+        if (rp->stream[i].fd != -1)
+        {
+            close(rp->stream[i].fd);
+        }
+    }
+
+    free(rp->pfd_stream);
+    free(rp->pfd);
+    free(rp->rtt);
+    free(rp->lag);
+    free(rp->stream);
+    free(rp->record);
+    free(rp->trace);
+    free(rp);
+    return ret;
+}
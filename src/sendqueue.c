@@ -0,0 +1,371 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file sendqueue.c
+ *  This file contains the outbound queues of contacts, which buffer
+ *  PDUs until the socket of a contact becomes writable.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#include "dchat_h/sendqueue.h"
+#include "dchat_h/framing.h"
+#include "dchat_h/metrics.h"
+#include "dchat_h/pool.h"
+#include "dchat_h/consoleui.h"
+
+
+/**
+ *  Initializes an empty outbound queue.
+ *  @param sq Pointer to the outbound queue
+ */
+void
+init_send_queue(send_queue_t* sq)
+{
+    memset(sq, 0, sizeof(*sq));
+}
+
+
+/**
+ *  Removes all entries of an outbound queue and releases the
+ *  prepared PDUs they are referencing.
+ *  @param sq Pointer to the outbound queue
+ */
+void
+free_send_queue(send_queue_t* sq)
+{
+    send_entry_t* e;
+
+    if (sq == NULL)
+    {
+        return;
+    }
+
+    while ((e = sq->head) != NULL)
+    {
+        sq->head = e->next;
+        unref_wire_pdu(e->wp);
+        pool_free(e);
+    }
+
+    init_send_queue(sq);
+}
+
+
+/**
+ *  Removes all entries of an outbound queue, that match the given
+ *  content-type and that have not been written partially. Session frames
+ *  of DChat V2 (see: update_session()) and PDUs of file transfers are
+ *  never removed.
+ *  @param sq           Pointer to the outbound queue
+ *  @param content_type Content-type to remove, 0 matches all content-types
+ *  @param limit        Stop removing entries once the queue holds no more
+ *                      than this amount of bytes
+ */
+void
+drop_send_queue(send_queue_t* sq, int content_type, int limit)
+{
+    send_entry_t** pe = &sq->head;
+    send_entry_t* prev = NULL;
+    send_entry_t* e;
+
+    // a partially written pdu must be written completely
+    if (sq->off && *pe != NULL)
+    {
+        prev = *pe;
+        pe = &prev->next;
+    }
+
+    while ((e = *pe) != NULL && sq->bytes > limit)
+    {
+        // session frames carry the identity of the following frames,
+        // pdus of file transfers must arrive without gaps
+        if ((content_type && e->wp->content_type != content_type) ||
+            e->wp->content_type == V2_TYPE_SESSION ||
+            e->wp->content_type == CTT_ID_BIN || e->wp->content_type == CTT_ID_RSM)
+        {
+            prev = e;
+            pe = &e->next;
+            continue;
+        }
+
+        *pe = e->next;
+
+        if (sq->tail == e)
+        {
+            sq->tail = prev;
+        }
+
+        sq->bytes -= e->wp->len;
+        sq->len--;
+        sq->dropped++;
+        count_dropped(sq->mt, 1);
+        unref_wire_pdu(e->wp);
+        pool_free(e);
+    }
+}
+
+
+/**
+ *  Appends a prepared PDU to an outbound queue.
+ *  If the high watermark would be exceeded, the queue is congested and
+ *  the given policy is applied: SQ_POLICY_DROP drops the oldest PDUs until
+ *  the low watermark is reached, SQ_POLICY_COALESCE drops queued PDUs of
+ *  the same control content-type first, since they are superseded by the
+ *  new PDU, and SQ_POLICY_DISCONNECT rejects the PDU.
+ *  @param sq     Pointer to the outbound queue
+ *  @param wp     Prepared PDU, a reference will be acquired
+ *  @param policy Policy applied if the queue is congested
+ *  @return 0 on success, -1 if the contact should be disconnected
+ */
+int
+push_send_queue(send_queue_t* sq, wire_pdu_t* wp, int policy)
+{
+    send_entry_t* e;
+
+    if (sq->bytes + wp->len > SQ_HIGH_WATERMARK)
+    {
+        if (!sq->congested)
+        {
+            sq->congested = 1;
+            ui_log(LOG_WARN, "Outbound queue is congested (%d bytes queued)!", sq->bytes);
+        }
+
+        if (policy == SQ_POLICY_DISCONNECT)
+        {
+            return -1;
+        }
+
+        if (policy == SQ_POLICY_COALESCE && wp->content_type != CTT_ID_TXT)
+        {
+            drop_send_queue(sq, wp->content_type, 0);
+        }
+
+        if (sq->bytes + wp->len > SQ_HIGH_WATERMARK)
+        {
+            drop_send_queue(sq, 0, SQ_LOW_WATERMARK - wp->len);
+        }
+    }
+
+    if ((e = pool_alloc(sizeof(*e))) == NULL)
+    {
+        ui_fatal("Memory allocation for outbound queue entry failed!");
+    }
+
+    e->wp = ref_wire_pdu(wp);
+    e->next = NULL;
+
+    if (sq->tail != NULL)
+    {
+        sq->tail->next = e;
+    }
+    else
+    {
+        sq->head = e;
+    }
+
+    sq->tail = e;
+    sq->len++;
+    sq->bytes += wp->len;
+    count_queued(sq->mt, sq->bytes);
+    return 0;
+}
+
+
+/**
+ *  Writes the content of a file chunk (see: prepare_file_pdu()), whose
+ *  headers have already been written, to a socket without blocking. The
+ *  content is sent with sendfile(2), thus it is never copied to user space.
+ *  @param fd  Socket file descriptor of the contact
+ *  @param wp  Prepared file chunk
+ *  @param off Bytes of the file chunk already written
+ *  @return amount of bytes written or -1 in case of error
+ */
+ssize_t
+send_file_content(int fd, wire_pdu_t* wp, int off)
+{
+    off_t pos = wp->file_off + off - (wp->len - wp->file_len);
+    ssize_t ret;
+#ifdef HAVE_SYS_SENDFILE_H
+
+    ret = sendfile(fd, wp->file_fd, &pos, wp->len - off);
+#else
+    char buf[MAX_CONTENT_LEN];
+
+    if ((ret = pread(wp->file_fd, buf, wp->len - off, pos)) > 0)
+    {
+        ret = send(fd, buf, ret, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+#endif
+
+    // the file has been truncated, but the length of the
+    // content has already been sent
+    if (ret == 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    return ret;
+}
+
+
+/**
+ *  Writes as many queued PDUs as possible to a socket without blocking.
+ *  Up to SQ_MAX_IOV PDUs are written with a single sendmsg(2). PDUs that
+ *  have been written completely are removed from the queue. A file chunk
+ *  ends the PDUs gathered, since its content is sent from the file.
+ *  @param fd Socket file descriptor of the contact
+ *  @param sq Pointer to the outbound queue
+ *  @return amount of bytes written (0 if the socket is not writable) or
+ *  -1 in case of error
+ */
+int
+flush_send_queue(int fd, send_queue_t* sq)
+{
+    struct iovec iov[SQ_MAX_IOV];
+    struct msghdr msg;
+    send_entry_t* e;
+    ssize_t ret;
+    int written;
+    int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    int cnt = 0;
+    int pdus = 0;
+
+    if (sq->head == NULL)
+    {
+        return 0;
+    }
+
+    e = sq->head;
+
+    // headers of a file chunk have been written
+    if (e->wp->file_len && sq->off >= e->wp->len - e->wp->file_len)
+    {
+        ret = send_file_content(fd, e->wp, sq->off);
+    }
+    else
+    {
+        // gather queued pdus up to the headers of the next file chunk
+        for (; e != NULL && cnt < SQ_MAX_IOV; e = e->next)
+        {
+            iov[cnt].iov_base = e->wp->data;
+            iov[cnt].iov_len  = e->wp->len - e->wp->file_len;
+            cnt++;
+
+            if (e->wp->file_len)
+            {
+#ifdef MSG_MORE
+                // the content of the chunk follows immediately
+                flags |= MSG_MORE;
+#endif
+                break;
+            }
+        }
+
+        iov[0].iov_base = (char*) iov[0].iov_base + sq->off;
+        iov[0].iov_len -= sq->off;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        ret = sendmsg(fd, &msg, flags);
+    }
+
+    if (ret == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            return 0;
+        }
+
+        return -1;
+    }
+
+    written = ret;
+    sq->bytes -= ret;
+    ret += sq->off;
+
+    // remove pdus that have been written completely
+    while ((e = sq->head) != NULL && ret >= e->wp->len)
+    {
+        ret -= e->wp->len;
+        sq->head = e->next;
+        sq->len--;
+        unref_wire_pdu(e->wp);
+        pool_free(e);
+        pdus++;
+    }
+
+    if (sq->head == NULL)
+    {
+        sq->tail = NULL;
+    }
+
+    sq->off = ret;
+    count_pdus_out(sq->mt, pdus, written);
+    count_queued(sq->mt, sq->bytes);
+
+    if (sq->congested && sq->bytes < SQ_LOW_WATERMARK)
+    {
+        sq->congested = 0;
+        ui_log(LOG_INFO, "Outbound queue recovered from congestion (%d pdus dropped)!",
+               sq->dropped);
+    }
+
+    return written;
+}
+
+
+/**
+ *  Converts the name of a policy for congested outbound queues to its id.
+ *  @param name Name of the policy (e.g. "drop")
+ *  @return id of the policy or -1 if the policy is unknown
+ */
+int
+parse_send_policy(char* name)
+{
+    if (!strcmp(name, SQ_POLICY_NAME_DROP))
+    {
+        return SQ_POLICY_DROP;
+    }
+
+    if (!strcmp(name, SQ_POLICY_NAME_DISCONNECT))
+    {
+        return SQ_POLICY_DISCONNECT;
+    }
+
+    if (!strcmp(name, SQ_POLICY_NAME_COALESCE))
+    {
+        return SQ_POLICY_COALESCE;
+    }
+
+    return -1;
+}
@@ -0,0 +1,222 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file snapshot.c
+ *  This file contains the snapshots of the contactlist. The contactlist
+ *  is only modified and accessed by the main loop. Other threads read
+ *  immutable snapshots of the connected contacts, which the main loop
+ *  publishes whenever the contactlist has changed (see:
+ *  publish_cl_snapshot()). Readers never wait for the main loop: they
+ *  announce the epoch they have entered, and replaced snapshots are
+ *  freed by the main loop once every reader has left older epochs.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dchat_h/snapshot.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/consoleui.h"
+
+
+static cl_snapshot_t _empty;               //!< snapshot published initially
+static cl_snapshot_t* _snap = &_empty;     //!< snapshot published last
+static cl_snapshot_t* _retired;            //!< replaced snapshots not freed yet
+static uint64_t _epoch = 1;                //!< epoch, incremented by every replacement
+static uint64_t _version;                  //!< version of the snapshot published last
+static int _dirty = 1;                     //!< contactlist changed since last published
+static uint64_t _reader[SNAP_MAX_READERS]; //!< epoch entered by a reader, 0 if none
+static int _readers;                       //!< amount of registered readers
+static __thread int _slot = -1;            //!< reader slot of the calling thread
+
+
+/**
+ *  Frees replaced snapshots, which can not be accessed by any reader
+ *  anymore. A reader can only access snapshots which have been replaced
+ *  in epochs after the one it has entered.
+ */
+static void
+reclaim_cl_snapshots()
+{
+    cl_snapshot_t** ps;
+    cl_snapshot_t* snap;
+    uint64_t min = UINT64_MAX; // oldest epoch entered by a reader
+    uint64_t epoch;
+    int readers = __atomic_load_n(&_readers, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < readers && i < SNAP_MAX_READERS; i++)
+    {
+        if ((epoch = __atomic_load_n(&_reader[i], __ATOMIC_SEQ_CST)) && epoch < min)
+        {
+            min = epoch;
+        }
+    }
+
+    for (ps = &_retired; (snap = *ps) != NULL;)
+    {
+        if (snap->retired <= min)
+        {
+            *ps = snap->next;
+            free(snap);
+            continue;
+        }
+
+        ps = &snap->next;
+    }
+}
+
+
+/**
+ *  Marks the contactlist as changed, it will be published by the next
+ *  call of publish_cl_snapshot(). Must be called by the main loop
+ *  whenever a contact is added, removed or its address changes.
+ */
+void
+touch_cl_snapshot()
+{
+    _dirty = 1;
+}
+
+
+/**
+ *  Publishes a snapshot of the connected contacts, if the contactlist
+ *  has changed since the last snapshot has been published. Must only be
+ *  called by the main loop, which may access the returned snapshot
+ *  without entering it, since only the main loop frees snapshots.
+ *  @return snapshot published last
+ */
+cl_snapshot_t*
+publish_cl_snapshot()
+{
+    cl_snapshot_t* snap;
+    cl_snapshot_t* old;
+    contact_t* contact;
+    cl_entry_t* e;
+
+    if (!_dirty)
+    {
+        return _snap;
+    }
+
+    if ((snap = malloc(sizeof(*snap) + _cnf->cl.used_contacts * sizeof(cl_entry_t))) == NULL)
+    {
+        ui_fatal("Memory allocation for snapshot of contactlist failed!");
+    }
+
+    snap->count = 0;
+
+    // fake contacts (see: roni_parse()) are not connected
+    for (int i = 0; i < _cnf->cl.cl_size; i++)
+    {
+        contact = CONTACT(i);
+
+        if (contact->used && contact->fd > 0)
+        {
+            e = &snap->entry[snap->count++];
+            e->n = i;
+            e->h = get_contact_handle(i);
+            strcpy(e->name, contact->name);
+            strcpy(e->onion_id, contact->onion_id);
+            e->lport = contact->lport;
+        }
+    }
+
+    snap->version = ++_version;
+    snap->retired = 0;
+    snap->next = NULL;
+    _dirty = 0;
+
+    // readers entering the epoch after the replacement get the new
+    // snapshot (see: enter_cl_snapshot())
+    old = __atomic_exchange_n(&_snap, snap, __ATOMIC_SEQ_CST);
+
+    if (old != &_empty)
+    {
+        old->retired = __atomic_add_fetch(&_epoch, 1, __ATOMIC_SEQ_CST);
+        old->next = _retired;
+        _retired = old;
+    }
+
+    reclaim_cl_snapshots();
+    return snap;
+}
+
+
+/**
+ *  Frees all snapshots. Must only be called if no thread reads
+ *  snapshots anymore.
+ */
+void
+destroy_cl_snapshots()
+{
+    cl_snapshot_t* snap;
+
+    while ((snap = _retired) != NULL)
+    {
+        _retired = snap->next;
+        free(snap);
+    }
+
+    if (_snap != &_empty)
+    {
+        free(_snap);
+    }
+
+    _snap = &_empty;
+    _dirty = 1;
+}
+
+
+/**
+ *  Enters the current epoch and returns the snapshot published last,
+ *  which stays valid until leave_cl_snapshot() is called. Snapshots
+ *  must not be entered recursively.
+ *  @return snapshot of the connected contacts
+ */
+cl_snapshot_t*
+enter_cl_snapshot()
+{
+    // the first snapshot entered by a thread registers the thread
+    if (_slot == -1 &&
+        (_slot = __atomic_fetch_add(&_readers, 1, __ATOMIC_SEQ_CST)) >= SNAP_MAX_READERS)
+    {
+        ui_fatal("Too many threads read snapshots of the contactlist!");
+    }
+
+    __atomic_store_n(&_reader[_slot], __atomic_load_n(&_epoch, __ATOMIC_SEQ_CST),
+                     __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&_snap, __ATOMIC_SEQ_CST);
+}
+
+
+/**
+ *  Leaves the epoch entered by enter_cl_snapshot(), the snapshot must
+ *  not be accessed anymore.
+ */
+void
+leave_cl_snapshot()
+{
+    __atomic_store_n(&_reader[_slot], 0, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,272 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file timer.c
+ *  This file contains the timers of the main loop, which are kept in a
+ *  hierarchical timer wheel. Arming and cancelling a timer takes constant
+ *  time, expired timers are run by the main loop, which sleeps until the
+ *  next timer may expire (see: run_timers()). Timers must only be used
+ *  by the main loop.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dchat_h/timer.h"
+#include "dchat_h/util.h"
+
+
+static tm_wheel_t _wh; //!< timer wheel of the main loop
+
+
+/**
+ *  Links a timer into the slot of the wheel, which is processed or
+ *  cascaded when the timer expires. Timers expiring later than the
+ *  wheel covers are linked into the last slot they can reach.
+ *  @param t Timer to link
+ */
+static void
+link_timer(tm_timer_t* t)
+{
+    tm_timer_t** slot;
+    uint64_t delta;
+    int level = 0;
+
+    // expired timers are run by the next tick
+    if (t->expires < _wh.tick)
+    {
+        slot = &_wh.slot[0][_wh.tick & TM_MASK];
+    }
+    else
+    {
+        delta = t->expires - _wh.tick;
+
+        if (delta >= (1ULL << (TM_BITS * TM_LEVELS)))
+        {
+            delta = (1ULL << (TM_BITS * TM_LEVELS)) - 1;
+            t->expires = _wh.tick + delta;
+        }
+
+        while (level < TM_LEVELS - 1 && delta >= (1ULL << (TM_BITS * (level + 1))))
+        {
+            level++;
+        }
+
+        slot = &_wh.slot[level][(t->expires >> (TM_BITS * level)) & TM_MASK];
+    }
+
+    if ((t->next = *slot) != NULL)
+    {
+        t->next->pprev = &t->next;
+    }
+
+    *slot = t;
+    t->pprev = slot;
+}
+
+
+/**
+ *  Unlinks a timer from its slot.
+ *  @param t Armed timer
+ */
+static void
+unlink_timer(tm_timer_t* t)
+{
+    if ((*t->pprev = t->next) != NULL)
+    {
+        t->next->pprev = t->pprev;
+    }
+
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+
+/**
+ *  Moves the timers of a slot of a higher level to the levels below,
+ *  since they expire within the range covered by the levels below.
+ *  @param level Level of the slot
+ *  @param idx   Index of the slot
+ */
+static void
+cascade_timers(int level, int idx)
+{
+    tm_timer_t* t = _wh.slot[level][idx];
+    tm_timer_t* next;
+
+    _wh.slot[level][idx] = NULL;
+
+    for (; t != NULL; t = next)
+    {
+        next = t->next;
+        link_timer(t);
+    }
+}
+
+
+/**
+ *  Initializes the timer wheel of the main loop.
+ */
+void
+init_timers()
+{
+    memset(&_wh, 0, sizeof(_wh));
+    _wh.tick = get_time_ms() / TM_TICK_MS;
+}
+
+
+/**
+ *  Initializes a timer, which is not armed afterwards.
+ *  @param t   Timer to initialize
+ *  @param cb  Callback invoked when the timer expires
+ *  @param arg Argument of the callback
+ */
+void
+init_timer(tm_timer_t* t, void (*cb)(void*), void* arg)
+{
+    memset(t, 0, sizeof(*t));
+    t->cb = cb;
+    t->arg = arg;
+}
+
+
+/**
+ *  Arms a timer, so that its callback is invoked by the main loop once
+ *  the given time has elapsed. A timer, which is already armed, is armed
+ *  again with the new time.
+ *  @param t  Initialized timer (see: init_timer())
+ *  @param ms Milliseconds until the timer expires
+ */
+void
+arm_timer(tm_timer_t* t, long long ms)
+{
+    if (t->pprev != NULL)
+    {
+        unlink_timer(t);
+        _wh.armed--;
+    }
+
+    // round up, so that timers never expire early
+    t->expires = (get_time_ms() + (ms > 0 ? ms : 0) + TM_TICK_MS - 1) / TM_TICK_MS;
+    link_timer(t);
+    _wh.armed++;
+}
+
+
+/**
+ *  Cancels a timer. Cancelling a timer, which is not armed, has no effect.
+ *  @param t Initialized timer (see: init_timer())
+ */
+void
+cancel_timer(tm_timer_t* t)
+{
+    if (t->pprev != NULL)
+    {
+        unlink_timer(t);
+        _wh.armed--;
+    }
+}
+
+
+/**
+ *  @param t Initialized timer (see: init_timer())
+ *  @return 1 if the timer is armed, 0 otherwise
+ */
+int
+timer_armed(tm_timer_t* t)
+{
+    return t->pprev != NULL;
+}
+
+
+/**
+ *  Runs the callbacks of all expired timers. The callbacks may arm and
+ *  cancel any timer, including their own.
+ *  @return milliseconds until the next timer may expire or -1 if no timer
+ *  is armed (usable as timeout of ev_wait())
+ */
+int
+run_timers()
+{
+    long long ms = get_time_ms();
+    uint64_t now = ms / TM_TICK_MS;
+    uint64_t tick;
+    tm_timer_t* list;
+    tm_timer_t* t;
+    int level;
+    int idx;
+
+    while (_wh.armed && _wh.tick <= now)
+    {
+        // the lower levels completed a round, refill them
+        for (level = 1, idx = 0; level < TM_LEVELS && !idx; level++)
+        {
+            if (_wh.tick & ((1ULL << (TM_BITS * level)) - 1))
+            {
+                break;
+            }
+
+            idx = (_wh.tick >> (TM_BITS * level)) & TM_MASK;
+            cascade_timers(level, idx);
+        }
+
+        // detach the expired timers, so that callbacks arming timers
+        // again do not add them to the list which is run
+        idx = _wh.tick & TM_MASK;
+        list = _wh.slot[0][idx];
+        _wh.slot[0][idx] = NULL;
+        _wh.tick++;
+
+        if (list != NULL)
+        {
+            list->pprev = &list;
+        }
+
+        while ((t = list) != NULL)
+        {
+            unlink_timer(t);
+            _wh.armed--;
+            t->cb(t->arg);
+        }
+    }
+
+    if (!_wh.armed)
+    {
+        // nothing to process until a timer is armed
+        if (_wh.tick <= now)
+        {
+            _wh.tick = now + 1;
+        }
+
+        return -1;
+    }
+
+    // the next tick with expiring timers, or the next cascade, which
+    // may refill the lowest level
+    for (tick = _wh.tick; (tick & TM_MASK) && _wh.slot[0][tick & TM_MASK] == NULL; tick++);
+
+    return tick * TM_TICK_MS > (uint64_t) ms ? (int) (tick * TM_TICK_MS - ms) : 0;
+}
+
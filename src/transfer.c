@@ -0,0 +1,770 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file transfer.c
+ *  This file contains the transfer of files between contacts. A file is
+ *  offered by an "application/octet" without content, which carries the
+ *  name and the size of the file. The contact answers with a
+ *  "control/resume" carrying the amount of bytes it has already received,
+ *  thus interrupted transfers continue where they stopped. Afterwards the
+ *  file is streamed in chunks of FT_CHUNK_LEN bytes, whose contents are
+ *  sent from the file by sendfile(2) and written to the partial file by
+ *  the receiver as soon as they arrive. A chunk is only queued if no
+ *  other PDU is waiting to be written, so a text message is delayed by
+ *  at most one chunk.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "dchat_h/transfer.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/sendqueue.h"
+#include "dchat_h/network.h"
+#include "dchat_h/pool.h"
+#include "dchat_h/event.h"
+#include "dchat_h/reactor.h"
+#include "dchat_h/consoleui.h"
+
+
+/**
+ *  Returns the file transfers of a contact, which are allocated
+ *  when the first file is sent to or received from the contact.
+ *  @param contact Pointer to the contact
+ *  @return file transfers of the contact
+ */
+static transfers_t*
+get_transfers(contact_t* contact)
+{
+    if (contact->ft == NULL && (contact->ft = calloc(1, sizeof(transfers_t))) == NULL)
+    {
+        ui_fatal("Memory allocation for file transfers failed!");
+    }
+
+    return contact->ft;
+}
+
+
+/**
+ *  Initializes a PDU of a file transfer.
+ *  @param pdu          Pointer to the PDU
+ *  @param content_type "application/octet" or "control/resume"
+ *  @param name         Name of the file
+ *  @param size         Size of the file
+ *  @param off          Offset of the content or of the requested content
+ *  @return 0 on success, -1 in case of error
+ */
+static int
+init_file_pdu(dchat_pdu_t* pdu, int content_type, char* name, off_t size, off_t off)
+{
+    if (init_dchat_pdu(pdu, DCHAT_V1, content_type, _cnf->me.onion_id,
+                       _cnf->me.lport, _cnf->me.name) == -1)
+    {
+        return -1;
+    }
+
+    snprintf(pdu->file_name, sizeof(pdu->file_name), "%s", name);
+    pdu->file_size = size;
+    pdu->file_offset = off;
+    return 0;
+}
+
+
+/**
+ *  Sends a PDU of a file transfer to a contact.
+ *  Such PDUs are always sent as DChat V1 PDUs, since the file headers
+ *  are not part of DChat V2 frames.
+ *  @see init_file_pdu()
+ *  @return 0 on success, -1 in case of error
+ */
+static int
+send_file_pdu(int n, int content_type, char* name, off_t size, off_t off)
+{
+    dchat_pdu_t pdu;
+    wire_pdu_t* wp;
+    int ret;
+
+    if (init_file_pdu(&pdu, content_type, name, size, off) == -1 ||
+        (wp = prepare_pdu(&pdu)) == NULL)
+    {
+        ui_log(LOG_ERR, "Encoding of PDU failed!");
+        return -1;
+    }
+
+    ret = send_wire_pdu(n, wp);
+    unref_wire_pdu(wp);
+    return ret;
+}
+
+
+/**
+ *  Prepares a chunk of a file. Only the headers are encoded, the content
+ *  will be sent from the file by the outbound queue (see:
+ *  send_file_content()). The chunk holds a duplicate of the file
+ *  descriptor, which is closed along with the chunk, thus the file may
+ *  be closed before the chunk has been written (e.g. by a reactor).
+ *  @param pdu Pointer to a PDU structure holding the header data
+ *  @param fd  File descriptor of the file
+ *  @param off Offset of the chunk in the file
+ *  @param len Length of the chunk
+ *  @return Pointer to the prepared chunk or NULL in case of error
+ */
+wire_pdu_t*
+prepare_file_pdu(dchat_pdu_t* pdu, int fd, off_t off, int len)
+{
+    char headers[MAX_HEADERS_LEN]; // encoded headers
+    wire_pdu_t* wp;                // prepared pdu
+    int hlen;                      // length of headers
+
+    pdu->content = NULL;
+    pdu->content_length = len;
+
+    if ((hlen = encode_headers(pdu, headers, sizeof(headers))) == -1 || (fd = dup(fd)) == -1)
+    {
+        return NULL;
+    }
+
+    if ((wp = pool_alloc(sizeof(*wp) + hlen)) == NULL)
+    {
+        ui_fatal("Memory allocation for prepared PDU failed!");
+    }
+
+    wp->refs = 1;
+    wp->len = hlen + len;
+    wp->content_type = pdu->content_type;
+    wp->v2 = NULL;
+    wp->deflated = NULL;
+    wp->file_fd = fd;
+    wp->file_off = off;
+    wp->file_len = len;
+    memcpy(wp->data, headers, hlen);
+    return wp;
+}
+
+
+/**
+ *  Offers a file to a contact. The file is sent as soon as the contact
+ *  requests it (see: receive_resume()).
+ *  @param n    Index of the contact in the contactlist
+ *  @param path Path of the file, its basename is offered as name
+ *  @return 0 on success, -1 in case of error
+ */
+int
+offer_file(int n, char* path)
+{
+    contact_t* contact = CONTACT(n);
+    transfers_t* ft;
+    file_send_t** pfs;
+    file_send_t* fs;
+    struct stat st;
+    char* name;
+    int fd;
+
+    name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+
+    if (!is_valid_file_name(name))
+    {
+        ui_log(LOG_WARN, "Invalid file name '%s'!", name);
+        return -1;
+    }
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Could not open '%s'!", path);
+        return -1;
+    }
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        ui_log(LOG_WARN, "'%s' is not a regular file!", path);
+        close(fd);
+        return -1;
+    }
+
+    ft = get_transfers(contact);
+
+    // a file that has not been requested yet is offered again
+    for (pfs = &ft->send; (fs = *pfs) != NULL; pfs = &fs->next)
+    {
+        if (!strcmp(fs->name, name))
+        {
+            if (fs->accepted)
+            {
+                ui_log(LOG_WARN, "'%s' is already sent to '%s'!", name, contact->name);
+                close(fd);
+                return -1;
+            }
+
+            *pfs = fs->next;
+            close(fs->fd);
+            free(fs);
+            break;
+        }
+    }
+
+    if ((fs = calloc(1, sizeof(*fs))) == NULL)
+    {
+        ui_fatal("Memory allocation for file transfer failed!");
+    }
+
+    fs->fd = fd;
+    snprintf(fs->name, sizeof(fs->name), "%s", name);
+    fs->size = st.st_size;
+
+    // append the file to the files sent
+    for (pfs = &ft->send; *pfs != NULL;)
+    {
+        pfs = &(*pfs)->next;
+    }
+
+    *pfs = fs;
+
+    if (send_file_pdu(n, CTT_ID_BIN, fs->name, fs->size, 0) == -1)
+    {
+        return -1;
+    }
+
+    ui_log(LOG_INFO, "Offered '%s' (%jd bytes) to '%s'!", fs->name,
+           (intmax_t) fs->size, contact->name);
+    return 0;
+}
+
+
+/**
+ *  Closes a file received from a contact and removes it from the
+ *  transfers of the contact. A file that has been received completely is
+ *  renamed from "<name>.part" to its name, unless that file exists.
+ *  @param contact Pointer to the contact
+ *  @param fr      File received from the contact
+ */
+static void
+close_recv(contact_t* contact, file_recv_t* fr)
+{
+    char part[PATH_MAX];
+    char path[PATH_MAX];
+    file_recv_t** pfr;
+    int len;
+
+    for (pfr = &contact->ft->recv; *pfr != fr;)
+    {
+        pfr = &(*pfr)->next;
+    }
+
+    *pfr = fr->next;
+    close(fr->fd);
+
+    if (fr->off == fr->size)
+    {
+        len = snprintf(path, sizeof(path), "%s/%s", _cnf->file_dir, fr->name);
+
+        // a truncated path could name another file
+        if (len < 0 || len >= (int) sizeof(path) ||
+            snprintf(part, sizeof(part), "%s%s", path, FT_PART_SUFFIX) >= (int) sizeof(part))
+        {
+            ui_log(LOG_ERR, "Path of the received file '%s' is too long!", fr->name);
+        }
+        else if (access(path, F_OK) == 0)
+        {
+            ui_log(LOG_WARN, "'%s' exists, received file is kept as '%s'!", path, part);
+        }
+        else if (rename(part, path) == -1)
+        {
+            ui_log_errno(LOG_ERR, "Could not rename '%s'!", part);
+        }
+        else
+        {
+            ui_log(LOG_NOTICE, "Received '%s' from '%s'!", path, contact->name);
+        }
+    }
+
+    free(fr);
+}
+
+
+/**
+ *  Handles a file offered by a contact. The file is stored in the
+ *  directory of received files (see: fdir_parse()). If it has been
+ *  received partially before, the contact is requested to resume the
+ *  transfer at the end of the partial file. Files larger than
+ *  FT_MAX_FILE_SIZE and offers exceeding FT_MAX_RECV files at the same
+ *  time are refused, symbolic links are not followed.
+ *  @param n   Index of the contact in the contactlist
+ *  @param pdu "application/octet" without content
+ *  @return 0 on success, -1 in case of error
+ */
+static int
+receive_offer(int n, dchat_pdu_t* pdu)
+{
+    contact_t* contact = CONTACT(n);
+    char part[PATH_MAX];
+    transfers_t* ft;
+    file_recv_t* fr;
+    struct stat st;
+    int cnt;
+    int len;
+    int fd;
+
+    if (_cnf->file_dir == NULL)
+    {
+        ui_log(LOG_NOTICE, "'%s' offers '%s' (%" PRId64 " bytes), use -f to receive files!",
+               contact->name, pdu->file_name, pdu->file_size);
+        return 0;
+    }
+
+    if (pdu->file_size > FT_MAX_FILE_SIZE)
+    {
+        ui_log(LOG_WARN, "'%s' offers '%s' (%" PRId64 " bytes), which is too large!",
+               contact->name, pdu->file_name, pdu->file_size);
+        return 0;
+    }
+
+    ft = get_transfers(contact);
+
+    // the contact restarts the transfer of a file
+    for (fr = ft->recv; fr != NULL; fr = fr->next)
+    {
+        if (!strcmp(fr->name, pdu->file_name))
+        {
+            close_recv(contact, fr);
+            break;
+        }
+    }
+
+    for (fr = ft->recv, cnt = 0; fr != NULL; fr = fr->next)
+    {
+        cnt++;
+    }
+
+    // every partial file holds a file descriptor
+    if (cnt >= FT_MAX_RECV)
+    {
+        ui_log(LOG_WARN, "'%s' offers '%s', but already sends %d files!", contact->name,
+               pdu->file_name, cnt);
+        return 0;
+    }
+
+    len = snprintf(part, sizeof(part), "%s/%s%s", _cnf->file_dir, pdu->file_name, FT_PART_SUFFIX);
+
+    if (len < 0 || len >= (int) sizeof(part))
+    {
+        ui_log(LOG_ERR, "Path of the offered file '%s' is too long!", pdu->file_name);
+        return -1;
+    }
+
+    if ((fd = open(part, O_WRONLY | O_CREAT | O_NOFOLLOW, 0600)) == -1 || fstat(fd, &st) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Could not open '%s'!", part);
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+
+        return -1;
+    }
+
+    // a partial file larger than the offered file belongs to another file
+    if (st.st_size > pdu->file_size)
+    {
+        if (ftruncate(fd, 0) == -1)
+        {
+            ui_log_errno(LOG_ERR, "Could not truncate '%s'!", part);
+            close(fd);
+            return -1;
+        }
+
+        st.st_size = 0;
+    }
+
+    if ((fr = calloc(1, sizeof(*fr))) == NULL)
+    {
+        ui_fatal("Memory allocation for file transfer failed!");
+    }
+
+    fr->fd = fd;
+    snprintf(fr->name, sizeof(fr->name), "%s", pdu->file_name);
+    fr->size = pdu->file_size;
+    fr->off = st.st_size;
+    fr->next = ft->recv;
+    ft->recv = fr;
+
+    if (send_file_pdu(n, CTT_ID_RSM, fr->name, fr->size, fr->off) == -1)
+    {
+        close_recv(contact, fr);
+        return -1;
+    }
+
+    if (fr->off == fr->size)
+    {
+        close_recv(contact, fr);
+    }
+    else
+    {
+        ui_log(LOG_INFO, "Receiving '%s' (%jd bytes) from '%s' at offset %jd!", fr->name,
+               (intmax_t) fr->size, contact->name, (intmax_t) fr->off);
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Handles an "application/octet" received from a contact, which is
+ *  either the offer of a file or a chunk of a requested file. Chunks are
+ *  written to the partial file immediately.
+ *  @param n   Index of the contact in the contactlist
+ *  @param pdu "application/octet" received from the contact
+ *  @return 0 on success, -1 if the PDU could not be handled
+ */
+int
+receive_file_pdu(int n, dchat_pdu_t* pdu)
+{
+    contact_t* contact = CONTACT(n);
+    file_recv_t* fr = NULL;
+    ssize_t ret;
+    int len;
+
+    if (pdu->file_name[0] == '\0')
+    {
+        ui_log(LOG_WARN, "'%s' sent a file without name!", contact->name);
+        return -1;
+    }
+
+    // offers do not have content
+    if (!pdu->content_length)
+    {
+        return receive_offer(n, pdu);
+    }
+
+    if (contact->ft != NULL)
+    {
+        for (fr = contact->ft->recv; fr != NULL; fr = fr->next)
+        {
+            if (!strcmp(fr->name, pdu->file_name))
+            {
+                break;
+            }
+        }
+    }
+
+    if (fr == NULL)
+    {
+        ui_log(LOG_WARN, "'%s' sent '%s', which has not been requested!", contact->name,
+               pdu->file_name);
+        return -1;
+    }
+
+    if (pdu->file_offset != fr->off || pdu->file_size != fr->size ||
+        fr->off + pdu->content_length > fr->size)
+    {
+        ui_log(LOG_ERR, "'%s' sent '%s' at unexpected offset %" PRId64 "!", contact->name,
+               fr->name, pdu->file_offset);
+        close_recv(contact, fr);
+        return -1;
+    }
+
+    for (len = 0; len < pdu->content_length; len += ret)
+    {
+        if ((ret = pwrite(fr->fd, pdu->content + len, pdu->content_length - len,
+                          fr->off + len)) == -1)
+        {
+            ui_log_errno(LOG_ERR, "Could not write '%s'!", fr->name);
+            close_recv(contact, fr);
+            return -1;
+        }
+    }
+
+    fr->off += len;
+
+    if (fr->off == fr->size)
+    {
+        close_recv(contact, fr);
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Handles a "control/resume" received from a contact, which requests
+ *  an offered file from the given offset. The file will be streamed
+ *  as soon as the socket of the contact becomes writable. The socket
+ *  buffers at most FT_NOTSENT_LOWAT unsent bytes from now on, so
+ *  chunks buffered by the kernel do not delay text messages either.
+ *  @param n   Index of the contact in the contactlist
+ *  @param pdu "control/resume" received from the contact
+ *  @return 0 on success, -1 if the PDU could not be handled
+ */
+int
+receive_resume(int n, dchat_pdu_t* pdu)
+{
+    contact_t* contact = CONTACT(n);
+    file_send_t* fs = NULL;
+#ifdef TCP_NOTSENT_LOWAT
+    int lowat = FT_NOTSENT_LOWAT;
+#endif
+
+    if (contact->ft != NULL)
+    {
+        for (fs = contact->ft->send; fs != NULL; fs = fs->next)
+        {
+            if (!strcmp(fs->name, pdu->file_name))
+            {
+                break;
+            }
+        }
+    }
+
+    if (fs == NULL || fs->accepted || pdu->file_offset > fs->size)
+    {
+        ui_log(LOG_WARN, "'%s' requested '%s', which has not been offered!", contact->name,
+               pdu->file_name);
+        return -1;
+    }
+
+    fs->off = pdu->file_offset;
+    fs->accepted = 1;
+
+#ifdef TCP_NOTSENT_LOWAT
+    // fails for sockets other than TCP
+    setsockopt(contact->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+#endif
+
+    // the reactor owning the socket writes the chunks
+    if (contact->rt != NULL)
+    {
+        ui_log(LOG_INFO, "Sending '%s' to '%s' from offset %jd!", fs->name, contact->name,
+               (intmax_t) fs->off);
+        return send_file_chunks(n);
+    }
+
+    // chunks are written by sendfile(2), which must not block
+    if (set_nonblocking(contact->fd, 1) == -1)
+    {
+        ui_log_errno(LOG_ERR, "fcntl() failed in receive_resume()");
+        return -1;
+    }
+
+    ui_log(LOG_INFO, "Sending '%s' to '%s' from offset %jd!", fs->name, contact->name,
+           (intmax_t) fs->off);
+
+    if (ev_mod(&_cnf->ev, contact->fd, contact_events(contact),
+               CONTACT_EV_ID(n)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Updating event of contact '%d' failed!", n);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Queues the next chunk of the files requested by a contact, if its
+ *  outbound queue is empty. Requested files take turns, so several
+ *  transfers to a contact proceed at the same pace. Files, whose last
+ *  chunk has been written, are closed.
+ *  @param n Index of the contact in the contactlist
+ *  @return 1 if a chunk has been queued, 0 if there is no chunk to send
+ *  or -1 in case of error
+ */
+int
+queue_file_chunk(int n)
+{
+    contact_t* contact = CONTACT(n);
+    file_send_t** pfs;
+    file_send_t* fs;
+    dchat_pdu_t pdu;
+    wire_pdu_t* wp;
+    int len;
+    int ret;
+
+    // a chunk is queued as soon as the previous ones have been written,
+    // chunks passed to a reactor are reported when they have been written
+    if (contact->ft == NULL ||
+        (contact->rt != NULL ? contact->ft->in_flight >= FT_CHUNKS_IN_FLIGHT :
+         contact->sq->head != NULL))
+    {
+        return 0;
+    }
+
+    // all queued chunks have been written
+    for (pfs = &contact->ft->send; (fs = *pfs) != NULL;)
+    {
+        if (fs->accepted && fs->off == fs->size && !contact->ft->in_flight)
+        {
+            ui_log(LOG_NOTICE, "Sent '%s' to '%s'!", fs->name, contact->name);
+            *pfs = fs->next;
+            close(fs->fd);
+            free(fs);
+            continue;
+        }
+
+        pfs = &fs->next;
+    }
+
+    // continue the first requested file
+    for (pfs = &contact->ft->send; (fs = *pfs) != NULL; pfs = &fs->next)
+    {
+        if (fs->accepted && fs->off < fs->size)
+        {
+            break;
+        }
+    }
+
+    if (fs == NULL)
+    {
+        return 0;
+    }
+
+    len = fs->size - fs->off < FT_CHUNK_LEN ? fs->size - fs->off : FT_CHUNK_LEN;
+
+    if (init_file_pdu(&pdu, CTT_ID_BIN, fs->name, fs->size, fs->off) == -1 ||
+        (wp = prepare_file_pdu(&pdu, fs->fd, fs->off, len)) == NULL)
+    {
+        ui_log(LOG_ERR, "Encoding of PDU failed!");
+        return -1;
+    }
+
+    fs->off += len;
+
+    // continue with the next file next time
+    if (fs->next != NULL)
+    {
+        *pfs = fs->next;
+
+        while (*pfs != NULL)
+        {
+            pfs = &(*pfs)->next;
+        }
+
+        *pfs = fs;
+        fs->next = NULL;
+    }
+
+    if (contact->rt != NULL)
+    {
+        contact->ft->in_flight++;
+        send_reactor_pdu(n, wp);
+        ret = 0;
+    }
+    else
+    {
+        ret = push_send_queue(contact->sq, wp, _cnf->sq_policy);
+    }
+
+    unref_wire_pdu(wp);
+    return ret == -1 ? -1 : 1;
+}
+
+
+/**
+ *  Passes chunks of the files requested by a contact to the reactor
+ *  owning its socket, until FT_CHUNKS_IN_FLIGHT chunks are in flight.
+ *  The reactor reports when they have been written (see:
+ *  handle_reactor_msgs()).
+ *  @param n Index of the contact in the contactlist
+ *  @return 0 on success, -1 in case of error
+ */
+int
+send_file_chunks(int n)
+{
+    int ret;
+
+    while ((ret = queue_file_chunk(n)) == 1);
+
+    return ret;
+}
+
+
+/**
+ *  Checks if chunks of files requested by a contact are left to be
+ *  queued (see: queue_file_chunk()).
+ *  @param contact Pointer to the contact
+ *  @return 1 if a file has been requested, 0 otherwise
+ */
+int
+has_file_chunks(contact_t* contact)
+{
+    file_send_t* fs;
+
+    if (contact->ft == NULL)
+    {
+        return 0;
+    }
+
+    for (fs = contact->ft->send; fs != NULL; fs = fs->next)
+    {
+        if (fs->accepted)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Closes all files sent to or received from a contact. Partially
+ *  received files are kept, so that their transfer can be resumed. The
+ *  outbound queue of the contact must have been released before.
+ *  @param contact Pointer to the contact
+ */
+void
+free_transfers(contact_t* contact)
+{
+    file_send_t* fs;
+
+    if (contact->ft == NULL)
+    {
+        return;
+    }
+
+    while ((fs = contact->ft->send) != NULL)
+    {
+        contact->ft->send = fs->next;
+        close(fs->fd);
+        free(fs);
+    }
+
+    while (contact->ft->recv != NULL)
+    {
+        close_recv(contact, contact->ft->recv);
+    }
+
+    free(contact->ft);
+    contact->ft = NULL;
+}
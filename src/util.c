@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
 
 
 /**
@@ -108,3 +109,33 @@ iszero(void* ptr, int n )
 
     return 1;
 }
+
+
+/**
+ *  Returns the time of a monotonic clock, which is not affected by
+ *  changes of the system time.
+ *  @return time in milliseconds
+ */
+long long
+get_time_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ *  Returns the time of a monotonic clock with nanosecond resolution,
+ *  which is used to measure latencies (see: metrics.c).
+ *  @return time in nanoseconds
+ */
+long long
+get_time_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}